@@ -0,0 +1,83 @@
+// bench/jsvim_fuzzy.c - Per-keystroke re-rank time of jsvim's file finder
+//
+// Builds an index of synthetic monorepo-style paths (default 500000), then
+// types a few queries one character at a time and times each re-rank, the
+// way the picker does on every keystroke.
+//
+//   make bench/jsvim_fuzzy && ./bench/jsvim_fuzzy [paths]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "finder.h"
+
+static const char *dirs[] = {
+    "services", "libs", "tools", "web", "infra", "third_party", "docs", "mobile",
+};
+static const char *subdirs[] = {
+    "src", "include", "test", "internal", "api", "cmd", "pkg", "components",
+};
+static const char *stems[] = {
+    "editor", "buffer", "render", "network", "session", "parser", "lexer",
+    "config", "handler", "router", "storage", "metrics", "cache", "auth",
+};
+static const char *exts[] = { ".c", ".h", ".cc", ".ts", ".go", ".py", ".md", ".json" };
+
+#define N_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+static void type_query(FinderState *f, const char *query) {
+    char q[FINDER_QUERY_MAX];
+    double worst = 0, sum = 0;
+    size_t n = strlen(query);
+    for (size_t i = 1; i <= n; i++) {
+        snprintf(q, sizeof(q), "%.*s", (int)i, query);
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        finder_set_query(f, q);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ms = elapsed_ms(t0, t1);
+        sum += ms;
+        if (ms > worst) worst = ms;
+    }
+    printf("%-24s %8zu matches  avg %6.2f ms  worst %6.2f ms per keystroke\n",
+           query, f->total, sum / (double)n, worst);
+}
+
+int main(int argc, char **argv) {
+    size_t npaths = argc > 1 ? strtoul(argv[1], NULL, 10) : 500000;
+
+    char **paths = malloc(npaths * sizeof(char *));
+    if (!paths) return 1;
+    unsigned seed = 12345;
+    for (size_t i = 0; i < npaths; i++) {
+        char p[256];
+        seed = seed * 1103515245u + 12345u;
+        snprintf(p, sizeof(p), "%s/%s%u/%s/%s_%s%u%s",
+                 dirs[seed % N_OF(dirs)], stems[(seed >> 8) % N_OF(stems)], (seed >> 4) % 300,
+                 subdirs[(seed >> 12) % N_OF(subdirs)],
+                 stems[(seed >> 16) % N_OF(stems)], stems[(seed >> 20) % N_OF(stems)],
+                 (unsigned)(i % 97), exts[(seed >> 24) % N_OF(exts)]);
+        paths[i] = strdup(p);
+    }
+
+    FinderState f;
+    finder_init(&f);
+    f.index = finder_index_from_paths("/bench", paths, npaths);
+    if (!f.index) return 1;
+    printf("%zu paths\n", f.index->count);
+
+    type_query(&f, "editorbuffer.c");
+    type_query(&f, "svc/router/api");
+    type_query(&f, "libsauthcache");
+    type_query(&f, "zzzz");
+
+    finder_free(&f);
+    for (size_t i = 0; i < npaths; i++) free(paths[i]);
+    free(paths);
+    return 0;
+}
@@ -0,0 +1,302 @@
+// bench/jsvim_replay.c - Headless keystroke replay for jsvim
+//
+// Loads a file, feeds a recorded keystroke script through the same
+// handlers the editor's main loop uses, and renders every frame into
+// ncurses' virtual screen (a terminal opened on /dev/null, so nothing is
+// drawn). Each keystroke is timed in three parts:
+//
+//   edit       the key handler itself (buffer edits, undo, search, ...)
+//   highlight  time spent in highlight_buffer during that keystroke
+//   render     render_main_window + render_command_window + wnoutrefresh
+//
+// and percentiles are reported per part.
+//
+//   make bench/jsvim_replay
+//   ./bench/jsvim_replay [-n repeat] [-r rows] [-c cols] <file> [script.keys]
+//
+// Scripts use vim-style key notation: plain characters are typed as-is,
+// and <Esc> <CR> <BS> <Tab> <Up> <Down> <Left> <Right> <Home> <End> <Del>
+// <lt> name special keys. Newlines in the script are ignored (use <CR>),
+// and lines starting with '#' are comments. Without a script, a built-in
+// one types, navigates, searches and undoes in the loaded file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <ncurses.h>
+#include "editor.h"
+#include "render.h"
+#include "highlight.h"
+#include "language.h"
+#include "util.h"
+
+static const char *default_script =
+    "# insert a function at the top of the file\n"
+    "static int replay_sum(const int *v, size_t n) {<CR>"
+    "int total = 0;<CR>"
+    "for (size_t i = 0; i < n; i++) {<CR>"
+    "total += v[i];<CR>"
+    "}<CR>"
+    "return total;<CR>"
+    "}<CR><CR>\n"
+    "# move around\n"
+    "<Down><Down><Down><Down><Down><Down><Down><Down><Down><Down>"
+    "<End><Home><Right><Right><Right><Left><Up><Up><Up>\n"
+    "# delete some of what was typed, then undo it\n"
+    "<BS><BS><BS><BS><BS><BS><Esc>u<Esc>\n"
+    "# search, step through the matches\n"
+    "<Esc>/total<CR><Esc>nnnN<Esc>\n"
+    "# substitute over the whole file, undo\n"
+    "<Esc>%s/total/sum/g<CR><Esc>u<Esc>\n";
+
+static const struct { const char *name; int key; } key_names[] = {
+    { "Esc", 27 }, { "CR", '\n' }, { "BS", KEY_BACKSPACE }, { "Tab", '\t' },
+    { "Up", KEY_UP }, { "Down", KEY_DOWN }, { "Left", KEY_LEFT },
+    { "Right", KEY_RIGHT }, { "Home", KEY_HOME }, { "End", KEY_END },
+    { "Del", KEY_DC }, { "lt", '<' },
+};
+
+// Parse a script into key codes. Returns the number of keys.
+static size_t parse_script(const char *text, int **out) {
+    size_t cap = 256, n = 0;
+    int *keys = malloc(cap * sizeof(int));
+    if (!keys) return 0;
+
+    const char *p = text;
+    int line_start = 1;
+    while (*p) {
+        if (line_start && *p == '#') {
+            while (*p && *p != '\n') p++;
+            continue;
+        }
+        line_start = (*p == '\n');
+        if (*p == '\n' || *p == '\r') {
+            p++;
+            continue;
+        }
+
+        int key = (unsigned char)*p;
+        size_t adv = 1;
+        if (*p == '<') {
+            const char *close = strchr(p, '>');
+            for (size_t i = 0; close && i < sizeof(key_names) / sizeof(key_names[0]); i++) {
+                size_t len = strlen(key_names[i].name);
+                if ((size_t)(close - p - 1) == len &&
+                    strncasecmp(p + 1, key_names[i].name, len) == 0) {
+                    key = key_names[i].key;
+                    adv = len + 2;
+                    break;
+                }
+            }
+        }
+        p += adv;
+
+        if (n == cap) {
+            cap *= 2;
+            int *tmp = realloc(keys, cap * sizeof(int));
+            if (!tmp) break;
+            keys = tmp;
+        }
+        keys[n++] = key;
+    }
+    *out = keys;
+    return n;
+}
+
+static char *read_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    size_t cap = 4096, len = 0;
+    char *data = malloc(cap);
+    while (data) {
+        len += fread(data + len, 1, cap - len - 1, fp);
+        if (len < cap - 1) break;
+        char *tmp = realloc(data, cap * 2);
+        if (!tmp) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = tmp;
+        cap *= 2;
+    }
+    if (data) data[len] = '\0';
+    fclose(fp);
+    return data;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, long long *samples, size_t n) {
+    qsort(samples, n, sizeof(long long), cmp_ll);
+    long long sum = 0;
+    for (size_t i = 0; i < n; i++) sum += samples[i];
+#define PCT(p) (samples[(size_t)((double)(n - 1) * (p))] / 1e3)
+    printf("%-10s %9.1f %9.1f %9.1f %9.1f %9.1f %11.1f\n", name,
+           (double)sum / (double)n / 1e3, PCT(0.50), PCT(0.90), PCT(0.99),
+           samples[n - 1] / 1e3, sum / 1e6);
+#undef PCT
+}
+
+int main(int argc, char **argv) {
+    int repeat = 1, rows = 50, cols = 160;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argi + 1 < argc; argi += 2) {
+        if (strcmp(argv[argi], "-n") == 0) repeat = atoi(argv[argi + 1]);
+        else if (strcmp(argv[argi], "-r") == 0) rows = atoi(argv[argi + 1]);
+        else if (strcmp(argv[argi], "-c") == 0) cols = atoi(argv[argi + 1]);
+        else break;
+    }
+    if (argi >= argc || repeat < 1 || rows < 8 || cols < 20) {
+        fprintf(stderr, "usage: %s [-n repeat] [-r rows] [-c cols] <file> [script.keys]\n", argv[0]);
+        return 2;
+    }
+    const char *file = argv[argi];
+    char *script = argi + 1 < argc ? read_file(argv[argi + 1]) : dupstr(default_script);
+    if (!script) {
+        fprintf(stderr, "cannot read script %s\n", argv[argi + 1]);
+        return 1;
+    }
+    int *keys = NULL;
+    size_t nkeys = parse_script(script, &keys);
+    free(script);
+    if (nkeys == 0) {
+        fprintf(stderr, "empty script\n");
+        return 1;
+    }
+
+    // Editor state as main.c sets it up (including ~/.jsvimrc), minus the
+    // LSP server
+    EditorState ed;
+    editor_init(&ed);
+    snprintf(ed.filename, sizeof(ed.filename), "%s", file);
+    ed.have_filename = 1;
+    editor_load_config(&ed);
+    ed.existing_file = !editor_load_file(&ed, ed.filename);
+    if (!ed.existing_file) {
+        fprintf(stderr, "cannot load %s\n", file);
+        return 1;
+    }
+    if (ed.buf.count == 0) buf_push(&ed.buf, dupstr(""));
+    ed.file_created = 1;
+    ed.buf.ft = detect_filetype(ed.filename);
+    snprintf(ed.buf.filepath, sizeof(ed.buf.filepath), "%s", ed.filename);
+    highlight_buffer(&ed.buf);
+
+    // Virtual screen: a terminal whose output goes nowhere
+    FILE *out = fopen("/dev/null", "w");
+    FILE *in = fopen("/dev/null", "r");
+    const char *term = getenv("TERM");
+    SCREEN *scr = newterm(term && *term ? term : "xterm-256color", out, in);
+    if (!scr) {
+        fprintf(stderr, "newterm failed\n");
+        return 1;
+    }
+    if (has_colors()) {
+        start_color();
+        use_default_colors();
+        render_init_colors();
+    }
+    resizeterm(rows, cols);
+    WINDOW *main_win = newwin(rows - 1, cols, 0, 0);
+    WINDOW *cmd_win = newwin(1, cols, rows - 1, 0);
+
+    size_t total = nkeys * (size_t)repeat;
+    long long *edit = malloc(total * sizeof(long long));
+    long long *hl = malloc(total * sizeof(long long));
+    long long *rend = malloc(total * sizeof(long long));
+    long long *all = malloc(total * sizeof(long long));
+    if (!edit || !hl || !rend || !all) return 1;
+
+    size_t lines_before = ed.buf.count;
+    for (size_t k = 0; k < total; k++) {
+        int ch = keys[k % nkeys];
+        int qf_rows = (ed.qf.open || ed.finder.active) ? QUICKFIX_ROWS : 0;
+        int visible_rows = rows - 3 - qf_rows;
+
+        long long h0 = highlight_time_ns();
+        long long t0 = now_ns();
+        if (ed.finder.active)
+            editor_handle_finder(&ed, ch);
+        else if (ed.mode_insert)
+            editor_handle_insert_mode(&ed, ch, visible_rows);
+        else
+            editor_handle_command_mode(&ed, ch, NULL, cols);
+        search_count_step(&ed.search, &ed.buf, SEARCH_COUNT_SLICE_MS);
+        long long t1 = now_ns();
+        long long h1 = highlight_time_ns();
+
+        int gutter_width = compute_gutter_width(ed.buf.count);
+        int cy, cx;
+        folds_reveal(&ed.folds, ed.cursor_line);
+        compute_cursor_position(&ed.buf, &ed.folds, ed.cursor_line, ed.cursor_col,
+                                gutter_width + 2, cols, visible_rows,
+                                &ed.scroll_y, &cy, &cx);
+        if (ed.large_file)
+            highlight_viewport(&ed.buf, ed.scroll_y,
+                               folds_line_at_row(&ed.folds, folds_row_of(&ed.folds, ed.scroll_y) +
+                                                 (size_t)visible_rows) - ed.scroll_y);
+        BracketMatch match;
+        brackets_match_at(&ed.brackets, &ed.buf, ed.cursor_line, ed.cursor_col, &match);
+        render_main_window(main_win, &ed.buf, &ed.folds, &ed.changes, rows - qf_rows, cols,
+                           ed.scroll_y, ed.cursor_line, ed.cursor_col,
+                           gutter_width, "JSVIM", ed.filename, ed.have_filename,
+                           ed.modified, ed.large_file, ed.mode_insert, ed.line_number_relative,
+                           &ed.search,
+                           &match);
+        render_command_window(cmd_win, &ed.buf, cols, ed.mode_insert,
+                              ed.cmdbuf, ed.cursor_line,
+                              ed.pending_create_prompt, ed.filename, ed.message);
+        wnoutrefresh(main_win);
+        wnoutrefresh(cmd_win);
+        long long t2 = now_ns();
+        long long h2 = highlight_time_ns();
+
+        // Large files re-highlight around the viewport while rendering;
+        // that counts as highlight time too
+        hl[k] = h2 - h0;
+        edit[k] = (t1 - t0) - (h1 - h0);
+        rend[k] = (t2 - t1) - (h2 - h1);
+        all[k] = t2 - t0;
+        if (ed.quit) {
+            total = k + 1;
+            break;
+        }
+    }
+
+    printf("%s: %zu lines (%zu after replay)%s, %zu keystrokes x %d, %dx%d screen\n\n",
+           file, lines_before, ed.buf.count, ed.large_file ? " [large]" : "",
+           nkeys, repeat, cols, rows);
+    printf("%-10s %9s %9s %9s %9s %9s %11s\n",
+           "us/key", "mean", "p50", "p90", "p99", "max", "total ms");
+    report("edit", edit, total);
+    report("highlight", hl, total);
+    report("render", rend, total);
+    report("total", all, total);
+
+    delwin(main_win);
+    delwin(cmd_win);
+    endwin();
+    delscreen(scr);
+    fclose(out);
+    fclose(in);
+    editor_cleanup(&ed);
+    highlight_cleanup();
+    free(keys);
+    free(edit);
+    free(hl);
+    free(rend);
+    free(all);
+    return 0;
+}
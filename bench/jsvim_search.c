@@ -0,0 +1,71 @@
+// bench/jsvim_search.c - Throughput of jsvim's in-buffer search
+//
+// Builds an in-memory Buffer of the requested size (default 1024 MB) out of
+// source-like lines, then times a full literal and regex match count over it.
+//
+//   make bench/jsvim_search && ./bench/jsvim_search [megabytes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "buffer.h"
+#include "search.h"
+#include "util.h"
+
+static const char *sample_lines[] = {
+    "    for (size_t i = 0; i < buf->count; i++) {",
+    "        total += strlen(buf->lines[i]) + 1;",
+    "    }",
+    "// TODO: handle the needle case separately",
+    "static int parse_header(const char *hdr, size_t len, int *out_status);",
+    "",
+    "    return JS_NewString(ctx, JS_SUPPRESS);",
+};
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+static void run(Buffer *buf, const char *pattern, size_t bytes) {
+    SearchState s;
+    search_init(&s);
+    if (search_set_pattern(&s, pattern) != 0) {
+        fprintf(stderr, "bad pattern: %s\n", pattern);
+        return;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    size_t hits = search_count_all(&s, buf);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double ms = elapsed_ms(t0, t1);
+    printf("%-8s %-24s %10zu matches  %9.1f ms  %7.2f GB/s\n",
+           s.is_regex ? "regex" : "literal", pattern, hits, ms,
+           (bytes / 1e9) / (ms / 1e3));
+    search_free(&s);
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 1024;
+    size_t target = megabytes * 1024 * 1024;
+    size_t nsamples = sizeof(sample_lines) / sizeof(sample_lines[0]);
+
+    Buffer buf;
+    buf_init(&buf);
+    size_t bytes = 0;
+    for (size_t i = 0; bytes < target; i++) {
+        const char *ln = sample_lines[i % nsamples];
+        buf_push(&buf, dupstr(ln));
+        bytes += strlen(ln) + 1;
+    }
+    printf("buffer: %zu lines, %.1f MB\n", buf.count, bytes / (1024.0 * 1024.0));
+
+    run(&buf, "needle", bytes);   // rare literal
+    run(&buf, "buf", bytes);      // common literal
+    run(&buf, "JS_[A-Z]+", bytes); // regex
+
+    buf_free(&buf);
+    return 0;
+}
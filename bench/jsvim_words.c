@@ -0,0 +1,90 @@
+// bench/jsvim_words.c - Latency of jsvim's Ctrl-N word completion
+//
+// Builds an in-memory Buffer of the requested number of lines (default
+// 500k) out of source-like lines with varied identifiers, indexes it once,
+// then times edit + completion rounds: each changes one line, reports it
+// to the index the way the editor does, and asks for completions of a
+// short prefix.
+//
+//   make bench/jsvim_words && ./bench/jsvim_words [lines]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "buffer.h"
+#include "words.h"
+#include "util.h"
+
+#define ROUNDS 2000
+
+static const char *sample_lines[] = {
+    "    for (size_t i = 0; i < buf->count_%u; i++) {",
+    "        total_%u += strlen(buf->lines[i]) + line_len_%u;",
+    "    }",
+    "// TODO: handle the needle_%u case separately",
+    "static int parse_header_%u(const char *hdr, size_t len, int *out_status);",
+    "",
+    "    return JS_NewString(ctx, js_suppress_%u);",
+};
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static char *make_line(size_t i) {
+    char tmp[256];
+    size_t nsamples = sizeof(sample_lines) / sizeof(sample_lines[0]);
+    // A few thousand distinct identifiers, like a real project
+    unsigned id = (unsigned)((i * 2654435761u) % 5000);
+    snprintf(tmp, sizeof(tmp), sample_lines[i % nsamples], id, id);
+    return dupstr(tmp);
+}
+
+int main(int argc, char **argv) {
+    size_t nlines = argc > 1 ? strtoul(argv[1], NULL, 10) : 500000;
+
+    Buffer buf;
+    buf_init(&buf);
+    for (size_t i = 0; i < nlines; i++) buf_push(&buf, make_line(i));
+
+    WordIndex ix;
+    words_init(&ix);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    words_step(&ix, &buf, -1);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("index   %zu lines, %zu trie nodes  %9.1f ms (first pass, idle time)\n",
+           nlines, ix.node_count, elapsed_ms(t0, t1));
+
+    static const char *prefixes[] = { "t", "to", "par", "parse_header_1", "js_", "needle_4" };
+    size_t nprefix = sizeof(prefixes) / sizeof(prefixes[0]);
+    char out[WORDS_MAX_SUGGEST][WORDS_MAX_LEN + 1];
+    double *ms = malloc(ROUNDS * sizeof(double));
+    size_t found = 0;
+    srand(1);
+    for (int r = 0; r < ROUNDS; r++) {
+        // One typed line somewhere in the file
+        size_t at = (size_t)rand() % buf.count;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        words_edit(&ix, at, 1, 1);
+        free(buf.lines[at]);
+        buf.lines[at] = make_line((size_t)rand());
+        found += words_complete(&ix, &buf, prefixes[r % nprefix], out, WORDS_MAX_SUGGEST);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ms[r] = elapsed_ms(t0, t1);
+    }
+    qsort(ms, ROUNDS, sizeof(double), cmp_double);
+    printf("edit+complete  %d rounds  p50 %.4f ms  p99 %.4f ms  max %.4f ms  (%zu suggestions)\n",
+           ROUNDS, ms[ROUNDS / 2], ms[ROUNDS * 99 / 100], ms[ROUNDS - 1], found);
+
+    free(ms);
+    words_free(&ix);
+    buf_free(&buf);
+    return 0;
+}
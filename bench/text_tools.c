@@ -0,0 +1,223 @@
+// bench/text_tools.c - jssh's pipe() filters against coreutils
+//
+// Writes a log-like file of the requested size (default 2048 MB) to
+// $TMPDIR, then runs each filter over it the way pipe(cat(file), ...)
+// does and the matching coreutils command (LC_ALL=C) through a pipe.
+// Both outputs are hashed, so every row also checks that the results
+// agree. sort gets a 256 MB run size, so files past that take the
+// external merge path.
+//
+// Last, plain cat(file) is printed into a file, a file opened for append
+// (>>), a pipe and /dev/null, next to the 4 KB fread/fwrite loop cat used
+// to be. Copies into a file are checked for size.
+//
+//   make bench/text_tools && ./bench/text_tools [megabytes]
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pipe.h"
+
+#define SORT_RUN_BYTES (256u << 20)
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+static const char *messages[] = {
+    "request served path=/api/v1/items status=200",
+    "cache miss key=user:%u",
+    "slow query took %u ms table=orders",
+    "connection reset by peer fd=%u",
+    "retrying upload chunk=%u",
+    "needle found in haystack id=%u",
+};
+
+typedef struct {
+    const char *name;
+    const char *coreutils;      // shell command, the file is appended
+    PipeStage *(*make)(void);
+} Case;
+
+static char err[128];
+
+static PipeStage *mk_wc_l(void) { return pipe_wc("l", err, sizeof(err)); }
+static PipeStage *mk_wc_w(void) { return pipe_wc("w", err, sizeof(err)); }
+static PipeStage *mk_grep_lit(void) { return pipe_grep("needle", 6, "", err, sizeof(err)); }
+static PipeStage *mk_grep_re(void) { return pipe_grep("ERROR.*fd=[0-9]+7$", 18, "E", err, sizeof(err)); }
+static PipeStage *mk_grep_i(void) { return pipe_grep("slow QUERY", 10, "i", err, sizeof(err)); }
+static PipeStage *mk_tail(void) { return pipe_tail(10); }
+static PipeStage *mk_sort(void) { return pipe_sort("", SORT_RUN_BYTES, err, sizeof(err)); }
+static PipeStage *mk_uniq_c(void) { return pipe_uniq("c", err, sizeof(err)); }
+
+static const Case cases[] = {
+    { "wc -l",      "wc -l <",                       mk_wc_l },
+    { "wc -w",      "wc -w <",                       mk_wc_w },
+    { "grep lit",   "grep -F needle",                mk_grep_lit },
+    { "grep -E",    "grep -E 'ERROR.*fd=[0-9]+7$'",  mk_grep_re },
+    { "grep -i",    "grep -i 'slow QUERY'",          mk_grep_i },
+    { "tail",       "tail -n 10",                    mk_tail },
+    { "sort",       "sort",                          mk_sort },
+    { "uniq -c",    "uniq -c",                       mk_uniq_c },
+};
+
+static double elapsed_ms(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// cat the old way: stdio through a 4 KB stack buffer
+static void cat_stdio(const char *path, int out) {
+    FILE *in = fopen(path, "r");
+    FILE *f = fdopen(dup(out), "w");
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, f);
+    fclose(f);
+    fclose(in);
+}
+
+static void cat_drain(const char *path, int out) {
+    int fd = open(path, O_RDONLY);
+    PipeStage *s = pipe_file_source(&fd, 1);
+    int ends_nl = 1;
+    if (pipe_drain(s, out, &ends_nl) != 0) perror("pipe_drain");
+    pipe_free(s);
+}
+
+static double time_cat(void (*cat)(const char *, int), const char *path, int out) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    cat(path, out);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return elapsed_ms(t0, t1);
+}
+
+static void run_cat(const char *name, const char *path, size_t bytes, const char *target,
+                    int oflags) {
+    double ms[2];
+    const char *check = "";
+    struct stat src;
+    stat(path, &src);
+    void (*cats[2])(const char *, int) = { cat_drain, cat_stdio };
+    for (int i = 0; i < 2; i++) {
+        FILE *p = NULL;
+        int out;
+        if (target) {
+            out = open(target, O_WRONLY | O_CREAT | O_TRUNC | oflags, 0600);
+        } else {
+            p = popen("cat > /dev/null", "w");
+            out = fileno(p);
+        }
+        ms[i] = time_cat(cats[i], path, out);
+        struct stat st;
+        if (i == 0 && fstat(out, &st) == 0 && S_ISREG(st.st_mode))
+            check = st.st_size == src.st_size ? "same size" : "WRONG SIZE";
+        if (p) pclose(p);
+        else close(out);
+    }
+    printf("cat %-6s %9.1f ms %7.2f GB/s   4K stdio  %9.1f ms %7.2f GB/s   %s\n",
+           name, ms[0], (bytes / 1e9) / (ms[0] / 1e3), ms[1], (bytes / 1e9) / (ms[1] / 1e3),
+           check);
+}
+
+static void write_file(const char *path, size_t target) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    size_t bytes = 0;
+    unsigned seed = 12345;
+    char line[256];
+    while (bytes < target) {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = seed >> 8;
+        int len = snprintf(line, sizeof(line), "2024-05-%02u %02u:%02u:%02u %-5s ",
+                           1 + r % 28, r % 24, (r >> 5) % 60, (r >> 11) % 60,
+                           levels[r % 6]);
+        len += snprintf(line + len, sizeof(line) - len,
+                        messages[(r >> 3) % 6], (r >> 4) % 100000);
+        line[len++] = '\n';
+        // Some lines repeat, so uniq has work to do
+        int copies = (r >> 17) % 4 == 0 ? 2 : 1;
+        for (int c = 0; c < copies; c++) {
+            fwrite(line, 1, len, f);
+            bytes += len;
+        }
+    }
+    fclose(f);
+}
+
+static void run(const Case *c, const char *path, size_t bytes) {
+    struct timespec t0, t1;
+    char *buf = malloc(PIPE_CHUNK);
+
+    // jssh: file source -> filter, drained the way the REPL prints it
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    PipeStage *s = c->make();
+    if (!s) {
+        fprintf(stderr, "%s: %s\n", c->name, err);
+        exit(1);
+    }
+    int fd = open(path, O_RDONLY);
+    s->up = pipe_file_source(&fd, 1);
+    uint64_t ours = 0xcbf29ce484222325ULL;
+    ssize_t n;
+    while ((n = s->pull(s, buf, PIPE_CHUNK)) > 0)
+        ours = fnv1a(ours, buf, n);
+    pipe_free(s);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = elapsed_ms(t0, t1);
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "LC_ALL=C %s %s", c->coreutils, path);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    FILE *p = popen(cmd, "r");
+    uint64_t theirs = 0xcbf29ce484222325ULL;
+    size_t got;
+    while ((got = fread(buf, 1, PIPE_CHUNK, p)) > 0)
+        theirs = fnv1a(theirs, buf, got);
+    pclose(p);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double cms = elapsed_ms(t0, t1);
+
+    printf("%-10s %9.1f ms %7.2f GB/s   coreutils %9.1f ms %7.2f GB/s   %s\n",
+           c->name, ms, (bytes / 1e9) / (ms / 1e3), cms, (bytes / 1e9) / (cms / 1e3),
+           ours == theirs ? "same" : "DIFFERENT");
+    free(buf);
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 2048;
+    size_t target = megabytes * 1024 * 1024;
+    const char *dir = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/jssh-text-bench.log", dir && *dir ? dir : "/tmp");
+
+    write_file(path, target);
+    printf("file: %s, %.1f MB\n", path, target / (1024.0 * 1024.0));
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        run(&cases[i], path, target);
+
+    char copy[520];
+    snprintf(copy, sizeof(copy), "%s.copy", path);
+    run_cat("file", path, target, copy, 0);
+    run_cat(">>", path, target, copy, O_APPEND);
+    run_cat("pipe", path, target, NULL, 0);
+    run_cat("null", path, target, "/dev/null", 0);
+    unlink(copy);
+
+    unlink(path);
+    return 0;
+}
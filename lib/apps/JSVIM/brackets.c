@@ -0,0 +1,382 @@
+// brackets.c - Incremental index of bracket nesting: (), [] and {}
+#include "brackets.h"
+#include "highlight.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char bracket_opens[] = "([{";
+static const char bracket_closes[] = ")]}";
+
+// Bracket type of c (0..BRACKET_TYPES-1), with *open set; -1 if none
+static int bracket_type(char c, int *open) {
+    const char *p;
+    *open = 0;
+    if (!c) return -1;
+    if ((p = strchr(bracket_opens, c)) != NULL) {
+        *open = 1;
+        return (int)(p - bracket_opens);
+    }
+    if ((p = strchr(bracket_closes, c)) != NULL)
+        return (int)(p - bracket_closes);
+    return -1;
+}
+
+static int is_code(Buffer *buf, size_t line, size_t col) {
+    SemanticKind k = semantic_kind_at(buf, (int)line, (int)col);
+    return k != SEM_STRING && k != SEM_COMMENT;
+}
+
+// a followed by b
+static BracketRun run_join(BracketRun a, BracketRun b) {
+    BracketRun r;
+    r.sum = a.sum + b.sum;
+    r.min_pre = a.min_pre < a.sum + b.min_pre ? a.min_pre : a.sum + b.min_pre;
+    return r;
+}
+
+static void scan_line(Buffer *buf, size_t line, BracketLine *out) {
+    const char *s = buf->lines[line];
+    memset(out, 0, sizeof(*out));
+    for (const char *p = s; (p = strpbrk(p, "()[]{}")) != NULL; p++) {
+        int open, t = bracket_type(*p, &open);
+        if (!is_code(buf, line, (size_t)(p - s))) continue;
+        BracketRun *r = &out->t[t];
+        r->sum += open ? 1 : -1;
+        if (r->sum < r->min_pre) r->min_pre = r->sum;
+    }
+    out->has_delim = highlight_has_comment_delim(buf->ft, s);
+}
+
+void brackets_init(BracketIndex *ix) {
+    memset(ix, 0, sizeof(*ix));
+}
+
+void brackets_free(BracketIndex *ix) {
+    free(ix->lines);
+    free(ix->tree);
+    brackets_init(ix);
+}
+
+void brackets_reset(BracketIndex *ix) {
+    ix->valid = 0;
+}
+
+void brackets_edit(BracketIndex *ix, size_t first, size_t old_count, size_t new_count) {
+    if (!ix->valid) return;
+    if (first > ix->count) {
+        ix->valid = 0;
+        return;
+    }
+    if (old_count > ix->count - first) old_count = ix->count - first;
+
+    // Removing "/*" or "*/" can recolour every line after it
+    for (size_t i = first; i < first + old_count; i++)
+        if (ix->lines[i].has_delim) ix->cascade = 1;
+
+    if (new_count != old_count) {
+        size_t count = ix->count - old_count + new_count;
+        if (count > ix->cap) {
+            size_t cap = ix->cap ? ix->cap : 64;
+            while (cap < count) cap *= 2;
+            BracketLine *tmp = realloc(ix->lines, cap * sizeof(BracketLine));
+            if (!tmp) {
+                ix->valid = 0;
+                return;
+            }
+            ix->lines = tmp;
+            ix->cap = cap;
+        }
+        memmove(ix->lines + first + new_count, ix->lines + first + old_count,
+                (ix->count - first - old_count) * sizeof(BracketLine));
+        ix->count = count;
+        ix->rebuild = 1;
+    }
+    for (size_t i = first; i < first + new_count; i++) ix->lines[i].has_delim = 0;
+
+    // Move the pending dirty range through the edit and add the new lines
+    size_t lo = first, hi = first + new_count;
+    if (ix->dirty_lo < ix->dirty_hi) {
+        size_t end = first + old_count;
+        size_t a = ix->dirty_lo, b = ix->dirty_hi;
+        a = a >= end ? a - old_count + new_count : a < first ? a : first;
+        b = b >= end ? b - old_count + new_count : b <= first ? b : first + new_count;
+        if (a < lo) lo = a;
+        if (b > hi) hi = b;
+    }
+    ix->dirty_lo = lo;
+    ix->dirty_hi = hi;
+}
+
+static void tree_pull(BracketIndex *ix, size_t i) {
+    for (int t = 0; t < BRACKET_TYPES; t++)
+        ix->tree[i].t[t] = run_join(ix->tree[2 * i].t[t], ix->tree[2 * i + 1].t[t]);
+}
+
+static int tree_build(BracketIndex *ix) {
+    size_t size = ix->size ? ix->size : 1;
+    while (size < ix->count) size *= 2;
+    if (size != ix->size || !ix->tree) {
+        BracketLine *tmp = realloc(ix->tree, 2 * size * sizeof(BracketLine));
+        if (!tmp) return -1;
+        ix->tree = tmp;
+        ix->size = size;
+    }
+    memcpy(ix->tree + size, ix->lines, ix->count * sizeof(BracketLine));
+    memset(ix->tree + size + ix->count, 0, (size - ix->count) * sizeof(BracketLine));
+    for (size_t i = size - 1; i >= 1; i--) tree_pull(ix, i);
+    return 0;
+}
+
+static void tree_set(BracketIndex *ix, size_t line) {
+    size_t i = ix->size + line;
+    ix->tree[i] = ix->lines[line];
+    for (i /= 2; i >= 1; i /= 2) tree_pull(ix, i);
+}
+
+// Rescan dirty lines and bring the tree up to date. Returns 0 when the
+// tree can be used.
+static int brackets_refresh(BracketIndex *ix, Buffer *buf) {
+    // New LSP tokens may move strings and comments anywhere; a count that
+    // disagrees means an edit went unreported
+    if (ix->valid && (ix->lsp_gen != buf->lsp_tokens_gen || ix->count != buf->count))
+        ix->valid = 0;
+
+    if (!ix->valid) {
+        if (buf->count > ix->cap) {
+            BracketLine *tmp = realloc(ix->lines, buf->count * sizeof(BracketLine));
+            if (!tmp) return -1;
+            ix->lines = tmp;
+            ix->cap = buf->count;
+        }
+        ix->count = buf->count;
+        ix->size = 0;
+        ix->dirty_lo = 0;
+        ix->dirty_hi = ix->count;
+        ix->rebuild = 1;
+        ix->cascade = 0;
+        ix->lsp_gen = buf->lsp_tokens_gen;
+        ix->valid = 1;
+    }
+    if (ix->dirty_lo >= ix->dirty_hi && !ix->rebuild && !ix->cascade) return 0;
+
+    size_t hi = ix->cascade ? ix->count : ix->dirty_hi;
+    if (hi - ix->dirty_lo > ix->count / 8) ix->rebuild = 1;
+    for (size_t l = ix->dirty_lo; l < hi; l++) {
+        scan_line(buf, l, &ix->lines[l]);
+        if (ix->lines[l].has_delim && hi < ix->count) {
+            hi = ix->count;
+            ix->rebuild = 1;
+        }
+        if (!ix->rebuild) tree_set(ix, l);
+    }
+    if (ix->rebuild && tree_build(ix) != 0) {
+        ix->valid = 0;
+        return -1;
+    }
+    ix->rebuild = 0;
+    ix->cascade = 0;
+    ix->dirty_lo = ix->dirty_hi = 0;
+    return 0;
+}
+
+// First line at or after `from` in which a forward search with *need
+// brackets of type t still open gets back to zero. Lines skipped add
+// their sums to *need. -1 if none.
+static long tree_find_fwd(const BracketIndex *ix, int t, size_t node,
+                          size_t nlo, size_t nhi, size_t from, int *need) {
+    if (nhi <= from) return -1;
+    const BracketRun *r = &ix->tree[node].t[t];
+    if (nlo >= from && *need + r->min_pre > 0) {
+        *need += r->sum;
+        return -1;
+    }
+    if (nhi - nlo == 1) return (long)nlo;
+    size_t mid = nlo + (nhi - nlo) / 2;
+    long found = tree_find_fwd(ix, t, 2 * node, nlo, mid, from, need);
+    if (found >= 0) return found;
+    return tree_find_fwd(ix, t, 2 * node + 1, mid, nhi, from, need);
+}
+
+// Last line before `to` in which a backward search with *need closing
+// brackets of type t unmatched gets back to zero. The most a line can
+// cancel going backwards is its best tail, sum - min_pre.
+static long tree_find_bwd(const BracketIndex *ix, int t, size_t node,
+                          size_t nlo, size_t nhi, size_t to, int *need) {
+    if (nlo >= to) return -1;
+    const BracketRun *r = &ix->tree[node].t[t];
+    if (nhi <= to && *need - (r->sum - r->min_pre) > 0) {
+        *need -= r->sum;
+        return -1;
+    }
+    if (nhi - nlo == 1) return (long)nlo;
+    size_t mid = nlo + (nhi - nlo) / 2;
+    long found = tree_find_bwd(ix, t, 2 * node + 1, mid, nhi, to, need);
+    if (found >= 0) return found;
+    return tree_find_bwd(ix, t, 2 * node, nlo, mid, to, need);
+}
+
+static int scan_fwd_in_line(Buffer *buf, int t, size_t line, size_t col,
+                            int *need, size_t *mcol) {
+    const char *s = buf->lines[line];
+    size_t len = strlen(s);
+    for (size_t c = col; c < len; c++) {
+        int open;
+        if (bracket_type(s[c], &open) != t || !is_code(buf, line, c)) continue;
+        *need += open ? 1 : -1;
+        if (*need == 0) {
+            *mcol = c;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Scans back from just before `end`
+static int scan_bwd_in_line(Buffer *buf, int t, size_t line, size_t end,
+                            int *need, size_t *mcol) {
+    const char *s = buf->lines[line];
+    for (size_t c = end; c-- > 0; ) {
+        int open;
+        if (bracket_type(s[c], &open) != t || !is_code(buf, line, c)) continue;
+        *need += open ? -1 : 1;
+        if (*need == 0) {
+            *mcol = c;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Searches cover lines [lo, hi); `tree` says whether the index is usable
+typedef struct {
+    int tree;
+    size_t lo, hi;
+} Scope;
+
+static int scope_for(BracketIndex *ix, Buffer *buf, Scope *sc) {
+    sc->lo = 0;
+    sc->hi = buf->count;
+    if (buf->hl_count > 0) {
+        // Highlight window: tokens only exist inside it
+        ix->valid = 0;
+        sc->tree = 0;
+        sc->lo = buf->hl_first;
+        if (buf->hl_first + buf->hl_count < sc->hi) sc->hi = buf->hl_first + buf->hl_count;
+    } else {
+        sc->tree = brackets_refresh(ix, buf) == 0;
+    }
+    return sc->lo < sc->hi;
+}
+
+// The close of type t matching an open just before (line, col)
+static int find_close(BracketIndex *ix, Buffer *buf, const Scope *sc, int t,
+                      size_t line, size_t col, size_t *ml, size_t *mc) {
+    int need = 1;
+    if (scan_fwd_in_line(buf, t, line, col, &need, mc)) {
+        *ml = line;
+        return 1;
+    }
+    size_t l;
+    if (sc->tree) {
+        long found = tree_find_fwd(ix, t, 1, 0, ix->size, line + 1, &need);
+        if (found < 0 || (size_t)found >= sc->hi) return 0;
+        l = (size_t)found;
+    } else {
+        for (l = line + 1; l < sc->hi; l++) {
+            BracketLine bl;
+            scan_line(buf, l, &bl);
+            if (need + bl.t[t].min_pre <= 0) break;
+            need += bl.t[t].sum;
+        }
+        if (l >= sc->hi) return 0;
+    }
+    *ml = l;
+    return scan_fwd_in_line(buf, t, l, 0, &need, mc);
+}
+
+// The open of type t left unmatched before (line, col)
+static int find_open(BracketIndex *ix, Buffer *buf, const Scope *sc, int t,
+                     size_t line, size_t col, size_t *ml, size_t *mc) {
+    int need = 1;
+    if (scan_bwd_in_line(buf, t, line, col, &need, mc)) {
+        *ml = line;
+        return 1;
+    }
+    size_t l;
+    if (sc->tree) {
+        long found = tree_find_bwd(ix, t, 1, 0, ix->size, line, &need);
+        if (found < 0 || (size_t)found < sc->lo) return 0;
+        l = (size_t)found;
+    } else {
+        int hit = 0;
+        for (l = line; l > sc->lo && !hit; ) {
+            BracketLine bl;
+            scan_line(buf, --l, &bl);
+            if (need - (bl.t[t].sum - bl.t[t].min_pre) <= 0) hit = 1;
+            else need -= bl.t[t].sum;
+        }
+        if (!hit) return 0;
+    }
+    *ml = l;
+    return scan_bwd_in_line(buf, t, l, strlen(buf->lines[l]), &need, mc);
+}
+
+int brackets_match_at(BracketIndex *ix, Buffer *buf, size_t line, size_t col,
+                      BracketMatch *m) {
+    m->active = 0;
+    if (line >= buf->count) return 0;
+    const char *s = buf->lines[line];
+    size_t len = strlen(s);
+
+    // Cheap test first: most cursor positions are nowhere near a bracket
+    int open;
+    if ((col >= len || bracket_type(s[col], &open) < 0) &&
+        (col == 0 || col > len || bracket_type(s[col - 1], &open) < 0))
+        return 0;
+    Scope sc;
+    if (!scope_for(ix, buf, &sc) || line < sc.lo || line >= sc.hi) return 0;
+
+    int t = -1;
+    size_t c = col;
+    for (size_t k = 0; k < 2 && k <= col && t < 0; k++) {
+        c = col - k;
+        if (c >= len) continue;
+        t = bracket_type(s[c], &open);
+        if (t >= 0 && !is_code(buf, line, c)) t = -1;
+    }
+    if (t < 0) return 0;
+
+    size_t ml, mc;
+    int found = open ? find_close(ix, buf, &sc, t, line, c + 1, &ml, &mc)
+                     : find_open(ix, buf, &sc, t, line, c, &ml, &mc);
+    if (!found) return 0;
+    m->active = 1;
+    m->line[0] = line;
+    m->col[0] = c;
+    m->line[1] = ml;
+    m->col[1] = mc;
+    return 1;
+}
+
+int brackets_enclosing(BracketIndex *ix, Buffer *buf, size_t line, size_t col,
+                       const char *opens, size_t *oline, size_t *ocol) {
+    if (line >= buf->count) return 0;
+    Scope sc;
+    if (!scope_for(ix, buf, &sc) || line < sc.lo || line >= sc.hi) return 0;
+    size_t len = strlen(buf->lines[line]);
+    if (col > len) col = len;
+
+    int found = 0;
+    for (const char *o = opens; *o; o++) {
+        int open, t = bracket_type(*o, &open);
+        size_t ml, mc;
+        if (t < 0 || !open) continue;
+        if (find_open(ix, buf, &sc, t, line, col, &ml, &mc) &&
+            (!found || ml > *oline || (ml == *oline && mc > *ocol))) {
+            *oline = ml;
+            *ocol = mc;
+            found = 1;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,70 @@
+// brackets.h - Incremental index of bracket nesting: (), [] and {}
+#ifndef BRACKETS_H
+#define BRACKETS_H
+
+#include <stddef.h>
+#include "buffer.h"
+
+#define BRACKET_TYPES 3   // ( [ {
+
+// What a run of text does to the depth of one bracket type. The most
+// any tail of the run opens is sum - min_pre, so that needs no field.
+typedef struct {
+    int sum;                     // opens minus closes
+    int min_pre;                 // lowest depth reached from the start (<= 0)
+} BracketRun;
+
+typedef struct {
+    BracketRun t[BRACKET_TYPES];
+    int has_delim;               // holds "/*" or "*/": may recolour later lines
+} BracketLine;
+
+// One BracketLine per buffer line, plus a segment tree over them so a
+// matching bracket or an enclosing opener anywhere in the file is found
+// by descending the tree instead of rescanning lines. Edits only mark
+// lines dirty (brackets_edit); they are rescanned at the next query.
+// Brackets inside strings and comments, as the highlighter's tokens
+// mark them, do not count.
+typedef struct {
+    BracketLine *lines;
+    size_t count;
+    size_t cap;
+    BracketLine *tree;           // node i covers its children 2i and 2i+1
+    size_t size;                 // leaves, a power of two >= count
+    size_t dirty_lo, dirty_hi;   // lines to rescan: [dirty_lo, dirty_hi)
+    int rebuild;                 // lines were added or removed
+    int cascade;                 // a removed line held a comment delimiter
+    int valid;                   // built for the current buffer
+    unsigned lsp_gen;            // buf->lsp_tokens_gen when built
+} BracketIndex;
+
+// A bracket near the cursor and its partner, for render_main_window
+typedef struct {
+    int active;
+    size_t line[2];
+    size_t col[2];
+} BracketMatch;
+
+void brackets_init(BracketIndex *ix);
+void brackets_free(BracketIndex *ix);
+
+// Drop everything; the next query scans the whole buffer
+void brackets_reset(BracketIndex *ix);
+
+// Lines [first, first + old_count) were replaced by new_count lines
+void brackets_edit(BracketIndex *ix, size_t first, size_t old_count, size_t new_count);
+
+// The bracket at (line, col), or else the one just before it (the insert
+// cursor sits between characters), and the bracket it pairs with.
+// O(log lines) plus a scan of the two lines involved. In a highlight
+// window (large files) the search stays inside the window. Returns 1 if
+// both were found.
+int brackets_match_at(BracketIndex *ix, Buffer *buf, size_t line, size_t col,
+                      BracketMatch *m);
+
+// Innermost bracket of one of `opens` (e.g. "({[") left open before
+// (line, col). Returns 1 and its position if there is one.
+int brackets_enclosing(BracketIndex *ix, Buffer *buf, size_t line, size_t col,
+                       const char *opens, size_t *oline, size_t *ocol);
+
+#endif
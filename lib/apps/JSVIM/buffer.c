@@ -7,6 +7,9 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 void buf_init(Buffer *b) {
     // Initialize line storage
@@ -33,6 +36,7 @@ void buf_init(Buffer *b) {
     b->lsp_version = 0;
     b->lsp_opened = 0;
     b->lsp_dirty = 0;
+    b->lsp_unsent = 0;
     b->lsp_last_edit_ms = 0;
     b->lsp_uri[0] = '\0';
     b->filepath[0] = '\0';
@@ -44,6 +48,14 @@ void buf_init(Buffer *b) {
 
     // Initialize LSP token map
     b->lsp_token_map_len = 0;
+    b->lsp_tokens_gen = 0;
+
+    // No completion list yet
+    memset(&b->completion, 0, sizeof(b->completion));
+
+    // Highlight the whole buffer
+    b->hl_first = 0;
+    b->hl_count = 0;
 }
 
 void buf_free(Buffer *b) {
@@ -86,6 +98,12 @@ void buf_free(Buffer *b) {
     }
     free(b->diagnostics);
 
+    // Free the completion list
+    free(b->completion.items);
+    free(b->completion.text);
+    free(b->completion.shown);
+    memset(&b->completion, 0, sizeof(b->completion));
+
     // Free semantic tokens
     free(b->tokens);
     b->tokens = NULL;
@@ -112,6 +130,17 @@ void buf_insert(Buffer *b, size_t idx, char *line) {
     b->count++;
 }
 
+// Insert n lines at idx with a single shift of the tail, instead of one
+// shift per line as repeated buf_insert calls would do.
+void buf_insert_lines(Buffer *b, size_t idx, char **lines, size_t n) {
+    if (n == 0) return;
+    if (idx > b->count) idx = b->count;
+    buf_ensure(b, b->count + n);
+    memmove(b->lines + idx + n, b->lines + idx, (b->count - idx) * sizeof(char*));
+    memcpy(b->lines + idx, lines, n * sizeof(char*));
+    b->count += n;
+}
+
 void buf_clear_diagnostics(Buffer *buf) {
     for (size_t i = 0; i < buf->diag_count; i++) {
         free(buf->diagnostics[i].msg);
@@ -150,6 +179,50 @@ int load_file(Buffer *b, const char *fname) {
     return 0;
 }
 
+int load_file_mapped(Buffer *b, const char *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+    if (st.st_size == 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return load_file(b, fname);
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return load_file(b, fname);
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    // Count lines first so the line array is allocated once
+    size_t lines = 1;
+    for (const char *p = map, *end = map + size;
+         (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+        lines++;
+    if (map[size - 1] == '\n') lines--;
+    buf_ensure(b, b->count + lines);
+
+    const char *p = map, *end = map + size;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        char *line = malloc(len + 1);
+        if (!line) break;
+        memcpy(line, p, len);
+        line[len] = '\0';
+        b->lines[b->count++] = line;
+        p += len + 1;
+    }
+
+    munmap(map, size);
+    if (b->count == 0) buf_push(b, dupstr(""));
+    return 0;
+}
+
 int save_file(Buffer *b, const char *fname) {
     FILE *fp = fopen(fname, "w");
     if (!fp) return 1;
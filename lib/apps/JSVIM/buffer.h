@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include "semantic.h"
 #include "language.h"
+#include "completion.h"
 
 #define MAX_LSP_TOKEN_TYPES 64
 
@@ -43,6 +44,7 @@ typedef struct {
     int lsp_version;        // last version sent to LSP
     int lsp_opened;         // didOpen was sent successfully
     int lsp_dirty;          // buffer changed, LSP send still pending
+    int lsp_unsent;         // changes the server has not been sent (no didChange yet)
     long long lsp_last_edit_ms; // wall-clock of last edit; used to debounce LSP sends
     char lsp_uri[4096];     // URI used in LSP textDocument
     char filepath[1024];    // filename as opened in jsvim
@@ -54,6 +56,16 @@ typedef struct {
 
     SemanticKind lsp_token_map[MAX_LSP_TOKEN_TYPES];
     size_t lsp_token_map_len;
+    unsigned lsp_tokens_gen;    // bumped when LSP tokens are replaced
+
+    // textDocument/completion: request in flight and the cached list
+    LspCompletion completion;
+
+    // Lines highlight_buffer covers: [hl_first, hl_first + hl_count).
+    // hl_count == 0 means the whole buffer; large files use a window
+    // around the viewport (see highlight_viewport).
+    size_t hl_first;
+    size_t hl_count;
 } Buffer;
 
 // Buffer initialization and cleanup
@@ -66,6 +78,7 @@ void buf_ensure(Buffer *b, size_t need);
 // Line operations
 void buf_push(Buffer *b, char *line);
 void buf_insert(Buffer *b, size_t idx, char *line);
+void buf_insert_lines(Buffer *b, size_t idx, char **lines, size_t n);
 
 // Diagnostics operations
 void buf_clear_diagnostics(Buffer *buf);
@@ -73,6 +86,10 @@ void buf_add_diagnostic(Buffer *buf, int line, int col, int severity, const char
 
 // File operations
 int load_file(Buffer *b, const char *fname);
+// Same result as load_file, read through mmap in one pass: the line
+// array is sized from a newline count and each line is copied straight
+// out of the mapping. Used for large files.
+int load_file_mapped(Buffer *b, const char *fname);
 int save_file(Buffer *b, const char *fname);
 
 #endif
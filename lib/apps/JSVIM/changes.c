@@ -0,0 +1,522 @@
+// changes.c - Change signs in the gutter: the buffer against git HEAD
+//
+// Each buffer gets one worker thread. It holds the base lines and runs
+// one job at a time. A job is a copy of a run of buffer lines plus the
+// base lines they line up with. The main thread hands over the next job
+// from changes_poll; the worker diffs it and leaves the hunks there for
+// the following poll to take back.
+#include "changes.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+struct ChangeWorker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int quit;
+    int queued;                  // a job is waiting for the worker
+    int done;                    // its hunks are ready
+
+    // The job, written by the main thread while none is running
+    char *path;                  // load the base from here first, NULL = keep it
+    char **snap;                 // copies of buffer lines [lo, hi)
+    char *snap_text;
+    size_t nsnap;
+    size_t base_lo, base_hi;     // base lines they line up with
+
+    // Its result: a in base lines, b counted from lo
+    DiffHunk *out;
+    size_t nout;
+    size_t base_count;
+
+    // Worker thread only
+    char **base;
+    size_t nbase;
+
+    // Main thread only
+    int busy;                    // handed over and not taken back yet
+    int stale;                   // an edit hit its lines while it ran
+    size_t lo, hi;               // its buffer lines, moved by later edits
+};
+
+// ---- base text (worker thread) -------------------------------------------
+
+static void free_lines(char **lines, size_t n) {
+    for (size_t i = 0; i < n; i++) free(lines[i]);
+    free(lines);
+}
+
+// Split a stream into lines the way load_file does: no trailing newline
+// kept, and always at least one line
+static int read_lines(FILE *fp, char ***out, size_t *nout) {
+    char **lines = NULL;
+    size_t n = 0, cap = 0;
+    char *line = NULL;
+    size_t lncap = 0;
+    ssize_t len;
+    int rc = 0;
+    while (rc == 0 && (len = getline(&line, &lncap, fp)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (n == cap) {
+            size_t ncap = cap ? cap * 2 : 256;
+            char **tmp = realloc(lines, ncap * sizeof(char *));
+            if (!tmp) { rc = -1; break; }
+            lines = tmp;
+            cap = ncap;
+        }
+        if (!(lines[n] = dupstr(line))) rc = -1;
+        else n++;
+    }
+    free(line);
+    if (rc == 0 && n == 0) {
+        lines = malloc(sizeof(char *));
+        if (!lines || !(lines[0] = dupstr(""))) rc = -1;
+        else n = 1;
+    }
+    if (rc != 0) {
+        free_lines(lines, n);
+        return -1;
+    }
+    *out = lines;
+    *nout = n;
+    return 0;
+}
+
+// The file as committed at HEAD, or -1 if git does not have it
+static int base_from_git(const char *path, char ***out, size_t *nout) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else if (slash == path) snprintf(dir, sizeof(dir), "/");
+    else snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    char spec[PATH_MAX + 8];
+    snprintf(spec, sizeof(spec), "HEAD:./%s", name);
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        dup2(fds[1], STDOUT_FILENO);
+        execlp("git", "git", "-C", dir, "show", spec, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    int rc = -1;
+    FILE *fp = fdopen(fds[0], "r");
+    if (fp) {
+        rc = read_lines(fp, out, nout);
+        fclose(fp);
+    } else {
+        close(fds[0]);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    if (rc == 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+        free_lines(*out, *nout);
+        rc = -1;
+    }
+    return rc;
+}
+
+// The file as saved on disk
+static int base_from_file(const char *path, char ***out, size_t *nout) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    int rc = read_lines(fp, out, nout);
+    fclose(fp);
+    return rc;
+}
+
+// ---- worker thread -------------------------------------------------------
+
+static void run_job(ChangeWorker *w) {
+    if (w->path) {
+        char **lines = NULL;
+        size_t n = 0;
+        if (base_from_git(w->path, &lines, &n) != 0 &&
+            base_from_file(w->path, &lines, &n) != 0) {
+            // Nothing to compare with: the buffer is its own base
+            lines = malloc((w->nsnap ? w->nsnap : 1) * sizeof(char *));
+            for (n = 0; lines && n < w->nsnap; n++) lines[n] = dupstr(w->snap[n]);
+        }
+        free_lines(w->base, w->nbase);
+        w->base = lines;
+        w->nbase = lines ? n : 0;
+        w->base_lo = 0;
+        w->base_hi = w->nbase;
+        free(w->path);
+        w->path = NULL;
+    }
+
+    size_t blo = w->base_lo < w->nbase ? w->base_lo : w->nbase;
+    size_t bhi = w->base_hi < w->nbase ? w->base_hi : w->nbase;
+    if (bhi < blo) bhi = blo;
+    DiffHunk *out;
+    size_t n = diff_lines(w->base + blo, bhi - blo, w->snap, w->nsnap, &out);
+    if (n == (size_t)-1) {
+        // Out of memory: the whole range shows as changed
+        n = 0;
+        if ((out = malloc(sizeof(DiffHunk))) != NULL) {
+            out[0] = (DiffHunk){ 0, bhi - blo, 0, w->nsnap };
+            n = 1;
+        }
+    }
+    for (size_t k = 0; k < n; k++) out[k].a_start += blo;
+
+    free(w->snap);
+    free(w->snap_text);
+    w->snap = NULL;
+    w->snap_text = NULL;
+    w->out = out;
+    w->nout = n;
+    w->base_count = w->nbase;
+}
+
+static void *worker_main(void *arg) {
+    ChangeWorker *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->queued && !w->quit) pthread_cond_wait(&w->cond, &w->lock);
+        if (w->quit) break;
+        w->queued = 0;
+        pthread_mutex_unlock(&w->lock);
+        run_job(w);
+        pthread_mutex_lock(&w->lock);
+        w->done = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// ---- main thread ---------------------------------------------------------
+
+void changes_init(ChangeSigns *cs) {
+    memset(cs, 0, sizeof(*cs));
+}
+
+void changes_free(ChangeSigns *cs) {
+    ChangeWorker *w = cs->worker;
+    if (w) {
+        pthread_mutex_lock(&w->lock);
+        w->quit = 1;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        free(w->path);
+        free(w->snap);
+        free(w->snap_text);
+        free(w->out);
+        free_lines(w->base, w->nbase);
+        free(w);
+    }
+    free(cs->signs);
+    free(cs->hunks);
+    free(cs->open_path);
+    memset(cs, 0, sizeof(*cs));
+}
+
+static int worker_start(ChangeSigns *cs) {
+    ChangeWorker *w = calloc(1, sizeof(ChangeWorker));
+    if (!w) return -1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        free(w);
+        return -1;
+    }
+    cs->worker = w;
+    return 0;
+}
+
+// Grow or shrink the sign table to `count` lines; new lines get no sign
+static int signs_resize(ChangeSigns *cs, size_t count) {
+    if (count > cs->cap) {
+        size_t ncap = cs->cap ? cs->cap : 256;
+        while (ncap < count) ncap *= 2;
+        unsigned char *tmp = realloc(cs->signs, ncap);
+        if (!tmp) return -1;
+        cs->signs = tmp;
+        cs->cap = ncap;
+    }
+    if (count > cs->count) memset(cs->signs + cs->count, CHANGE_NONE, count - cs->count);
+    cs->count = count;
+    return 0;
+}
+
+static void mark_dirty(ChangeSigns *cs, size_t lo, size_t hi) {
+    if (!cs->dirty) {
+        cs->dirty = 1;
+        cs->dirty_lo = lo;
+        cs->dirty_hi = hi;
+        return;
+    }
+    if (lo < cs->dirty_lo) cs->dirty_lo = lo;
+    if (hi > cs->dirty_hi) cs->dirty_hi = hi;
+}
+
+// Move the range [*lo, *hi) for an edit. Returns 1 if the edit overlaps
+// it, in which case the range grows to cover the edited lines as well.
+static int move_range(size_t *lo, size_t *hi, size_t first, size_t old_count, size_t new_count) {
+    if (first + old_count <= *lo) {
+        *lo = *lo - old_count + new_count;
+        *hi = *hi - old_count + new_count;
+        return 0;
+    }
+    if (first >= *hi) return 0;
+    size_t end = *hi > first + old_count ? *hi : first + old_count;
+    if (first < *lo) *lo = first;
+    *hi = end - old_count + new_count;
+    return 1;
+}
+
+void changes_reset(ChangeSigns *cs, size_t count) {
+    if (!cs->worker || signs_resize(cs, count) != 0) return;
+    cs->nhunks = 0;
+    cs->dirty = 1;
+    cs->dirty_lo = 0;
+    cs->dirty_hi = count;
+    if (cs->worker->busy) cs->worker->stale = 1;
+}
+
+void changes_open(ChangeSigns *cs, const char *path, size_t count) {
+    if (!cs->worker && worker_start(cs) != 0) return;
+    free(cs->open_path);
+    cs->open_path = dupstr(path);
+    changes_reset(cs, count);
+}
+
+void changes_edit(ChangeSigns *cs, size_t first, size_t old_count, size_t new_count) {
+    if (!cs->worker) return;
+    if (first > cs->count) first = cs->count;
+    if (old_count > cs->count - first) old_count = cs->count - first;
+    size_t count = cs->count - old_count + new_count;
+
+    // Shift the signs below the edit. Until the diff comes back, edited
+    // lines show as modified and extra lines as added.
+    size_t tail = cs->count - first - old_count;
+    if (new_count > old_count && signs_resize(cs, count) != 0) {
+        changes_reset(cs, cs->count);
+        return;
+    }
+    memmove(cs->signs + first + new_count, cs->signs + first + old_count, tail);
+    for (size_t i = first; i < first + new_count; i++) {
+        if (i >= first + old_count) cs->signs[i] = CHANGE_ADDED;
+        else if (cs->signs[i] == CHANGE_NONE || cs->signs[i] == CHANGE_DELETED)
+            cs->signs[i] = CHANGE_MODIFIED;
+    }
+    cs->count = count;
+
+    // The dirty range moves first: everything marked below is already in
+    // post-edit lines. Hunks below move; hunks the edit cuts into are
+    // diffed again.
+    if (cs->dirty) move_range(&cs->dirty_lo, &cs->dirty_hi, first, old_count, new_count);
+    size_t keep = 0;
+    for (size_t k = 0; k < cs->nhunks; k++) {
+        DiffHunk h = cs->hunks[k];
+        size_t end = h.b_start + h.b_count;
+        if (h.b_start >= first + old_count) {
+            h.b_start = h.b_start - old_count + new_count;
+        } else if (end > first) {
+            size_t lo = h.b_start < first ? h.b_start : first;
+            size_t hi = end > first + old_count ? end : first + old_count;
+            mark_dirty(cs, lo, hi - old_count + new_count);
+            continue;
+        }
+        cs->hunks[keep++] = h;
+    }
+    cs->nhunks = keep;
+    mark_dirty(cs, first, first + new_count);
+
+    ChangeWorker *w = cs->worker;
+    if (w->busy && move_range(&w->lo, &w->hi, first, old_count, new_count)) {
+        w->stale = 1;
+        mark_dirty(cs, w->lo, w->hi);
+    }
+}
+
+// Signs for lines [lo, hi] from the hunks at hunks[k0, k1). A deletion
+// marks the line below the deleted lines (the last line at the end).
+static void paint(ChangeSigns *cs, size_t lo, size_t hi, size_t k0, size_t k1) {
+    if (cs->count == 0) return;
+    size_t end = hi < cs->count ? hi + 1 : cs->count;
+    if (lo < end) memset(cs->signs + lo, CHANGE_NONE, end - lo);
+    for (size_t k = k0; k < k1; k++) {
+        const DiffHunk *h = &cs->hunks[k];
+        if (h->b_count > 0) {
+            int sign = h->a_count ? CHANGE_MODIFIED : CHANGE_ADDED;
+            for (size_t i = h->b_start; i < h->b_start + h->b_count && i < cs->count; i++)
+                cs->signs[i] = (unsigned char)sign;
+        } else {
+            size_t i = h->b_start < cs->count ? h->b_start : cs->count - 1;
+            if (cs->signs[i] == CHANGE_NONE) cs->signs[i] = CHANGE_DELETED;
+        }
+    }
+    // A deletion at the end of the file marks the last line, which may
+    // lie in this range while the hunk does not
+    if (cs->nhunks > 0 && cs->hunks[cs->nhunks - 1].b_count == 0 &&
+        cs->hunks[cs->nhunks - 1].b_start >= cs->count &&
+        cs->signs[cs->count - 1] == CHANGE_NONE)
+        cs->signs[cs->count - 1] = CHANGE_DELETED;
+}
+
+static void take_result(ChangeSigns *cs) {
+    ChangeWorker *w = cs->worker;
+    DiffHunk *out = w->out;
+    size_t n = w->nout;
+    w->out = NULL;
+    w->nout = 0;
+    cs->base_count = w->base_count;
+
+    if (w->stale) {
+        free(out);
+        return;
+    }
+
+    if (cs->nhunks + n > cs->hcap) {
+        size_t ncap = cs->hcap ? cs->hcap : 64;
+        while (ncap < cs->nhunks + n) ncap *= 2;
+        DiffHunk *tmp = realloc(cs->hunks, ncap * sizeof(DiffHunk));
+        if (!tmp) {
+            free(out);
+            mark_dirty(cs, w->lo, w->hi);
+            return;
+        }
+        cs->hunks = tmp;
+        cs->hcap = ncap;
+    }
+    // The region's hunks go between the ones above and below it
+    size_t at = 0;
+    while (at < cs->nhunks && cs->hunks[at].b_start < w->lo) at++;
+    if (n > 0)
+        memmove(cs->hunks + at + n, cs->hunks + at, (cs->nhunks - at) * sizeof(DiffHunk));
+    for (size_t k = 0; k < n; k++) {
+        cs->hunks[at + k] = out[k];
+        cs->hunks[at + k].b_start += w->lo;
+    }
+    cs->nhunks += n;
+    free(out);
+    paint(cs, w->lo, w->hi, at, at + n);
+}
+
+static void start_job(ChangeSigns *cs, char *const *lines, size_t count) {
+    ChangeWorker *w = cs->worker;
+    if (cs->count != count || cs->open_path) {
+        // A full diff: after a (re)load, or if the line count drifted
+        if (cs->count != count && signs_resize(cs, count) != 0) return;
+        cs->nhunks = 0;
+        cs->dirty_lo = 0;
+        cs->dirty_hi = count;
+    }
+    size_t lo = cs->dirty_lo, hi = cs->dirty_hi < count ? cs->dirty_hi : count;
+    if (lo > hi) lo = hi;
+
+    // Take in the hunks the range touches; they are diffed again with it
+    size_t i = 0;
+    while (i < cs->nhunks && cs->hunks[i].b_start + cs->hunks[i].b_count < lo) i++;
+    size_t j = i;
+    for (; j < cs->nhunks && cs->hunks[j].b_start <= hi; j++) {
+        size_t end = cs->hunks[j].b_start + cs->hunks[j].b_count;
+        if (cs->hunks[j].b_start < lo) lo = cs->hunks[j].b_start;
+        if (end > hi) hi = end < count ? end : count;
+    }
+
+    // Outside any hunk, buffer and base lines differ by a fixed offset:
+    // the one left by the hunk above, and the one before the hunk below
+    long long base_lo = (long long)lo, base_hi;
+    if (i > 0) {
+        const DiffHunk *h = &cs->hunks[i - 1];
+        base_lo += (long long)(h->a_start + h->a_count) - (long long)(h->b_start + h->b_count);
+    }
+    if (j < cs->nhunks)
+        base_hi = (long long)hi + (long long)cs->hunks[j].a_start - (long long)cs->hunks[j].b_start;
+    else
+        base_hi = (long long)cs->base_count - (long long)(count - hi);
+    if (base_lo < 0) base_lo = 0;
+    if (base_hi < base_lo) base_hi = base_lo;
+
+    size_t bytes = 0;
+    for (size_t k = lo; k < hi; k++) bytes += strlen(lines[k]) + 1;
+    char **snap = malloc((hi - lo + 1) * sizeof(char *));
+    char *text = malloc(bytes + 1);
+    if (!snap || !text) {
+        free(snap);
+        free(text);
+        return;
+    }
+    char *p = text;
+    for (size_t k = lo; k < hi; k++) {
+        size_t len = strlen(lines[k]) + 1;
+        memcpy(p, lines[k], len);
+        snap[k - lo] = p;
+        p += len;
+    }
+
+    if (j > i) {
+        memmove(cs->hunks + i, cs->hunks + j, (cs->nhunks - j) * sizeof(DiffHunk));
+        cs->nhunks -= j - i;
+    }
+    cs->dirty = 0;
+
+    w->snap = snap;
+    w->snap_text = text;
+    w->nsnap = hi - lo;
+    w->base_lo = (size_t)base_lo;
+    w->base_hi = (size_t)base_hi;
+    w->path = cs->open_path;
+    cs->open_path = NULL;
+    w->lo = lo;
+    w->hi = hi;
+    w->stale = 0;
+    w->busy = 1;
+
+    pthread_mutex_lock(&w->lock);
+    w->queued = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int changes_poll(ChangeSigns *cs, char *const *lines, size_t count) {
+    ChangeWorker *w = cs->worker;
+    if (!w) return 0;
+    if (w->busy) {
+        pthread_mutex_lock(&w->lock);
+        int done = w->done;
+        w->done = 0;
+        pthread_mutex_unlock(&w->lock);
+        if (!done) return 1;
+        w->busy = 0;
+        take_result(cs);
+    }
+    if (!cs->dirty && !cs->open_path) return 0;
+    start_job(cs, lines, count);
+    return 1;
+}
+
+int changes_sign_at(const ChangeSigns *cs, size_t line) {
+    return line < cs->count ? cs->signs[line] : CHANGE_NONE;
+}
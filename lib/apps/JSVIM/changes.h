@@ -0,0 +1,62 @@
+// changes.h - Change signs in the gutter: the buffer against git HEAD
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include <stddef.h>
+#include "diff.h"
+
+// One per buffer line
+enum { CHANGE_NONE, CHANGE_ADDED, CHANGE_MODIFIED, CHANGE_DELETED };
+
+// Background diff thread (see changes.c)
+typedef struct ChangeWorker ChangeWorker;
+
+// The change signs of a buffer. The base text - the file at git HEAD, or
+// as saved when git does not know it - lives on a worker thread, which
+// diffs it against copies of buffer lines. The hunks that come back are
+// kept here: an edit moves the hunks below it and marks its own lines
+// dirty, and the next job diffs only the dirty lines (grown to take in
+// the hunks they touch) against the base lines they line up with.
+// `signs` has one CHANGE_* per buffer line, so drawing is a lookup.
+typedef struct {
+    unsigned char *signs;
+    size_t count;                // buffer lines signs covers
+    size_t cap;
+
+    DiffHunk *hunks;             // a = base lines, b = buffer lines, ascending
+    size_t nhunks;
+    size_t hcap;
+    size_t base_count;
+
+    int dirty;
+    size_t dirty_lo, dirty_hi;   // buffer lines to diff again
+    char *open_path;             // the next job reloads the base from here
+
+    ChangeWorker *worker;        // NULL until changes_open
+} ChangeSigns;
+
+void changes_init(ChangeSigns *cs);
+
+// Stop the worker and forget everything
+void changes_free(ChangeSigns *cs);
+
+// (Re)load the base for `path` on the worker and diff the whole buffer
+// of `count` lines against it. Call after loading and after saving.
+void changes_open(ChangeSigns *cs, const char *path, size_t count);
+
+// The buffer was replaced without line-by-line reports (crash recovery):
+// diff all `count` lines against the base again
+void changes_reset(ChangeSigns *cs, size_t count);
+
+// Lines [first, first + old_count) are being replaced by new_count lines.
+// Call before the buffer changes, like the other per-line indexes.
+void changes_edit(ChangeSigns *cs, size_t first, size_t old_count, size_t new_count);
+
+// Take in a finished diff and start the next one. Returns 1 while a job
+// is running or lines are waiting to be diffed.
+int changes_poll(ChangeSigns *cs, char *const *lines, size_t count);
+
+// CHANGE_* for a buffer line
+int changes_sign_at(const ChangeSigns *cs, size_t line);
+
+#endif
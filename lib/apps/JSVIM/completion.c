@@ -0,0 +1,162 @@
+// completion.c - LSP completion list: cached per word, filtered locally
+#include "completion.h"
+#include "cJSON.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void completion_clear(LspCompletion *c) {
+    free(c->items);
+    free(c->text);
+    free(c->shown);
+    memset(c, 0, sizeof(*c));
+}
+
+static const char *json_str(const cJSON *obj, const char *key) {
+    const cJSON *v = cJSON_GetObjectItemCaseSensitive(obj, key);
+    return cJSON_IsString(v) && v->valuestring ? v->valuestring : NULL;
+}
+
+// clangd starts labels with a space, or a bullet when picking the item
+// would add an #include
+static const char *trim_label(const char *s) {
+    for (;;) {
+        if (*s == ' ') s++;
+        else if (strncmp(s, "\xE2\x80\xA2", 3) == 0) s += 3;
+        else return s;
+    }
+}
+
+// The four strings of one item, with their fallbacks
+static void item_strings(const cJSON *it, const char *out[4]) {
+    const char *label = json_str(it, "label");
+    const cJSON *edit = cJSON_GetObjectItemCaseSensitive(it, "textEdit");
+    const char *insert = edit ? json_str(edit, "newText") : NULL;
+    if (!insert) insert = json_str(it, "insertText");
+    const char *filter = json_str(it, "filterText");
+    const char *sort = json_str(it, "sortText");
+
+    label = label ? trim_label(label) : "";
+    out[0] = label;
+    out[1] = insert ? insert : label;
+    out[2] = filter ? filter : label;
+    out[3] = sort ? sort : label;
+}
+
+// Server order. Strings sit in the text block in arrival order, so
+// their addresses break ties and keep the sort stable.
+static int cmp_item(const void *a, const void *b) {
+    const CompletionItem *x = a, *y = b;
+    int r = strcmp(x->sort, y->sort);
+    if (r) return r;
+    return x->sort < y->sort ? -1 : 1;
+}
+
+void completion_take_result(LspCompletion *c, const cJSON *result) {
+    free(c->items);
+    free(c->text);
+    free(c->shown);
+    c->items = NULL;
+    c->text = NULL;
+    c->shown = NULL;
+    c->count = c->shown_count = 0;
+    c->sel = c->top = 0;
+    c->pending_id = 0;
+    c->have_list = 0;
+    c->incomplete = 0;
+
+    const cJSON *arr = result;
+    if (cJSON_IsObject(result)) {
+        arr = cJSON_GetObjectItemCaseSensitive(result, "items");
+        c->incomplete = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(result, "isIncomplete"));
+    }
+    if (!cJSON_IsArray(arr)) return;
+
+    int n = cJSON_GetArraySize(arr);
+    if (n > COMPLETION_MAX_ITEMS) n = COMPLETION_MAX_ITEMS;
+
+    // One pass to size the string block, one to fill it
+    size_t total = 0;
+    const cJSON *it;
+    int i = 0;
+    cJSON_ArrayForEach(it, arr) {
+        if (i++ == n) break;
+        const char *s[4];
+        item_strings(it, s);
+        for (int k = 0; k < 4; k++) total += strlen(s[k]) + 1;
+    }
+
+    CompletionItem *items = calloc((size_t)n + 1, sizeof(CompletionItem));
+    char *text = malloc(total + 1);
+    c->shown = malloc(((size_t)n + 1) * sizeof(size_t));
+    if (!items || !text || !c->shown) {
+        free(items);
+        free(text);
+        free(c->shown);
+        c->shown = NULL;
+        return;
+    }
+
+    char *p = text;
+    i = 0;
+    cJSON_ArrayForEach(it, arr) {
+        if (i == n) break;
+        const char *s[4];
+        const char **dst[4] = { &items[i].label, &items[i].insert,
+                                &items[i].filter, &items[i].sort };
+        item_strings(it, s);
+        for (int k = 0; k < 4; k++) {
+            size_t len = strlen(s[k]);
+            memcpy(p, s[k], len + 1);
+            *dst[k] = p;
+            p += len + 1;
+        }
+        const cJSON *kind = cJSON_GetObjectItemCaseSensitive(it, "kind");
+        items[i].kind = cJSON_IsNumber(kind) ? kind->valueint : 0;
+        i++;
+    }
+
+    // Sorted once here, so filtering keeps the order for free
+    qsort(items, (size_t)n, sizeof(CompletionItem), cmp_item);
+
+    c->items = items;
+    c->text = text;
+    c->count = (size_t)n;
+    c->have_list = 1;
+    c->fresh = 1;
+}
+
+void completion_filter(LspCompletion *c, const char *word, size_t len) {
+    c->shown_count = 0;
+    c->sel = c->top = 0;
+    if (!c->have_list) return;
+
+    // Exact-case prefix matches, then the rest of the case-insensitive ones
+    for (size_t i = 0; i < c->count; i++)
+        if (strncmp(c->items[i].filter, word, len) == 0)
+            c->shown[c->shown_count++] = i;
+    for (size_t i = 0; i < c->count; i++)
+        if (strncmp(c->items[i].filter, word, len) != 0 &&
+            strncasecmp(c->items[i].filter, word, len) == 0)
+            c->shown[c->shown_count++] = i;
+}
+
+void completion_move(LspCompletion *c, long d) {
+    if (c->shown_count == 0) return;
+    long n = (long)c->shown_count;
+    long s = ((long)c->sel + d) % n;
+    if (s < 0) s += n;
+    c->sel = (size_t)s;
+    if (c->sel < c->top) c->top = c->sel;
+    if (c->sel >= c->top + COMPLETION_ROWS) c->top = c->sel - COMPLETION_ROWS + 1;
+}
+
+const char *completion_kind_tag(int kind) {
+    static const char *tags[] = {
+        "", "text", "meth", "fn", "ctor", "field", "var", "class", "iface",
+        "mod", "prop", "unit", "val", "enum", "kw", "snip", "color", "file",
+        "ref", "dir", "enum", "const", "struct", "event", "op", "type",
+    };
+    if (kind < 0 || kind >= (int)(sizeof(tags) / sizeof(tags[0]))) return "";
+    return tags[kind];
+}
@@ -0,0 +1,61 @@
+// completion.h - LSP completion list: cached per word, filtered locally
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stddef.h>
+
+#define COMPLETION_MAX_ITEMS 1000    // kept from one response
+#define COMPLETION_ROWS 8            // popup height
+#define COMPLETION_MIN_WORD 2        // identifier length that asks the server
+
+struct cJSON;
+
+typedef struct {
+    const char *label;           // shown in the popup
+    const char *insert;          // replaces the typed word when accepted
+    const char *filter;          // matched against the typed word
+    const char *sort;            // server's order (sortText)
+    int kind;                    // LSP CompletionItemKind, 0 if none
+} CompletionItem;
+
+// The completion state of a buffer. A request is sent once for the
+// position where a word starts (line, col); the items that come back are
+// kept and re-filtered against the word as it is typed, so the server is
+// asked again only for a new word, or when it said the list was
+// incomplete. Plain memory only, so buf_init/buf_free handle it.
+typedef struct {
+    int pending_id;              // request in flight, 0 = none
+    size_t line, col;            // word start the request and list are for
+    size_t asked;                // length of the word when it was sent
+    int have_list;
+    int incomplete;              // server wants a new request as the word grows
+    int fresh;                   // a list arrived and has not been filtered yet
+    int dismissed;               // Esc closed the popup for this word
+
+    CompletionItem *items;       // in the server's order
+    size_t count;
+    char *text;                  // every string of items, one allocation
+
+    size_t *shown;               // indexes into items that match the word
+    size_t shown_count;
+    size_t sel, top;             // selected row, first row on screen
+} LspCompletion;
+
+// Forget the list and the request (the caller cancels the request)
+void completion_clear(LspCompletion *c);
+
+// Keep a textDocument/completion result: CompletionItem[] or
+// CompletionList. NULL (an error, e.g. after $/cancelRequest) clears.
+void completion_take_result(LspCompletion *c, const struct cJSON *result);
+
+// Show the items whose filter text starts with word (case-insensitive),
+// exact-case matches first, each group in the server's order
+void completion_filter(LspCompletion *c, const char *word, size_t len);
+
+// Move the selection by d rows, wrapping, and keep it on screen
+void completion_move(LspCompletion *c, long d);
+
+// Short tag for a CompletionItemKind ("fn", "var", ...)
+const char *completion_kind_tag(int kind);
+
+#endif
@@ -0,0 +1,168 @@
+// diff.c - Line diff between two versions of a buffer
+#include "diff.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t line_hash(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+typedef struct {
+    char *const *a, *const *b;
+    const uint64_t *ha, *hb;
+} Lines;
+
+static int same(const Lines *l, size_t i, size_t j) {
+    return l->ha[i] == l->hb[j] && strcmp(l->a[i], l->b[j]) == 0;
+}
+
+static int push_hunk(DiffHunk **out, size_t *n, size_t *cap, DiffHunk h) {
+    if (*n == *cap) {
+        size_t ncap = *cap ? *cap * 2 : 8;
+        DiffHunk *tmp = realloc(*out, ncap * sizeof(DiffHunk));
+        if (!tmp) return -1;
+        *out = tmp;
+        *cap = ncap;
+    }
+    (*out)[(*n)++] = h;
+    return 0;
+}
+
+// Myers over a[0..n) and b[0..m), none of which share a first or last
+// line. Marks deleted lines of a in del[] and inserted lines of b in ins[].
+// Returns 1 if the edit distance is over DIFF_MAX_EDITS, -1 on OOM.
+static int myers(const Lines *l, size_t n, size_t m, char *del, char *ins) {
+    long max = (long)(n + m < DIFF_MAX_EDITS ? n + m : DIFF_MAX_EDITS);
+    long off = max + 1;
+    long *v = calloc((size_t)(2 * max + 3), sizeof(long));
+    if (!v) return -1;
+
+    // trace holds V[-d..d] as it was after round d, at trace[d * d]
+    size_t trace_cap = 64;
+    long *trace = malloc(trace_cap * sizeof(long));
+    if (!trace) {
+        free(v);
+        return -1;
+    }
+
+    long d, found = -1;
+    for (d = 0; d <= max && found < 0; d++) {
+        for (long k = -d; k <= d; k += 2) {
+            long x;
+            if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1]))
+                x = v[off + k + 1];
+            else
+                x = v[off + k - 1] + 1;
+            long y = x - k;
+            while ((size_t)x < n && (size_t)y < m && same(l, (size_t)x, (size_t)y)) {
+                x++;
+                y++;
+            }
+            v[off + k] = x;
+            if ((size_t)x >= n && (size_t)y >= m) {
+                found = d;
+                break;
+            }
+        }
+        size_t need = (size_t)((d + 1) * (d + 1));
+        if (need > trace_cap) {
+            while (trace_cap < need) trace_cap *= 2;
+            long *tmp = realloc(trace, trace_cap * sizeof(long));
+            if (!tmp) {
+                free(trace);
+                free(v);
+                return -1;
+            }
+            trace = tmp;
+        }
+        memcpy(trace + d * d, v + off - d, (size_t)(2 * d + 1) * sizeof(long));
+    }
+    free(v);
+    if (found < 0) {
+        free(trace);
+        return 1;
+    }
+
+    // Walk back from (n, m): each round contributes one insert or delete
+    // plus the diagonal run that followed it
+    long x = (long)n, y = (long)m;
+    for (d = found; d > 0; d--) {
+        const long *pv = trace + (d - 1) * (d - 1) + (d - 1);  // pv[k] = V[k] after d-1
+        long k = x - y;
+        long pk = (k == -d || (k != d && pv[k - 1] < pv[k + 1])) ? k + 1 : k - 1;
+        long px = pv[pk], py = px - pk;
+        if (pk == k + 1) ins[py] = 1;   // moved down: b[py] inserted
+        else del[px] = 1;               // moved right: a[px] deleted
+        x = px;
+        y = py;
+    }
+    free(trace);
+    return 0;
+}
+
+size_t diff_lines(char *const *a, size_t na, char *const *b, size_t nb,
+                  DiffHunk **out) {
+    *out = NULL;
+    size_t pre = 0;
+    while (pre < na && pre < nb && strcmp(a[pre], b[pre]) == 0) pre++;
+    size_t suf = 0;
+    while (suf < na - pre && suf < nb - pre &&
+           strcmp(a[na - 1 - suf], b[nb - 1 - suf]) == 0)
+        suf++;
+
+    size_t n = na - pre - suf, m = nb - pre - suf;
+    size_t count = 0, cap = 0;
+    if (n == 0 && m == 0) return 0;
+
+    DiffHunk whole = { pre, n, pre, m };
+    if (n == 0 || m == 0) {
+        if (push_hunk(out, &count, &cap, whole) != 0) return (size_t)-1;
+        return count;
+    }
+
+    uint64_t *ha = malloc(n * sizeof(uint64_t));
+    uint64_t *hb = malloc(m * sizeof(uint64_t));
+    char *del = calloc(n, 1), *ins = calloc(m, 1);
+    int rc = -1;
+    if (ha && hb && del && ins) {
+        for (size_t i = 0; i < n; i++) ha[i] = line_hash(a[pre + i]);
+        for (size_t j = 0; j < m; j++) hb[j] = line_hash(b[pre + j]);
+        Lines l = { a + pre, b + pre, ha, hb };
+        rc = myers(&l, n, m, del, ins);
+    }
+    free(ha);
+    free(hb);
+
+    if (rc == 1) {
+        rc = push_hunk(out, &count, &cap, whole);
+    } else if (rc == 0) {
+        // Unchanged lines pair up in order, so a run of deletions and
+        // insertions between two of them is one hunk
+        size_t i = 0, j = 0;
+        while (rc == 0 && (i < n || j < m)) {
+            if ((i < n && del[i]) || (j < m && ins[j])) {
+                DiffHunk h = { pre + i, 0, pre + j, 0 };
+                while (i < n && del[i]) i++, h.a_count++;
+                while (j < m && ins[j]) j++, h.b_count++;
+                rc = push_hunk(out, &count, &cap, h);
+            } else {
+                i++;
+                j++;
+            }
+        }
+    }
+    free(del);
+    free(ins);
+    if (rc != 0) {
+        free(*out);
+        *out = NULL;
+        return (size_t)-1;
+    }
+    return count;
+}
@@ -0,0 +1,25 @@
+// diff.h - Line diff between two versions of a buffer
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+
+// Past this many inserted + deleted lines the search gives up and the
+// whole region between the common prefix and suffix becomes one hunk
+#define DIFF_MAX_EDITS 1000
+
+// Lines [a_start, a_start + a_count) of the old version were replaced by
+// lines [b_start, b_start + b_count) of the new one. Either count may be 0.
+typedef struct {
+    size_t a_start, a_count;
+    size_t b_start, b_count;
+} DiffHunk;
+
+// Diff a[0..na) against b[0..nb) (Myers' O(ND) algorithm after trimming
+// the common prefix and suffix). *out gets the hunks in ascending order,
+// to be freed by the caller. Returns the hunk count, or (size_t)-1 if out
+// of memory.
+size_t diff_lines(char *const *a, size_t na, char *const *b, size_t nb,
+                  DiffHunk **out);
+
+#endif
@@ -6,14 +6,20 @@
 #include "highlight.h"
 #include "util.h"
 #include "render.h"
+#include "profile.h"
+#include "diff.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
 
 #define JSVIM_CONFIG_FILE ".jsvimrc"
 #define DEFAULT_TAB_WIDTH 4
@@ -22,8 +28,15 @@
 // didChange + semantic-tokens request to the LSP server. Keeps fast typing
 // from queuing many full-file syncs back-to-back.
 #define LSP_DEBOUNCE_MS 400
+// Most LSP output read per main-loop tick; the rest waits a tick
+#define LSP_READ_MAX_PER_FRAME (1u << 20)
 // LSP_SEMTOK_MAX_LINES is defined in lsp.h and shared with the init handler.
 
+// In large-file mode, a paste or :s touching more text than this is
+// applied without an undo record (and clears the history), instead of
+// keeping a second copy of everything it replaced.
+#define LARGE_FILE_UNDO_MAX (1 << 20)
+
 // Static indent string buffer for tab/spaces
 static char s_indent_str[32] = "    ";  // default 4 spaces
 
@@ -136,6 +149,26 @@ void editor_init(EditorState *ed) {
     ed->history.index = 0;
     ed->last_edit_time_ms = 0;
     ed->has_last_edit_time = 0;
+
+    search_init(&ed->search);
+
+    ed->grep = NULL;
+    quickfix_init(&ed->qf);
+    finder_init(&ed->finder);
+    ed->message[0] = '\0';
+
+    ed->large_file_bytes = (long long)LARGE_FILE_MB_DEFAULT << 20;
+    ed->large_file_lines = LARGE_FILE_LINES_DEFAULT;
+    ed->large_file = 0;
+
+    journal_init(&ed->journal);
+    ed->pending_recover_prompt = 0;
+    watch_init(&ed->watch);
+    brackets_init(&ed->brackets);
+    folds_init(&ed->folds);
+    words_init(&ed->words);
+    ed->completion.active = 0;
+    changes_init(&ed->changes);
 }
 
 void editor_load_config(EditorState *ed) {
@@ -186,6 +219,12 @@ void editor_load_config(EditorState *ed) {
             if (timeout_val > 0) {
                 ed->edit_group_timeout = timeout_val;
             }
+        } else if (strcmp(key, "editor.large_file_mb") == 0) {
+            long long mb = atoll(value);
+            if (mb >= 0) ed->large_file_bytes = mb << 20;
+        } else if (strcmp(key, "editor.large_file_lines") == 0) {
+            long long n = atoll(value);
+            if (n >= 0) ed->large_file_lines = (size_t)n;
         }
     }
 
@@ -244,8 +283,64 @@ static int line_ends_with_colon(const char *line) {
     return line[i] == ':';
 }
 
+static int filetype_c_like(FileType ft) {
+    switch (ft) {
+        case FT_C:
+        case FT_CPP:
+        case FT_JAVA:
+        case FT_JS:
+        case FT_TS:
+        case FT_RUST:
+        case FT_GO:
+        case FT_JSON:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Indent for a new line at the cursor, from the innermost bracket still
+// open there: one level past the opener's line for '{' or an opener that
+// ends its line, else lined up with the text after an open '(' or '['.
+// NULL outside any bracket.
+static char *bracket_indent(EditorState *ed) {
+    Buffer *buf = &ed->buf;
+    size_t ol, oc;
+    if (!brackets_enclosing(&ed->brackets, buf, ed->cursor_line, ed->cursor_col,
+                            "({[", &ol, &oc))
+        return NULL;
+    const char *oline = buf->lines[ol];
+    size_t ind = 0;
+    while (oline[ind] == ' ' || oline[ind] == '\t') ind++;
+    size_t text = oc + 1;
+    while (oline[text] == ' ' || oline[text] == '\t') text++;
+
+    char *result;
+    if (oline[oc] != '{' && oline[text]) {
+        // The opener line's own indent (tabs and all), then spaces
+        result = malloc(text + 1);
+        if (!result) return NULL;
+        memcpy(result, oline, ind);
+        memset(result + ind, ' ', text - ind);
+        result[text] = '\0';
+    } else {
+        const char *indent_str = editor_get_indent_str(ed);
+        size_t indent_len = strlen(indent_str);
+        result = malloc(ind + indent_len + 1);
+        if (!result) return NULL;
+        memcpy(result, oline, ind);
+        memcpy(result + ind, indent_str, indent_len + 1);
+    }
+    return result;
+}
+
 char *editor_auto_indent(EditorState *ed, const char *prev_line) {
     Buffer *buf = &ed->buf;
+    if (filetype_c_like(buf->ft)) {
+        char *indent = bracket_indent(ed);
+        if (indent) return indent;
+    }
+
     char *base_indent = editor_get_line_indent(prev_line);
     if (!base_indent) return dupstr("");
 
@@ -306,16 +401,34 @@ char *editor_auto_indent(EditorState *ed, const char *prev_line) {
     return base_indent;
 }
 
+static void undo_delta_free(UndoDelta *d) {
+    free(d->old_text);
+    free(d->new_text);
+    for (size_t i = 0; i < d->swap_count; i++)
+        free(d->swap_text[i]);
+    free(d->swap_lines);
+    free(d->swap_text);
+}
+
 void editor_cleanup(EditorState *ed) {
+    // Unsaved edits stay recoverable unless the user threw them away (q!)
+    journal_close(&ed->journal, !ed->modified || ed->force_quit);
+    watch_stop(&ed->watch);
+    brackets_free(&ed->brackets);
+    folds_clear(&ed->folds);
+    words_free(&ed->words);
+    changes_free(&ed->changes);
+    grep_free(ed->grep);
+    quickfix_clear(&ed->qf);
+    finder_free(&ed->finder);
     stop_lsp(&ed->buf.lsp);
     buf_free(&ed->buf);
+    search_free(&ed->search);
 
     for (size_t i = 0; i < ed->history.size; i++) {
         UndoEntry *e = &ed->history.entries[i];
-        for (size_t j = 0; j < e->count; j++) {
-            free(e->deltas[j].old_text);
-            free(e->deltas[j].new_text);
-        }
+        for (size_t j = 0; j < e->count; j++)
+            undo_delta_free(&e->deltas[j]);
         free(e->deltas);
     }
     free(ed->history.entries);
@@ -331,10 +444,8 @@ static void history_clear_from_index(UndoHistory *h, size_t index) {
     if (index >= h->size) return;
     for (size_t i = index; i < h->size; i++) {
         UndoEntry *e = &h->entries[i];
-        for (size_t j = 0; j < e->count; j++) {
-            free(e->deltas[j].old_text);
-            free(e->deltas[j].new_text);
-        }
+        for (size_t j = 0; j < e->count; j++)
+            undo_delta_free(&e->deltas[j]);
         free(e->deltas);
     }
     h->size = index;
@@ -393,6 +504,20 @@ static void history_append_delta(EditorState *ed, UndoDelta *delta) {
     ed->has_last_edit_time = 1;
 }
 
+static void show_cmd_message(EditorState *ed, const char *msg);
+
+// Large-file mode: whether an edit replacing or inserting `bytes` of text
+// goes without an undo record. Older entries would then describe a buffer
+// that no longer exists, so the whole history is dropped.
+static int large_edit_skips_undo(EditorState *ed, size_t bytes) {
+    if (!ed->large_file || bytes < LARGE_FILE_UNDO_MAX) return 0;
+    history_clear_from_index(&ed->history, 0);
+    ed->history.index = 0;
+    ed->has_last_edit_time = 0;
+    show_cmd_message(ed, "Large file: edit is not undoable");
+    return 1;
+}
+
 static char *collect_text_range(Buffer *buf,
                                 size_t start_line, size_t start_col,
                                 size_t end_line, size_t end_col) {
@@ -462,16 +587,13 @@ static void apply_text_replace(Buffer *buf,
         memcpy(merged, first, prefix_len);
         memcpy(merged + prefix_len, last + end_col, suffix_len + 1);
 
+        // Drop every line after the first in one shift
         free(first);
-        free(last);
-        for (size_t ln = start_line + 1; ln <= end_line; ln++) {
-            for (size_t i = ln; i + 1 < buf->count; i++) {
-                buf->lines[i] = buf->lines[i + 1];
-            }
-            buf->count--;
-            end_line--;
-            ln--;
-        }
+        for (size_t ln = start_line + 1; ln <= end_line; ln++)
+            free(buf->lines[ln]);
+        memmove(buf->lines + start_line + 1, buf->lines + end_line + 1,
+                (buf->count - end_line - 1) * sizeof(char*));
+        buf->count -= end_line - start_line;
         buf->lines[start_line] = merged;
     }
 
@@ -479,60 +601,90 @@ static void apply_text_replace(Buffer *buf,
     if (!new_text || !*new_text)
         return;
 
-    char *text_copy = dupstr(new_text);
-    if (!text_copy) return;
-
-    size_t current_line = start_line;
-    size_t insert_col = start_col;
-    char *seg_start = text_copy;
-    char *p = text_copy;
-    int first_segment = 1;
-
-    while (1) {
-        if (*p == '\n' || *p == '\0') {
-            size_t seg_len = (size_t)(p - seg_start);
-
-            if (first_segment) {
-                // First segment: either insert into existing line, or if empty and
-                // starting with a newline, begin on a new line instead.
-                if (seg_len > 0) {
-                    char *line = buf->lines[current_line];
-                    size_t line_len = strlen(line);
-                    if (insert_col > line_len) insert_col = line_len;
-                    char *tmp_seg = realloc(line, line_len + seg_len + 1);
-                    if (!tmp_seg) break;
-                    line = tmp_seg;
-                    memmove(line + insert_col + seg_len, line + insert_col,
-                            line_len - insert_col + 1);
-                    memcpy(line + insert_col, seg_start, seg_len);
-                    buf->lines[current_line] = line;
-                    insert_col += seg_len;
-                }
-                // If seg_len == 0 (i.e., text starts with '\n'), we just move to
-                // the next line on the next segment without modifying this line.
-                first_segment = 0;
-            } else {
-                // Subsequent segments always become their own lines
-                char *newline = malloc(seg_len + 1);
-                if (!newline) {
-                    break;
-                }
-                memcpy(newline, seg_start, seg_len);
-                newline[seg_len] = '\0';
-                buf_insert(buf, current_line + 1, newline);
-                current_line += 1;
-                insert_col = seg_len;
-            }
+    char *line = buf->lines[start_line];
+    size_t line_len = strlen(line);
+    if (start_col > line_len) start_col = line_len;
+
+    const char *nl = strchr(new_text, '\n');
+    if (!nl) {
+        // Single segment: splice into the existing line
+        size_t seg_len = strlen(new_text);
+        char *tmp_seg = realloc(line, line_len + seg_len + 1);
+        if (!tmp_seg) return;
+        line = tmp_seg;
+        memmove(line + start_col + seg_len, line + start_col, line_len - start_col + 1);
+        memcpy(line + start_col, new_text, seg_len);
+        buf->lines[start_line] = line;
+        return;
+    }
 
-            if (*p == '\0') {
-                break;
-            }
-            seg_start = p + 1;
+    // Multi-line: the first segment ends the start line, the rest of that
+    // line moves to the end of the last segment, and every new line goes
+    // in with a single buf_insert_lines splice.
+    size_t extra = 0;
+    for (const char *p = nl; p; p = strchr(p + 1, '\n')) extra++;
+
+    char **new_lines = malloc(extra * sizeof(char*));
+    if (!new_lines) return;
+
+    const char *tail = line + start_col;
+    size_t tail_len = line_len - start_col;
+    const char *seg = nl + 1;
+    for (size_t i = 0; i < extra; i++) {
+        const char *seg_end = strchr(seg, '\n');
+        size_t seg_len = seg_end ? (size_t)(seg_end - seg) : strlen(seg);
+        size_t add = (i + 1 == extra) ? tail_len : 0;
+        char *nline = malloc(seg_len + add + 1);
+        if (!nline) {
+            for (size_t j = 0; j < i; j++) free(new_lines[j]);
+            free(new_lines);
+            return;
         }
-        p++;
+        memcpy(nline, seg, seg_len);
+        memcpy(nline + seg_len, tail, add);
+        nline[seg_len + add] = '\0';
+        new_lines[i] = nline;
+        seg = seg_end ? seg_end + 1 : seg + seg_len;
+    }
+
+    size_t first_len = (size_t)(nl - new_text);
+    char *tmp_first = realloc(line, start_col + first_len + 1);
+    if (!tmp_first) {
+        for (size_t j = 0; j < extra; j++) free(new_lines[j]);
+        free(new_lines);
+        return;
     }
+    line = tmp_first;
+    memcpy(line + start_col, new_text, first_len);
+    line[start_col + first_len] = '\0';
+    buf->lines[start_line] = line;
 
-    free(text_copy);
+    buf_insert_lines(buf, start_line + 1, new_lines, extra);
+    free(new_lines);
+}
+
+// Lines [first, first + old_count) became new_count lines: move what is
+// kept per line (bracket index, folds, words) along with them
+static void note_lines(EditorState *ed, size_t first, size_t old_count, size_t new_count) {
+    brackets_edit(&ed->brackets, first, old_count, new_count);
+    folds_edit(&ed->folds, first, old_count, new_count);
+    words_edit(&ed->words, first, old_count, new_count);
+    changes_edit(&ed->changes, first, old_count, new_count);
+}
+
+// Every change to the buffer's text is reported through one of these two:
+// the journal records it and note_lines updates the per-line state
+static void note_replace(EditorState *ed, size_t start_line, size_t start_col,
+                         size_t end_line, size_t end_col, const char *text) {
+    journal_replace(&ed->journal, start_line, start_col, end_line, end_col, text);
+    size_t lines = 1;
+    for (const char *p = text; p && *p; p++) lines += *p == '\n';
+    note_lines(ed, start_line, end_line - start_line + 1, lines);
+}
+
+static void note_set_line(EditorState *ed, size_t line, const char *text) {
+    journal_set_line(&ed->journal, line, text);
+    note_lines(ed, line, 1, 1);
 }
 
 static void record_replace(EditorState *ed,
@@ -543,7 +695,13 @@ static void record_replace(EditorState *ed,
                            CursorPos cursor_after) {
     Buffer *buf = &ed->buf;
 
+    note_replace(ed, pre_start_line, pre_start_col,
+                 pre_end_line, pre_end_col, new_text);
+
     UndoDelta delta;
+    delta.swap_lines = NULL;
+    delta.swap_text = NULL;
+    delta.swap_count = 0;
     delta.pre_start_line = pre_start_line;
     delta.pre_start_col = pre_start_col;
     delta.pre_end_line = pre_end_line;
@@ -593,20 +751,56 @@ static void record_replace(EditorState *ed,
     history_append_delta(ed, &delta);
 }
 
+// Exchange the buffer lines named by a line-swap delta with the saved ones
+static void apply_line_swap(Buffer *buf, UndoDelta *d) {
+    for (size_t i = 0; i < d->swap_count; i++) {
+        size_t ln = d->swap_lines[i];
+        if (ln >= buf->count) continue;
+        char *tmp = buf->lines[ln];
+        buf->lines[ln] = d->swap_text[i];
+        d->swap_text[i] = tmp;
+    }
+}
+
+// Report the lines a line-swap delta just changed
+static void note_swapped_lines(EditorState *ed, const UndoDelta *d) {
+    for (size_t i = 0; i < d->swap_count; i++)
+        if (d->swap_lines[i] < ed->buf.count)
+            note_set_line(ed, d->swap_lines[i], ed->buf.lines[d->swap_lines[i]]);
+}
+
 static void apply_delta_forward(EditorState *ed, UndoDelta *d) {
+    if (d->swap_count) {
+        apply_line_swap(&ed->buf, d);
+        note_swapped_lines(ed, d);
+        ed->cursor_line = d->cursor_after.line;
+        ed->cursor_col = d->cursor_after.col;
+        return;
+    }
     apply_text_replace(&ed->buf,
                        d->pre_start_line, d->pre_start_col,
                        d->pre_end_line, d->pre_end_col,
                        d->new_text);
+    note_replace(ed, d->pre_start_line, d->pre_start_col,
+                 d->pre_end_line, d->pre_end_col, d->new_text);
     ed->cursor_line = d->cursor_after.line;
     ed->cursor_col = d->cursor_after.col;
 }
 
 static void apply_delta_backward(EditorState *ed, UndoDelta *d) {
+    if (d->swap_count) {
+        apply_line_swap(&ed->buf, d);
+        note_swapped_lines(ed, d);
+        ed->cursor_line = d->cursor_before.line;
+        ed->cursor_col = d->cursor_before.col;
+        return;
+    }
     apply_text_replace(&ed->buf,
                        d->post_start_line, d->post_start_col,
                        d->post_end_line, d->post_end_col,
                        d->old_text);
+    note_replace(ed, d->post_start_line, d->post_start_col,
+                 d->post_end_line, d->post_end_col, d->old_text);
     ed->cursor_line = d->cursor_before.line;
     ed->cursor_col = d->cursor_before.col;
 }
@@ -623,6 +817,7 @@ void editor_undo(EditorState *ed) {
 
     ed->modified = 1;
     ed->buf.lsp_dirty = 1;
+    search_invalidate_count(&ed->search);
 }
 
 void editor_redo(EditorState *ed) {
@@ -637,13 +832,964 @@ void editor_redo(EditorState *ed) {
 
     ed->modified = 1;
     ed->buf.lsp_dirty = 1;
+    search_invalidate_count(&ed->search);
+}
+
+long editor_substitute(EditorState *ed, size_t first, size_t last,
+                       const char *pattern, const char *repl, int global) {
+    Buffer *buf = &ed->buf;
+    if (buf->count == 0) return 0;
+    if (last >= buf->count) last = buf->count - 1;
+    if (first > last) return 0;
+
+    SearchState s;
+    search_init(&s);
+    if (search_set_pattern(&s, pattern) != 0 || !s.active) {
+        search_free(&s);
+        return -1;
+    }
+
+    // Single scan: build every replaced line before touching the buffer, so
+    // a failure part-way leaves it exactly as it was.
+    size_t cap = 64, count = 0, nsubs = 0;
+    size_t *lines = malloc(cap * sizeof(size_t));
+    char **text = malloc(cap * sizeof(char *));
+    int failed = (!lines || !text);
+    for (size_t ln = first; ln <= last && !failed; ln++) {
+        char *nl;
+        int r = search_replace_line(&s, buf->lines[ln], repl, global, &nl, &nsubs);
+        if (r < 0) failed = 1;
+        if (r <= 0) continue;
+        if (count == cap) {
+            cap *= 2;
+            size_t *nlines = realloc(lines, cap * sizeof(size_t));
+            if (nlines) lines = nlines;
+            char **ntext = realloc(text, cap * sizeof(char *));
+            if (ntext) text = ntext;
+            if (!nlines || !ntext) {
+                free(nl);
+                failed = 1;
+                break;
+            }
+        }
+        lines[count] = ln;
+        text[count] = nl;
+        count++;
+    }
+    search_free(&s);
+
+    if (failed || count == 0) {
+        for (size_t i = 0; i < count; i++) free(text[i]);
+        free(lines);
+        free(text);
+        return failed ? -2 : 0;
+    }
+
+    // Large file: swap the new lines in and free the old ones right away
+    // rather than keeping them for undo
+    size_t old_bytes = 0;
+    if (ed->large_file) {
+        for (size_t i = 0; i < count && old_bytes < LARGE_FILE_UNDO_MAX; i++)
+            old_bytes += strlen(buf->lines[lines[i]]) + 1;
+    }
+    if (large_edit_skips_undo(ed, old_bytes)) {
+        for (size_t i = 0; i < count; i++) {
+            free(buf->lines[lines[i]]);
+            buf->lines[lines[i]] = text[i];
+            note_set_line(ed, lines[i], text[i]);
+        }
+        ed->cursor_line = lines[count - 1];
+        ed->cursor_col = 0;
+        free(lines);
+        free(text);
+        goto done;
+    }
+
+    // Swap the new lines in; the delta now owns the old ones.
+    UndoDelta delta;
+    memset(&delta, 0, sizeof(delta));
+    delta.swap_lines = lines;
+    delta.swap_text = text;
+    delta.swap_count = count;
+    delta.cursor_before.line = ed->cursor_line;
+    delta.cursor_before.col = ed->cursor_col;
+    delta.cursor_after.line = lines[count - 1];
+    delta.cursor_after.col = 0;
+    apply_line_swap(buf, &delta);
+    note_swapped_lines(ed, &delta);
+
+    // Always a history entry of its own, never merged with typing around it
+    ed->has_last_edit_time = 0;
+    history_append_delta(ed, &delta);
+    ed->has_last_edit_time = 0;
+
+    ed->cursor_line = delta.cursor_after.line;
+    ed->cursor_col = 0;
+
+done:
+    ed->modified = 1;
+
+    // One highlight pass and one (debounced) LSP sync for the whole batch
+    highlight_buffer(buf);
+    search_invalidate_count(&ed->search);
+    buf->lsp_dirty = 1;
+    buf->lsp_last_edit_ms = now_ms();
+
+    return (long)nsubs;
+}
+
+int editor_insert_text(EditorState *ed, const char *text, size_t len) {
+    Buffer *buf = &ed->buf;
+    if (len == 0) return 0;
+    if (buf->count == 0) buf_insert(buf, 0, dupstr(""));
+
+    // Normalise line endings (CRLF and lone CR become \n) and drop control
+    // bytes other than tab, so pasted text lands verbatim without going
+    // through auto-indent or the per-key handlers.
+    char *clean = malloc(len + 1);
+    if (!clean) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\r') {
+            clean[n++] = '\n';
+            if (i + 1 < len && text[i + 1] == '\n') i++;
+        } else if (c == '\n' || c == '\t' || c >= 32) {
+            clean[n++] = (char)c;
+        }
+    }
+    clean[n] = '\0';
+    if (n == 0) {
+        free(clean);
+        return 0;
+    }
+
+    size_t line_len = strlen(buf->lines[ed->cursor_line]);
+    if (ed->cursor_col > line_len) ed->cursor_col = line_len;
+
+    // Cursor ends after the last pasted character
+    CursorPos before = { ed->cursor_line, ed->cursor_col };
+    CursorPos after = before;
+    for (const char *p = clean; *p; p++) {
+        if (*p == '\n') {
+            after.line++;
+            after.col = 0;
+        } else {
+            after.col++;
+        }
+    }
+
+    // One undo entry of its own, one splice into the line array
+    ed->has_last_edit_time = 0;
+    if (!large_edit_skips_undo(ed, n))
+        record_replace(ed, before.line, before.col, before.line, before.col,
+                       clean, before, after);
+    else
+        note_replace(ed, before.line, before.col,
+                     before.line, before.col, clean);
+    ed->has_last_edit_time = 0;
+    apply_text_replace(buf, before.line, before.col, before.line, before.col, clean);
+    free(clean);
+
+    ed->cursor_line = after.line;
+    ed->cursor_col = after.col;
+    ed->modified = 1;
+
+    // One highlight pass and one (debounced) LSP sync for the whole paste
+    highlight_buffer(buf);
+    search_invalidate_count(&ed->search);
+    buf->lsp_dirty = 1;
+    buf->lsp_last_edit_ms = now_ms();
+    return 0;
+}
+
+int editor_load_file(EditorState *ed, const char *path) {
+    struct stat st;
+    int by_size = ed->large_file_bytes > 0 && stat(path, &st) == 0 &&
+                  (long long)st.st_size >= ed->large_file_bytes;
+    int rc = by_size ? load_file_mapped(&ed->buf, path) : load_file(&ed->buf, path);
+    brackets_reset(&ed->brackets);
+    words_reset(&ed->words);
+    folds_clear(&ed->folds);
+
+    ed->large_file = rc == 0 &&
+        (by_size || (ed->large_file_lines > 0 && ed->buf.count >= ed->large_file_lines));
+    if (ed->large_file) {
+        // Start with the window at the top; highlight_viewport follows the
+        // cursor from there
+        ed->buf.hl_first = 0;
+        ed->buf.hl_count = 2 * HL_WINDOW_MARGIN;
+    }
+    return rc;
+}
+
+int editor_open_file(EditorState *ed, const char *path) {
+    char cur[PATH_MAX], want[PATH_MAX];
+    if (ed->have_filename && realpath(ed->filename, cur) &&
+        realpath(path, want) && strcmp(cur, want) == 0)
+        return 0;
+    if (ed->modified) return -1;
+
+    // Nothing unsaved in the old file, so its journal can go
+    journal_close(&ed->journal, 1);
+    ed->pending_recover_prompt = 0;
+
+    // buf_free also shuts down the old file's language server
+    buf_free(&ed->buf);
+    buf_init(&ed->buf);
+    snprintf(ed->filename, sizeof(ed->filename), "%s", path);
+    ed->have_filename = 1;
+    ed->existing_file = !editor_load_file(ed, ed->filename);
+    if (ed->buf.count == 0) buf_push(&ed->buf, dupstr(""));
+    ed->file_created = 1;
+    ed->pending_create_prompt = 0;
+    ed->modified = 0;
+    ed->cursor_line = 0;
+    ed->cursor_col = 0;
+    ed->scroll_y = 0;
+
+    // Undo history belongs to the old buffer
+    history_clear_from_index(&ed->history, 0);
+    ed->history.index = 0;
+    ed->has_last_edit_time = 0;
+
+    ed->buf.ft = detect_filetype(ed->filename);
+    snprintf(ed->buf.filepath, sizeof(ed->buf.filepath), "%s", ed->filename);
+    highlight_buffer(&ed->buf);
+    search_invalidate_count(&ed->search);
+
+    if (ed->buf.ft != FT_NONE && !ed->large_file) {
+        ed->buf.lsp = spawn_lsp(&ed->buf.ft);
+        if (ed->buf.lsp.pid > 0)
+            lsp_initialize(&ed->buf);
+    }
+    editor_start_journal(ed);
+    if (ed->existing_file) watch_start(&ed->watch, ed->filename);
+    else watch_stop(&ed->watch);
+    editor_open_changes(ed);
+    return 0;
+}
+
+void editor_open_changes(EditorState *ed) {
+    if (ed->have_filename && ed->existing_file && !ed->large_file)
+        changes_open(&ed->changes, ed->filename, ed->buf.count);
+    else
+        changes_free(&ed->changes);
+}
+
+void editor_start_journal(EditorState *ed) {
+    if (!ed->have_filename || !ed->existing_file || ed->journal.fd >= 0) return;
+
+    JournalInfo info;
+    int found = journal_probe(ed->filename, &info);
+    char msg[sizeof(ed->message)];
+    if (info.pid_alive) {
+        // Another jsvim owns it; leave it alone
+        snprintf(msg, sizeof(msg), "Swap file in use by pid %d; edits are not journaled",
+                 (int)info.pid);
+        show_cmd_message(ed, msg);
+        return;
+    }
+    if (found) {
+        snprintf(msg, sizeof(msg), "Unsaved edits found (%zu change%s%s). Recover? (y/n)",
+                 info.records, info.records == 1 ? "" : "s",
+                 info.base_changed ? ", file changed since" : "");
+        show_cmd_message(ed, msg);
+        ed->pending_recover_prompt = 1;
+        ed->mode_insert = 0;
+        return;
+    }
+    journal_open(&ed->journal, ed->filename, 0);
+}
+
+// Replay the journal over the file just loaded. Every record is checked
+// against the buffer first; replay stops at the first one that does not
+// fit (the file changed under it, or the journal is damaged).
+static void editor_recover(EditorState *ed) {
+    Buffer *buf = &ed->buf;
+    JournalReader r;
+    JournalRecord rec;
+    size_t applied = 0;
+    long long keep = 0;
+    int rc = 0;
+    if (journal_reader_open(&r, ed->filename) == 0) {
+        while ((rc = journal_read(&r, &rec)) == 1) {
+            if (rec.type == 'R') {
+                if (rec.start_line > rec.end_line || rec.end_line >= buf->count ||
+                    (rec.start_line == rec.end_line && rec.start_col > rec.end_col)) {
+                    rc = -1;
+                    break;
+                }
+                apply_text_replace(buf, rec.start_line, rec.start_col,
+                                   rec.end_line, rec.end_col, rec.text);
+                ed->cursor_line = rec.start_line;
+                ed->cursor_col = rec.start_col;
+            } else {
+                if (rec.start_line >= buf->count) {
+                    rc = -1;
+                    break;
+                }
+                char *line = dupstr(rec.text);
+                if (!line) break;
+                free(buf->lines[rec.start_line]);
+                buf->lines[rec.start_line] = line;
+                ed->cursor_line = rec.start_line;
+                ed->cursor_col = 0;
+            }
+            applied++;
+            keep = r.good_end;
+        }
+        journal_reader_close(&r);
+    }
+
+    if (ed->cursor_line >= buf->count) ed->cursor_line = buf->count - 1;
+    size_t len = strlen(buf->lines[ed->cursor_line]);
+    if (ed->cursor_col > len) ed->cursor_col = len;
+    ed->modified = applied > 0;
+    brackets_reset(&ed->brackets);
+    words_reset(&ed->words);
+    changes_reset(&ed->changes, buf->count);
+    highlight_buffer(buf);
+    search_invalidate_count(&ed->search);
+    buf->lsp_dirty = 1;
+    buf->lsp_last_edit_ms = now_ms();
+
+    // The file on disk still lacks these edits, so the journal keeps the
+    // records that were replayed and new edits are appended after them
+    journal_open(&ed->journal, ed->filename, applied > 0 ? keep : 0);
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Recovered %zu change%s%s", applied, applied == 1 ? "" : "s",
+             rc == -1 ? " (journal did not match the file past that point)" : "");
+    show_cmd_message(ed, msg);
+}
+
+static int pread_full(int fd, char *dst, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t r = pread(fd, dst, len, off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        dst += r;
+        len -= (size_t)r;
+        off += r;
+    }
+    return 0;
+}
+
+// Whether `data`, the last `n` bytes of the file as it was loaded, is what
+// the end of the buffer holds. The file's final newline has no line of
+// its own in the buffer.
+static int buffer_tail_matches(const Buffer *buf, const char *data, size_t n) {
+    if (n > 0 && data[n - 1] == '\n') n--;
+    size_t line = buf->count - 1;
+    size_t pos = strlen(buf->lines[line]);
+    while (n > 0) {
+        char c = data[--n];
+        if (pos > 0) {
+            if (buf->lines[line][--pos] != c) return 0;
+        } else {
+            if (c != '\n' || line == 0) return 0;
+            line--;
+            pos = strlen(buf->lines[line]);
+        }
+    }
+    return 1;
+}
+
+// Lines after a change: the line that held the cursor stays on the same
+// text, lines in a replaced range go to the start of what replaced it
+static size_t map_line_through_hunks(const DiffHunk *h, size_t n, size_t line) {
+    long shift = 0;
+    for (size_t k = 0; k < n && line >= h[k].a_start; k++) {
+        if (line < h[k].a_start + h[k].a_count) {
+            size_t off = line - h[k].a_start;
+            return h[k].b_start + (h[k].b_count == 0 ? 0 :
+                                   off < h[k].b_count ? off : h[k].b_count - 1);
+        }
+        shift += (long)h[k].b_count - (long)h[k].a_count;
+    }
+    return (size_t)((long)line + shift);
+}
+
+// The file only grew (a log being written): read just the new bytes and
+// add them to the end of the buffer. Only the last 4 KB of what was
+// loaded is compared, which is enough to tell an append from a rewrite.
+// Returns 1 if the buffer was updated this way.
+static int reload_appended(EditorState *ed) {
+    FileWatch *w = &ed->watch;
+    Buffer *buf = &ed->buf;
+    struct stat st;
+    if (ed->modified || w->size < 0 || stat(ed->filename, &st) != 0 ||
+        st.st_dev != w->dev || st.st_ino != w->ino || st.st_size <= w->size)
+        return 0;
+
+    char tail[4096];
+    size_t tn = (size_t)w->size < sizeof(tail) ? (size_t)w->size : sizeof(tail);
+    size_t grow = (size_t)(st.st_size - w->size);
+    char *text = malloc(grow + 2);
+    if (!text) return 0;
+    int fd = open(ed->filename, O_RDONLY);
+    int ok = fd >= 0 &&
+             pread_full(fd, tail, tn, w->size - (off_t)tn) == 0 &&
+             pread_full(fd, text + 1, grow, w->size) == 0;
+    if (fd >= 0) close(fd);
+    if (!ok || !buffer_tail_matches(buf, tail, tn) || memchr(text + 1, '\0', grow)) {
+        free(text);
+        return 0;
+    }
+
+    // Joined onto the last line: a newline first if the file used to end
+    // with one, and none for the file's new final newline
+    size_t len = grow;
+    if (text[len] == '\n') len--;
+    char *add = text + 1;
+    if (tn > 0 && tail[tn - 1] == '\n') {
+        add = text;
+        add[0] = '\n';
+        len++;
+    }
+    add[len] = '\0';
+
+    size_t last = buf->count - 1;
+    CursorPos before = { ed->cursor_line, ed->cursor_col };
+    CursorPos at = { last, strlen(buf->lines[last]) };
+    int comment_delim = highlight_has_comment_delim(buf->ft, buf->lines[last]) ||
+                        highlight_has_comment_delim(buf->ft, add);
+
+    // Like tail -f, a cursor on the last line follows the new lines
+    size_t new_lines = 0;
+    for (const char *p = add; (p = strchr(p, '\n')) != NULL; p++) new_lines++;
+    CursorPos after = before;
+    if (before.line == last) {
+        after.line = last + new_lines;
+        after.col = 0;
+    }
+
+    if (len > 0) {
+        ed->has_last_edit_time = 0;
+        if (!large_edit_skips_undo(ed, len))
+            record_replace(ed, at.line, at.col, at.line, at.col, add, before, after);
+        else
+            note_lines(ed, at.line, 1, 1 + new_lines);
+        ed->has_last_edit_time = 0;
+        apply_text_replace(buf, at.line, at.col, at.line, at.col, add);
+
+        DiffHunk h = { last, 1, last, 1 + new_lines };
+        if (comment_delim) highlight_buffer(buf);
+        else highlight_hunks(buf, &h, 1);
+    }
+    free(text);
+
+    ed->cursor_line = after.line;
+    ed->cursor_col = after.col;
+    return 1;
+}
+
+// Any other change: read the whole file, diff it against the buffer by
+// line, and replace only the hunks that differ, bottom up, as one undo
+// entry. Returns the number of hunks, or -1 if the file cannot be read.
+static long reload_diff(EditorState *ed) {
+    Buffer *buf = &ed->buf;
+    Buffer disk;
+    buf_init(&disk);
+    if ((ed->large_file ? load_file_mapped(&disk, ed->filename)
+                        : load_file(&disk, ed->filename)) != 0) {
+        buf_free(&disk);
+        return -1;
+    }
+    DiffHunk *hunks;
+    size_t n = diff_lines(buf->lines, buf->count, disk.lines, disk.count, &hunks);
+    if (n == (size_t)-1) {
+        buf_free(&disk);
+        return -1;
+    }
+
+    size_t bytes = 0;
+    int comment_delim = 0;
+    for (size_t k = 0; k < n; k++) {
+        for (size_t i = 0; i < hunks[k].a_count; i++) {
+            const char *l = buf->lines[hunks[k].a_start + i];
+            bytes += strlen(l) + 1;
+            comment_delim |= highlight_has_comment_delim(buf->ft, l);
+        }
+        for (size_t i = 0; i < hunks[k].b_count; i++) {
+            const char *l = disk.lines[hunks[k].b_start + i];
+            bytes += strlen(l) + 1;
+            comment_delim |= highlight_has_comment_delim(buf->ft, l);
+        }
+    }
+
+    int was_last = ed->cursor_line + 1 == buf->count;
+    CursorPos before = { ed->cursor_line, ed->cursor_col };
+    CursorPos after = { map_line_through_hunks(hunks, n, ed->cursor_line), ed->cursor_col };
+    if (was_last || after.line >= disk.count) after.line = disk.count - 1;
+    size_t scroll = map_line_through_hunks(hunks, n, ed->scroll_y);
+
+    int undoable = n > 0 && !large_edit_skips_undo(ed, bytes);
+    ed->has_last_edit_time = 0;
+    for (size_t k = n; k-- > 0; ) {
+        const DiffHunk *h = &hunks[k];
+        size_t sl = h->a_start, sc = 0, el = h->a_start, ec = 0;
+        int lead_nl = 0, trail_nl = 0;
+        if (h->a_count > 0 && h->b_count > 0) {
+            el = h->a_start + h->a_count - 1;
+            ec = strlen(buf->lines[el]);
+        } else if (h->a_count == 0 && h->a_start < buf->count) {
+            trail_nl = 1;                       // insert above line a_start
+        } else if (h->a_count == 0) {
+            sl = el = buf->count - 1;           // insert after the last line
+            sc = ec = strlen(buf->lines[sl]);
+            lead_nl = 1;
+        } else if (h->a_start + h->a_count < buf->count) {
+            el = h->a_start + h->a_count;       // delete whole lines
+        } else {
+            sl = h->a_start - 1;                // delete through the last line
+            sc = strlen(buf->lines[sl]);
+            el = buf->count - 1;
+            ec = strlen(buf->lines[el]);
+        }
+
+        size_t len = (size_t)lead_nl + (size_t)trail_nl;
+        for (size_t i = 0; i < h->b_count; i++)
+            len += strlen(disk.lines[h->b_start + i]) + (i > 0);
+        char *text = malloc(len + 1);
+        if (!text) break;
+        char *p = text;
+        if (lead_nl) *p++ = '\n';
+        for (size_t i = 0; i < h->b_count; i++) {
+            if (i > 0) *p++ = '\n';
+            size_t l = strlen(disk.lines[h->b_start + i]);
+            memcpy(p, disk.lines[h->b_start + i], l);
+            p += l;
+        }
+        if (trail_nl) *p++ = '\n';
+        *p = '\0';
+
+        if (undoable) {
+            // Keep every hunk in the same undo entry
+            ed->last_edit_time_ms = now_ms();
+            record_replace(ed, sl, sc, el, ec, text, before, after);
+        } else {
+            size_t lines = 1;
+            for (const char *q = text; *q; q++) lines += *q == '\n';
+            note_lines(ed, sl, el - sl + 1, lines);
+        }
+        apply_text_replace(buf, sl, sc, el, ec, text);
+        free(text);
+    }
+    ed->has_last_edit_time = 0;
+
+    if (comment_delim) highlight_buffer(buf);
+    else highlight_hunks(buf, hunks, n);
+    free(hunks);
+    buf_free(&disk);
+
+    ed->cursor_line = after.line < buf->count ? after.line : buf->count - 1;
+    ed->scroll_y = scroll < buf->count ? scroll : buf->count - 1;
+    return (long)n;
+}
+
+// Returns the number of hunks applied (an append counts as one), or -1
+static long reload_file(EditorState *ed, int *appended) {
+    if (!ed->have_filename) return -1;
+    *appended = reload_appended(ed);
+    long n = *appended ? 1 : reload_diff(ed);
+    if (n < 0) return -1;
+
+    Buffer *buf = &ed->buf;
+    size_t len = strlen(buf->lines[ed->cursor_line]);
+    if (ed->cursor_col > len) ed->cursor_col = len;
+    ed->modified = 0;
+    if (n > 0) {
+        brackets_reset(&ed->brackets);
+        search_invalidate_count(&ed->search);
+        buf->lsp_dirty = 1;
+        buf->lsp_last_edit_ms = now_ms();
+    }
+    // The buffer matches the file again
+    journal_saved(&ed->journal, ed->filename);
+    watch_sync(&ed->watch);
+    if (n > 0) editor_open_changes(ed);
+    return n;
+}
+
+long editor_reload_file(EditorState *ed) {
+    int appended;
+    return reload_file(ed, &appended);
+}
+
+int editor_poll_file(EditorState *ed) {
+    if (!watch_poll(&ed->watch)) return 0;
+    char msg[sizeof(ed->message)];
+    const char *name = strrchr(ed->filename, '/');
+    name = name ? name + 1 : ed->filename;
+    if (ed->modified || ed->pending_recover_prompt || ed->pending_create_prompt) {
+        // Unsaved edits win; the user decides. Say so once per change.
+        snprintf(msg, sizeof(msg), "%.200s changed on disk; e! loads it (your edits stay in undo)",
+                 name);
+        show_cmd_message(ed, msg);
+        watch_sync(&ed->watch);
+        return 0;
+    }
+    int appended;
+    long n = reload_file(ed, &appended);
+    if (n < 0) {
+        snprintf(msg, sizeof(msg), "%.200s changed on disk and cannot be read", name);
+        show_cmd_message(ed, msg);
+        watch_sync(&ed->watch);
+        return 0;
+    }
+    // Appends (tail -f) reload quietly
+    if (n > 0 && !appended) {
+        snprintf(msg, sizeof(msg), "%.200s changed on disk: reloaded", name);
+        show_cmd_message(ed, msg);
+    }
+    return n > 0;
+}
+
+int editor_poll_grep(EditorState *ed) {
+    if (!ed->grep) return 0;
+    return grep_drain(ed->grep, &ed->qf);
+}
+
+// The line `rows` screen rows below `line` (above if negative), kept
+// inside the buffer. Closed folds count as one row.
+static size_t line_by_rows(EditorState *ed, size_t line, long rows) {
+    FoldSet *fs = &ed->folds;
+    size_t row = folds_row_of(fs, line);
+    size_t last = folds_row_of(fs, ed->buf.count - 1);
+    if (rows < 0)
+        row = (size_t)-rows > row ? 0 : row - (size_t)-rows;
+    else
+        row = (size_t)rows > last - row ? last : row + (size_t)rows;
+    return folds_line_at_row(fs, row);
+}
+
+// Width of a line's leading whitespace, or -1 if the line is blank
+static long indent_width(EditorState *ed, const char *line) {
+    long tw = ed->tab_width > 0 ? ed->tab_width : DEFAULT_TAB_WIDTH;
+    long w = 0;
+    for (; *line == ' ' || *line == '\t'; line++)
+        w = *line == '\t' ? w + tw - w % tw : w + 1;
+    return *line ? w : -1;
+}
+
+// C-like: the bracket block opened on `line` (the innermost bracket still
+// open at its end) and the line it closes on
+static int bracket_block_at(EditorState *ed, size_t line, size_t *end) {
+    Buffer *buf = &ed->buf;
+    size_t ol, oc;
+    BracketMatch m;
+    if (!brackets_enclosing(&ed->brackets, buf, line, strlen(buf->lines[line]), "{[",
+                            &ol, &oc) || ol != line)
+        return 0;
+    if (!brackets_match_at(&ed->brackets, buf, ol, oc, &m) || m.line[1] <= line) return 0;
+    *end = m.line[1];
+    return 1;
+}
+
+// The block that starts at `line`: its bracket block in C-like files,
+// else the lines indented deeper than it. Large files go by indent only.
+static int block_at(EditorState *ed, size_t line, size_t *end) {
+    Buffer *buf = &ed->buf;
+    if (filetype_c_like(buf->ft) && !ed->large_file) {
+        size_t next;
+        if (!bracket_block_at(ed, line, end)) return 0;
+        // "} else {" heads the next fold, so this one stops above it
+        if (bracket_block_at(ed, *end, &next)) {
+            if (*end - 1 == line) return 0;
+            (*end)--;
+        }
+        return 1;
+    }
+
+    long ind = indent_width(ed, buf->lines[line]);
+    if (ind < 0) return 0;
+    size_t last = line;
+    for (size_t l = line + 1; l < buf->count; l++) {
+        long w = indent_width(ed, buf->lines[l]);
+        if (w < 0) continue;
+        if (w <= ind) break;
+        last = l;
+    }
+    *end = last;
+    return last > line;
+}
+
+// The innermost block that `line` is inside
+static int block_around(EditorState *ed, size_t line, size_t *start, size_t *end) {
+    Buffer *buf = &ed->buf;
+    if (filetype_c_like(buf->ft) && !ed->large_file) {
+        size_t ol, oc;
+        if (!brackets_enclosing(&ed->brackets, buf, line, 0, "{[", &ol, &oc) ||
+            !block_at(ed, ol, end) || *end < line)
+            return 0;
+        *start = ol;
+        return 1;
+    }
+
+    // Up to the nearest line indented less, and further out from there
+    // if its block stops short of `line`
+    long ind = indent_width(ed, buf->lines[line]);
+    for (size_t h = line; h-- > 0; ) {
+        long w = indent_width(ed, buf->lines[h]);
+        if (w < 0 || (ind >= 0 && w >= ind)) continue;
+        if (block_at(ed, h, end) && *end >= line) {
+            *start = h;
+            return 1;
+        }
+        ind = w;
+    }
+    return 0;
+}
+
+int editor_fold(EditorState *ed, size_t line) {
+    size_t start = line, end;
+    // The block this line opens, unless that is already folded; else the
+    // one around it
+    if ((folds_hidden_after(&ed->folds, line) > 0 || !block_at(ed, line, &end)) &&
+        !block_around(ed, line, &start, &end))
+        return -1;
+    if (folds_close(&ed->folds, start, end) != 0) return -1;
+    if (ed->cursor_line > start && ed->cursor_line <= end) {
+        ed->cursor_line = start;
+        size_t len = strlen(ed->buf.lines[start]);
+        if (ed->cursor_col > len) ed->cursor_col = len;
+    }
+    return 0;
+}
+
+size_t editor_fold_all(EditorState *ed) {
+    size_t n = 0, end;
+    // Bottom up, so each fold takes in the ones already closed inside it
+    for (size_t l = ed->buf.count; l-- > 0; )
+        if (block_at(ed, l, &end) && folds_close(&ed->folds, l, end) == 0) n++;
+    ed->cursor_line = folds_visible_line(&ed->folds, ed->cursor_line);
+    size_t len = strlen(ed->buf.lines[ed->cursor_line]);
+    if (ed->cursor_col > len) ed->cursor_col = len;
+    return n;
+}
+
+// '}' typed as the first thing on its line goes to the indent of the
+// line that opened the block. Returns 1 if it inserted the brace.
+static int electric_close_brace(EditorState *ed) {
+    Buffer *buf = &ed->buf;
+    char *line = buf->lines[ed->cursor_line];
+    size_t col = ed->cursor_col;
+    for (size_t i = 0; i < col; i++)
+        if (line[i] != ' ' && line[i] != '\t') return 0;
+
+    size_t ol, oc;
+    if (!brackets_enclosing(&ed->brackets, buf, ed->cursor_line, col, "{", &ol, &oc))
+        return 0;
+    const char *oline = buf->lines[ol];
+    size_t ind = 0;
+    while (oline[ind] == ' ' || oline[ind] == '\t') ind++;
+    if (ind == col && strncmp(oline, line, ind) == 0) return 0;
+
+    size_t len = strlen(line);
+    char *text = malloc(ind + 2);
+    char *nl = malloc(ind + 1 + len - col + 1);
+    if (!text || !nl) {
+        free(text);
+        free(nl);
+        return 0;
+    }
+    memcpy(text, oline, ind);
+    text[ind] = '}';
+    text[ind + 1] = '\0';
+    CursorPos before = { ed->cursor_line, col };
+    CursorPos after = { ed->cursor_line, ind + 1 };
+    record_replace(ed, ed->cursor_line, 0, ed->cursor_line, col, text, before, after);
+
+    memcpy(nl, text, ind + 1);
+    memcpy(nl + ind + 1, line + col, len - col + 1);
+    free(text);
+    free(line);
+    buf->lines[ed->cursor_line] = nl;
+    ed->cursor_col = ind + 1;
+    ed->modified = 1;
+    buf->lsp_dirty = 1;
+    return 1;
+}
+
+// Start of the identifier that ends at the cursor
+static size_t word_start_at_cursor(EditorState *ed) {
+    const char *line = ed->buf.lines[ed->cursor_line];
+    size_t ws = ed->cursor_col;
+    while (ws > 0 && words_is_word_char((unsigned char)line[ws - 1])) ws--;
+    return ws;
+}
+
+// Cancel the completion request in flight, if any, and drop the list
+static void lsp_completion_close(EditorState *ed) {
+    LspCompletion *c = &ed->buf.completion;
+    if (c->pending_id) lsp_cancel_request(&ed->buf, c->pending_id);
+    completion_clear(c);
+}
+
+int editor_completion_visible(EditorState *ed) {
+    LspCompletion *c = &ed->buf.completion;
+    return ed->mode_insert && c->have_list && !c->dismissed && c->shown_count > 0 &&
+           ed->buf.count > 0 && c->line == ed->cursor_line &&
+           c->col == word_start_at_cursor(ed);
+}
+
+// Keep the LSP completion list in step with the word before the cursor.
+// A new word start sends one request (cancelling an older one still in
+// flight); typing more of the same word only re-filters the cached list.
+// The server is asked again for the same word only if it called its list
+// incomplete, or the word got shorter than what was asked for.
+static void lsp_completion_update(EditorState *ed, int typed) {
+    Buffer *buf = &ed->buf;
+    LspCompletion *c = &buf->completion;
+    if (buf->lsp.pid <= 0 || !buf->lsp_opened || buf->count == 0) return;
+
+    const char *line = buf->lines[ed->cursor_line];
+    size_t ws = word_start_at_cursor(ed);
+    size_t wlen = ed->cursor_col - ws;
+    int same = (c->pending_id || c->have_list) && c->line == ed->cursor_line && c->col == ws;
+
+    if (!same) {
+        lsp_completion_close(ed);
+        // Member access asks at once, a plain identifier once it is long enough
+        int member = ws > 0 && (line[ws - 1] == '.' ||
+                                (ws > 1 && line[ws - 2] == '-' && line[ws - 1] == '>') ||
+                                (ws > 1 && line[ws - 2] == ':' && line[ws - 1] == ':'));
+        if (!typed || (wlen < COMPLETION_MIN_WORD && !member)) return;
+        c->line = ed->cursor_line;
+        c->col = ws;
+        c->asked = wlen;
+        c->pending_id = lsp_request_completion(buf, ed->cursor_line, ed->cursor_col);
+        return;
+    }
+
+    if (!c->pending_id && !c->dismissed && (wlen < c->asked || (typed && c->incomplete))) {
+        // The cached list stays up until the new one lands
+        c->asked = wlen;
+        c->pending_id = lsp_request_completion(buf, ed->cursor_line, ed->cursor_col);
+    }
+    completion_filter(c, line + ws, wlen);
+}
+
+// Tab in the popup: the selected item replaces the typed word
+static void lsp_completion_accept(EditorState *ed) {
+    Buffer *buf = &ed->buf;
+    LspCompletion *c = &buf->completion;
+    const char *text = c->items[c->shown[c->sel]].insert;
+
+    CursorPos before = { ed->cursor_line, ed->cursor_col };
+    CursorPos after = { c->line, c->col };
+    for (const char *p = text; *p; p++) {
+        if (*p == '\n') {
+            after.line++;
+            after.col = 0;
+        } else {
+            after.col++;
+        }
+    }
+    record_replace(ed, c->line, c->col, ed->cursor_line, ed->cursor_col, text, before, after);
+    apply_text_replace(buf, c->line, c->col, ed->cursor_line, ed->cursor_col, text);
+    ed->cursor_line = after.line;
+    ed->cursor_col = after.col;
+    ed->modified = 1;
+    lsp_completion_close(ed);
+
+    highlight_buffer(buf);
+    search_invalidate_count(&ed->search);
+    buf->lsp_dirty = 1;
+    buf->lsp_last_edit_ms = now_ms();
+}
+
+// Ctrl-N / Ctrl-P: replace the word before the cursor with the next (or
+// previous) buffer word that starts with it. Repeated presses cycle
+// through the suggestions and back to what was typed.
+static void editor_complete_word(EditorState *ed, int forward) {
+    Buffer *buf = &ed->buf;
+    WordCompletion *c = &ed->completion;
+    if (buf->count == 0) return;
+    if (ed->large_file) {
+        show_cmd_message(ed, "No word completion in large-file mode");
+        return;
+    }
+
+    if (!c->active || c->line != ed->cursor_line || c->col + c->len != ed->cursor_col) {
+        const char *line = buf->lines[ed->cursor_line];
+        size_t start = ed->cursor_col;
+        while (start > 0 && words_is_word_char((unsigned char)line[start - 1])) start--;
+        size_t plen = ed->cursor_col - start;
+        c->active = 0;
+        if (plen == 0 || plen > WORDS_MAX_LEN) {
+            show_cmd_message(ed, "No word before the cursor");
+            return;
+        }
+        memcpy(c->prefix, line + start, plen);
+        c->prefix[plen] = '\0';
+        c->count = words_complete(&ed->words, buf, c->prefix, c->items, WORDS_MAX_SUGGEST);
+        if (c->count == 0) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "No words starting with %s", c->prefix);
+            show_cmd_message(ed, msg);
+            return;
+        }
+        c->active = 1;
+        c->line = ed->cursor_line;
+        c->col = start;
+        c->len = plen;
+        c->sel = -1;
+    }
+
+    // The typed prefix (-1) sits between the last suggestion and the first
+    long n = (long)c->count;
+    c->sel = forward ? (c->sel + 2) % (n + 1) - 1 : (c->sel + n + 1) % (n + 1) - 1;
+    const char *text = c->sel < 0 ? c->prefix : c->items[c->sel];
+    size_t tlen = strlen(text);
+
+    CursorPos before = { c->line, c->col + c->len };
+    CursorPos after = { c->line, c->col + tlen };
+    record_replace(ed, c->line, c->col, c->line, c->col + c->len, text, before, after);
+    apply_text_replace(buf, c->line, c->col, c->line, c->col + c->len, text);
+    c->len = tlen;
+    ed->cursor_col = c->col + tlen;
+    ed->modified = 1;
+    buf->lsp_dirty = 1;
+
+    // Suggestions in the command bar, the current one bracketed
+    char msg[sizeof(ed->message)];
+    size_t off = (size_t)snprintf(msg, sizeof(msg), "%ld/%zu ", c->sel + 1, c->count);
+    for (size_t i = 0; i < c->count && off < sizeof(msg) - 1; i++)
+        off += (size_t)snprintf(msg + off, sizeof(msg) - off,
+                                (long)i == c->sel ? " [%s]" : " %s", c->items[i]);
+    show_cmd_message(ed, msg);
 }
 
 void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
     Buffer *buf = &ed->buf;
+
+    if (ch != ERR) ed->message[0] = '\0';
+    if (ch != ERR && ch != 14 && ch != 16) ed->completion.active = 0;
+
+    // While the completion popup is up it takes the keys that move in it
+    if (ch != ERR && editor_completion_visible(ed)) {
+        LspCompletion *c = &buf->completion;
+        if (ch == 27) {
+            c->dismissed = 1;
+            return;
+        } else if (ch == 14 || ch == KEY_DOWN) {
+            completion_move(c, 1);
+            return;
+        } else if (ch == 16 || ch == KEY_UP) {
+            completion_move(c, -1);
+            return;
+        } else if (ch == '\t') {
+            lsp_completion_accept(ed);
+            return;
+        }
+    }
     
     if (ch == 27) {
         // ESC -> command mode
+        lsp_completion_close(ed);
         ed->mode_insert = 0;
         ed->cmdlen = 0;
         ed->cmdbuf[0] = '\0';
@@ -654,17 +1800,21 @@ void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
     case ERR:
         // timeout for clock update; continue
         break;
+    case 14:  // Ctrl-N
+    case 16:  // Ctrl-P
+        editor_complete_word(ed, ch == 14);
+        break;
     case KEY_UP:
-        if (ed->cursor_line > 0) {
-            ed->cursor_line--;
+        if (folds_row_of(&ed->folds, ed->cursor_line) > 0) {
+            ed->cursor_line = line_by_rows(ed, ed->cursor_line, -1);
             size_t len = strlen(buf->lines[ed->cursor_line]);
             if (ed->cursor_col > len) ed->cursor_col = len;
             if (ed->cursor_line < ed->scroll_y) ed->scroll_y = ed->cursor_line;
         }
         break;
     case KEY_DOWN:
-        if (ed->cursor_line + 1 < buf->count) {
-            ed->cursor_line++;
+        if (ed->cursor_line + 1 + folds_hidden_after(&ed->folds, ed->cursor_line) < buf->count) {
+            ed->cursor_line = line_by_rows(ed, ed->cursor_line, 1);
             size_t len = strlen(buf->lines[ed->cursor_line]);
             if (ed->cursor_col > len) ed->cursor_col = len;
             if (ed->cursor_line >= ed->scroll_y + (size_t)visible_rows) {
@@ -677,8 +1827,8 @@ void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
         break;
     case KEY_LEFT:
         if (ed->cursor_col > 0) ed->cursor_col--;
-        else if (ed->cursor_line > 0) {
-            ed->cursor_line--;
+        else if (folds_row_of(&ed->folds, ed->cursor_line) > 0) {
+            ed->cursor_line = line_by_rows(ed, ed->cursor_line, -1);
             ed->cursor_col = strlen(buf->lines[ed->cursor_line]);
             if (ed->cursor_line < ed->scroll_y) ed->scroll_y = ed->cursor_line;
         }
@@ -687,8 +1837,8 @@ void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
         {
             size_t len = strlen(buf->lines[ed->cursor_line]);
             if (ed->cursor_col < len) ed->cursor_col++;
-            else if (ed->cursor_line + 1 < buf->count) {
-                ed->cursor_line++;
+            else if (ed->cursor_line + 1 + folds_hidden_after(&ed->folds, ed->cursor_line) < buf->count) {
+                ed->cursor_line = line_by_rows(ed, ed->cursor_line, 1);
                 ed->cursor_col = 0;
                 if (ed->cursor_line >= ed->scroll_y + (size_t)visible_rows) {
                     if (ed->cursor_line >= (size_t)visible_rows)
@@ -1015,6 +2165,8 @@ void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
                 ed->cursor_col++;  // Position cursor between the brackets
                 ed->modified = 1;
                 buf->lsp_dirty = 1;
+            } else if (ch == '}' && filetype_c_like(buf->ft) && electric_close_brace(ed)) {
+                break;
             } else {
                 // Normal character insertion
                 char inserted[2];
@@ -1050,9 +2202,22 @@ void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
     // shipping the whole file and parsing multi-MB token responses.
     if (buf->lsp_dirty) {
         highlight_buffer(buf);
+        search_invalidate_count(&ed->search);
         buf->lsp_last_edit_ms = now_ms();
         // lsp_dirty stays set; editor_flush_lsp() clears it after sending.
     }
+
+    if (ch != ERR)
+        lsp_completion_update(ed, ch > ' ' && ch < KEY_MIN && ch != 127);
+}
+
+// Show a one-line message in the command bar. It is kept in the editor
+// state and drawn by render_command_window until the next keypress.
+static void show_cmd_message(EditorState *ed, const char *msg) {
+    size_t n = strlen(msg);
+    if (n >= sizeof(ed->message)) n = sizeof(ed->message) - 1;
+    memcpy(ed->message, msg, n);
+    ed->message[n] = '\0';
 }
 
 // Shared save logic for :w and :wq/:x.  If and_quit is set, ed->quit is
@@ -1061,7 +2226,10 @@ void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows) {
 static int do_save_cmd(EditorState *ed, WINDOW *cmd_win, int maxx, int and_quit) {
     Buffer *buf = &ed->buf;
 
-    if (!ed->have_filename || strlen(ed->filename) == 0) {
+    // The filename and create prompts need a terminal; without one (the
+    // headless replay driver passes no window) a nameless buffer is not
+    // saved and a new file is created without asking.
+    if ((!ed->have_filename || strlen(ed->filename) == 0) && cmd_win) {
         const char *pr = "Enter filename: ";
         echo();
         curs_set(1);
@@ -1083,7 +2251,7 @@ static int do_save_cmd(EditorState *ed, WINDOW *cmd_win, int maxx, int and_quit)
     if (!ed->have_filename)
         return 0;
 
-    if (!file_exists(ed->filename)) {
+    if (!file_exists(ed->filename) && cmd_win) {
         char qbuf[128];
         snprintf(qbuf, sizeof(qbuf), "Create %.63s and write to it? (Y/n): ", ed->filename);
         wattron(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
@@ -1100,19 +2268,192 @@ static int do_save_cmd(EditorState *ed, WINDOW *cmd_win, int maxx, int and_quit)
         ed->modified = 0;
         ed->existing_file = 1;
         ed->file_created = 1;
+        if (ed->journal.fd >= 0)
+            journal_saved(&ed->journal, ed->filename);
+        else
+            editor_start_journal(ed);
+        // Our own write is not an external change
+        if (ed->watch.fd >= 0)
+            watch_sync(&ed->watch);
+        else
+            watch_start(&ed->watch, ed->filename);
         if (and_quit)
             ed->quit = 1;
+        else
+            editor_open_changes(ed);   // outside git the base is this save
         return 1;
     }
 
-    wattron(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
-    for (int i = 0; i < maxx; i++) mvwaddch(cmd_win, 0, i, ' ');
-    mvwprintw(cmd_win, 0, 1, "Error writing %s", ed->filename);
-    wattroff(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
-    wrefresh(cmd_win);
+    char msg[sizeof(ed->filename) + 32];
+    snprintf(msg, sizeof(msg), "Error writing %s", ed->filename);
+    show_cmd_message(ed, msg);
     return 0;
 }
 
+// Put the cursor back where it was when '/' was typed
+static void search_restore_origin(EditorState *ed) {
+    SearchState *s = &ed->search;
+    if (!s->has_origin) return;
+    ed->cursor_line = s->origin_line;
+    ed->cursor_col = s->origin_col;
+    ed->scroll_y = s->origin_scroll;
+    s->has_origin = 0;
+}
+
+// Search-as-you-type: re-run the pattern typed so far from the origin and
+// park the cursor on the first match after it.
+static void editor_incremental_search(EditorState *ed) {
+    SearchState *s = &ed->search;
+    const char *pat = ed->cmdbuf + 1;
+
+    ed->cursor_line = s->origin_line;
+    ed->cursor_col = s->origin_col;
+    ed->scroll_y = s->origin_scroll;
+
+    if (*pat == '\0') {
+        search_clear(s);
+        return;
+    }
+    // An unfinished regex (e.g. "foo(") just leaves nothing highlighted
+    if (search_set_pattern(s, pat) != 0) return;
+
+    size_t line, col;
+    if (search_find(s, &ed->buf, s->origin_line, s->origin_col, 1, &line, &col)) {
+        ed->cursor_line = line;
+        ed->cursor_col = col;
+    }
+}
+
+// Copy one delimiter-separated field of a substitute command into out,
+// turning "\<delim>" into the bare delimiter. Returns a pointer just past
+// the closing delimiter (or the terminating NUL).
+static const char *parse_subst_field(const char *p, char delim, char *out, size_t outsz) {
+    size_t n = 0;
+    while (*p && *p != delim) {
+        if (p[0] == '\\' && p[1] == delim) p++;
+        if (n + 1 < outsz) out[n++] = *p;
+        p++;
+    }
+    out[n] = '\0';
+    return *p ? p + 1 : p;
+}
+
+// Parse "s/pat/repl/[g]" or "%s/pat/repl/[g]". Any punctuation character
+// may stand in for '/'. Returns 0 on success, -1 if cmd is not a substitute.
+static int parse_substitute(const char *cmd, int *whole_file,
+                            char *pat, size_t patsz, char *repl, size_t replsz,
+                            int *global) {
+    *whole_file = 0;
+    if (*cmd == '%') {
+        *whole_file = 1;
+        cmd++;
+    }
+    if (cmd[0] != 's' || !ispunct((unsigned char)cmd[1]))
+        return -1;
+
+    char delim = cmd[1];
+    const char *p = parse_subst_field(cmd + 2, delim, pat, patsz);
+    p = parse_subst_field(p, delim, repl, replsz);
+    *global = (strchr(p, 'g') != NULL);
+    return pat[0] ? 0 : -1;
+}
+
+// n / N: jump to the next / previous match of the active pattern
+static void editor_search_next(EditorState *ed, int forward) {
+    size_t line, col;
+    if (search_find(&ed->search, &ed->buf, ed->cursor_line, ed->cursor_col,
+                    forward, &line, &col)) {
+        ed->cursor_line = line;
+        ed->cursor_col = col;
+    }
+}
+
+// Open the selected quickfix entry and put the cursor on its match
+static void quickfix_jump(EditorState *ed) {
+    QuickfixList *qf = &ed->qf;
+    if (qf->count == 0) {
+        show_cmd_message(ed, "Quickfix list is empty");
+        return;
+    }
+    if (qf->sel >= qf->count) qf->sel = qf->count - 1;
+    const GrepHit *h = &qf->items[qf->sel];
+    if (editor_open_file(ed, h->path) != 0) {
+        show_cmd_message(ed, "No write since last change (w first)");
+        return;
+    }
+    Buffer *buf = &ed->buf;
+    ed->cursor_line = h->line < buf->count ? h->line : buf->count - 1;
+    size_t len = strlen(buf->lines[ed->cursor_line]);
+    ed->cursor_col = h->col <= len ? h->col : len;
+}
+
+// Directory of the current file, or "." without one
+static void editor_file_dir(EditorState *ed, char *out, size_t outsz) {
+    snprintf(out, outsz, ".");
+    if (!ed->have_filename) return;
+    const char *slash = strrchr(ed->filename, '/');
+    if (slash == ed->filename)
+        snprintf(out, outsz, "/");
+    else if (slash)
+        snprintf(out, outsz, "%.*s", (int)(slash - ed->filename), ed->filename);
+}
+
+void editor_handle_finder(EditorState *ed, int ch) {
+    FinderState *f = &ed->finder;
+    if (ch == ERR) return;
+    ed->message[0] = '\0';
+
+    if (ch == 27) {
+        f->active = 0;
+    } else if (ch == '\n' || ch == '\r') {
+        char path[PATH_MAX + 1100];
+        if (!finder_selected(f, path, sizeof(path))) return;
+        if (editor_open_file(ed, path) != 0) {
+            show_cmd_message(ed, "No write since last change (w first)");
+            return;
+        }
+        f->active = 0;
+        ed->mode_insert = 1;
+    } else if (ch == KEY_DOWN || ch == 14) {            // Down / Ctrl-N
+        if (f->sel + 1 < f->nresults) f->sel++;
+    } else if (ch == KEY_UP || ch == 16) {              // Up / Ctrl-P
+        if (f->sel > 0) f->sel--;
+    } else if (ch == KEY_BACKSPACE || ch == 127 || ch == '\b') {
+        if (f->qlen > 0) {
+            char q[FINDER_QUERY_MAX];
+            snprintf(q, sizeof(q), "%.*s", (int)(f->qlen - 1), f->query);
+            finder_set_query(f, q);
+        }
+    } else if (ch >= 32 && ch <= 126 && f->qlen + 1 < FINDER_QUERY_MAX) {
+        char q[FINDER_QUERY_MAX];
+        memcpy(q, f->query, f->qlen);
+        q[f->qlen] = (char)ch;
+        q[f->qlen + 1] = '\0';
+        finder_set_query(f, q);
+    }
+}
+
+// :grep - scan the directory of the current file (or the working
+// directory) on the grep thread pool; hits stream into the quickfix list.
+static void editor_start_grep(EditorState *ed, const char *pattern) {
+    char root[1024];
+    editor_file_dir(ed, root, sizeof(root));
+
+    grep_free(ed->grep);
+    ed->grep = NULL;
+    quickfix_clear(&ed->qf);
+
+    ed->grep = grep_start(pattern, root);
+    if (!ed->grep) {
+        char msg[SEARCH_PATTERN_MAX + 32];
+        snprintf(msg, sizeof(msg), "Invalid pattern: %s", pattern);
+        show_cmd_message(ed, msg);
+        return;
+    }
+    snprintf(ed->qf.title, sizeof(ed->qf.title), "grep: %s", pattern);
+    ed->qf.open = 1;
+}
+
 void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int maxx) {
     Buffer *buf = &ed->buf;
     
@@ -1120,6 +2461,23 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
         // refresh/clock; continue
         return;
     }
+    // Answer to "Unsaved edits found ... Recover? (y/n)"; the question
+    // stays up until one of them is typed
+    if (ed->pending_recover_prompt) {
+        if (ch == 'y' || ch == 'Y' || ch == '\n' || ch == '\r') {
+            ed->message[0] = '\0';
+            editor_recover(ed);
+        } else if (ch == 'n' || ch == 'N') {
+            ed->message[0] = '\0';
+            journal_open(&ed->journal, ed->filename, 0);
+        } else {
+            return;
+        }
+        ed->pending_recover_prompt = 0;
+        ed->mode_insert = 1;
+        return;
+    }
+    ed->message[0] = '\0';
     
     // Handle create file prompt
     if (ed->pending_create_prompt) {
@@ -1141,10 +2499,30 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
         } else if (ch == 'r') {
             editor_redo(ed);
             return;
+        } else if ((ch == 'n' || ch == 'N') && ed->search.active) {
+            editor_search_next(ed, ch == 'n');
+            return;
+        } else if (ch == 'z') {
+            // open the fold on the cursor row, or fold the block around it
+            if (!folds_open(&ed->folds, ed->cursor_line) && editor_fold(ed, ed->cursor_line) != 0)
+                show_cmd_message(ed, "No block to fold here");
+            return;
+        } else if ((ch == 'j' || ch == 'k') && ed->qf.open) {
+            // move the quickfix selection
+            if (ch == 'j' && ed->qf.sel + 1 < ed->qf.count) ed->qf.sel++;
+            if (ch == 'k' && ed->qf.sel > 0) ed->qf.sel--;
+            return;
         }
     }
     
     if (ch == 27) {
+        // Abandon an in-progress search
+        if (ed->cmdbuf[0] == '/') {
+            search_restore_origin(ed);
+            search_clear(&ed->search);
+            ed->cmdlen = 0;
+            ed->cmdbuf[0] = '\0';
+        }
         // ESC in command mode -> back to insert (only if file is created)
         if (ed->file_created) {
             ed->mode_insert = 1;
@@ -1155,12 +2533,66 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
     if (ch == '\n' || ch == '\r') {
         // execute command in cmdbuf
         if (ed->cmdlen > 0) {
-            if (ed->cmdbuf[0] == 'q' && ed->cmdbuf[1] == '\0') {
+            if (ed->cmdbuf[0] == '/') {
+                // Commit the search; a bare '/' repeats the last one
+                SearchState *s = &ed->search;
+                if (ed->cmdlen == 1 && s->last_pattern[0]) {
+                    search_set_pattern(s, s->last_pattern);
+                    search_restore_origin(ed);
+                    editor_search_next(ed, 1);
+                }
+                char msg[SEARCH_PATTERN_MAX + 32];
+                size_t hit_line, hit_col;
+                if (s->pattern[0] && !s->active) {
+                    search_restore_origin(ed);
+                    snprintf(msg, sizeof(msg), "Invalid pattern: %s", s->pattern);
+                    show_cmd_message(ed, msg);
+                } else if (s->active &&
+                           !search_find(s, buf, ed->cursor_line, ed->cursor_col, 1,
+                                        &hit_line, &hit_col)) {
+                    search_restore_origin(ed);
+                    snprintf(msg, sizeof(msg), "Pattern not found: %s", s->pattern);
+                    show_cmd_message(ed, msg);
+                } else if (s->active) {
+                    snprintf(s->last_pattern, sizeof(s->last_pattern), "%s", s->pattern);
+                }
+                s->has_origin = 0;
+            } else if (ed->cmdbuf[0] == 'q' && ed->cmdbuf[1] == '\0') {
                 ed->quit = 1;
             } else if (strcmp(ed->cmdbuf, "q!") == 0) {
                 // force quit (ignore modified)
                 ed->force_quit = 1;
                 ed->quit = 1;
+            } else if (strcmp(ed->cmdbuf, "e!") == 0) {
+                // reload from disk; unsaved edits are replaced but undoable
+                char msg[64];
+                long n = editor_reload_file(ed);
+                if (n < 0) snprintf(msg, sizeof(msg), "Cannot read the file");
+                else if (n == 0) snprintf(msg, sizeof(msg), "Buffer matches the file");
+                else snprintf(msg, sizeof(msg), "Reloaded: %ld change%s", n, n == 1 ? "" : "s");
+                if (!ed->message[0]) show_cmd_message(ed, msg);
+            } else if (strcmp(ed->cmdbuf, "%") == 0) {
+                // jump to the bracket matching the one at (or just before) the cursor
+                BracketMatch m;
+                if (brackets_match_at(&ed->brackets, buf, ed->cursor_line, ed->cursor_col, &m)) {
+                    ed->cursor_line = m.line[1];
+                    ed->cursor_col = m.col[1] + (m.col[0] != ed->cursor_col);
+                } else {
+                    show_cmd_message(ed, "No matching bracket");
+                }
+            } else if (strcmp(ed->cmdbuf, "fold") == 0) {
+                if (editor_fold(ed, ed->cursor_line) != 0)
+                    show_cmd_message(ed, "No block to fold here");
+            } else if (strcmp(ed->cmdbuf, "unfold") == 0) {
+                if (!folds_open(&ed->folds, ed->cursor_line))
+                    show_cmd_message(ed, "No fold here");
+            } else if (strcmp(ed->cmdbuf, "fold all") == 0) {
+                char msg[64];
+                size_t n = editor_fold_all(ed);
+                snprintf(msg, sizeof(msg), "%zu fold%s", n, n == 1 ? "" : "s");
+                show_cmd_message(ed, msg);
+            } else if (strcmp(ed->cmdbuf, "unfold all") == 0) {
+                folds_clear(&ed->folds);
             } else if (strcmp(ed->cmdbuf, "w") == 0) {
                 do_save_cmd(ed, cmd_win, maxx, 0);
             } else if (strcmp(ed->cmdbuf, "wq") == 0 || strcmp(ed->cmdbuf, "x") == 0) {
@@ -1168,6 +2600,78 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
             } else if (strcmp(ed->cmdbuf, "set rel") == 0) {
                 // set relative line numbers
                 ed->line_number_relative = 1;
+            } else if ((ed->cmdbuf[0] == 's' || strncmp(ed->cmdbuf, "%s", 2) == 0) &&
+                       ispunct((unsigned char)ed->cmdbuf[ed->cmdbuf[0] == '%' ? 2 : 1])) {
+                // substitute: s/pat/repl/[g] on this line, %s/... on all lines
+                char pat[SEARCH_PATTERN_MAX], repl[sizeof(ed->cmdbuf)];
+                char msg[SEARCH_PATTERN_MAX + 64];
+                int whole_file, global;
+                if (parse_substitute(ed->cmdbuf, &whole_file, pat, sizeof(pat),
+                                     repl, sizeof(repl), &global) != 0) {
+                    show_cmd_message(ed, "Usage: %s/pattern/replacement/[g]");
+                } else {
+                    size_t first = whole_file ? 0 : ed->cursor_line;
+                    size_t last = whole_file ? buf->count - 1 : ed->cursor_line;
+                    long n = editor_substitute(ed, first, last, pat, repl, global);
+                    if (n == -2)
+                        snprintf(msg, sizeof(msg), "Out of memory: nothing substituted");
+                    else if (n < 0)
+                        snprintf(msg, sizeof(msg), "Invalid pattern: %s", pat);
+                    else if (n == 0)
+                        snprintf(msg, sizeof(msg), "Pattern not found: %s", pat);
+                    else
+                        // a message already set here came from the large-file undo check
+                        snprintf(msg, sizeof(msg), "%ld substitution%s%s", n, n == 1 ? "" : "s",
+                                 ed->message[0] ? " (not undoable: large file)" : "");
+                    show_cmd_message(ed, msg);
+                }
+            } else if (strncmp(ed->cmdbuf, "grep ", 5) == 0 && ed->cmdbuf[5]) {
+                editor_start_grep(ed, ed->cmdbuf + 5);
+            } else if (strcmp(ed->cmdbuf, "cn") == 0 || strcmp(ed->cmdbuf, "cp") == 0) {
+                // next / previous quickfix entry
+                QuickfixList *qf = &ed->qf;
+                if (ed->cmdbuf[1] == 'n' && qf->sel + 1 < qf->count) qf->sel++;
+                if (ed->cmdbuf[1] == 'p' && qf->sel > 0) qf->sel--;
+                quickfix_jump(ed);
+            } else if (strcmp(ed->cmdbuf, "cc") == 0 || strncmp(ed->cmdbuf, "cc ", 3) == 0) {
+                // jump to quickfix entry N (1-based), or the selected one
+                int n = atoi(ed->cmdbuf + 2);
+                if (n > 0) ed->qf.sel = (size_t)(n - 1);
+                quickfix_jump(ed);
+            } else if (strcmp(ed->cmdbuf, "find") == 0 || strncmp(ed->cmdbuf, "find ", 5) == 0) {
+                // fuzzy file picker; any argument becomes the initial query
+                char dir[1024];
+                editor_file_dir(ed, dir, sizeof(dir));
+                finder_open(&ed->finder, dir);
+                if (ed->cmdbuf[4] == ' ')
+                    finder_set_query(&ed->finder, ed->cmdbuf + 5);
+                ed->cmdlen = 0;
+                ed->cmdbuf[0] = '\0';
+                return;
+            } else if (strcmp(ed->cmdbuf, "copen") == 0) {
+                ed->qf.open = 1;
+            } else if (strcmp(ed->cmdbuf, "cclose") == 0) {
+                ed->qf.open = 0;
+            } else if (strcmp(ed->cmdbuf, "profile on") == 0) {
+                // frame-time overlay; see profile.h
+                profile_enable(1);
+            } else if (strcmp(ed->cmdbuf, "profile off") == 0) {
+                profile_enable(0);
+            } else if (strcmp(ed->cmdbuf, "profile dump") == 0 ||
+                       strncmp(ed->cmdbuf, "profile dump ", 13) == 0) {
+                // write the rolling percentiles and raw samples to a file
+                const char *path = ed->cmdbuf[12] ? ed->cmdbuf + 13 : "jsvim-profile.log";
+                char msg[PATH_MAX + 32];
+                if (profile_frame_count() == 0)
+                    snprintf(msg, sizeof(msg), "No profile data (profile on first)");
+                else if (profile_dump(path) == 0)
+                    snprintf(msg, sizeof(msg), "Profile written to %s", path);
+                else
+                    snprintf(msg, sizeof(msg), "Cannot write %s", path);
+                show_cmd_message(ed, msg);
+            } else if (strcmp(ed->cmdbuf, "noh") == 0) {
+                // clear search highlighting
+                search_clear(&ed->search);
             } else if (strcmp(ed->cmdbuf, "set nu") == 0) {
                 // set absolute line numbers
                 ed->line_number_relative = 0;
@@ -1195,12 +2699,13 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
                 }
             } else {
                 // unknown command; show it briefly
-                wattron(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
-                for (int i = 0; i < maxx; i++) mvwaddch(cmd_win, 0, i, ' ');
-                mvwprintw(cmd_win, 0, 1, "Unknown command: %s", ed->cmdbuf);
-                wattroff(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
-                wrefresh(cmd_win);
+                char msg[sizeof(ed->cmdbuf) + 32];
+                snprintf(msg, sizeof(msg), "Unknown command: %s", ed->cmdbuf);
+                show_cmd_message(ed, msg);
             }
+        } else if (ed->qf.open && ed->qf.count > 0) {
+            // Enter on an empty command line picks the quickfix selection
+            quickfix_jump(ed);
         }
         // clear command buffer and go back to insert mode (unless quit)
         ed->cmdlen = 0;
@@ -1211,8 +2716,15 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
     
     if (ch == KEY_BACKSPACE || ch == 127 || ch == '\b') {
         if (ed->cmdlen > 0) {
+            int was_search = (ed->cmdbuf[0] == '/');
             ed->cmdlen--;
             ed->cmdbuf[ed->cmdlen] = '\0';
+            if (was_search && ed->cmdlen > 0) {
+                editor_incremental_search(ed);
+            } else if (was_search) {
+                search_restore_origin(ed);
+                search_clear(&ed->search);
+            }
         } else {
             // if empty, ESC to insert mode
             ed->mode_insert = 1;
@@ -1224,6 +2736,18 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
         if (ed->cmdlen + 1 < sizeof(ed->cmdbuf)) {
             ed->cmdbuf[ed->cmdlen++] = (char)ch;
             ed->cmdbuf[ed->cmdlen] = '\0';
+
+            if (ed->cmdbuf[0] == '/') {
+                SearchState *s = &ed->search;
+                if (ed->cmdlen == 1) {
+                    s->origin_line = ed->cursor_line;
+                    s->origin_col = ed->cursor_col;
+                    s->origin_scroll = ed->scroll_y;
+                    s->has_origin = 1;
+                } else {
+                    editor_incremental_search(ed);
+                }
+            }
         }
         return;
     }
@@ -1238,10 +2762,7 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
             }
         }
         if (amount <= 0) amount = 1;  // default to 1 if empty/invalid
-        if (ed->cursor_line >= (size_t)amount)
-            ed->cursor_line -= amount;
-        else
-            ed->cursor_line = 0;
+        ed->cursor_line = line_by_rows(ed, ed->cursor_line, -(long)amount);
         size_t len = strlen(buf->lines[ed->cursor_line]);
         if (ed->cursor_col > len) ed->cursor_col = len;
         if (ed->cursor_line < ed->scroll_y)
@@ -1261,10 +2782,8 @@ void editor_handle_command_mode(EditorState *ed, int ch, WINDOW *cmd_win, int ma
             }
         }
         if (amount <= 0) amount = 1;
-        if (ed->cursor_line + amount < buf->count)
-            ed->cursor_line += amount;
-        else if (buf->count > 0)
-            ed->cursor_line = buf->count - 1;
+        if (buf->count > 0)
+            ed->cursor_line = line_by_rows(ed, ed->cursor_line, amount);
         size_t len = strlen(buf->lines[ed->cursor_line]);
         if (ed->cursor_col > len) ed->cursor_col = len;
         // Clear cmdbuf after navigation
@@ -1279,18 +2798,44 @@ void editor_process_lsp(EditorState *ed) {
     Buffer *buf = &ed->buf;
 
     if (buf->lsp.stdout_fd != -1) {
-        char temp[4096];
-        ssize_t n = read(buf->lsp.stdout_fd, temp, sizeof(temp));
-        if (n > 0) {
+        long long prof = profile_begin();
+        char temp[65536];
+        ssize_t n;
+        size_t got = 0;
+        // Take everything the server has written so far (up to 1 MB a
+        // frame): a reply should wait on the parser below, not on one
+        // small read per tick
+        while (got < LSP_READ_MAX_PER_FRAME &&
+               (n = read(buf->lsp.stdout_fd, temp, sizeof(temp))) > 0) {
             lsp_append_data(&buf->lsp, temp, (size_t)n);
-
+            got += (size_t)n;
+            if ((size_t)n < sizeof(temp)) break;
+        }
+        if (buf->lsp.lsp_accum_len > 0) {
             // Parse at most one message per frame. A single completed
             // semantic-tokens payload can be multiple MB of JSON; doing the
             // cJSON_Parse for several queued messages in a single tick is
             // what makes the editor feel hung on big files. Remaining
             // messages stay in the accumulator and get parsed next frame.
-            try_parse_lsp_message(buf);
+            size_t before = buf->lsp.lsp_accum_len;
+            long long t0 = profile_begin();
+            int parsed = try_parse_lsp_message(buf);
+            long long parse_ns = profile_end(PROF_LSP, t0);
+            if (parsed == 1)
+                profile_lsp_message(before - buf->lsp.lsp_accum_len, parse_ns);
         }
+        profile_end(PROF_LSP, prof);
+    }
+
+    // A completion list just landed: filter it by what has been typed since
+    LspCompletion *c = &buf->completion;
+    if (c->fresh) {
+        c->fresh = 0;
+        if (ed->mode_insert && buf->count > 0 && c->line == ed->cursor_line &&
+            c->col == word_start_at_cursor(ed))
+            completion_filter(c, buf->lines[c->line] + c->col, ed->cursor_col - c->col);
+        else
+            completion_clear(c);
     }
 }
 
@@ -1299,8 +2844,10 @@ void editor_flush_lsp(EditorState *ed) {
     if (!buf->lsp_dirty) return;
 
     // No LSP attached, or filetype that doesn't use semantic tokens —
-    // nothing to flush. Clear the flag so we don't keep checking.
+    // nothing to flush. Clear the flag so we don't keep checking; a
+    // completion request sends the text first (lsp_unsent).
     if (buf->lsp.pid <= 0 || (buf->ft != FT_C && buf->ft != FT_CPP)) {
+        buf->lsp_unsent = buf->lsp.pid > 0;
         buf->lsp_dirty = 0;
         return;
     }
@@ -1308,6 +2855,7 @@ void editor_flush_lsp(EditorState *ed) {
     // File too large for full-file semantic tokens. Regex highlighting
     // already ran in editor_handle_insert_mode; that's all this file gets.
     if (buf->count > LSP_SEMTOK_MAX_LINES) {
+        buf->lsp_unsent = 1;
         buf->lsp_dirty = 0;
         return;
     }
@@ -5,6 +5,19 @@
 #include <ncurses.h>
 #include <time.h>
 #include "buffer.h"
+#include "search.h"
+#include "grep.h"
+#include "finder.h"
+#include "journal.h"
+#include "watch.h"
+#include "brackets.h"
+#include "fold.h"
+#include "words.h"
+#include "changes.h"
+
+// Large-file mode thresholds unless ~/.jsvimrc overrides them
+#define LARGE_FILE_MB_DEFAULT    64
+#define LARGE_FILE_LINES_DEFAULT 1000000
 
 typedef struct {
     size_t line;
@@ -25,6 +38,12 @@ typedef struct {
     // Text replaced: old_text (pre range contents) -> new_text (post range contents)
     char *old_text;
     char *new_text;
+    // Line-swap delta (bulk substitute): the line pointers swapped out of
+    // the buffer. Undo and redo both swap them back in, so no text is
+    // copied and the range fields above are unused.
+    size_t *swap_lines;
+    char **swap_text;
+    size_t swap_count;
     CursorPos cursor_before;
     CursorPos cursor_after;
 } UndoDelta;
@@ -74,6 +93,46 @@ typedef struct {
     UndoHistory history;
     long long last_edit_time_ms;
     int has_last_edit_time;
+
+    // '/' search
+    SearchState search;
+
+    // :grep scan (NULL when none has run) and the quickfix list it fills
+    GrepJob *grep;
+    QuickfixList qf;
+
+    // :find fuzzy file picker
+    FinderState finder;
+
+    // One-line message for the command bar, cleared by the next keypress
+    char message[256];
+
+    // Large-file mode: set by editor_load_file when the file crosses either
+    // threshold (editor.large_file_mb / editor.large_file_lines, 0 = off)
+    long long large_file_bytes;
+    size_t large_file_lines;
+    int large_file;
+
+    // Crash-recovery journal of edits since the last save, and the prompt
+    // shown when an earlier session left one behind
+    Journal journal;
+    int pending_recover_prompt;
+
+    // inotify watch on the file, for reloading changes made on disk
+    FileWatch watch;
+
+    // Bracket nesting, for %, the matching-bracket highlight and indenting
+    BracketIndex brackets;
+
+    // Closed folds
+    FoldSet folds;
+
+    // Buffer words for Ctrl-N / Ctrl-P, and the completion being cycled
+    WordIndex words;
+    WordCompletion completion;
+
+    // Added/modified/deleted signs against git HEAD, diffed on a thread
+    ChangeSigns changes;
 } EditorState;
 
 // Load editor configuration from ~/.jsvimrc
@@ -85,7 +144,9 @@ const char *editor_get_indent_str(EditorState *ed);
 // Get the current line's indentation
 char *editor_get_line_indent(const char *line);
 
-// Get auto-indent for new line based on language and previous line
+// Get auto-indent for a new line split off at the cursor, based on
+// language and the previous line; C-like files use the innermost bracket
+// still open at the cursor
 char *editor_auto_indent(EditorState *ed, const char *prev_line);
 
 // Initialize editor state
@@ -98,9 +159,71 @@ void editor_cleanup(EditorState *ed);
 void editor_undo(EditorState *ed);
 void editor_redo(EditorState *ed);
 
+// Replace matches of `pattern` with `repl` on lines [first, last] in one
+// pass, recorded as a single undo entry. Returns the number of
+// replacements, -1 if the pattern is invalid, or -2 if out of memory (the
+// buffer is left unchanged).
+long editor_substitute(EditorState *ed, size_t first, size_t last,
+                       const char *pattern, const char *repl, int global);
+
+// Load `path` into ed->buf. Files at or over the configured size or line
+// count open in large-file mode: read via load_file_mapped, highlighted
+// only around the viewport, no language server, and mass edits are not
+// kept for undo. Returns load_file's result (non-zero if unreadable).
+int editor_load_file(EditorState *ed, const char *path);
+
+// Start journaling the current file's edits. If an earlier session left
+// unsaved edits in a journal, raise the recovery prompt instead; it is
+// answered in command mode (y replays them, n discards them).
+void editor_start_journal(EditorState *ed);
+
+// Start (or restart) the change signs for the current file: diffed
+// against git HEAD, or the saved file outside git. None for new or
+// large files.
+void editor_open_changes(EditorState *ed);
+
+// Make the buffer match the file on disk. Growth at the end is read
+// and appended on its own; any other change is diffed by line and only
+// the changed hunks are replaced, kept as one undo entry. Cursor, undo
+// history and the highlighting of unchanged lines survive. Returns the
+// number of hunks replaced, or -1 if the file cannot be read.
+long editor_reload_file(EditorState *ed);
+
+// Act on the watch: reload after an external change, or only say so if
+// the buffer has unsaved edits (e! then reloads). Returns 1 if the
+// buffer changed.
+int editor_poll_file(EditorState *ed);
+
+// Fold the block around `line`: from its opening bracket to the closing
+// one in C-like files, else the lines indented under its header line.
+// Returns 0, or -1 if there is no block or it crosses a closed fold.
+int editor_fold(EditorState *ed, size_t line);
+
+// Fold every block, nested ones included. Returns the number folded.
+size_t editor_fold_all(EditorState *ed);
+
+// Replace the buffer with another file (used by the quickfix list).
+// Refuses with -1 if the current buffer has unsaved changes.
+int editor_open_file(EditorState *ed, const char *path);
+
+// Move finished :grep hits into the quickfix list. Returns 1 while the
+// scan is still running.
+int editor_poll_grep(EditorState *ed);
+
+// Insert a block of text (e.g. a bracketed paste) at the cursor as one
+// buffer splice and one undo entry. Returns 0 on success, -1 on OOM.
+int editor_insert_text(EditorState *ed, const char *text, size_t len);
+
+// 1 while the LSP completion popup is on screen: a list for the word
+// at the cursor that has matches and was not dismissed
+int editor_completion_visible(EditorState *ed);
+
 // Handle input in insert mode
 void editor_handle_insert_mode(EditorState *ed, int ch, int visible_rows);
 
+// Handle input while the :find picker is open
+void editor_handle_finder(EditorState *ed, int ch);
+
 // Handle input in command mode
 void editor_handle_command_mode(EditorState *ed, int ch, 
                                 WINDOW *cmd_win, int maxx);
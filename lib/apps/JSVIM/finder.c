@@ -0,0 +1,772 @@
+// finder.c - Fuzzy file finder over a cached project file index
+//
+// The index is a list of directory records (path, mtime, file names),
+// saved under ~/.cache/jsvim. Opening the picker loads the saved records
+// and refreshes them on a pool of threads: a directory whose mtime has not
+// changed keeps its record as-is, a changed one is listed again, and only
+// directories that are new get walked. With no saved index the whole tree
+// is walked by the same pool. The records are then flattened into a
+// FileIndex that the main thread ranks on every keystroke.
+#include "finder.h"
+#include "ignore.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define FINDER_CACHE_MAGIC "jsvim-files 1"
+
+typedef struct {
+    char *rel;            // directory relative to top ("" for top itself)
+    long long mtime_ns;
+    char **names;         // file basenames
+    size_t nnames;
+} DirRecord;
+
+enum { WALK_FULL, WALK_CHECK };
+
+typedef struct {
+    char *rel;
+    IgnoreNode *ign;      // rules of the parent directory (WALK_FULL)
+    int mode;
+    DirRecord old;        // saved record (WALK_CHECK)
+} WalkItem;
+
+struct FinderBuild {
+    char top[1024];
+    char cache_path[PATH_MAX];
+    pthread_t thread;
+    volatile int cancel;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    WalkItem *queue;
+    size_t qhead;
+    size_t qcount;
+    size_t qcap;
+    size_t busy;          // items queued or being processed
+
+    DirRecord *dirs;      // output records
+    size_t ndirs;
+    size_t dircap;
+
+    IgnoreNode **nodes;   // every rule set loaded, freed at the end
+    size_t nnodes;
+    size_t nodecap;
+
+    // Directories present in the saved index (read-only once workers run)
+    char **known;
+    size_t known_cap;
+
+    FileIndex *result;
+    int done;
+};
+
+static void record_free(DirRecord *r) {
+    free(r->rel);
+    for (size_t i = 0; i < r->nnames; i++) free(r->names[i]);
+    free(r->names);
+    memset(r, 0, sizeof(*r));
+}
+
+// ---- known-directory set (open addressing, FNV-1a) -----------------------
+
+static uint64_t fnv1a(const char *s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void known_add(FinderBuild *b, const char *rel) {
+    size_t mask = b->known_cap - 1;
+    for (size_t i = fnv1a(rel) & mask; ; i = (i + 1) & mask) {
+        if (!b->known[i]) {
+            b->known[i] = dupstr(rel);
+            return;
+        }
+        if (strcmp(b->known[i], rel) == 0) return;
+    }
+}
+
+static int known_has(const FinderBuild *b, const char *rel) {
+    if (!b->known) return 0;
+    size_t mask = b->known_cap - 1;
+    for (size_t i = fnv1a(rel) & mask; b->known[i]; i = (i + 1) & mask) {
+        if (strcmp(b->known[i], rel) == 0) return 1;
+    }
+    return 0;
+}
+
+// ---- work queue ----------------------------------------------------------
+
+static void walk_push(FinderBuild *b, WalkItem *item) {
+    pthread_mutex_lock(&b->lock);
+    if (b->qcount == b->qcap) {
+        if (b->qhead > 0) {
+            memmove(b->queue, b->queue + b->qhead, (b->qcount - b->qhead) * sizeof(WalkItem));
+            b->qcount -= b->qhead;
+            b->qhead = 0;
+        }
+        if (b->qcount == b->qcap) {
+            size_t ncap = b->qcap ? b->qcap * 2 : 256;
+            WalkItem *tmp = realloc(b->queue, ncap * sizeof(WalkItem));
+            if (!tmp) {
+                pthread_mutex_unlock(&b->lock);
+                free(item->rel);
+                record_free(&item->old);
+                return;
+            }
+            b->queue = tmp;
+            b->qcap = ncap;
+        }
+    }
+    b->queue[b->qcount++] = *item;
+    b->busy++;
+    pthread_cond_signal(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void keep_record(FinderBuild *b, DirRecord *r) {
+    pthread_mutex_lock(&b->lock);
+    if (b->ndirs == b->dircap) {
+        size_t ncap = b->dircap ? b->dircap * 2 : 256;
+        DirRecord *tmp = realloc(b->dirs, ncap * sizeof(DirRecord));
+        if (!tmp) {
+            pthread_mutex_unlock(&b->lock);
+            record_free(r);
+            return;
+        }
+        b->dirs = tmp;
+        b->dircap = ncap;
+    }
+    b->dirs[b->ndirs++] = *r;
+    pthread_mutex_unlock(&b->lock);
+}
+
+static IgnoreNode *load_rules(FinderBuild *b, IgnoreNode *parent, const char *rel) {
+    IgnoreNode *n = ignore_load(parent, b->top, rel);
+    if (n == parent) return n;
+    pthread_mutex_lock(&b->lock);
+    if (b->nnodes == b->nodecap) {
+        size_t ncap = b->nodecap ? b->nodecap * 2 : 64;
+        IgnoreNode **tmp = realloc(b->nodes, ncap * sizeof(IgnoreNode *));
+        if (!tmp) {
+            pthread_mutex_unlock(&b->lock);
+            ignore_free(n);
+            return parent;
+        }
+        b->nodes = tmp;
+        b->nodecap = ncap;
+    }
+    b->nodes[b->nnodes++] = n;
+    pthread_mutex_unlock(&b->lock);
+    return n;
+}
+
+// Rules in effect inside `rel`: every .gitignore from top down to it
+static IgnoreNode *load_rules_chain(FinderBuild *b, const char *rel) {
+    IgnoreNode *ign = load_rules(b, NULL, "");
+    char part[PATH_MAX];
+    for (const char *p = rel; *p; ) {
+        const char *slash = strchr(p, '/');
+        size_t end = slash ? (size_t)(slash - rel) : strlen(rel);
+        snprintf(part, sizeof(part), "%.*s", (int)end, rel);
+        ign = load_rules(b, ign, part);
+        p = slash ? slash + 1 : rel + end;
+    }
+    return ign;
+}
+
+// ---- directory scan ------------------------------------------------------
+
+static long long stat_mtime_ns(const struct stat *sb) {
+    return (long long)sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+}
+
+// List one directory into a record. Subdirectories are queued when
+// `recurse_all` is set, otherwise only those missing from the saved index.
+static void scan_dir(FinderBuild *b, const char *rel, IgnoreNode *ign, int recurse_all) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s%s", b->top, *rel ? "/" : "", rel);
+    DIR *d = opendir(path);
+    if (!d) return;
+
+    DirRecord rec = {0};
+    struct stat sb;
+    if (fstat(dirfd(d), &sb) == 0) rec.mtime_ns = stat_mtime_ns(&sb);
+    rec.rel = dupstr(rel);
+    size_t cap = 0;
+
+    struct dirent *de;
+    while (!b->cancel && (de = readdir(d)) != NULL) {
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, ".git") == 0 || strchr(name, '\n'))
+            continue;
+
+        char child[PATH_MAX];
+        int n = snprintf(child, sizeof(child), "%s%s%s", rel, *rel ? "/" : "", name);
+        if (n < 0 || (size_t)n >= sizeof(child)) continue;
+
+        // Symlinks are not followed, so a link cycle can't trap the walk
+        int type = de->d_type;
+        if (type == DT_UNKNOWN) {
+            char full[PATH_MAX];
+            if (snprintf(full, sizeof(full), "%s/%s", b->top, child) >= (int)sizeof(full) ||
+                lstat(full, &sb) != 0)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG : DT_LNK;
+        }
+        if (type != DT_DIR && type != DT_REG) continue;
+        if (ignore_match(ign, child, name, type == DT_DIR)) continue;
+
+        if (type == DT_DIR) {
+            if (recurse_all || !known_has(b, child)) {
+                WalkItem item = { dupstr(child), ign, WALK_FULL, {0} };
+                walk_push(b, &item);
+            }
+            continue;
+        }
+
+        if (rec.nnames == cap) {
+            size_t ncap = cap ? cap * 2 : 16;
+            char **tmp = realloc(rec.names, ncap * sizeof(char *));
+            if (!tmp) break;
+            rec.names = tmp;
+            cap = ncap;
+        }
+        rec.names[rec.nnames++] = dupstr(name);
+    }
+    closedir(d);
+    keep_record(b, &rec);
+}
+
+static void process_item(FinderBuild *b, WalkItem *item) {
+    if (item->mode == WALK_FULL) {
+        IgnoreNode *ign = load_rules(b, item->ign, item->rel);
+        scan_dir(b, item->rel, ign, 1);
+        free(item->rel);
+        return;
+    }
+
+    // WALK_CHECK: an unchanged mtime means no entry was added, removed or
+    // renamed, so the saved record still holds.
+    char path[PATH_MAX];
+    struct stat sb;
+    snprintf(path, sizeof(path), "%s%s%s", b->top, *item->old.rel ? "/" : "", item->old.rel);
+    if (lstat(path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+        record_free(&item->old);
+    } else if (stat_mtime_ns(&sb) == item->old.mtime_ns) {
+        keep_record(b, &item->old);
+    } else {
+        IgnoreNode *ign = load_rules_chain(b, item->old.rel);
+        scan_dir(b, item->old.rel, ign, 0);
+        record_free(&item->old);
+    }
+}
+
+static void *walk_worker(void *arg) {
+    FinderBuild *b = arg;
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        while (b->qhead == b->qcount && b->busy > 0 && !b->cancel)
+            pthread_cond_wait(&b->cond, &b->lock);
+        if (b->cancel || b->qhead == b->qcount) {
+            pthread_mutex_unlock(&b->lock);
+            break;
+        }
+        WalkItem item = b->queue[b->qhead++];
+        pthread_mutex_unlock(&b->lock);
+
+        if (b->cancel) {
+            free(item.rel);
+            record_free(&item.old);
+        } else {
+            process_item(b, &item);
+        }
+
+        pthread_mutex_lock(&b->lock);
+        if (--b->busy == 0) pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+// ---- on-disk cache -------------------------------------------------------
+
+static void cache_path_for(const char *top, char *out, size_t outsz) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+    if (xdg && *xdg) snprintf(dir, sizeof(dir), "%s/jsvim", xdg);
+    else if (home) snprintf(dir, sizeof(dir), "%s/.cache/jsvim", home);
+    else { out[0] = '\0'; return; }
+    if (snprintf(out, outsz, "%s/files-%016llx", dir,
+                 (unsigned long long)fnv1a(top)) >= (int)outsz)
+        out[0] = '\0';
+}
+
+// Format: magic line, "T <top>", then per directory "D <mtime_ns> <rel>"
+// followed by one "F <name>" line per file in it.
+static int cache_load(FinderBuild *b, DirRecord **out, size_t *nout) {
+    FILE *fp = b->cache_path[0] ? fopen(b->cache_path, "r") : NULL;
+    if (!fp) return -1;
+
+    char *line = NULL;
+    size_t lcap = 0;
+    ssize_t len;
+    DirRecord *dirs = NULL;
+    size_t ndirs = 0, dcap = 0, ncap = 0;
+    int ok = 0;
+
+    if ((len = getline(&line, &lcap, fp)) > 0 && strcmp(line, FINDER_CACHE_MAGIC "\n") == 0 &&
+        (len = getline(&line, &lcap, fp)) > 2 && line[0] == 'T') {
+        line[len - 1] = '\0';
+        ok = strcmp(line + 2, b->top) == 0;
+    }
+
+    while (ok && (len = getline(&line, &lcap, fp)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        if (line[0] == 'D' && line[1] == ' ') {
+            char *end;
+            long long mt = strtoll(line + 2, &end, 10);
+            if (*end != ' ') { ok = 0; break; }
+            if (ndirs == dcap) {
+                size_t nc = dcap ? dcap * 2 : 256;
+                DirRecord *tmp = realloc(dirs, nc * sizeof(DirRecord));
+                if (!tmp) { ok = 0; break; }
+                dirs = tmp;
+                dcap = nc;
+            }
+            DirRecord *r = &dirs[ndirs++];
+            memset(r, 0, sizeof(*r));
+            r->rel = dupstr(end + 1);
+            r->mtime_ns = mt;
+            ncap = 0;
+        } else if (line[0] == 'F' && line[1] == ' ' && ndirs > 0) {
+            DirRecord *r = &dirs[ndirs - 1];
+            if (r->nnames == ncap) {
+                size_t nc = ncap ? ncap * 2 : 16;
+                char **tmp = realloc(r->names, nc * sizeof(char *));
+                if (!tmp) { ok = 0; break; }
+                r->names = tmp;
+                ncap = nc;
+            }
+            r->names[r->nnames++] = dupstr(line + 2);
+        } else {
+            ok = 0;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (!ok) {
+        for (size_t i = 0; i < ndirs; i++) record_free(&dirs[i]);
+        free(dirs);
+        return -1;
+    }
+    *out = dirs;
+    *nout = ndirs;
+    return 0;
+}
+
+static void cache_save(FinderBuild *b) {
+    if (!b->cache_path[0] || mkdir_parents(b->cache_path) != 0) return;
+
+    // Write a temp file and rename it, so a crash never leaves half an index
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.%d", b->cache_path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return;
+    fprintf(fp, FINDER_CACHE_MAGIC "\nT %s\n", b->top);
+    for (size_t i = 0; i < b->ndirs; i++) {
+        const DirRecord *r = &b->dirs[i];
+        fprintf(fp, "D %lld %s\n", r->mtime_ns, r->rel);
+        for (size_t j = 0; j < r->nnames; j++)
+            fprintf(fp, "F %s\n", r->names[j]);
+    }
+    if (fclose(fp) != 0 || rename(tmp, b->cache_path) != 0)
+        unlink(tmp);
+}
+
+// ---- flat index ----------------------------------------------------------
+
+static int cmp_record(const void *a, const void *b) {
+    return strcmp(((const DirRecord *)a)->rel, ((const DirRecord *)b)->rel);
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static FileIndex *index_alloc(const char *top, size_t count, size_t bytes) {
+    FileIndex *ix = calloc(1, sizeof(FileIndex));
+    if (!ix) return NULL;
+    snprintf(ix->top, sizeof(ix->top), "%s", top);
+    ix->entries = malloc((count ? count : 1) * sizeof(FinderEntry));
+    ix->blob = malloc(bytes ? bytes : 1);
+    if (!ix->entries || !ix->blob) {
+        finder_index_free(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+// Append "dir/name" and its lower-case copy to the blob
+static void index_add(FileIndex *ix, char **cursor, const char *dir, const char *name) {
+    char *p = *cursor;
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    size_t len = dlen + (dlen ? 1 : 0) + nlen;
+
+    FinderEntry *e = &ix->entries[ix->count++];
+    e->path = p;
+    memcpy(p, dir, dlen);
+    if (dlen) p[dlen] = '/';
+    memcpy(p + len - nlen, name, nlen + 1);
+    p += len + 1;
+
+    e->lower = p;
+    for (size_t i = 0; i <= len; i++) p[i] = (char)tolower((unsigned char)e->path[i]);
+    p += len + 1;
+
+    e->len = (uint32_t)len;
+    e->base = (uint32_t)(len - nlen);
+    *cursor = p;
+}
+
+static FileIndex *index_flatten(const char *top, DirRecord *dirs, size_t ndirs) {
+    if (ndirs > 1) qsort(dirs, ndirs, sizeof(DirRecord), cmp_record);
+
+    size_t count = 0, bytes = 0;
+    for (size_t i = 0; i < ndirs; i++) {
+        size_t dlen = strlen(dirs[i].rel);
+        if (dirs[i].nnames > 1)
+            qsort(dirs[i].names, dirs[i].nnames, sizeof(char *), cmp_name);
+        for (size_t j = 0; j < dirs[i].nnames; j++)
+            bytes += 2 * (dlen + 1 + strlen(dirs[i].names[j]) + 1);
+        count += dirs[i].nnames;
+    }
+
+    FileIndex *ix = index_alloc(top, count, bytes);
+    if (!ix) return NULL;
+    char *cursor = ix->blob;
+    for (size_t i = 0; i < ndirs; i++)
+        for (size_t j = 0; j < dirs[i].nnames; j++)
+            index_add(ix, &cursor, dirs[i].rel, dirs[i].names[j]);
+    return ix;
+}
+
+FileIndex *finder_index_from_paths(const char *top, char **paths, size_t n) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) bytes += 2 * (strlen(paths[i]) + 1);
+    FileIndex *ix = index_alloc(top, n, bytes);
+    if (!ix) return NULL;
+    char *cursor = ix->blob;
+    for (size_t i = 0; i < n; i++) {
+        const char *slash = strrchr(paths[i], '/');
+        if (slash) {
+            char dir[PATH_MAX];
+            snprintf(dir, sizeof(dir), "%.*s", (int)(slash - paths[i]), paths[i]);
+            index_add(ix, &cursor, dir, slash + 1);
+        } else {
+            index_add(ix, &cursor, "", paths[i]);
+        }
+    }
+    return ix;
+}
+
+void finder_index_free(FileIndex *ix) {
+    if (!ix) return;
+    free(ix->entries);
+    free(ix->blob);
+    free(ix);
+}
+
+// ---- build thread --------------------------------------------------------
+
+static void *build_main(void *arg) {
+    FinderBuild *b = arg;
+
+    DirRecord *saved = NULL;
+    size_t nsaved = 0;
+    if (cache_load(b, &saved, &nsaved) == 0) {
+        // Refresh: every saved directory is re-checked by the pool
+        b->known_cap = 64;
+        while (b->known_cap < nsaved * 2) b->known_cap *= 2;
+        b->known = calloc(b->known_cap, sizeof(char *));
+        if (b->known) {
+            for (size_t i = 0; i < nsaved; i++) known_add(b, saved[i].rel);
+            for (size_t i = 0; i < nsaved; i++) {
+                WalkItem item = { NULL, NULL, WALK_CHECK, saved[i] };
+                walk_push(b, &item);
+            }
+        } else {
+            for (size_t i = 0; i < nsaved; i++) record_free(&saved[i]);
+        }
+        free(saved);
+    }
+    if (b->busy == 0) {
+        WalkItem item = { dupstr(""), NULL, WALK_FULL, {0} };
+        walk_push(b, &item);
+    }
+
+    pthread_t workers[FINDER_MAX_THREADS];
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = ncpu < 1 ? 1 : ncpu > FINDER_MAX_THREADS ? FINDER_MAX_THREADS : (int)ncpu;
+    int started = 0;
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&workers[started], NULL, walk_worker, b) != 0) break;
+        started++;
+    }
+    walk_worker(b);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    // Anything left in the queue after a cancel
+    for (size_t i = b->qhead; i < b->qcount; i++) {
+        free(b->queue[i].rel);
+        record_free(&b->queue[i].old);
+    }
+
+    FileIndex *ix = NULL;
+    if (!b->cancel) {
+        cache_save(b);
+        ix = index_flatten(b->top, b->dirs, b->ndirs);
+    }
+
+    pthread_mutex_lock(&b->lock);
+    b->result = ix;
+    b->done = 1;
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+static FinderBuild *build_start(const char *top) {
+    FinderBuild *b = calloc(1, sizeof(FinderBuild));
+    if (!b) return NULL;
+    snprintf(b->top, sizeof(b->top), "%s", top);
+    cache_path_for(b->top, b->cache_path, sizeof(b->cache_path));
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    if (pthread_create(&b->thread, NULL, build_main, b) != 0) {
+        pthread_mutex_destroy(&b->lock);
+        pthread_cond_destroy(&b->cond);
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+static void build_free(FinderBuild *b) {
+    if (!b) return;
+    b->cancel = 1;
+    pthread_mutex_lock(&b->lock);
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+    pthread_join(b->thread, NULL);
+
+    finder_index_free(b->result);
+    for (size_t i = 0; i < b->ndirs; i++) record_free(&b->dirs[i]);
+    free(b->dirs);
+    free(b->queue);
+    for (size_t i = 0; i < b->nnodes; i++) ignore_free(b->nodes[i]);
+    free(b->nodes);
+    for (size_t i = 0; b->known && i < b->known_cap; i++) free(b->known[i]);
+    free(b->known);
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->cond);
+    free(b);
+}
+
+// ---- ranking -------------------------------------------------------------
+
+static int is_separator(char c) {
+    return c == '/' || c == '_' || c == '-' || c == '.' || c == ' ';
+}
+
+int finder_score(const FinderEntry *e, const char *q, size_t qlen, int *score) {
+    const char *s = e->lower;
+    const char *end = s + e->len;
+
+    // Forward pass with memchr: rejects non-matches quickly and finds the
+    // end of the leftmost match.
+    const char *p = s;
+    for (size_t i = 0; i < qlen; i++) {
+        p = memchr(p, q[i], (size_t)(end - p));
+        if (!p) return 0;
+        p++;
+    }
+
+    // Backward pass from that end for the tightest start, so "ab" in
+    // "a/x/ab" scores the adjacent pair rather than the first 'a'.
+    const char *start = p;
+    for (size_t i = qlen; i > 0; ) {
+        start--;
+        if (*start == q[i - 1]) i--;
+    }
+
+    int sc = 0;
+    long last = -2;
+    size_t qi = 0;
+    for (const char *c = start; c < p && qi < qlen; c++) {
+        long pos = (long)(c - s);
+        if (*c != q[qi]) {
+            sc -= 1;  // gap inside the match
+            continue;
+        }
+        int bonus = 16;
+        char prev = pos > 0 ? e->path[pos - 1] : '/';
+        if (is_separator(prev))
+            bonus += (pos == (long)e->base) ? 24 : 12;
+        else if (isupper((unsigned char)e->path[pos]) && islower((unsigned char)prev))
+            bonus += 10;
+        if (last == pos - 1) bonus += 12;
+        if (pos >= (long)e->base) bonus += 4;
+        sc += bonus;
+        last = pos;
+        qi++;
+    }
+    sc -= (int)(e->len >> 3);  // shorter paths win ties
+    *score = sc;
+    return 1;
+}
+
+// Keep the best FINDER_MAX_RESULTS, sorted by descending score
+static void results_offer(FinderState *f, uint32_t idx, int score) {
+    size_t n = f->nresults;
+    if (n == FINDER_MAX_RESULTS && score <= f->results[n - 1].score) return;
+    size_t pos = n < FINDER_MAX_RESULTS ? n : n - 1;
+    while (pos > 0 && f->results[pos - 1].score < score) {
+        f->results[pos] = f->results[pos - 1];
+        pos--;
+    }
+    f->results[pos].idx = idx;
+    f->results[pos].score = score;
+    if (n < FINDER_MAX_RESULTS) f->nresults++;
+}
+
+static void finder_rank(FinderState *f) {
+    f->nresults = 0;
+    f->total = 0;
+    f->sel = 0;
+    f->top_row = 0;
+    FileIndex *ix = f->index;
+    if (!ix) return;
+
+    if (f->qlen == 0) {
+        for (size_t i = 0; i < ix->count && i < FINDER_MAX_RESULTS; i++) {
+            f->results[i].idx = (uint32_t)i;
+            f->results[i].score = 0;
+        }
+        f->nresults = ix->count < FINDER_MAX_RESULTS ? ix->count : FINDER_MAX_RESULTS;
+        f->total = ix->count;
+        f->cand_valid = 0;
+        return;
+    }
+
+    char q[FINDER_QUERY_MAX];
+    for (size_t i = 0; i <= f->qlen; i++) q[i] = (char)tolower((unsigned char)f->query[i]);
+
+    // A query that extends the previous one can only match a subset of
+    // its candidates; filter them in place instead of rescanning the index.
+    int narrow = f->cand_valid &&
+                 strncmp(q, f->cand_query, strlen(f->cand_query)) == 0;
+    if (!narrow && f->cand_cap < ix->count) {
+        uint32_t *tmp = realloc(f->cand, ix->count * sizeof(uint32_t));
+        if (!tmp) return;
+        f->cand = tmp;
+        f->cand_cap = ix->count;
+    }
+
+    size_t src_n = narrow ? f->ncand : ix->count;
+    size_t out = 0;
+    int score;
+    for (size_t k = 0; k < src_n; k++) {
+        uint32_t idx = narrow ? f->cand[k] : (uint32_t)k;
+        if (!finder_score(&ix->entries[idx], q, f->qlen, &score)) continue;
+        f->cand[out++] = idx;
+        results_offer(f, idx, score);
+    }
+    f->ncand = out;
+    f->total = out;
+    snprintf(f->cand_query, sizeof(f->cand_query), "%s", q);
+    f->cand_valid = 1;
+}
+
+// ---- picker state --------------------------------------------------------
+
+void finder_init(FinderState *f) {
+    memset(f, 0, sizeof(*f));
+}
+
+void finder_free(FinderState *f) {
+    build_free(f->build);
+    finder_index_free(f->index);
+    free(f->cand);
+    memset(f, 0, sizeof(*f));
+}
+
+void finder_open(FinderState *f, const char *dir) {
+    char abs[PATH_MAX];
+    size_t top_len = ignore_find_top(dir, abs, sizeof(abs));
+    abs[top_len ? top_len : strlen(abs)] = '\0';
+
+    // A different project drops the old index; the same one keeps serving
+    // it while the refresh runs.
+    if (f->index && strcmp(f->index->top, abs) != 0) {
+        finder_index_free(f->index);
+        f->index = NULL;
+        f->cand_valid = 0;
+    }
+    if (f->build && strcmp(f->build->top, abs) != 0) {
+        build_free(f->build);
+        f->build = NULL;
+    }
+    if (!f->build) f->build = build_start(abs);
+
+    f->active = 1;
+    f->query[0] = '\0';
+    f->qlen = 0;
+    finder_rank(f);
+}
+
+int finder_poll(FinderState *f) {
+    if (!f->build) return 0;
+    pthread_mutex_lock(&f->build->lock);
+    int done = f->build->done;
+    FileIndex *ix = f->build->result;
+    if (done) f->build->result = NULL;
+    pthread_mutex_unlock(&f->build->lock);
+    if (!done) return 1;
+
+    build_free(f->build);
+    f->build = NULL;
+    if (ix) {
+        finder_index_free(f->index);
+        f->index = ix;
+        f->cand_valid = 0;
+        finder_rank(f);
+    }
+    return 0;
+}
+
+void finder_set_query(FinderState *f, const char *query) {
+    snprintf(f->query, sizeof(f->query), "%s", query);
+    f->qlen = strlen(f->query);
+    finder_rank(f);
+}
+
+const char *finder_selected(const FinderState *f, char *out, size_t outsz) {
+    if (!f->index || f->sel >= f->nresults) return NULL;
+    const FinderEntry *e = &f->index->entries[f->results[f->sel].idx];
+    snprintf(out, outsz, "%s/%s", f->index->top, e->path);
+    return out;
+}
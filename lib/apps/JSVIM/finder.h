@@ -0,0 +1,87 @@
+// finder.h - Fuzzy file finder over a cached project file index
+#ifndef FINDER_H
+#define FINDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define FINDER_QUERY_MAX   256
+#define FINDER_MAX_RESULTS 200   // best matches kept per query
+#define FINDER_MAX_THREADS 16
+
+// One indexed file. `path` is relative to the index top; `lower` is the
+// same path folded to lower case for matching.
+typedef struct {
+    const char *path;
+    const char *lower;
+    uint32_t len;
+    uint32_t base;   // offset of the basename within path
+} FinderEntry;
+
+// Flat, read-only view of every file under `top` (repository root or the
+// directory of the current file). All strings live in one blob.
+typedef struct {
+    char top[1024];
+    FinderEntry *entries;
+    size_t count;
+    char *blob;
+} FileIndex;
+
+typedef struct {
+    uint32_t idx;
+    int score;
+} FinderMatch;
+
+// Background load/refresh/build of an index (see finder.c)
+typedef struct FinderBuild FinderBuild;
+
+typedef struct {
+    int active;                   // picker is open and owns the keyboard
+    char query[FINDER_QUERY_MAX];
+    size_t qlen;
+
+    FileIndex *index;             // index being searched (main thread only)
+    FinderBuild *build;           // running build/refresh, or NULL
+
+    // Every entry matching cand_query. A query that extends it only has
+    // to re-score these, so each keystroke narrows the previous result.
+    uint32_t *cand;
+    size_t ncand;
+    size_t cand_cap;
+    char cand_query[FINDER_QUERY_MAX];
+    int cand_valid;
+
+    FinderMatch results[FINDER_MAX_RESULTS];  // best first
+    size_t nresults;
+    size_t total;                 // number of matching files
+    size_t sel;
+    size_t top_row;
+} FinderState;
+
+void finder_init(FinderState *f);
+void finder_free(FinderState *f);
+
+// Open the picker for the project containing `dir`. The on-disk index is
+// loaded and refreshed (or built from scratch) on a background thread;
+// until it is ready the previous index, if any, keeps serving queries.
+void finder_open(FinderState *f, const char *dir);
+
+// Swap in a finished build and re-rank. Returns 1 while a build is running.
+int finder_poll(FinderState *f);
+
+// Replace the query and re-rank
+void finder_set_query(FinderState *f, const char *query);
+
+// Full path of the selected match, or NULL if there is none
+const char *finder_selected(const FinderState *f, char *out, size_t outsz);
+
+// Score `lower` (already lower-cased) against a lower-cased query.
+// Returns 1 and the score on a match, 0 if the query is not a subsequence.
+int finder_score(const FinderEntry *e, const char *q, size_t qlen, int *score);
+
+// Build or load an index synchronously (used by benchmarks)
+FileIndex *finder_index_from_paths(const char *top, char **paths, size_t n);
+void finder_index_free(FileIndex *ix);
+
+#endif
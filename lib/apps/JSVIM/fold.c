@@ -0,0 +1,371 @@
+// fold.c - Closed folds: runs of lines drawn as a single row
+#include "fold.h"
+#include <stdlib.h>
+
+struct Fold {
+    size_t start, end;           // start is shown; start+1..end are hidden
+    Fold **inner;                // closed folds inside, relative to start
+    size_t inner_count;
+    // Tree links, unused for inner folds
+    Fold *left, *right;
+    unsigned prio;
+    long shift;                  // still to be added to both subtrees
+    size_t hidden;               // lines hidden by this subtree
+};
+
+typedef struct {
+    Fold **v;
+    size_t n, cap;
+} FoldVec;
+
+static int vec_push(FoldVec *vec, Fold *f) {
+    if (vec->n == vec->cap) {
+        size_t cap = vec->cap ? vec->cap * 2 : 8;
+        Fold **tmp = realloc(vec->v, cap * sizeof(Fold *));
+        if (!tmp) return -1;
+        vec->v = tmp;
+        vec->cap = cap;
+    }
+    vec->v[vec->n++] = f;
+    return 0;
+}
+
+static void fold_free(Fold *f) {
+    if (!f) return;
+    for (size_t i = 0; i < f->inner_count; i++) fold_free(f->inner[i]);
+    free(f->inner);
+    free(f);
+}
+
+static void tree_free(Fold *t) {
+    if (!t) return;
+    tree_free(t->left);
+    tree_free(t->right);
+    fold_free(t);
+}
+
+static unsigned next_prio(FoldSet *fs) {
+    // xorshift32
+    unsigned x = fs->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return fs->seed = x;
+}
+
+static size_t hidden_of(const Fold *t) {
+    return t ? t->hidden : 0;
+}
+
+static void shift_tree(Fold *t, long d) {
+    if (!t) return;
+    t->start += (size_t)d;
+    t->end += (size_t)d;
+    t->shift += d;
+}
+
+static void push(Fold *t) {
+    if (t->shift) {
+        shift_tree(t->left, t->shift);
+        shift_tree(t->right, t->shift);
+        t->shift = 0;
+    }
+}
+
+static void pull(Fold *t) {
+    t->hidden = t->end - t->start + hidden_of(t->left) + hidden_of(t->right);
+}
+
+// l gets the folds starting before key, r the rest
+static void split(Fold *t, size_t key, Fold **l, Fold **r) {
+    if (!t) {
+        *l = *r = NULL;
+        return;
+    }
+    push(t);
+    if (t->start < key) {
+        split(t->right, key, &t->right, r);
+        *l = t;
+    } else {
+        split(t->left, key, l, &t->left);
+        *r = t;
+    }
+    pull(t);
+}
+
+static Fold *merge(Fold *l, Fold *r) {
+    if (!l) return r;
+    if (!r) return l;
+    if (l->prio > r->prio) {
+        push(l);
+        l->right = merge(l->right, r);
+        pull(l);
+        return l;
+    }
+    push(r);
+    r->left = merge(l, r->left);
+    pull(r);
+    return r;
+}
+
+static Fold *tree_first(Fold *t) {
+    for (; t && t->left; t = t->left) push(t);
+    if (t) push(t);
+    return t;
+}
+
+static Fold *tree_last(Fold *t) {
+    for (; t && t->right; t = t->right) push(t);
+    if (t) push(t);
+    return t;
+}
+
+// The top-level fold with the greatest start <= line
+static Fold *floor_fold(Fold *t, size_t line) {
+    Fold *best = NULL;
+    while (t) {
+        push(t);
+        if (t->start <= line) {
+            best = t;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return best;
+}
+
+static void tree_insert(FoldSet *fs, Fold *f) {
+    Fold *l, *r;
+    f->left = f->right = NULL;
+    f->shift = 0;
+    f->prio = next_prio(fs);
+    f->hidden = f->end - f->start;
+    split(fs->root, f->start, &l, &r);
+    fs->root = merge(merge(l, f), r);
+    fs->count++;
+}
+
+// Take the folds of t out in order, in absolute positions
+static void tree_collect(Fold *t, FoldVec *out, int *failed) {
+    if (!t) return;
+    push(t);
+    Fold *left = t->left, *right = t->right;
+    tree_collect(left, out, failed);
+    t->left = t->right = NULL;
+    if (vec_push(out, t) != 0) {
+        fold_free(t);
+        *failed = 1;
+    }
+    tree_collect(right, out, failed);
+}
+
+void folds_init(FoldSet *fs) {
+    fs->root = NULL;
+    fs->count = 0;
+    fs->seed = 2463534242u;
+}
+
+void folds_clear(FoldSet *fs) {
+    tree_free(fs->root);
+    fs->root = NULL;
+    fs->count = 0;
+}
+
+int folds_close(FoldSet *fs, size_t start, size_t end) {
+    if (end <= start) return -1;
+    Fold *l, *m, *r;
+    split(fs->root, start, &l, &m);
+    split(m, end + 1, &m, &r);
+    Fold *before = tree_last(l), *first = tree_first(m), *last = tree_last(m);
+    if ((before && before->end >= start) || (last && last->end > end) ||
+        (first && first->start == start && first->end == end)) {
+        fs->root = merge(merge(l, m), r);
+        return (first && first->start == start && first->end == end) ? 0 : -1;
+    }
+
+    Fold *f = calloc(1, sizeof(Fold));
+    FoldVec inner = { NULL, 0, 0 };
+    int failed = 0;
+    if (!f) {
+        fs->root = merge(merge(l, m), r);
+        return -1;
+    }
+    tree_collect(m, &inner, &failed);
+    for (size_t i = 0; i < inner.n; i++) {
+        inner.v[i]->start -= start;
+        inner.v[i]->end -= start;
+    }
+    fs->count -= inner.n + (size_t)failed;
+    f->start = start;
+    f->end = end;
+    f->inner = inner.v;
+    f->inner_count = inner.n;
+    fs->root = merge(l, r);
+    tree_insert(fs, f);
+    return 0;
+}
+
+// Open top-level fold f, already out of the tree
+static void open_fold(FoldSet *fs, Fold *f) {
+    for (size_t i = 0; i < f->inner_count; i++) {
+        Fold *g = f->inner[i];
+        g->start += f->start;
+        g->end += f->start;
+        tree_insert(fs, g);
+    }
+    f->inner_count = 0;
+    fold_free(f);
+}
+
+// Take out the top-level fold covering line (start < line when
+// `hidden_only`), or NULL
+static Fold *take_fold_at(FoldSet *fs, size_t line, int hidden_only) {
+    if (hidden_only && line == 0) return NULL;
+    Fold *f = floor_fold(fs->root, hidden_only ? line - 1 : line);
+    if (!f || f->end < line) return NULL;
+    Fold *l, *m, *r;
+    size_t start = f->start;
+    split(fs->root, start, &l, &m);
+    split(m, start + 1, &m, &r);
+    fs->root = merge(l, r);
+    fs->count--;
+    return m;
+}
+
+int folds_open(FoldSet *fs, size_t line) {
+    Fold *f = take_fold_at(fs, line, 0);
+    if (!f) return 0;
+    open_fold(fs, f);
+    return 1;
+}
+
+int folds_reveal(FoldSet *fs, size_t line) {
+    int opened = 0;
+    Fold *f;
+    while (fs->root && (f = take_fold_at(fs, line, 1)) != NULL) {
+        open_fold(fs, f);
+        opened++;
+    }
+    return opened;
+}
+
+// Apply an edit to one fold (positions in the edit's coordinates) and
+// add what is left of it to out: itself, moved or resized, or the folds
+// inside it if the edit cut across it
+static void edit_fold(Fold *f, size_t first, size_t old_count, size_t new_count,
+                      FoldVec *out) {
+    long delta = (long)new_count - (long)old_count;
+    if (f->end < first) {
+        if (vec_push(out, f) != 0) fold_free(f);
+        return;
+    }
+    if (f->start >= first + old_count) {
+        f->start += (size_t)delta;
+        f->end += (size_t)delta;
+        if (vec_push(out, f) != 0) fold_free(f);
+        return;
+    }
+
+    int holds_edit = f->start <= first && f->end + 1 >= first + old_count &&
+                     !(f->start == first && new_count == 0) &&
+                     f->end + (size_t)delta > f->start;
+    FoldVec inner = { NULL, 0, 0 };
+    if (holds_edit) {
+        // Same edit, seen from inside
+        for (size_t i = 0; i < f->inner_count; i++)
+            edit_fold(f->inner[i], first - f->start, old_count, new_count, &inner);
+        free(f->inner);
+        f->inner = inner.v;
+        f->inner_count = inner.n;
+        f->end += (size_t)delta;
+        if (vec_push(out, f) != 0) fold_free(f);
+        return;
+    }
+
+    for (size_t i = 0; i < f->inner_count; i++) {
+        Fold *g = f->inner[i];
+        g->start += f->start;
+        g->end += f->start;
+        edit_fold(g, first, old_count, new_count, out);
+    }
+    f->inner_count = 0;
+    fold_free(f);
+}
+
+void folds_edit(FoldSet *fs, size_t first, size_t old_count, size_t new_count) {
+    // A same-size edit moves nothing but can still cut across a fold, so
+    // it takes the same path
+    if (!fs->root) return;
+
+    // Folds starting past the edit only move: shift the whole subtree
+    Fold *l, *m, *r;
+    split(fs->root, first, &l, &m);
+    split(m, first + old_count, &m, &r);
+    shift_tree(r, (long)new_count - (long)old_count);
+
+    // The rest are few: the one fold before the edit that may reach into
+    // it, and those starting inside it
+    FoldVec touched = { NULL, 0, 0 };
+    int failed = 0;
+    Fold *before = tree_last(l);
+    if (before && before->end >= first) {
+        Fold *x;
+        split(l, before->start, &l, &x);
+        tree_collect(x, &touched, &failed);
+    }
+    tree_collect(m, &touched, &failed);
+    fs->count -= touched.n + (size_t)failed;
+    fs->root = merge(l, r);
+
+    FoldVec kept = { NULL, 0, 0 };
+    for (size_t i = 0; i < touched.n; i++)
+        edit_fold(touched.v[i], first, old_count, new_count, &kept);
+    for (size_t i = 0; i < kept.n; i++) tree_insert(fs, kept.v[i]);
+    free(touched.v);
+    free(kept.v);
+}
+
+size_t folds_hidden_after(FoldSet *fs, size_t line) {
+    if (!fs->root) return 0;
+    Fold *f = floor_fold(fs->root, line);
+    return f && f->start == line ? f->end - f->start : 0;
+}
+
+size_t folds_visible_line(FoldSet *fs, size_t line) {
+    if (!fs->root) return line;
+    Fold *f = floor_fold(fs->root, line);
+    return f && f->end >= line ? f->start : line;
+}
+
+size_t folds_row_of(FoldSet *fs, size_t line) {
+    if (!fs->root) return line;
+    line = folds_visible_line(fs, line);
+    size_t hidden = 0;
+    for (Fold *t = fs->root; t; ) {
+        push(t);
+        if (t->start < line) {
+            hidden += hidden_of(t->left) + (t->end - t->start);
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return line - hidden;
+}
+
+size_t folds_line_at_row(FoldSet *fs, size_t row) {
+    size_t hidden = 0;
+    for (Fold *t = fs->root; t; ) {
+        push(t);
+        // Row of this fold's start line
+        size_t at = t->start - hidden - hidden_of(t->left);
+        if (at < row) {
+            hidden += hidden_of(t->left) + (t->end - t->start);
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return row + hidden;
+}
@@ -0,0 +1,52 @@
+// fold.h - Closed folds: runs of lines drawn as a single row
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stddef.h>
+
+typedef struct Fold Fold;
+
+// The closed folds of a buffer. Top-level folds never overlap; they sit
+// in an interval tree (a treap ordered by start line) whose nodes also
+// count the lines hidden below them, so screen rows and buffer lines
+// convert in O(log folds) either way. A fold closed inside another is
+// kept by it and shows again when the outer one is opened.
+typedef struct {
+    Fold *root;
+    size_t count;                // top-level folds
+    unsigned seed;               // treap priorities
+} FoldSet;
+
+void folds_init(FoldSet *fs);
+
+// Open (forget) every fold
+void folds_clear(FoldSet *fs);
+
+// Close lines [start, end]: start stays on screen as the fold's row.
+// Closed folds inside the range become part of it. Returns 0, or -1 if
+// the range crosses a closed fold or starts inside one.
+int folds_close(FoldSet *fs, size_t start, size_t end);
+
+// Open the fold whose row is `line`. Returns 1 if there was one.
+int folds_open(FoldSet *fs, size_t line);
+
+// Open folds until `line` is on screen (after a jump into a fold).
+// Returns the number opened.
+int folds_reveal(FoldSet *fs, size_t line);
+
+// Lines [first, first + old_count) were replaced by new_count lines.
+// Folds below the edit move with it, a fold holding all of it grows or
+// shrinks, and a fold the edit cuts across is opened.
+void folds_edit(FoldSet *fs, size_t first, size_t old_count, size_t new_count);
+
+// Lines hidden under `line` if a fold starts there, else 0
+size_t folds_hidden_after(FoldSet *fs, size_t line);
+
+// The line on screen for `line`: the start of a fold hiding it, else line
+size_t folds_visible_line(FoldSet *fs, size_t line);
+
+// Screen row of `line` counted from the top of the buffer, and back
+size_t folds_row_of(FoldSet *fs, size_t line);
+size_t folds_line_at_row(FoldSet *fs, size_t row);
+
+#endif
@@ -0,0 +1,453 @@
+// grep.c - Project-wide parallel grep and the quickfix list it fills
+#include "grep.h"
+#include "ignore.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// ---- walker --------------------------------------------------------------
+
+static void queue_push(GrepJob *job, const char *rel) {
+    char *copy = dupstr(rel);
+    pthread_mutex_lock(&job->lock);
+    if (job->qcount == job->qcap) {
+        // Compact consumed slots before growing
+        if (job->qhead > 0) {
+            memmove(job->queue, job->queue + job->qhead,
+                    (job->qcount - job->qhead) * sizeof(char *));
+            job->qcount -= job->qhead;
+            job->qhead = 0;
+        }
+        if (job->qcount == job->qcap) {
+            size_t ncap = job->qcap ? job->qcap * 2 : 1024;
+            char **tmp = realloc(job->queue, ncap * sizeof(char *));
+            if (!tmp) {
+                pthread_mutex_unlock(&job->lock);
+                free(copy);
+                return;
+            }
+            job->queue = tmp;
+            job->qcap = ncap;
+        }
+    }
+    job->queue[job->qcount++] = copy;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void walk_dir(GrepJob *job, IgnoreNode *parent, const char *rel) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s%s", job->top, *rel ? "/" : "", rel);
+    DIR *d = opendir(path);
+    if (!d) return;
+
+    IgnoreNode *ign = ignore_load(parent, job->top, rel);
+
+    struct dirent *de;
+    while (!job->cancel && (de = readdir(d)) != NULL) {
+        const char *name = de->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, ".git") == 0)
+            continue;
+
+        char child[PATH_MAX];
+        int n = snprintf(child, sizeof(child), "%s%s%s", rel, *rel ? "/" : "", name);
+        if (n < 0 || (size_t)n >= sizeof(child)) continue;
+
+        // Symlinks are not followed, so a link cycle can't trap the walk
+        int type = de->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            char full[PATH_MAX];
+            if (snprintf(full, sizeof(full), "%s/%s", job->top, child) >= (int)sizeof(full) ||
+                lstat(full, &sb) != 0)
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG : DT_LNK;
+        }
+        if (type != DT_DIR && type != DT_REG) continue;
+        if (ignore_match(ign, child, name, type == DT_DIR)) continue;
+
+        if (type == DT_DIR)
+            walk_dir(job, ign, child);
+        else
+            queue_push(job, child);
+    }
+    closedir(d);
+    if (ign != parent) ignore_free(ign);
+}
+
+static void *walker_main(void *arg) {
+    GrepJob *job = arg;
+
+    // The search root may sit below the repository root; rules from the
+    // .gitignore files in between still apply.
+    IgnoreNode *chain[PATH_MAX / 2];
+    size_t depth = 0;
+    IgnoreNode *ign = NULL;
+    const char *prefix = job->top + strlen(job->top) + 1;
+    char rel[PATH_MAX] = "";
+    for (const char *p = prefix; *p; ) {
+        IgnoreNode *next = ignore_load(ign, job->top, rel);
+        if (next != ign) chain[depth++] = next;
+        ign = next;
+        const char *slash = strchr(p, '/');
+        size_t seg = slash ? (size_t)(slash - p) : strlen(p);
+        size_t len = strlen(rel);
+        snprintf(rel + len, sizeof(rel) - len, "%s%.*s", len ? "/" : "", (int)seg, p);
+        p += seg + (slash ? 1 : 0);
+    }
+    walk_dir(job, ign, rel);
+    while (depth > 0) ignore_free(chain[--depth]);
+
+    pthread_mutex_lock(&job->lock);
+    job->walk_done = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// ---- workers -------------------------------------------------------------
+
+// Literal search over a non NUL-terminated range. SSE2 compares the first
+// and last needle bytes at 16 candidate offsets per step and only runs
+// memcmp where both agree, which skips most of the file without looking
+// at it byte by byte.
+static const char *grep_find_literal(const char *hay, size_t n,
+                                     const char *needle, size_t k) {
+    if (k == 0 || k > n) return NULL;
+    if (k == 1) return memchr(hay, needle[0], n);
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i bl = _mm_loadu_si128((const __m128i *)(hay + i + k - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, k - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return memmem(hay + i, n - i, needle, k);
+#else
+    return memmem(hay, n, needle, k);
+#endif
+}
+
+typedef struct {
+    GrepHit *items;
+    size_t count;
+    size_t cap;
+} HitBatch;
+
+static void batch_add(HitBatch *b, const char *path, size_t name_off,
+                      size_t line, size_t col, const char *text, size_t len) {
+    if (b->count == b->cap) {
+        size_t ncap = b->cap ? b->cap * 2 : 16;
+        GrepHit *tmp = realloc(b->items, ncap * sizeof(GrepHit));
+        if (!tmp) return;
+        b->items = tmp;
+        b->cap = ncap;
+    }
+    if (len > GREP_TEXT_MAX) len = GREP_TEXT_MAX;
+    char *t = malloc(len + 1);
+    if (!t) return;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        t[i] = (c < 32 || c == 127) ? ' ' : (char)c;
+    }
+    t[len] = '\0';
+
+    GrepHit *h = &b->items[b->count++];
+    h->path = dupstr(path);
+    h->name_off = name_off;
+    h->line = line;
+    h->col = col;
+    h->text = t;
+}
+
+static void grep_file(GrepJob *job, const char *path, size_t name_off, HitBatch *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)sb.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return;
+
+    // Binary files (a NUL in the first 1 KB) are skipped, like grep -I
+    if (memchr(data, '\0', size < 1024 ? size : 1024)) {
+        munmap((void *)data, size);
+        return;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    const SearchState *s = &job->search;
+    const char *end = data + size;
+    const char *line_start = data;
+    size_t line_no = 0;
+    char *linebuf = NULL;
+    size_t linecap = 0;
+
+    while (line_start < end && !job->cancel) {
+        const char *hit;
+        size_t col;
+        if (!s->is_regex) {
+            hit = grep_find_literal(line_start, (size_t)(end - line_start),
+                                    s->pattern, s->pat_len);
+            if (!hit) break;
+            // Advance the line count to the line containing the hit
+            const char *nl;
+            while ((nl = memchr(line_start, '\n', (size_t)(hit - line_start))) != NULL) {
+                line_start = nl + 1;
+                line_no++;
+            }
+            col = (size_t)(hit - line_start);
+        } else {
+            // Regex path: regexec needs a NUL-terminated copy of each line
+            const char *nl = memchr(line_start, '\n', (size_t)(end - line_start));
+            size_t len = nl ? (size_t)(nl - line_start) : (size_t)(end - line_start);
+            if (len + 1 > linecap) {
+                size_t ncap = linecap ? linecap : 256;
+                while (ncap < len + 1) ncap *= 2;
+                char *tmp = realloc(linebuf, ncap);
+                if (!tmp) break;
+                linebuf = tmp;
+                linecap = ncap;
+            }
+            memcpy(linebuf, line_start, len);
+            linebuf[len] = '\0';
+            size_t ms, ml;
+            if (!search_match_in_line(s, linebuf, 0, &ms, &ml)) {
+                if (!nl) break;
+                line_start = nl + 1;
+                line_no++;
+                continue;
+            }
+            col = ms;
+        }
+
+        const char *nl = memchr(line_start, '\n', (size_t)(end - line_start));
+        size_t len = nl ? (size_t)(nl - line_start) : (size_t)(end - line_start);
+        if (len > 0 && line_start[len - 1] == '\r') len--;
+        batch_add(out, path, name_off, line_no, col, line_start, len);
+
+        // One hit per line
+        if (!nl) break;
+        line_start = nl + 1;
+        line_no++;
+    }
+
+    free(linebuf);
+    munmap((void *)data, size);
+}
+
+static void *worker_main(void *arg) {
+    GrepJob *job = arg;
+    HitBatch batch = {0};
+    char path[PATH_MAX];
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        while (job->qhead == job->qcount && !job->walk_done && !job->cancel)
+            pthread_cond_wait(&job->cond, &job->lock);
+        if (job->cancel || job->qhead == job->qcount) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        char *rel = job->queue[job->qhead++];
+        pthread_mutex_unlock(&job->lock);
+
+        snprintf(path, sizeof(path), "%s/%s", job->top, rel);
+        free(rel);
+
+        batch.count = 0;
+        grep_file(job, path, job->root_len, &batch);
+
+        // Hand a whole file's hits over at once to keep the lock cold
+        pthread_mutex_lock(&job->lock);
+        job->files_scanned++;
+        if (batch.count > 0 && !job->cancel) {
+            if (job->pending_count + batch.count > job->pending_cap) {
+                size_t ncap = job->pending_cap ? job->pending_cap : 256;
+                while (ncap < job->pending_count + batch.count) ncap *= 2;
+                GrepHit *tmp = realloc(job->pending, ncap * sizeof(GrepHit));
+                if (tmp) {
+                    job->pending = tmp;
+                    job->pending_cap = ncap;
+                }
+            }
+            if (job->pending_count + batch.count <= job->pending_cap) {
+                memcpy(job->pending + job->pending_count, batch.items,
+                       batch.count * sizeof(GrepHit));
+                job->pending_count += batch.count;
+                job->total_hits += batch.count;
+                batch.count = 0;
+            }
+            if (job->total_hits >= GREP_MAX_HITS) {
+                job->truncated = 1;
+                job->cancel = 1;
+                pthread_cond_broadcast(&job->cond);
+            }
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        // Anything not handed over (OOM or cancelled) is dropped here
+        for (size_t i = 0; i < batch.count; i++) {
+            free(batch.items[i].path);
+            free(batch.items[i].text);
+        }
+    }
+
+    free(batch.items);
+    pthread_mutex_lock(&job->lock);
+    job->workers_left--;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// ---- job -----------------------------------------------------------------
+
+GrepJob *grep_start(const char *pattern, const char *root) {
+    GrepJob *job = calloc(1, sizeof(GrepJob));
+    if (!job) return NULL;
+
+    search_init(&job->search);
+    if (search_set_pattern(&job->search, pattern) != 0 || !job->search.active) {
+        search_free(&job->search);
+        free(job);
+        return NULL;
+    }
+
+    // top is the repository root containing `root`, or `root` itself.
+    // It is stored as "top\0prefix" so the walker can recover the search
+    // root below it.
+    char abs[PATH_MAX];
+    size_t top_len = ignore_find_top(root, abs, sizeof(abs));
+    size_t abs_len = strlen(abs);
+    if (top_len == 0) top_len = abs_len;
+    if (abs_len + 2 > sizeof(job->top)) {
+        search_free(&job->search);
+        free(job);
+        return NULL;
+    }
+    memcpy(job->top, abs, abs_len + 1);
+    job->top[top_len] = '\0';  // abs[top_len] is '/' (or already '\0')
+    job->root_len = abs_len + 1;
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = ncpu < 1 ? 1 : ncpu > GREP_MAX_THREADS ? GREP_MAX_THREADS : (int)ncpu;
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&job->workers[i], NULL, worker_main, job) != 0) break;
+        job->nworkers++;
+    }
+    job->workers_left = job->nworkers;
+    if (job->nworkers == 0 ||
+        pthread_create(&job->walker, NULL, walker_main, job) != 0) {
+        job->walk_done = 1;
+        job->cancel = 1;
+        pthread_cond_broadcast(&job->cond);
+        for (int i = 0; i < job->nworkers; i++) pthread_join(job->workers[i], NULL);
+        pthread_mutex_destroy(&job->lock);
+        pthread_cond_destroy(&job->cond);
+        search_free(&job->search);
+        free(job);
+        return NULL;
+    }
+    return job;
+}
+
+int grep_drain(GrepJob *job, QuickfixList *qf) {
+    pthread_mutex_lock(&job->lock);
+    if (job->pending_count > 0) {
+        size_t need = qf->count + job->pending_count;
+        if (need > qf->cap) {
+            size_t ncap = qf->cap ? qf->cap : 256;
+            while (ncap < need) ncap *= 2;
+            GrepHit *tmp = realloc(qf->items, ncap * sizeof(GrepHit));
+            if (tmp) {
+                qf->items = tmp;
+                qf->cap = ncap;
+            }
+        }
+        if (need <= qf->cap) {
+            memcpy(qf->items + qf->count, job->pending,
+                   job->pending_count * sizeof(GrepHit));
+            qf->count = need;
+            job->pending_count = 0;
+        }
+    }
+    int running = job->workers_left > 0;
+    pthread_mutex_unlock(&job->lock);
+    return running;
+}
+
+size_t grep_files_scanned(GrepJob *job) {
+    pthread_mutex_lock(&job->lock);
+    size_t n = job->files_scanned;
+    pthread_mutex_unlock(&job->lock);
+    return n;
+}
+
+void grep_free(GrepJob *job) {
+    if (!job) return;
+    pthread_mutex_lock(&job->lock);
+    job->cancel = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+
+    pthread_join(job->walker, NULL);
+    for (int i = 0; i < job->nworkers; i++) pthread_join(job->workers[i], NULL);
+
+    for (size_t i = job->qhead; i < job->qcount; i++) free(job->queue[i]);
+    free(job->queue);
+    for (size_t i = 0; i < job->pending_count; i++) {
+        free(job->pending[i].path);
+        free(job->pending[i].text);
+    }
+    free(job->pending);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    search_free(&job->search);
+    free(job);
+}
+
+// ---- quickfix ------------------------------------------------------------
+
+void quickfix_init(QuickfixList *qf) {
+    memset(qf, 0, sizeof(*qf));
+}
+
+void quickfix_clear(QuickfixList *qf) {
+    for (size_t i = 0; i < qf->count; i++) {
+        free(qf->items[i].path);
+        free(qf->items[i].text);
+    }
+    free(qf->items);
+    qf->items = NULL;
+    qf->count = 0;
+    qf->cap = 0;
+    qf->sel = 0;
+    qf->top = 0;
+}
@@ -0,0 +1,88 @@
+// grep.h - Project-wide parallel grep and the quickfix list it fills
+#ifndef GREP_H
+#define GREP_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "search.h"
+
+#define GREP_MAX_THREADS 16
+#define GREP_MAX_HITS    100000  // stop the scan once this many lines matched
+#define GREP_TEXT_MAX    256     // bytes of the matching line kept per hit
+#define QUICKFIX_ROWS    10      // screen rows used by the open quickfix list
+
+// One matching line
+typedef struct {
+    char *path;       // full path, used to open the file
+    size_t name_off;  // offset of the path relative to the search root
+    size_t line;      // 0-based
+    size_t col;       // byte column of the first match
+    char *text;       // the line, truncated to GREP_TEXT_MAX, controls blanked
+} GrepHit;
+
+// Results as seen by the editor. Only the main thread touches this; hits
+// are moved in from the running job by grep_drain.
+typedef struct {
+    GrepHit *items;
+    size_t count;
+    size_t cap;
+    size_t sel;       // selected entry
+    size_t top;       // first entry shown
+    int open;         // 1 = list is drawn under the buffer
+    char title[SEARCH_PATTERN_MAX + 32];
+} QuickfixList;
+
+// A running scan: one walker thread feeds file paths to a pool of workers
+// that mmap each file and search it.
+typedef struct {
+    SearchState search;  // compiled pattern, shared read-only by workers
+    char top[1024];      // repository root (or the search root outside a repo)
+    size_t root_len;     // length of the search root within top/prefix paths
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    // Work queue of paths relative to top
+    char **queue;
+    size_t qhead;
+    size_t qcount;
+    size_t qcap;
+    int walk_done;
+
+    // Hits found since the last grep_drain
+    GrepHit *pending;
+    size_t pending_count;
+    size_t pending_cap;
+    size_t total_hits;
+
+    size_t files_scanned;
+    int workers_left;
+    volatile int cancel; // polled without the lock between files/lines
+    int truncated;       // GREP_MAX_HITS reached
+
+    pthread_t walker;
+    pthread_t workers[GREP_MAX_THREADS];
+    int nworkers;
+} GrepJob;
+
+// Start searching every file under `root` (respecting .gitignore) for
+// `pattern`. Literal patterns use an SSE2 first/last-byte filter over the
+// mapped file; anything else goes through the regex path in search.c.
+// Returns NULL if the pattern is invalid or the threads cannot start.
+GrepJob *grep_start(const char *pattern, const char *root);
+
+// Move hits found so far into the quickfix list. Returns 1 while the scan
+// is still running, 0 once it has finished.
+int grep_drain(GrepJob *job, QuickfixList *qf);
+
+// Stop the scan, join its threads and free the job
+void grep_free(GrepJob *job);
+
+// Number of files searched so far
+size_t grep_files_scanned(GrepJob *job);
+
+// Quickfix list helpers
+void quickfix_init(QuickfixList *qf);
+void quickfix_clear(QuickfixList *qf);
+
+#endif
@@ -1,7 +1,16 @@
 // highlight.c - Syntax highlighting functions
 #include "highlight.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+// Total time spent in highlight_buffer, for the replay benchmark/profiler
+static long long highlight_ns_total = 0;
+
+long long highlight_time_ns(void) {
+    return highlight_ns_total;
+}
 
 // ============================================================================
 // C/C++ Highlight Rules
@@ -710,6 +719,10 @@ void highlight_buffer(Buffer *buf) {
     
     LanguageHighlighter *hl = get_highlighter(buf->ft);
     if (!hl) return;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long long prof = profile_begin();
     
     // Compile regexes if not already done
     compile_rules(hl);
@@ -726,8 +739,15 @@ void highlight_buffer(Buffer *buf) {
     //   regex_start = first regex token pushed for this line (captured before the call)
     // position_has_token checks both ranges, keeping O(tokens_on_line) cost while
     // correctly preventing regex tokens from overlapping LSP tokens.
+    // A windowed pass starts outside any block comment; a comment opened
+    // above the window shows up once the window reaches its start.
+    size_t first = 0, last = buf->count;
+    if (buf->hl_count > 0) {
+        first = buf->hl_first < buf->count ? buf->hl_first : buf->count;
+        last = buf->hl_count < buf->count - first ? first + buf->hl_count : buf->count;
+    }
     int in_block_comment = 0;
-    for (size_t i = 0; i < buf->count; i++) {
+    for (size_t i = first; i < last; i++) {
         size_t ls  = lsp_line_start(buf, lsp_count, (int)i);
         size_t rs  = buf->token_count;
         highlight_line(buf, hl, (int)i, &in_block_comment, ls, lsp_count, rs);
@@ -735,6 +755,123 @@ void highlight_buffer(Buffer *buf) {
 
     // Sort combined token array so semantic_kind_at can use binary search.
     semantic_tokens_sort(buf);
+
+    profile_end(PROF_HIGHLIGHT, prof);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    highlight_ns_total += (long long)(t1.tv_sec - t0.tv_sec) * 1000000000LL +
+                          (t1.tv_nsec - t0.tv_nsec);
+}
+
+int highlight_has_comment_delim(FileType ft, const char *line) {
+    LanguageHighlighter *hl = get_highlighter(ft);
+    if (!hl || !hl->block_comment_start) return 0;
+    return strstr(line, hl->block_comment_start) || strstr(line, hl->block_comment_end);
+}
+
+static int token_cmp(const void *a, const void *b);
+
+// The block-comment part of highlight_line alone: whether a comment is
+// still open after `line`. LSP tokens are not consulted; after a reload
+// they are stale until the server answers again.
+static int comment_open_after(LanguageHighlighter *hl, const char *line, int open) {
+    const char *p = line;
+    size_t start_len = strlen(hl->block_comment_start);
+    size_t end_len = strlen(hl->block_comment_end);
+    if (open) {
+        p = strstr(p, hl->block_comment_end);
+        if (!p) return 1;
+        p += end_len;
+    }
+    while ((p = strstr(p, hl->block_comment_start)) != NULL) {
+        p = strstr(p + start_len, hl->block_comment_end);
+        if (!p) return 1;
+        p += end_len;
+    }
+    return 0;
+}
+
+void highlight_hunks(Buffer *buf, const DiffHunk *hunks, size_t n) {
+    if (!buf || n == 0) return;
+    LanguageHighlighter *hl = get_highlighter(buf->ft);
+    if (!hl) return;
+    // A highlight window is small; redo it
+    if (buf->hl_count > 0) {
+        highlight_buffer(buf);
+        return;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long long prof = profile_begin();
+    compile_rules(hl);
+
+    // One pass over the sorted tokens: drop those on replaced lines and
+    // renumber the rest. Order is kept, since every line after a hunk
+    // moves by the same amount.
+    size_t keep = 0, h = 0;
+    long shift = 0;
+    for (size_t i = 0; i < buf->token_count; i++) {
+        SemanticToken t = buf->tokens[i];
+        size_t line = (size_t)t.line;
+        while (h < n && line >= hunks[h].a_start + hunks[h].a_count) {
+            shift += (long)hunks[h].b_count - (long)hunks[h].a_count;
+            h++;
+        }
+        if (h < n && line >= hunks[h].a_start) continue;
+        t.line = (int)((long)line + shift);
+        buf->tokens[keep++] = t;
+    }
+    buf->token_count = keep;
+
+    // Highlight the new lines; their tokens go on the end of the array
+    size_t line = 0;
+    int in_block_comment = 0;
+    for (h = 0; h < n; h++) {
+        size_t first = hunks[h].b_start, last = first + hunks[h].b_count;
+        if (hl->block_comment_start)
+            for (; line < first && line < buf->count; line++)
+                in_block_comment = comment_open_after(hl, buf->lines[line], in_block_comment);
+        for (size_t i = first; i < last && i < buf->count; i++)
+            highlight_line(buf, hl, (int)i, &in_block_comment, 0, 0, buf->token_count);
+        line = last;
+    }
+
+    // Sort the new tokens and merge them into the rest, back to front
+    size_t added = buf->token_count - keep;
+    if (added > 0) {
+        SemanticToken *tail = malloc(added * sizeof(SemanticToken));
+        if (!tail) {
+            semantic_tokens_sort(buf);
+        } else {
+            memcpy(tail, buf->tokens + keep, added * sizeof(SemanticToken));
+            qsort(tail, added, sizeof(SemanticToken), token_cmp);
+            size_t a = keep, b = added, out = keep + added;
+            while (b > 0) {
+                if (a > 0 && token_cmp(&buf->tokens[a - 1], &tail[b - 1]) > 0)
+                    buf->tokens[--out] = buf->tokens[--a];
+                else
+                    buf->tokens[--out] = tail[--b];
+            }
+            free(tail);
+        }
+    }
+
+    profile_end(PROF_HIGHLIGHT, prof);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    highlight_ns_total += (long long)(t1.tv_sec - t0.tv_sec) * 1000000000LL +
+                          (t1.tv_nsec - t0.tv_nsec);
+}
+
+void highlight_viewport(Buffer *buf, size_t top, size_t rows) {
+    if (!buf || buf->hl_count == 0) return;
+    size_t bottom = top + rows;
+    if (top >= buf->hl_first && bottom <= buf->hl_first + buf->hl_count) return;
+
+    // Re-centre with a margin on both sides, so scrolling only re-highlights
+    // once every HL_WINDOW_MARGIN lines
+    buf->hl_first = top > HL_WINDOW_MARGIN ? top - HL_WINDOW_MARGIN : 0;
+    buf->hl_count = (top - buf->hl_first) + rows + HL_WINDOW_MARGIN;
+    highlight_buffer(buf);
 }
 
 void highlight_cleanup(void) {
@@ -829,8 +966,11 @@ static int token_cmp(const void *a, const void *b) {
 }
 
 void semantic_tokens_sort(Buffer *buf) {
-    if (buf && buf->token_count > 1)
+    if (buf && buf->token_count > 1) {
+        long long prof = profile_begin();
         qsort(buf->tokens, buf->token_count, sizeof(SemanticToken), token_cmp);
+        profile_end(PROF_SORT, prof);
+    }
 }
 
 // Binary search for first token on `line`, then scan that line.
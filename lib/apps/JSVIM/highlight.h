@@ -5,6 +5,7 @@
 #include "buffer.h"
 #include "semantic.h"
 #include "language.h"
+#include "diff.h"
 #include <regex.h>
 
 // Syntax color pairs
@@ -48,9 +49,31 @@ typedef struct {
 // Get highlighter for a file type (returns NULL if none)
 LanguageHighlighter *get_highlighter(FileType ft);
 
-// Perform regex-based syntax highlighting on a buffer
+// Lines highlighted above and below the viewport in windowed mode
+#define HL_WINDOW_MARGIN 200
+
+// Perform regex-based syntax highlighting on a buffer (only the lines in
+// its highlight window, if one is set)
 void highlight_buffer(Buffer *buf);
 
+// Windowed mode: move the highlight window, and re-highlight, when
+// `rows` lines from `top` are no longer all inside it
+void highlight_viewport(Buffer *buf, size_t top, size_t rows);
+
+// Whether `line` holds a block-comment delimiter of `ft` ("/*" or "*/")
+int highlight_has_comment_delim(FileType ft, const char *line);
+
+// After the lines in `hunks` (ascending, as diff_lines returns them) were
+// spliced into the buffer: move the tokens below each hunk with their
+// lines, drop those of replaced lines, and highlight only the new lines.
+// Only valid when none of the replaced or new lines holds a block-comment
+// delimiter, since those can recolour every line after them; callers use
+// highlight_buffer then.
+void highlight_hunks(Buffer *buf, const DiffHunk *hunks, size_t n);
+
+// Cumulative nanoseconds spent in highlight_buffer since startup
+long long highlight_time_ns(void);
+
 // Cleanup compiled regexes (call on exit)
 void highlight_cleanup(void);
 
@@ -0,0 +1,104 @@
+// ignore.c - .gitignore rules shared by the project scanners (grep, finder)
+#include "ignore.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <limits.h>
+
+// Supports the common subset: blank lines and '#' comments, '!' negation,
+// trailing '/' for directories only, and patterns with a '/' anchored to
+// the directory of their .gitignore. "**" is handled by letting '*' cross
+// '/' for that pattern.
+IgnoreNode *ignore_load(IgnoreNode *parent, const char *top, const char *rel) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s%s.gitignore", top, rel, *rel ? "/" : "");
+    FILE *fp = fopen(path, "r");
+    if (!fp) return parent;
+
+    IgnoreNode *n = calloc(1, sizeof(IgnoreNode));
+    if (!n) {
+        fclose(fp);
+        return parent;
+    }
+    n->parent = parent;
+    n->base_len = strlen(rel);
+
+    size_t cap = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        while (len > 0 && line[len - 1] == ' ') line[--len] = '\0';
+        char *p = line;
+        if (*p == '\0' || *p == '#') continue;
+
+        IgnoreRule r = {0};
+        if (*p == '!') { r.negate = 1; p++; }
+        if (*p == '\\') p++;
+        len = strlen(p);
+        if (len > 0 && p[len - 1] == '/') { r.dir_only = 1; p[--len] = '\0'; }
+        if (*p == '/') { r.anchored = 1; p++; }
+        if (strchr(p, '/')) r.anchored = 1;
+        if (*p == '\0') continue;
+        r.flags = strstr(p, "**") ? 0 : FNM_PATHNAME;
+
+        if (n->count == cap) {
+            size_t ncap = cap ? cap * 2 : 16;
+            IgnoreRule *tmp = realloc(n->rules, ncap * sizeof(IgnoreRule));
+            if (!tmp) break;
+            n->rules = tmp;
+            cap = ncap;
+        }
+        r.pat = dupstr(p);
+        n->rules[n->count++] = r;
+    }
+    fclose(fp);
+
+    if (n->count == 0) {
+        ignore_free(n);
+        return parent;
+    }
+    return n;
+}
+
+void ignore_free(IgnoreNode *n) {
+    if (!n) return;
+    for (size_t i = 0; i < n->count; i++) free(n->rules[i].pat);
+    free(n->rules);
+    free(n);
+}
+
+int ignore_match(const IgnoreNode *n, const char *rel, const char *name, int is_dir) {
+    // Walking leaf to root with rules in reverse, the first hit is the
+    // rule git would have applied last.
+    for (; n; n = n->parent) {
+        const char *sub = rel + n->base_len + (n->base_len ? 1 : 0);
+        for (size_t j = n->count; j-- > 0; ) {
+            const IgnoreRule *r = &n->rules[j];
+            if (r->dir_only && !is_dir) continue;
+            const char *subject = r->anchored ? sub : name;
+            if (fnmatch(r->pat, subject, r->anchored ? r->flags : 0) == 0)
+                return !r->negate;
+        }
+    }
+    return 0;
+}
+
+size_t ignore_find_top(const char *dir, char *abs, size_t abs_size) {
+    char resolved[PATH_MAX];
+    if (!realpath(dir, resolved)) snprintf(resolved, sizeof(resolved), "%s", dir);
+    snprintf(abs, abs_size, "%s", resolved);
+
+    size_t abs_len = strlen(abs);
+    for (size_t len = abs_len; len > 0; ) {
+        char probe[PATH_MAX + 8];
+        snprintf(probe, sizeof(probe), "%.*s/.git", (int)len, abs);
+        if (access(probe, F_OK) == 0) return len;
+        while (len > 0 && abs[len - 1] != '/') len--;
+        if (len > 0) len--;  // drop the '/'
+    }
+    return abs_len;
+}
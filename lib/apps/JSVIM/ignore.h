@@ -0,0 +1,41 @@
+// ignore.h - .gitignore rules shared by the project scanners (grep, finder)
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stddef.h>
+
+typedef struct {
+    char *pat;
+    int negate;
+    int dir_only;
+    int anchored;
+    int flags;       // fnmatch flags
+} IgnoreRule;
+
+// Rules of one .gitignore, chained to those of the directories above it.
+// Nodes are immutable once loaded, so one chain can be shared by threads
+// walking different subdirectories.
+typedef struct IgnoreNode {
+    struct IgnoreNode *parent;
+    IgnoreRule *rules;
+    size_t count;
+    size_t base_len;  // length of its directory, relative to the walk's top
+} IgnoreNode;
+
+// Load `top/rel/.gitignore`. Returns a new node chained to `parent`, or
+// `parent` itself when the directory has no (usable) .gitignore.
+IgnoreNode *ignore_load(IgnoreNode *parent, const char *top, const char *rel);
+
+// Free a node returned by ignore_load (never its parents)
+void ignore_free(IgnoreNode *n);
+
+// 1 if `rel` (relative to top, basename `name`) is ignored. The last
+// matching rule wins, with deeper .gitignore files taking precedence.
+int ignore_match(const IgnoreNode *n, const char *rel, const char *name, int is_dir);
+
+// Resolve `dir` into `abs` and return the length of its repository root
+// (the nearest ancestor holding a .git entry) within it, or strlen(abs)
+// when `dir` is not inside a repository.
+size_t ignore_find_top(const char *dir, char *abs, size_t abs_size);
+
+#endif
@@ -0,0 +1,286 @@
+// journal.c - Crash-recovery journal ("swap file") of unsaved edits
+#include "journal.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define JOURNAL_MAGIC "jsvim-journal 1"
+
+static long long journal_now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void journal_init(Journal *j) {
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+}
+
+int journal_path_for(const char *file, char *out, size_t outsz) {
+    char abs[PATH_MAX];
+    if (!realpath(file, abs)) return -1;
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+    if (xdg && *xdg) snprintf(dir, sizeof(dir), "%s/jsvim/swap", xdg);
+    else if (home) snprintf(dir, sizeof(dir), "%s/.cache/jsvim/swap", home);
+    else return -1;
+
+    // One flat directory; the absolute path, '/' spelled '%', names the file
+    int n = snprintf(out, outsz, "%s/", dir);
+    if (n < 0 || (size_t)n >= outsz) return -1;
+    size_t pos = (size_t)n;
+    for (const char *p = abs; *p && pos + 1 < outsz; p++)
+        out[pos++] = *p == '/' ? '%' : *p;
+    if (pos + sizeof(".swp") > outsz) return -1;
+    memcpy(out + pos, ".swp", sizeof(".swp"));
+    return 0;
+}
+
+// Header: magic, "P <pid>" padded so it can be rewritten in place,
+// "B <size> <mtime>" of the file the records apply to
+static int write_header(int fd, const char *file) {
+    struct stat st;
+    long long size = 0, mtime = 0;
+    if (stat(file, &st) == 0) {
+        size = (long long)st.st_size;
+        mtime = (long long)st.st_mtime;
+    }
+    char hdr[128];
+    int n = snprintf(hdr, sizeof(hdr), JOURNAL_MAGIC "\nP %10d\nB %lld %lld\n",
+                     (int)getpid(), size, mtime);
+    if (n < 0 || (size_t)n >= sizeof(hdr)) return -1;
+    return pwrite(fd, hdr, (size_t)n, 0) == n ? 0 : -1;
+}
+
+int journal_open(Journal *j, const char *file, long long keep) {
+    journal_close(j, 0);
+    if (journal_path_for(file, j->path, sizeof(j->path)) != 0 ||
+        mkdir_parents(j->path) != 0)
+        return -1;
+
+    int fd = open(j->path, O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0600);
+    if (fd < 0) return -1;
+    if (keep) {
+        // Claim it: drop anything past `keep` and rewrite only the pid;
+        // the base stays the old one
+        char pid[24];
+        int n = snprintf(pid, sizeof(pid), "P %10d\n", (int)getpid());
+        if (ftruncate(fd, (off_t)keep) != 0 ||
+            pwrite(fd, pid, (size_t)n, sizeof(JOURNAL_MAGIC)) != n) {
+            close(fd);
+            return -1;
+        }
+    } else if (write_header(fd, file) != 0) {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_END);
+    j->fd = fd;
+    j->len = 0;
+    j->unsynced = 1;
+    j->last_sync_ms = 0;
+    j->records = 0;
+    return 0;
+}
+
+static void pending_append(Journal *j, const char *data, size_t n) {
+    if (j->len + n > j->cap) {
+        size_t ncap = j->cap ? j->cap : 4096;
+        while (ncap < j->len + n) ncap *= 2;
+        char *tmp = realloc(j->pending, ncap);
+        if (!tmp) return;
+        j->pending = tmp;
+        j->cap = ncap;
+    }
+    memcpy(j->pending + j->len, data, n);
+    j->len += n;
+}
+
+static void flush_pending(Journal *j) {
+    size_t off = 0;
+    while (off < j->len) {
+        ssize_t w = write(j->fd, j->pending + off, j->len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += (size_t)w;
+    }
+    j->len = 0;
+    j->unsynced = 1;
+}
+
+static void append_record(Journal *j, const char *head, size_t head_len,
+                          const char *text, size_t text_len) {
+    pending_append(j, head, head_len);
+    pending_append(j, text, text_len);
+    pending_append(j, "\n", 1);
+    j->records++;
+    // A big paste or :s goes out now rather than sitting in memory
+    if (j->len >= JOURNAL_FLUSH_BYTES) flush_pending(j);
+}
+
+void journal_replace(Journal *j, size_t start_line, size_t start_col,
+                     size_t end_line, size_t end_col, const char *text) {
+    if (j->fd < 0) return;
+    size_t len = text ? strlen(text) : 0;
+    char head[128];
+    int n = snprintf(head, sizeof(head), "R %zu %zu %zu %zu %zu\n",
+                     start_line, start_col, end_line, end_col, len);
+    append_record(j, head, (size_t)n, text ? text : "", len);
+}
+
+void journal_set_line(Journal *j, size_t line, const char *text) {
+    if (j->fd < 0) return;
+    size_t len = strlen(text);
+    char head[64];
+    int n = snprintf(head, sizeof(head), "L %zu %zu\n", line, len);
+    append_record(j, head, (size_t)n, text, len);
+}
+
+void journal_tick(Journal *j) {
+    if (j->fd < 0) return;
+    if (j->len > 0) flush_pending(j);
+    if (!j->unsynced) return;
+
+    // Batch the fsyncs: a burst of typing costs one per JOURNAL_SYNC_MS
+    long long now = journal_now_ms();
+    if (now - j->last_sync_ms < JOURNAL_SYNC_MS) return;
+    fdatasync(j->fd);
+    j->unsynced = 0;
+    j->last_sync_ms = now;
+}
+
+void journal_saved(Journal *j, const char *file) {
+    if (j->fd < 0) return;
+    j->len = 0;
+    j->records = 0;
+    if (ftruncate(j->fd, 0) != 0 || write_header(j->fd, file) != 0) {
+        journal_close(j, 1);
+        return;
+    }
+    lseek(j->fd, 0, SEEK_END);
+    j->unsynced = 1;
+}
+
+void journal_close(Journal *j, int discard) {
+    if (j->fd >= 0) {
+        if (!discard && j->len > 0) flush_pending(j);
+        close(j->fd);
+        if (discard) unlink(j->path);
+    }
+    free(j->pending);
+    j->pending = NULL;
+    j->len = j->cap = 0;
+    j->fd = -1;
+}
+
+// ---- reading ---------------------------------------------------------------
+
+static int read_header(FILE *fp, JournalInfo *info) {
+    char line[256];
+    int pid = 0;
+    long long size = 0, mtime = 0;
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, JOURNAL_MAGIC "\n", sizeof(JOURNAL_MAGIC)) != 0)
+        return -1;
+    if (!fgets(line, sizeof(line), fp) || sscanf(line, "P %d", &pid) != 1)
+        return -1;
+    if (!fgets(line, sizeof(line), fp) || sscanf(line, "B %lld %lld", &size, &mtime) != 2)
+        return -1;
+    if (info) {
+        info->pid = (pid_t)pid;
+        info->base_size = size;
+        info->base_mtime = mtime;
+    }
+    return 0;
+}
+
+int journal_reader_open(JournalReader *r, const char *file) {
+    memset(r, 0, sizeof(*r));
+    char path[4096];
+    if (journal_path_for(file, path, sizeof(path)) != 0) return -1;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    if (read_header(fp, NULL) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    r->fp = fp;
+    r->good_end = ftell(fp);
+    return 0;
+}
+
+int journal_read(JournalReader *r, JournalRecord *rec) {
+    FILE *fp = r->fp;
+    char head[128];
+    size_t len;
+    if (!fp || !fgets(head, sizeof(head), fp)) return 0;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = head[0];
+    if (rec->type == 'R') {
+        if (sscanf(head, "R %zu %zu %zu %zu %zu", &rec->start_line, &rec->start_col,
+                   &rec->end_line, &rec->end_col, &len) != 5)
+            return -1;
+    } else if (rec->type == 'L') {
+        if (sscanf(head, "L %zu %zu", &rec->start_line, &len) != 2)
+            return -1;
+    } else {
+        return -1;
+    }
+
+    if (len + 1 > r->text_cap) {
+        char *tmp = realloc(r->text, len + 1);
+        if (!tmp) return -1;
+        r->text = tmp;
+        r->text_cap = len + 1;
+    }
+    // A record cut short by the crash is simply not there
+    if (fread(r->text, 1, len, fp) != len || fgetc(fp) != '\n') return 0;
+    r->text[len] = '\0';
+    rec->text = r->text;
+    r->good_end = ftell(fp);
+    return 1;
+}
+
+void journal_reader_close(JournalReader *r) {
+    if (r->fp) fclose(r->fp);
+    free(r->text);
+    memset(r, 0, sizeof(*r));
+}
+
+int journal_probe(const char *file, JournalInfo *info) {
+    memset(info, 0, sizeof(*info));
+    char path[4096];
+    if (journal_path_for(file, path, sizeof(path)) != 0) return 0;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    int ok = read_header(fp, info) == 0;
+    fclose(fp);
+    if (!ok) return 0;
+
+    JournalReader r;
+    JournalRecord rec;
+    if (journal_reader_open(&r, file) != 0) return 0;
+    while (journal_read(&r, &rec) == 1) info->records++;
+    journal_reader_close(&r);
+
+    info->pid_alive = info->pid > 0 && info->pid != getpid() &&
+                      (kill(info->pid, 0) == 0 || errno == EPERM);
+    struct stat st;
+    info->base_changed = stat(file, &st) != 0 ||
+                         (long long)st.st_size != info->base_size ||
+                         (long long)st.st_mtime != info->base_mtime;
+    return info->records > 0;
+}
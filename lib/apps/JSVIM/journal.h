@@ -0,0 +1,92 @@
+// journal.h - Crash-recovery journal ("swap file") of unsaved edits
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define JOURNAL_SYNC_MS     1000         // fdatasync at most this often
+#define JOURNAL_FLUSH_BYTES (256 * 1024) // write() early past this much
+
+// Every edit since the last save is appended as a record, using the same
+// range data as an UndoDelta:
+//
+//   R <start_line> <start_col> <end_line> <end_col> <len>\n<text>\n
+//       replace the range with <text> (typing, paste, undo/redo)
+//   L <line> <len>\n<text>\n
+//       set a whole line (the line-swap deltas written by :s)
+//
+// after a header naming the file, the owning pid, and the size and mtime
+// the file had when the journal was started. Saving starts it over;
+// quitting without unsaved changes removes it.
+typedef struct {
+    int fd;                      // -1 when not journaling
+    char path[4096];
+    char *pending;               // records not yet written
+    size_t len;
+    size_t cap;
+    int unsynced;                // written since the last fdatasync
+    long long last_sync_ms;
+    size_t records;
+} Journal;
+
+// What a journal left behind by another session says
+typedef struct {
+    pid_t pid;                   // session that wrote it
+    int pid_alive;               // ... and is still running
+    long long base_size;         // file size/mtime the edits apply to
+    long long base_mtime;
+    int base_changed;            // the file no longer matches them
+    size_t records;              // complete records
+} JournalInfo;
+
+typedef struct {
+    char type;                   // 'R' or 'L'
+    size_t start_line, start_col, end_line, end_col;  // 'L' uses start_line
+    char *text;                  // owned by the reader until the next call
+} JournalRecord;
+
+void journal_init(Journal *j);
+
+// Swap file path for `file` (under ~/.cache/jsvim/swap). 0 on success.
+int journal_path_for(const char *file, char *out, size_t outsz);
+
+// Inspect a journal left for `file`. Returns 1 if one with at least one
+// record exists, 0 otherwise.
+int journal_probe(const char *file, JournalInfo *info);
+
+// Start journaling `file`. keep == 0 starts an empty journal; otherwise
+// the first `keep` bytes of the existing one (its header and the records
+// a recovery replayed, see JournalReader.good_end) stay, since the file
+// on disk still lacks those edits. Returns 0 on success.
+int journal_open(Journal *j, const char *file, long long keep);
+
+// Append one edit; written out by journal_tick
+void journal_replace(Journal *j, size_t start_line, size_t start_col,
+                     size_t end_line, size_t end_col, const char *text);
+void journal_set_line(Journal *j, size_t line, const char *text);
+
+// Write pending records, and fdatasync once JOURNAL_SYNC_MS has passed
+// since the last one. Called every main-loop tick.
+void journal_tick(Journal *j);
+
+// The file was saved: drop every record and re-stamp the header
+void journal_saved(Journal *j, const char *file);
+
+// Stop journaling; remove the swap file too if `discard` is set
+void journal_close(Journal *j, int discard);
+
+// Read the records of the journal for `file` in order. Returns 1 for a
+// record, 0 at the end (including a torn final record), -1 on error.
+typedef struct {
+    void *fp;
+    char *text;
+    size_t text_cap;
+    long long good_end;          // offset just past the last complete record
+} JournalReader;
+
+int journal_reader_open(JournalReader *r, const char *file);
+int journal_read(JournalReader *r, JournalRecord *rec);
+void journal_reader_close(JournalReader *r);
+
+#endif
@@ -355,6 +355,13 @@ void lsp_initialize(Buffer *buf) {
     cJSON_AddItemToObject(textDoc, "publishDiagnostics", pubDiag);
     cJSON_AddBoolToObject(pubDiag, "relatedInformation", 1);
 
+    // Completion items as plain text: no snippet placeholders to expand
+    cJSON *completion = cJSON_CreateObject();
+    cJSON_AddItemToObject(textDoc, "completion", completion);
+    cJSON *compItem = cJSON_CreateObject();
+    cJSON_AddItemToObject(completion, "completionItem", compItem);
+    cJSON_AddBoolToObject(compItem, "snippetSupport", 0);
+
     cJSON *semTokens = cJSON_CreateObject();
     cJSON_AddItemToObject(textDoc, "semanticTokens", semTokens);
 
@@ -444,6 +451,7 @@ void lsp_notify_did_change(Buffer *buf) {
     free(text);
 
     buf->lsp_dirty = 0;
+    buf->lsp_unsent = 0;
 }
 
 void lsp_request_semantic_tokens(Buffer *buf) {
@@ -483,6 +491,55 @@ void lsp_request_semantic_tokens(Buffer *buf) {
     cJSON_Delete(root);
 }
 
+int lsp_request_completion(Buffer *buf, size_t line, size_t character) {
+    // Ids 1 and 100 are the fixed initialize and semantic-token requests
+    static int next_id = 1000;
+
+    if (buf->lsp.stdin_fd == -1 || !buf->lsp_opened) return 0;
+
+    // The server must see the text being completed, even where the
+    // debounced sync in editor_flush_lsp has not run (or never runs)
+    if (buf->lsp_dirty || buf->lsp_unsent) {
+        int dirty = buf->lsp_dirty;
+        lsp_notify_did_change(buf);
+        // Leave the flush its semantic-token refresh
+        buf->lsp_dirty = dirty;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    if (!root) return 0;
+    int id = next_id++;
+    cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+    cJSON_AddNumberToObject(root, "id", id);
+    cJSON_AddStringToObject(root, "method", "textDocument/completion");
+
+    cJSON *params = cJSON_CreateObject();
+    cJSON_AddItemToObject(root, "params", params);
+    cJSON *td = cJSON_CreateObject();
+    cJSON_AddItemToObject(params, "textDocument", td);
+    cJSON_AddStringToObject(td, "uri", buf->lsp_uri);
+    cJSON *pos = cJSON_CreateObject();
+    cJSON_AddItemToObject(params, "position", pos);
+    cJSON_AddNumberToObject(pos, "line", (double)line);
+    cJSON_AddNumberToObject(pos, "character", (double)character);
+
+    char *json = cJSON_PrintUnformatted(root);
+    if (json) {
+        lsp_send(&buf->lsp, json);
+        free(json);
+    }
+    cJSON_Delete(root);
+    return json ? id : 0;
+}
+
+void lsp_cancel_request(Buffer *buf, int id) {
+    if (buf->lsp.stdin_fd == -1 || id <= 0) return;
+    char json[128];
+    snprintf(json, sizeof(json),
+             "{\"jsonrpc\":\"2.0\",\"method\":\"$/cancelRequest\",\"params\":{\"id\":%d}}", id);
+    lsp_send(&buf->lsp, json);
+}
+
 static void handle_lsp_json_message(Buffer *buf, const char *json_text) {
     cJSON *root = cJSON_Parse(json_text);
     if (!root) {
@@ -595,6 +652,11 @@ static void handle_lsp_json_message(Buffer *buf, const char *json_text) {
 
             // Sort so semantic_kind_at can binary-search the updated array
             semantic_tokens_sort(buf);
+            buf->lsp_tokens_gen++;
+        } else if (buf->completion.pending_id && msg_id == buf->completion.pending_id) {
+            // Replies to cancelled requests no longer match pending_id and
+            // fall through; an error reply just clears the list
+            completion_take_result(&buf->completion, cJSON_GetObjectItem(root, "result"));
         }
 
         cJSON_Delete(root);
@@ -37,6 +37,13 @@ void lsp_notify_did_open(Buffer *buf);
 void lsp_notify_did_change(Buffer *buf);
 void lsp_request_semantic_tokens(Buffer *buf);
 
+// textDocument/completion at a position; returns the request id, 0 if
+// nothing was sent. The reply lands in buf->completion.
+int lsp_request_completion(Buffer *buf, size_t line, size_t character);
+
+// $/cancelRequest for a request whose reply is no longer wanted
+void lsp_cancel_request(Buffer *buf, int id);
+
 // LSP configuration from ~/.jsvimrc
 void lsp_load_config(void);
 void lsp_config_cleanup(void);
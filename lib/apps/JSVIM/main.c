@@ -20,6 +20,8 @@
 #include "language.h"
 #include "lsp.h"
 #include "highlight.h"
+#include "search.h"
+#include "profile.h"
 
 #ifndef JSVIM_VERSION
 #define JSVIM_VERSION "0.3.0"
@@ -30,6 +32,30 @@
 
 #define JSVIM_CONFIG_FILE ".jsvimrc"
 
+// Insert a bracketed paste, up to ESC[201~ or a read timeout, as one block
+static void read_paste(EditorState *ed, WINDOW *win) {
+    size_t cap = 4096, len = 0;
+    char *text = malloc(cap);
+    if (!text) return;
+
+    wtimeout(win, 200);
+    for (;;) {
+        int c = wgetch(win);
+        if (c == ERR || c == KEY_PASTE_END) break;
+        if (c < 0 || c > 255) continue;
+        if (len == cap) {
+            char *tmp = realloc(text, cap * 2);
+            if (!tmp) break;
+            text = tmp;
+            cap *= 2;
+        }
+        text[len++] = (char)c;
+    }
+
+    editor_insert_text(ed, text, len);
+    free(text);
+}
+
 // Open or create the config file at ~/.jsvimrc
 static int init_config_file(void) {
     const char *home = getenv("HOME");
@@ -55,6 +81,8 @@ static int init_config_file(void) {
     fprintf(fp, "editor.tab = 4\n");
     fprintf(fp, "editor.autosave = 0\n");
     fprintf(fp, "editor.edit_group_timeout = 500\n");
+    fprintf(fp, "editor.large_file_mb = %d\n", LARGE_FILE_MB_DEFAULT);
+    fprintf(fp, "editor.large_file_lines = %d\n", LARGE_FILE_LINES_DEFAULT);
     fprintf(fp, "\n");
     fprintf(fp, "# Editor Highlighing settings\n");
     fprintf(fp, "editor.color.keyword = %d\n", 147);
@@ -100,7 +128,7 @@ int main(int argc, char **argv) {
         else {
             strncpy(ed.filename, argv[1], sizeof(ed.filename)-1);
             ed.have_filename = 1;
-            ed.existing_file = !load_file(&ed.buf, ed.filename);
+            ed.existing_file = !editor_load_file(&ed, ed.filename);
             if (!ed.existing_file) {
                 buf_push(&ed.buf, dupstr(""));
                 ed.file_created = 0;
@@ -141,7 +169,7 @@ int main(int argc, char **argv) {
         if (strlen(fnamebuf) > 0) {
             snprintf(ed.filename, sizeof(ed.filename), "%s", fnamebuf);
             ed.have_filename = 1;
-            ed.existing_file = !load_file(&ed.buf, ed.filename);
+            ed.existing_file = !editor_load_file(&ed, ed.filename);
             if (!ed.existing_file) {
                 buf_free(&ed.buf);
                 buf_init(&ed.buf);
@@ -166,8 +194,14 @@ int main(int argc, char **argv) {
     ed.buf.filepath[sizeof(ed.buf.filepath) - 1] = '\0';
 
     highlight_buffer(&ed.buf);
-
-    if (ed.buf.ft != FT_NONE) {
+    editor_start_journal(&ed);
+    if (ed.existing_file)
+        watch_start(&ed.watch, ed.filename);
+    editor_open_changes(&ed);
+
+    // Large files get no language server: a full-file didOpen and
+    // semantic-token reply would dwarf everything else the editor does
+    if (ed.buf.ft != FT_NONE && !ed.large_file) {
         ed.buf.lsp = spawn_lsp(&ed.buf.ft);
         if (ed.buf.lsp.pid > 0) {
             lsp_initialize(&ed.buf);
@@ -183,6 +217,8 @@ int main(int argc, char **argv) {
     int last_maxy = 0, last_maxx = 0;
 
     while (!ed.quit) {
+        profile_frame_begin();
+        journal_tick(&ed.journal);
         editor_process_lsp(&ed);
         editor_flush_lsp(&ed);
 
@@ -210,39 +246,118 @@ int main(int argc, char **argv) {
 *  my uses. Some people who saw this project called it an exercise in futility since the entire app is literally written in C and
 *  ncurses, so what is the point in calling it JSsh and jsvim? Even I don't know...
 */
+        // Stream :grep hits into the quickfix list; the list takes rows
+        // from the bottom of the main window while it is open.
+        int grepping = editor_poll_grep(&ed);
+        editor_poll_file(&ed);
+        int indexing = finder_poll(&ed.finder);
+        int diffing = changes_poll(&ed.changes, ed.buf.lines, ed.buf.count);
+        int panel_open = ed.qf.open || ed.finder.active;
+        int qf_rows = (panel_open && maxy - 3 - QUICKFIX_ROWS >= 3) ? QUICKFIX_ROWS : 0;
+
         int gutter_width = compute_gutter_width(ed.buf.count);
         int col_offset = gutter_width + 2;
-        int visible_rows = maxy - 3;
+        int visible_rows = maxy - 3 - qf_rows;
 
+        long long prof = profile_begin();
         int cy, cx;
-        compute_cursor_position(&ed.buf, ed.cursor_line, ed.cursor_col,
+        // A jump (search, :N, quickfix) into a closed fold opens it
+        folds_reveal(&ed.folds, ed.cursor_line);
+        compute_cursor_position(&ed.buf, &ed.folds, ed.cursor_line, ed.cursor_col,
                                col_offset, maxx, visible_rows,
                                &ed.scroll_y, &cy, &cx);
 
+        // Large files are highlighted only around the viewport
+        if (ed.large_file)
+            highlight_viewport(&ed.buf, ed.scroll_y,
+                               folds_line_at_row(&ed.folds, folds_row_of(&ed.folds, ed.scroll_y) +
+                                                 (size_t)visible_rows) - ed.scroll_y);
+
+        BracketMatch match;
+        brackets_match_at(&ed.brackets, &ed.buf, ed.cursor_line, ed.cursor_col, &match);
+
         // Render windows
-        render_main_window(main_win, &ed.buf, maxy, maxx,
+        render_main_window(main_win, &ed.buf, &ed.folds, &ed.changes, maxy - qf_rows, maxx,
                           ed.scroll_y, ed.cursor_line, ed.cursor_col,
                           gutter_width, title, ed.filename, ed.have_filename,
-                          ed.modified, ed.mode_insert, ed.line_number_relative);
+                          ed.modified, ed.large_file, ed.mode_insert, ed.line_number_relative,
+                          &ed.search,
+                          &match);
 
         render_command_window(cmd_win, &ed.buf, maxx, ed.mode_insert,
                              ed.cmdbuf, ed.cursor_line,
-                             ed.pending_create_prompt, ed.filename);
+                             ed.pending_create_prompt, ed.filename,
+                             ed.message);
+
+        // The picker, when open, covers the quickfix list and the command line
+        if (ed.finder.active)
+            render_finder(main_win, cmd_win, maxy - 1 - qf_rows, qf_rows, maxx,
+                          &ed.finder, indexing);
+        else if (qf_rows > 0)
+            render_quickfix(main_win, maxy - 1 - qf_rows, qf_rows, maxx, &ed.qf,
+                            grepping, ed.grep ? grep_files_scanned(ed.grep) : 0);
+        if (editor_completion_visible(&ed))
+            render_completion(main_win, &ed.buf.completion, cy,
+                              col_offset + (int)ed.buf.completion.col, visible_rows, maxx);
+        if (profile_on)
+            render_profile(main_win, maxx, maxy - 1 - qf_rows);
+        profile_end(PROF_RENDER, prof);
+
+        // Keep the total-match count moving between keystrokes: scan a
+        // time-boxed slice per tick and poll input without waiting until
+        // the count is finished.
+        int counting = search_count_step(&ed.search, &ed.buf, SEARCH_COUNT_SLICE_MS);
+        // Same for the Ctrl-N word index: the first pass over a new file,
+        // then the lines each edit touched
+        if (!ed.large_file)
+            counting |= words_step(&ed.words, &ed.buf, WORDS_SLICE_MS);
+        int wait_ms = counting ? 0 : (grepping || indexing) ? 50 : 200;
+        // A completion reply (or a half-read LSP message) and new change
+        // signs are shown as soon as they are in, not at the next 200 ms tick
+        if (ed.buf.completion.pending_id || ed.buf.lsp.lsp_accum_len > 0 || diffing)
+            wait_ms = wait_ms < 10 ? wait_ms : 10;
+        wtimeout(main_win, wait_ms);
+        wtimeout(cmd_win, wait_ms);
 
         // Position cursor and get input
         time_t now = time(NULL);
-        if (ed.mode_insert) {
+        if (ed.finder.active) {
+            wmove(cmd_win, 0, 6 + (int)ed.finder.qlen);
+            prof = profile_begin();
+            wrefresh(main_win);
+            wrefresh(cmd_win);
+            profile_end(PROF_REFRESH, prof);
+            profile_wait_begin();
+            ch = wgetch(cmd_win);
+            profile_wait_end();
+            if (ch != ERR) {
+                ed.last_input_time = now;
+            }
+            prof = profile_begin();
+            editor_handle_finder(&ed, ch);
+            profile_end(PROF_INPUT, prof);
+        } else if (ed.mode_insert) {
             // clamp cy to visible text area bounds
             if (cy < 1) cy = 1;
             if (cy > visible_rows) cy = visible_rows;
             wmove(main_win, cy, cx);
+            prof = profile_begin();
             wrefresh(cmd_win);
             wrefresh(main_win);
+            profile_end(PROF_REFRESH, prof);
+            profile_wait_begin();
             ch = wgetch(main_win);
+            profile_wait_end();
             if (ch != ERR) {
                 ed.last_input_time = now;
             }
-            editor_handle_insert_mode(&ed, ch, visible_rows);
+            prof = profile_begin();
+            if (ch == KEY_PASTE_BEGIN) {
+                read_paste(&ed, main_win);
+            } else {
+                editor_handle_insert_mode(&ed, ch, visible_rows);
+            }
+            profile_end(PROF_INPUT, prof);
         } else {
             // place cursor in command window
             if (ed.pending_create_prompt) {
@@ -250,26 +365,37 @@ int main(int argc, char **argv) {
             } else {
                 wmove(cmd_win, 0, (int)ed.cmdlen + 2);
             }
+            prof = profile_begin();
             wrefresh(main_win);
             wrefresh(cmd_win);
+            profile_end(PROF_REFRESH, prof);
+            profile_wait_begin();
             ch = wgetch(cmd_win);
+            profile_wait_end();
                 if (ch != ERR) {
                     ed.last_input_time = now;
                 }
+            prof = profile_begin();
             editor_handle_command_mode(&ed, ch, cmd_win, maxx);
+            profile_end(PROF_INPUT, prof);
         }
 
-            // Autosave
-            if (ed.autosave_enabled && ed.modified && ed.have_filename && ed.file_created) {
+            // Autosave. Unsaved edits are already in the journal, so this
+            // is a convenience; rewriting a large file every pause is not.
+            if (ed.autosave_enabled && ed.modified && ed.have_filename && ed.file_created &&
+                !ed.large_file) {
                 if (ed.last_input_time != 0) {
                     time_t now2 = time(NULL);
                     if (now2 - ed.last_input_time >= 2) {
                         if (save_file(&ed.buf, ed.filename) == 0) {
                             ed.modified = 0;
+                            journal_saved(&ed.journal, ed.filename);
+                            watch_sync(&ed.watch);
                         }
                     }
                 }
             }
+        profile_frame_end();
     }
 
     // Cleanup
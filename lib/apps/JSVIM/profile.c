@@ -0,0 +1,240 @@
+// profile.c - Frame-time profiler behind ":profile on"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROF_DEPTH       16
+#define STATS_REFRESH_NS 250000000LL
+
+int profile_on = 0;
+
+static const char *section_names[PROF_SECTIONS] = {
+    "lsp", "highlight", "sort", "render", "refresh", "input", "other",
+};
+
+// Current frame. child[d] collects the time of sections nested directly
+// inside the open section at depth d, so profile_end can charge only the
+// section's own time.
+static long long cur[PROF_SECTIONS];
+static long long child[PROF_DEPTH];
+static int depth;
+static int in_frame;
+static long long frame_t0, wait_t0, wait_ns;
+
+// Ring of finished frames: the per-section times, then the frame total
+static long long frames[PROFILE_FRAMES][PROF_SECTIONS + 1];
+static size_t frame_head, frame_count;
+
+static long long lsp_bytes[PROFILE_LSP_MESSAGES];
+static long long lsp_ns[PROFILE_LSP_MESSAGES];
+static size_t lsp_head, lsp_count, lsp_total;
+
+// Percentiles are cached; sorting every series on every frame would show
+// up in the numbers being measured.
+static ProfStats section_cache[PROF_SECTIONS + 1];
+static ProfStats lsp_size_cache, lsp_parse_cache;
+static long long stats_at;
+static int stats_dirty;
+
+static long long clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void profile_enable(int on) {
+    if (on && !profile_on) {
+        frame_head = frame_count = 0;
+        lsp_head = lsp_count = lsp_total = 0;
+        memset(section_cache, 0, sizeof(section_cache));
+        memset(&lsp_size_cache, 0, sizeof(lsp_size_cache));
+        memset(&lsp_parse_cache, 0, sizeof(lsp_parse_cache));
+        in_frame = 0;
+    }
+    profile_on = on;
+}
+
+long long profile_begin(void) {
+    if (!profile_on) return 0;
+    if (depth < PROF_DEPTH) child[depth] = 0;
+    depth++;
+    return clock_ns();
+}
+
+long long profile_end(ProfSection s, long long t0) {
+    // A section opened while profiling was on is closed even if it has
+    // since been turned off, so the nesting depth stays balanced.
+    if (t0 == 0 || depth == 0) return 0;
+    long long elapsed = clock_ns() - t0;
+    depth--;
+    long long self = elapsed;
+    if (depth < PROF_DEPTH) self -= child[depth];
+    if (depth > 0 && depth - 1 < PROF_DEPTH) child[depth - 1] += elapsed;
+    if (in_frame && self > 0) cur[s] += self;
+    return elapsed;
+}
+
+void profile_frame_begin(void) {
+    in_frame = profile_on;
+    if (!in_frame) return;
+    memset(cur, 0, sizeof(cur));
+    wait_ns = 0;
+    wait_t0 = 0;
+    frame_t0 = clock_ns();
+}
+
+void profile_wait_begin(void) {
+    if (in_frame) wait_t0 = clock_ns();
+}
+
+void profile_wait_end(void) {
+    if (in_frame && wait_t0) {
+        wait_ns += clock_ns() - wait_t0;
+        wait_t0 = 0;
+    }
+}
+
+void profile_frame_end(void) {
+    if (!in_frame || !profile_on) {
+        in_frame = 0;
+        return;
+    }
+    in_frame = 0;
+
+    long long total = clock_ns() - frame_t0 - wait_ns;
+    long long accounted = 0;
+    for (int s = 0; s < PROF_OTHER; s++) accounted += cur[s];
+    cur[PROF_OTHER] = total > accounted ? total - accounted : 0;
+
+    long long *row = frames[frame_head];
+    memcpy(row, cur, sizeof(cur));
+    row[PROF_SECTIONS] = total;
+    frame_head = (frame_head + 1) % PROFILE_FRAMES;
+    if (frame_count < PROFILE_FRAMES) frame_count++;
+    stats_dirty = 1;
+}
+
+void profile_lsp_message(size_t bytes, long long ns) {
+    if (!profile_on) return;
+    lsp_bytes[lsp_head] = (long long)bytes;
+    lsp_ns[lsp_head] = ns;
+    lsp_head = (lsp_head + 1) % PROFILE_LSP_MESSAGES;
+    if (lsp_count < PROFILE_LSP_MESSAGES) lsp_count++;
+    lsp_total++;
+    stats_dirty = 1;
+}
+
+const char *profile_section_name(ProfSection s) {
+    return (s >= 0 && s < PROF_SECTIONS) ? section_names[s] : "?";
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Sort `v` in place and fill `out`, dividing every value by `scale`.
+// `last` is the newest sample, passed in because sorting loses order.
+static void series_stats(long long *v, size_t n, long long last, double scale,
+                         ProfStats *out) {
+    memset(out, 0, sizeof(*out));
+    if (n == 0) return;
+    if (n > 1) qsort(v, n, sizeof(long long), cmp_ll);
+    out->last = (double)last / scale;
+    out->p50 = (double)v[(n - 1) / 2] / scale;
+    out->p99 = (double)v[(size_t)((double)(n - 1) * 0.99)] / scale;
+    out->max = (double)v[n - 1] / scale;
+}
+
+static void refresh_stats(int force) {
+    if (!stats_dirty) return;
+    long long now = clock_ns();
+    if (!force && now - stats_at < STATS_REFRESH_NS) return;
+    stats_at = now;
+    stats_dirty = 0;
+
+    static long long tmp[PROFILE_FRAMES];
+    size_t newest = (frame_head + PROFILE_FRAMES - 1) % PROFILE_FRAMES;
+    for (int s = 0; s <= PROF_SECTIONS; s++) {
+        for (size_t i = 0; i < frame_count; i++) tmp[i] = frames[i][s];
+        series_stats(tmp, frame_count, frame_count ? frames[newest][s] : 0, 1e6,
+                     &section_cache[s]);
+    }
+
+    size_t lnewest = (lsp_head + PROFILE_LSP_MESSAGES - 1) % PROFILE_LSP_MESSAGES;
+    memcpy(tmp, lsp_bytes, lsp_count * sizeof(long long));
+    series_stats(tmp, lsp_count, lsp_count ? lsp_bytes[lnewest] : 0, 1024.0,
+                 &lsp_size_cache);
+    memcpy(tmp, lsp_ns, lsp_count * sizeof(long long));
+    series_stats(tmp, lsp_count, lsp_count ? lsp_ns[lnewest] : 0, 1e6,
+                 &lsp_parse_cache);
+}
+
+void profile_section_stats(ProfSection s, ProfStats *out) {
+    refresh_stats(0);
+    *out = section_cache[s];
+}
+
+void profile_frame_stats(ProfStats *out) {
+    refresh_stats(0);
+    *out = section_cache[PROF_SECTIONS];
+}
+
+void profile_lsp_stats(ProfStats *size_kb, ProfStats *parse_ms, size_t *count) {
+    refresh_stats(0);
+    *size_kb = lsp_size_cache;
+    *parse_ms = lsp_parse_cache;
+    *count = lsp_total;
+}
+
+size_t profile_frame_count(void) {
+    return frame_count;
+}
+
+int profile_dump(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    refresh_stats(1);
+    fprintf(fp, "# jsvim profile: last %zu frames, time blocked on input excluded\n",
+            frame_count);
+    fprintf(fp, "%-10s %10s %10s %10s %10s\n", "ms", "last", "p50", "p99", "max");
+    for (int s = 0; s <= PROF_SECTIONS; s++) {
+        const ProfStats *st = &section_cache[s];
+        fprintf(fp, "%-10s %10.3f %10.3f %10.3f %10.3f\n",
+                s < PROF_SECTIONS ? section_names[s] : "frame",
+                st->last, st->p50, st->p99, st->max);
+    }
+
+    fprintf(fp, "\n# LSP messages: %zu total, last %zu kept\n", lsp_total, lsp_count);
+    fprintf(fp, "%-10s %10.1f %10.1f %10.1f %10.1f\n", "size KB",
+            lsp_size_cache.last, lsp_size_cache.p50, lsp_size_cache.p99,
+            lsp_size_cache.max);
+    fprintf(fp, "%-10s %10.3f %10.3f %10.3f %10.3f\n", "parse ms",
+            lsp_parse_cache.last, lsp_parse_cache.p50, lsp_parse_cache.p99,
+            lsp_parse_cache.max);
+
+    // Raw samples, oldest first, in microseconds
+    fprintf(fp, "\n# frames (us)\n");
+    for (int s = 0; s < PROF_SECTIONS; s++) fprintf(fp, "%s,", section_names[s]);
+    fprintf(fp, "frame\n");
+    size_t start = (frame_head + PROFILE_FRAMES - frame_count) % PROFILE_FRAMES;
+    for (size_t i = 0; i < frame_count; i++) {
+        const long long *row = frames[(start + i) % PROFILE_FRAMES];
+        for (int s = 0; s <= PROF_SECTIONS; s++)
+            fprintf(fp, "%lld%c", row[s] / 1000, s < PROF_SECTIONS ? ',' : '\n');
+    }
+
+    fprintf(fp, "\n# lsp messages (bytes,us)\n");
+    size_t lstart = (lsp_head + PROFILE_LSP_MESSAGES - lsp_count) % PROFILE_LSP_MESSAGES;
+    for (size_t i = 0; i < lsp_count; i++) {
+        size_t k = (lstart + i) % PROFILE_LSP_MESSAGES;
+        fprintf(fp, "%lld,%lld\n", lsp_bytes[k], lsp_ns[k] / 1000);
+    }
+
+    int err = ferror(fp);
+    if (fclose(fp) != 0) err = 1;
+    return err ? -1 : 0;
+}
@@ -0,0 +1,66 @@
+// profile.h - Frame-time profiler behind ":profile on"
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+
+#define PROFILE_FRAMES       1024  // frames kept for the rolling percentiles
+#define PROFILE_LSP_MESSAGES 256   // LSP messages kept for size/parse stats
+
+// Where a frame's time goes. Sections are exclusive: time spent in a
+// section nested inside another (semantic_tokens_sort inside
+// highlight_buffer, highlight_buffer inside an LSP reply, ...) is charged
+// to the inner one only.
+typedef enum {
+    PROF_LSP,        // editor_process_lsp: read + parse + handle replies
+    PROF_HIGHLIGHT,  // highlight_buffer
+    PROF_SORT,       // semantic_tokens_sort
+    PROF_RENDER,     // render_main_window and the other panels
+    PROF_REFRESH,    // wrefresh
+    PROF_INPUT,      // key handlers
+    PROF_OTHER,      // rest of the main loop
+    PROF_SECTIONS
+} ProfSection;
+
+// Rolling statistics of one series, in milliseconds
+typedef struct {
+    double last;
+    double p50;
+    double p99;
+    double max;
+} ProfStats;
+
+extern int profile_on;
+
+void profile_enable(int on);
+
+// Time a section: t0 = profile_begin(); ...; profile_end(PROF_X, t0).
+// profile_begin returns 0 while profiling is off, which makes the
+// matching profile_end a no-op. profile_end returns the section's total
+// (inclusive) time in ns, or 0.
+long long profile_begin(void);
+long long profile_end(ProfSection s, long long t0);
+
+// The main loop brackets each iteration with these. Time spent blocked
+// in wgetch is bracketed by profile_wait_begin/end and left out.
+void profile_frame_begin(void);
+void profile_wait_begin(void);
+void profile_wait_end(void);
+void profile_frame_end(void);
+
+// One complete LSP message: payload bytes and time to parse and handle it
+void profile_lsp_message(size_t bytes, long long ns);
+
+const char *profile_section_name(ProfSection s);
+
+// Rolling stats per section, for the whole frame, and for LSP messages
+// (sizes in KB, parse times in ms). Refreshed at most every 250 ms.
+void profile_section_stats(ProfSection s, ProfStats *out);
+void profile_frame_stats(ProfStats *out);
+void profile_lsp_stats(ProfStats *size_kb, ProfStats *parse_ms, size_t *count);
+size_t profile_frame_count(void);
+
+// Write percentiles and the raw per-frame samples to `path`
+int profile_dump(const char *path);
+
+#endif
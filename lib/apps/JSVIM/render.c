@@ -1,6 +1,7 @@
 // render.c - ncurses rendering functions
 #include "render.h"
 #include "highlight.h"
+#include "profile.h"
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
@@ -125,9 +126,18 @@ void render_init(void) {
     use_default_colors();
     set_escdelay(100);
     timeout(200); // update screen
+
+    // Bracketed paste: the terminal wraps pasted text in ESC[200~ ... ESC[201~
+    // so insert mode can take it as one block instead of key by key.
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    printf("\033[?2004h");
+    fflush(stdout);
 }
 
 void render_cleanup(void) {
+    printf("\033[?2004l");
+    fflush(stdout);
     endwin();
 }
 
@@ -137,6 +147,8 @@ void render_init_colors(void) {
     init_pair(COLOR_PAIR_STATUS, COLOR_BLACK, 7); // status bar
     init_pair(COLOR_PAIR_ERROR, 196, -1);               // errors
     init_pair(COLOR_PAIR_WARNING, 226, -1);             // warnings
+    init_pair(COLOR_PAIR_SEARCH, COLOR_BLACK, COLOR_YELLOW); // search matches
+    init_pair(COLOR_PAIR_ADDED, 114, -1);               // added lines
 
     // Semantic token colors (foreground only, background stays default)
     init_pair(SY_KEYWORD,   get_semantic_color("keyword",   147), -1);
@@ -161,12 +173,15 @@ int compute_gutter_width(size_t line_count) {
     return gutter_width;
 }
 
-void render_main_window(WINDOW *main_win, Buffer *buf, 
+void render_main_window(WINDOW *main_win, Buffer *buf, FoldSet *folds,
+                        const ChangeSigns *changes,
                         int maxy, int maxx,
                         size_t scroll_y, size_t cursor_line, size_t cursor_col,
                         int gutter_width,
                         const char *title, const char *filename, int have_filename,
-                        int modified, int mode_insert, int line_number_relative) {
+                        int modified, int large_file, int mode_insert,
+                        int line_number_relative, const SearchState *search,
+                        const BracketMatch *match) {
     (void)cursor_col;
     
     werase(main_win);
@@ -184,9 +199,14 @@ void render_main_window(WINDOW *main_win, Buffer *buf,
 
     int col_offset = gutter_width + 2;
 
-    // render file starting from scroll_y logical line
+    // render file starting from scroll_y logical line; relative numbers
+    // count screen rows, so a closed fold is one
+    size_t cursor_row = folds_row_of(folds, cursor_line);
+    size_t top_row = folds_row_of(folds, scroll_y);
     int row = 1;
     for (size_t lineno = scroll_y; lineno < buf->count && row < maxy - 2; lineno++) {
+        size_t hidden = folds_hidden_after(folds, lineno);
+        size_t screen_row = top_row + (size_t)row - 1;
         // Check for diagnostics on this line
         int diag_severity = 0;
         for (size_t d = 0; d < buf->diag_count; d++) {
@@ -201,10 +221,10 @@ void render_main_window(WINDOW *main_win, Buffer *buf,
         if (line_number_relative) {
             if (lineno == cursor_line) {
                 display_num = lineno + 1;  // current line shows absolute number
-            } else if (lineno > cursor_line) {
-                display_num = lineno - cursor_line;
+            } else if (screen_row > cursor_row) {
+                display_num = screen_row - cursor_row;
             } else {
-                display_num = cursor_line - lineno;
+                display_num = cursor_row - screen_row;
             }
         } else {
             display_num = lineno + 1;
@@ -230,21 +250,59 @@ void render_main_window(WINDOW *main_win, Buffer *buf,
             wattroff(main_win, COLOR_PAIR(COLOR_PAIR_GUTTER));
         }
 
+        // Change sign in the column left of the number; modified and
+        // deleted reuse the warning and error colors
+        int sign = changes_sign_at(changes, lineno);
+        if (sign != CHANGE_NONE) {
+            int pair = sign == CHANGE_ADDED ? COLOR_PAIR_ADDED :
+                       sign == CHANGE_MODIFIED ? COLOR_PAIR_WARNING : COLOR_PAIR_ERROR;
+            wattron(main_win, COLOR_PAIR(pair));
+            mvwaddch(main_win, row, 0, sign == CHANGE_ADDED ? '+' : sign == CHANGE_MODIFIED ? '~' : '_');
+            wattroff(main_win, COLOR_PAIR(pair));
+        }
+
         // No wrap: render at most one screen row per buffer line and
         // truncate anything past the right edge. This keeps cursor math
         // O(1) (see compute_cursor_position) and removes a per-character
         // branch from the hot loop.
         int col = col_offset;
         const char *p = buf->lines[lineno];
+
+        // Search matches are only computed for rows actually on screen
+        SearchSpan spans[64];
+        size_t span_count = search ? search_line_spans(search, p, spans, 64) : 0;
+        size_t si = 0;
+
         for (size_t ip = 0; p[ip] && col < maxx - 1; ip++) {
+            while (si < span_count && ip >= spans[si].col + spans[si].len) si++;
+            if (si < span_count && ip >= spans[si].col) {
+                wattron(main_win, COLOR_PAIR(COLOR_PAIR_SEARCH));
+                mvwaddch(main_win, row, col++, p[ip]);
+                wattroff(main_win, COLOR_PAIR(COLOR_PAIR_SEARCH));
+                continue;
+            }
+
             SemanticKind sk = semantic_kind_at(buf, (int)lineno, (int)ip);
             int sy = color_for_semantic_kind(sk);
-            if (sy)
-                wattron(main_win, COLOR_PAIR(sy));
+            attr_t at = sy ? COLOR_PAIR(sy) : 0;
+            if (match && match->active &&
+                ((lineno == match->line[0] && ip == match->col[0]) ||
+                 (lineno == match->line[1] && ip == match->col[1])))
+                at |= A_REVERSE;
+            if (at)
+                wattron(main_win, at);
             mvwaddch(main_win, row, col++, p[ip]);
-            if (sy)
-                wattroff(main_win, COLOR_PAIR(sy));
+            if (at)
+                wattroff(main_win, at);
+        }
+        if (hidden && col < maxx - 1) {
+            char fbuf[48];
+            snprintf(fbuf, sizeof(fbuf), "  [+%zu line%s]", hidden, hidden == 1 ? "" : "s");
+            wattron(main_win, COLOR_PAIR(COLOR_PAIR_GUTTER));
+            mvwprintw(main_win, row, col, "%.*s", maxx - 1 - col, fbuf);
+            wattroff(main_win, COLOR_PAIR(COLOR_PAIR_GUTTER));
         }
+        lineno += hidden;
         row++;
     }
 
@@ -257,15 +315,29 @@ void render_main_window(WINDOW *main_win, Buffer *buf,
     wattron(main_win, COLOR_PAIR(COLOR_PAIR_STATUS));
     char status_left[256];
     const char *mod_suffix = modified ? " [+]" : "";
+    const char *large_suffix = large_file ? " [large]" : "";
     if (have_filename) {
-        snprintf(status_left, sizeof(status_left), "%.*s%s",
-                 (int)(sizeof(status_left) - sizeof(" [+]")), filename, mod_suffix);
+        snprintf(status_left, sizeof(status_left), "%.*s%s%s",
+                 (int)(sizeof(status_left) - sizeof(" [+] [large]")), filename,
+                 mod_suffix, large_suffix);
     } else {
-        snprintf(status_left, sizeof(status_left), "[No Name]%s", mod_suffix);
+        snprintf(status_left, sizeof(status_left), "[No Name]%s%s", mod_suffix, large_suffix);
     }
     const char *mode_str = mode_insert ? "-- INSERT --" : "-- COMMAND --";
     mvwprintw(main_win, maxy - 2, 2, "%s %s", status_left, mode_str);
 
+    // search: pattern and total matches (still counting on huge buffers)
+    if (search && search->active) {
+        char sbuf[96];
+        if (search->count_done)
+            snprintf(sbuf, sizeof(sbuf), "/%.48s [%zu]", search->pattern, search->match_total);
+        else
+            snprintf(sbuf, sizeof(sbuf), "/%.48s [%zu...]", search->pattern, search->match_total);
+        int sx = maxx - 1 - 6 - (int)strlen(sbuf) - 2;
+        if (sx > 2)
+            mvwprintw(main_win, maxy - 2, sx, "%s", sbuf);
+    }
+
     // clock
     time_t now = time(NULL);
     struct tm *tm_info = localtime(&now);
@@ -275,10 +347,159 @@ void render_main_window(WINDOW *main_win, Buffer *buf,
     wattroff(main_win, COLOR_PAIR(COLOR_PAIR_STATUS));
 }
 
+void render_quickfix(WINDOW *win, int y, int rows, int maxx,
+                     QuickfixList *qf, int running, size_t files_scanned) {
+    if (rows < 2) return;
+
+    // header: title and progress
+    char hbuf[SEARCH_PATTERN_MAX + 96];
+    snprintf(hbuf, sizeof(hbuf), " %s  [%zu match%s in %zu files%s]",
+             qf->title, qf->count, qf->count == 1 ? "" : "es", files_scanned,
+             running ? ", searching..." : "");
+    wattron(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+    for (int i = 0; i < maxx; i++) mvwaddch(win, y, i, ' ');
+    mvwprintw(win, y, 0, "%.*s", maxx, hbuf);
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+
+    // keep the selection on screen
+    size_t list_rows = (size_t)(rows - 1);
+    if (qf->sel < qf->top) qf->top = qf->sel;
+    if (qf->sel >= qf->top + list_rows) qf->top = qf->sel - list_rows + 1;
+
+    for (size_t r = 0; r < list_rows; r++) {
+        int row = y + 1 + (int)r;
+        for (int i = 0; i < maxx; i++) mvwaddch(win, row, i, ' ');
+        size_t idx = qf->top + r;
+        if (idx >= qf->count) continue;
+
+        const GrepHit *h = &qf->items[idx];
+        char loc[1100];
+        int loclen = snprintf(loc, sizeof(loc), "%s:%zu: ", h->path + h->name_off, h->line + 1);
+        if (loclen < 0) continue;
+        if (idx == qf->sel) wattron(win, A_REVERSE);
+        wattron(win, COLOR_PAIR(COLOR_PAIR_GUTTER));
+        mvwprintw(win, row, 1, "%.*s", maxx - 2, loc);
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_GUTTER));
+        if (loclen < maxx - 2)
+            mvwprintw(win, row, 1 + loclen, "%.*s", maxx - 2 - loclen, h->text);
+        if (idx == qf->sel) wattroff(win, A_REVERSE);
+    }
+}
+
+void render_finder(WINDOW *win, WINDOW *cmd_win, int y, int rows, int maxx,
+                   FinderState *f, int indexing) {
+    if (rows < 2) return;
+
+    char hbuf[128];
+    size_t indexed = f->index ? f->index->count : 0;
+    snprintf(hbuf, sizeof(hbuf), " find  [%zu/%zu files%s]", f->total, indexed,
+             indexing ? ", indexing..." : "");
+    wattron(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+    for (int i = 0; i < maxx; i++) mvwaddch(win, y, i, ' ');
+    mvwprintw(win, y, 0, "%.*s", maxx, hbuf);
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+
+    // keep the selection on screen
+    size_t list_rows = (size_t)(rows - 1);
+    if (f->sel < f->top_row) f->top_row = f->sel;
+    if (f->sel >= f->top_row + list_rows) f->top_row = f->sel - list_rows + 1;
+
+    for (size_t r = 0; r < list_rows; r++) {
+        int row = y + 1 + (int)r;
+        for (int i = 0; i < maxx; i++) mvwaddch(win, row, i, ' ');
+        size_t idx = f->top_row + r;
+        if (idx >= f->nresults) continue;
+
+        const FinderEntry *e = &f->index->entries[f->results[idx].idx];
+        if (idx == f->sel) wattron(win, A_REVERSE);
+        wattron(win, COLOR_PAIR(COLOR_PAIR_GUTTER));
+        mvwprintw(win, row, 1, "%.*s", maxx - 2 < (int)e->base ? maxx - 2 : (int)e->base, e->path);
+        wattroff(win, COLOR_PAIR(COLOR_PAIR_GUTTER));
+        if ((int)e->base < maxx - 2)
+            mvwprintw(win, row, 1 + (int)e->base, "%.*s", maxx - 2 - (int)e->base, e->path + e->base);
+        if (idx == f->sel) wattroff(win, A_REVERSE);
+    }
+
+    // prompt replaces the command line
+    werase(cmd_win);
+    mvwprintw(cmd_win, 0, 0, "find> %.*s", maxx > 7 ? maxx - 7 : 0, f->query);
+}
+
+void render_completion(WINDOW *win, const LspCompletion *c, int cy, int x,
+                       int rows, int maxx) {
+    size_t n = c->shown_count - c->top;
+    if (n > COMPLETION_ROWS) n = COMPLETION_ROWS;
+
+    // Label column as wide as the widest visible label, within limits
+    int lw = 8;
+    for (size_t r = 0; r < n; r++) {
+        int len = (int)strlen(c->items[c->shown[c->top + r]].label);
+        if (len > lw) lw = len;
+    }
+    if (lw > 40) lw = 40;
+    int w = lw + 9;                         // " label  kind  "
+    if (w > maxx - 2) w = maxx - 2;
+    if (w < 4) return;
+    if (x + w > maxx - 1) x = maxx - 1 - w;
+    if (x < 1) x = 1;
+
+    // Below the cursor row if it fits, else above it
+    int y = cy + 1;
+    if (y + (int)n > rows + 1) y = cy - (int)n;
+    if (y < 1) return;
+
+    wattron(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+    for (size_t r = 0; r < n; r++) {
+        size_t idx = c->top + r;
+        const CompletionItem *it = &c->items[c->shown[idx]];
+        if (idx == c->sel) wattron(win, A_REVERSE);
+        mvwprintw(win, y + (int)r, x, " %-*.*s %-6.6s", w - 8, w - 8, it->label,
+                  completion_kind_tag(it->kind));
+        if (idx == c->sel) wattroff(win, A_REVERSE);
+    }
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+}
+
+void render_profile(WINDOW *win, int maxx, int max_rows) {
+    enum { W = 38 };
+    int rows = PROF_SECTIONS + 4;
+    if (maxx < W + 2 || max_rows < rows + 1) return;
+    int x = maxx - W - 1;
+    char line[W + 1];
+
+    wattron(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+    snprintf(line, sizeof(line), " profile ms    last    p50    p99");
+    mvwprintw(win, 1, x, "%-*s", W, line);
+
+    ProfStats st;
+    for (int s = 0; s < PROF_SECTIONS; s++) {
+        profile_section_stats((ProfSection)s, &st);
+        snprintf(line, sizeof(line), " %-10s %7.2f %6.2f %6.2f",
+                 profile_section_name((ProfSection)s), st.last, st.p50, st.p99);
+        mvwprintw(win, 2 + s, x, "%-*s", W, line);
+    }
+    profile_frame_stats(&st);
+    wattron(win, A_BOLD);
+    snprintf(line, sizeof(line), " %-10s %7.2f %6.2f %6.2f", "frame", st.last, st.p50, st.p99);
+    mvwprintw(win, 2 + PROF_SECTIONS, x, "%-*s", W, line);
+    wattroff(win, A_BOLD);
+
+    // LSP traffic: message size and parse time of the last message and p99
+    ProfStats kb, ms;
+    size_t n;
+    profile_lsp_stats(&kb, &ms, &n);
+    snprintf(line, sizeof(line), " lsp %zu msg, p99 %.0f KB %.1f ms", n, kb.p99, ms.p99);
+    mvwprintw(win, 3 + PROF_SECTIONS, x, "%-*s", W, line);
+    snprintf(line, sizeof(line), " last %.1f KB parsed in %.2f ms", kb.last, ms.last);
+    mvwprintw(win, 4 + PROF_SECTIONS, x, "%-*s", W, line);
+    wattroff(win, COLOR_PAIR(COLOR_PAIR_STATUS));
+}
+
 void render_command_window(WINDOW *cmd_win, Buffer *buf,
                           int maxx, int mode_insert,
                           const char *cmdbuf, size_t cursor_line,
-                          int pending_create_prompt, const char *filename) {
+                          int pending_create_prompt, const char *filename,
+                          const char *message) {
     werase(cmd_win);
     
     // command row background
@@ -294,6 +515,15 @@ void render_command_window(WINDOW *cmd_win, Buffer *buf,
         return;
     }
 
+    // Message from the last command, until the next keypress
+    if (message && message[0] && !(cmdbuf && cmdbuf[0])) {
+        wattron(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
+        for (int i = 0; i < maxx; i++) mvwaddch(cmd_win, 0, i, ' ');
+        mvwprintw(cmd_win, 0, 1, "%.*s", maxx > 2 ? maxx - 2 : 0, message);
+        wattroff(cmd_win, COLOR_PAIR(COLOR_PAIR_STATUS));
+        return;
+    }
+
     if (!mode_insert) {
         wattron(cmd_win, COLOR_PAIR(COLOR_PAIR_TEXT));
         mvwprintw(cmd_win, 0, 1, ":%s", cmdbuf);
@@ -315,7 +545,7 @@ void render_command_window(WINDOW *cmd_win, Buffer *buf,
     }
 }
 
-void compute_cursor_position(Buffer *buf, size_t cursor_line, size_t cursor_col,
+void compute_cursor_position(Buffer *buf, FoldSet *folds, size_t cursor_line, size_t cursor_col,
                             int col_offset, int maxx, int visible_rows,
                             size_t *scroll_y, int *cy, int *cx) {
     // No line wrapping: each buffer line maps to exactly one screen row, so
@@ -324,14 +554,22 @@ void compute_cursor_position(Buffer *buf, size_t cursor_line, size_t cursor_col,
     // on large files (e.g. quickjs.h) freeze the input loop.
     if (visible_rows < 1) visible_rows = 1;
 
+    // Closed folds take one row each, so the arithmetic is done in screen
+    // rows (folds_row_of, O(log folds)) rather than lines.
+    *scroll_y = folds_visible_line(folds, *scroll_y);
+    size_t crow = folds_row_of(folds, cursor_line);
+    size_t trow = folds_row_of(folds, *scroll_y);
+
     // Keep cursor inside the visible window by sliding scroll_y.
-    if (cursor_line < *scroll_y) {
-        *scroll_y = cursor_line;
-    } else if (cursor_line >= *scroll_y + (size_t)visible_rows) {
-        *scroll_y = cursor_line - (size_t)(visible_rows - 1);
+    if (crow < trow) {
+        trow = crow;
+        *scroll_y = folds_line_at_row(folds, trow);
+    } else if (crow >= trow + (size_t)visible_rows) {
+        trow = crow - (size_t)(visible_rows - 1);
+        *scroll_y = folds_line_at_row(folds, trow);
     }
 
-    *cy = (int)(cursor_line - *scroll_y) + 1;
+    *cy = (int)(crow - trow) + 1;
     if (*cy < 1) *cy = 1;
     if (*cy > visible_rows) *cy = visible_rows;
 
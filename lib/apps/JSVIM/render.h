@@ -4,6 +4,12 @@
 
 #include <ncurses.h>
 #include "buffer.h"
+#include "search.h"
+#include "grep.h"
+#include "finder.h"
+#include "brackets.h"
+#include "fold.h"
+#include "changes.h"
 
 // Color pairs
 #define COLOR_PAIR_TEXT     1
@@ -14,6 +20,12 @@
 #define COLOR_PAIR_STATUS_MID    6   // middle section of status bar
 #define COLOR_PAIR_ARROW_LEFT    7   // left arrow transition
 #define COLOR_PAIR_ARROW_RIGHT   8   // right arrow transition
+#define COLOR_PAIR_SEARCH        9   // search match highlight
+#define COLOR_PAIR_ADDED         24  // added-line sign (after the SY_* pairs)
+
+// Bracketed-paste markers, mapped from ESC[200~ / ESC[201~ in render_init
+#define KEY_PASTE_BEGIN (KEY_MAX + 1)
+#define KEY_PASTE_END   (KEY_MAX + 2)
 
 // Initialize ncurses and colors
 void render_init(void);
@@ -24,22 +36,46 @@ void render_cleanup(void);
 // Initialize color pairs
 void render_init_colors(void);
 
-// Render the main editor window
-void render_main_window(WINDOW *main_win, Buffer *buf, 
+// Render the main editor window; `match`, if active, is a bracket pair
+// drawn in reverse video. A closed fold is drawn as its first line, and
+// each line's change sign goes left of its number.
+void render_main_window(WINDOW *main_win, Buffer *buf, FoldSet *folds,
+                        const ChangeSigns *changes,
                         int maxy, int maxx,
                         size_t scroll_y, size_t cursor_line, size_t cursor_col,
                         int gutter_width,
                         const char *title, const char *filename, int have_filename,
-                        int modified, int mode_insert, int line_number_relative);
+                        int modified, int large_file, int mode_insert,
+                        int line_number_relative, const SearchState *search,
+                        const BracketMatch *match);
+
+// Render the quickfix list in `rows` rows of `win` starting at row y
+void render_quickfix(WINDOW *win, int y, int rows, int maxx,
+                     QuickfixList *qf, int running, size_t files_scanned);
+
+// Render the :find picker in `rows` rows of `win` starting at row y, and
+// its query prompt in the command window
+void render_finder(WINDOW *win, WINDOW *cmd_win, int y, int rows, int maxx,
+                   FinderState *f, int indexing);
+
+// Render the LSP completion popup under (or, near the bottom, over) screen
+// row cy of `win`, starting at column x. `rows` is the text area height.
+void render_completion(WINDOW *win, const LspCompletion *c, int cy, int x,
+                       int rows, int maxx);
+
+// Render the :profile overlay in the top-right corner of `win`
+void render_profile(WINDOW *win, int maxx, int max_rows);
 
 // Render the command window
 void render_command_window(WINDOW *cmd_win, Buffer *buf,
                           int maxx, int mode_insert,
                           const char *cmdbuf, size_t cursor_line,
-                          int pending_create_prompt, const char *filename);
+                          int pending_create_prompt, const char *filename,
+                          const char *message);
 
-// Compute cursor screen position
-void compute_cursor_position(Buffer *buf, size_t cursor_line, size_t cursor_col,
+// Compute cursor screen position; cursor_line must not be inside a
+// closed fold (folds_reveal)
+void compute_cursor_position(Buffer *buf, FoldSet *folds, size_t cursor_line, size_t cursor_col,
                             int col_offset, int maxx, int visible_rows,
                             size_t *scroll_y, int *cy, int *cx);
 
@@ -0,0 +1,256 @@
+// search.c - In-buffer literal/regex search
+#include "search.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static long long search_now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// Patterns made only of plain characters skip regcomp/regexec entirely
+static int pattern_is_literal(const char *p) {
+    for (; *p; p++) {
+        if (strchr(".[]()*+?{}|^$\\", *p))
+            return 0;
+    }
+    return 1;
+}
+
+// Literal fast path. Lines are already NUL-terminated, so strchr/strstr
+// scan them without a separate strlen pass; glibc vectorises both and
+// strstr switches to Two-Way for long needles, so neither degrades on
+// pathological lines.
+static const char *find_literal(const char *hay, const char *needle, size_t nlen) {
+    if (nlen == 1) return strchr(hay, needle[0]);
+    return strstr(hay, needle);
+}
+
+void search_init(SearchState *s) {
+    memset(s, 0, sizeof(*s));
+    s->count_done = 1;
+}
+
+void search_free(SearchState *s) {
+    if (s->re_compiled) {
+        regfree(&s->re);
+        s->re_compiled = 0;
+    }
+    s->active = 0;
+}
+
+int search_set_pattern(SearchState *s, const char *pattern) {
+    search_free(s);
+
+    snprintf(s->pattern, sizeof(s->pattern), "%s", pattern);
+    s->pat_len = strlen(s->pattern);
+    if (s->pat_len == 0) return 0;
+
+    s->is_regex = !pattern_is_literal(s->pattern);
+    if (s->is_regex) {
+        if (regcomp(&s->re, s->pattern, REG_EXTENDED) != 0)
+            return -1;
+        s->re_compiled = 1;
+    }
+
+    s->active = 1;
+    search_invalidate_count(s);
+    return 0;
+}
+
+void search_clear(SearchState *s) {
+    search_free(s);
+    s->pattern[0] = '\0';
+    s->pat_len = 0;
+    s->match_total = 0;
+    s->count_done = 1;
+}
+
+int search_match_in_line(const SearchState *s, const char *line,
+                         size_t from, size_t *mstart, size_t *mlen) {
+    if (!s->active) return 0;
+
+    if (!s->is_regex) {
+        const char *hit = find_literal(line + from, s->pattern, s->pat_len);
+        if (!hit) return 0;
+        *mstart = (size_t)(hit - line);
+        *mlen = s->pat_len;
+        return 1;
+    }
+
+    // Zero-length regex matches (e.g. "x*") are stepped over so every hit
+    // has something to highlight and the cursor always moves.
+    for (;;) {
+        regmatch_t m;
+        if (regexec(&s->re, line + from, 1, &m, from > 0 ? REG_NOTBOL : 0) != 0)
+            return 0;
+        if (m.rm_eo > m.rm_so) {
+            *mstart = from + (size_t)m.rm_so;
+            *mlen = (size_t)(m.rm_eo - m.rm_so);
+            return 1;
+        }
+        if (line[from + m.rm_so] == '\0')
+            return 0;
+        from += (size_t)m.rm_so + 1;
+    }
+}
+
+size_t search_line_spans(const SearchState *s, const char *line,
+                         SearchSpan *spans, size_t max) {
+    if (!s->active) return 0;
+
+    size_t n = 0, from = 0, ms, ml;
+    while (n < max && search_match_in_line(s, line, from, &ms, &ml)) {
+        spans[n].col = ms;
+        spans[n].len = ml;
+        n++;
+        from = ms + ml;
+    }
+    return n;
+}
+
+// Last match on `line` starting strictly before `limit`
+static int last_match_before(const SearchState *s, const char *line,
+                             size_t limit, size_t *out_col) {
+    size_t from = 0, ms, ml;
+    int found = 0;
+    while (search_match_in_line(s, line, from, &ms, &ml) && ms < limit) {
+        *out_col = ms;
+        found = 1;
+        from = ms + 1;
+    }
+    return found;
+}
+
+int search_find(const SearchState *s, Buffer *buf,
+                size_t line, size_t col, int forward,
+                size_t *out_line, size_t *out_col) {
+    if (!s->active || buf->count == 0) return 0;
+    if (line >= buf->count) line = buf->count - 1;
+
+    size_t ms, ml;
+    if (forward) {
+        // Rest of the current line, then every other line, then wrap back
+        // to the start of the current line.
+        const char *text = buf->lines[line];
+        if (col < strlen(text) &&
+            search_match_in_line(s, text, col + 1, &ms, &ml)) {
+            *out_line = line;
+            *out_col = ms;
+            return 1;
+        }
+        for (size_t i = 1; i <= buf->count; i++) {
+            size_t ln = (line + i) % buf->count;
+            text = buf->lines[ln];
+            if (search_match_in_line(s, text, 0, &ms, &ml)) {
+                if (ln == line && ms > col) break;
+                *out_line = ln;
+                *out_col = ms;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (last_match_before(s, buf->lines[line], col, out_col)) {
+        *out_line = line;
+        return 1;
+    }
+    for (size_t i = 1; i <= buf->count; i++) {
+        size_t ln = (line + buf->count - i) % buf->count;
+        if (last_match_before(s, buf->lines[ln], (size_t)-1, out_col)) {
+            if (ln == line && *out_col < col) break;
+            *out_line = ln;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Append n bytes to a growable output line
+static int out_append(char **out, size_t *len, size_t *cap, const char *src, size_t n) {
+    if (*len + n + 1 > *cap) {
+        size_t ncap = *cap ? *cap : 64;
+        while (*len + n + 1 > ncap) ncap *= 2;
+        char *tmp = realloc(*out, ncap);
+        if (!tmp) return -1;
+        *out = tmp;
+        *cap = ncap;
+    }
+    memcpy(*out + *len, src, n);
+    *len += n;
+    (*out)[*len] = '\0';
+    return 0;
+}
+
+int search_replace_line(const SearchState *s, const char *line,
+                        const char *repl, int global, char **result, size_t *nsubs) {
+    size_t ms, ml;
+    if (!search_match_in_line(s, line, 0, &ms, &ml))
+        return 0;
+
+    char *out = NULL;
+    size_t len = 0, cap = 0, from = 0, count = 0;
+    do {
+        if (out_append(&out, &len, &cap, line + from, ms - from) != 0) goto fail;
+        for (const char *r = repl; *r; r++) {
+            if (*r == '&') {
+                if (out_append(&out, &len, &cap, line + ms, ml) != 0) goto fail;
+            } else {
+                if (*r == '\\' && (r[1] == '&' || r[1] == '\\')) r++;
+                if (out_append(&out, &len, &cap, r, 1) != 0) goto fail;
+            }
+        }
+        from = ms + ml;
+        count++;
+    } while (global && search_match_in_line(s, line, from, &ms, &ml));
+
+    if (out_append(&out, &len, &cap, line + from, strlen(line + from)) != 0) goto fail;
+    *nsubs += count;
+    *result = out;
+    return 1;
+
+fail:
+    free(out);
+    return -1;
+}
+
+void search_invalidate_count(SearchState *s) {
+    s->match_total = 0;
+    s->count_line = 0;
+    s->count_done = !s->active;
+}
+
+static size_t count_line_matches(const SearchState *s, const char *line) {
+    size_t n = 0, from = 0, ms, ml;
+    while (search_match_in_line(s, line, from, &ms, &ml)) {
+        n++;
+        from = ms + ml;
+    }
+    return n;
+}
+
+int search_count_step(SearchState *s, Buffer *buf, long long budget_ms) {
+    if (!s->active || s->count_done) return 0;
+
+    long long deadline = search_now_ms() + budget_ms;
+    while (s->count_line < buf->count) {
+        s->match_total += count_line_matches(s, buf->lines[s->count_line]);
+        s->count_line++;
+        // Checking the clock per line would cost more than the scan itself
+        if ((s->count_line & 4095) == 0 && search_now_ms() >= deadline)
+            return 1;
+    }
+    s->count_done = 1;
+    return 0;
+}
+
+size_t search_count_all(const SearchState *s, Buffer *buf) {
+    size_t total = 0;
+    for (size_t i = 0; i < buf->count; i++)
+        total += count_line_matches(s, buf->lines[i]);
+    return total;
+}
@@ -0,0 +1,90 @@
+// search.h - In-buffer literal/regex search
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <regex.h>
+#include "buffer.h"
+
+#define SEARCH_PATTERN_MAX 256
+
+// Spend at most this long per main-loop tick on the total-match count so a
+// search over a huge buffer never holds up the next keystroke.
+#define SEARCH_COUNT_SLICE_MS 15
+
+// A single match on a line, in byte columns
+typedef struct {
+    size_t col;
+    size_t len;
+} SearchSpan;
+
+typedef struct {
+    char pattern[SEARCH_PATTERN_MAX];
+    size_t pat_len;
+    char last_pattern[SEARCH_PATTERN_MAX]; // last committed search, reused by a bare '/'
+    int active;        // 1 = pattern set and matches are highlighted
+    int is_regex;      // 0 = literal fast path, 1 = POSIX extended regex
+    regex_t re;
+    int re_compiled;
+
+    // Cursor/scroll at the moment '/' was typed, restored if the search
+    // is abandoned with Esc or finds nothing.
+    size_t origin_line;
+    size_t origin_col;
+    size_t origin_scroll;
+    int has_origin;
+
+    // Total-match count, computed a slice at a time by search_count_step
+    size_t match_total;
+    size_t count_line;   // next line to scan
+    int count_done;
+} SearchState;
+
+// Initialize / release search state
+void search_init(SearchState *s);
+void search_free(SearchState *s);
+
+// Set the active pattern. Patterns without regex metacharacters take the
+// literal strchr/strstr path; anything else is compiled as an extended regex.
+// Returns 0 on success, -1 if the regex does not compile.
+int search_set_pattern(SearchState *s, const char *pattern);
+
+// Drop the active pattern and its highlighting
+void search_clear(SearchState *s);
+
+// Find the first match in `line` starting at byte `from` (<= strlen(line)).
+// Returns 1 and fills start/len on a hit, 0 otherwise.
+int search_match_in_line(const SearchState *s, const char *line,
+                         size_t from, size_t *mstart, size_t *mlen);
+
+// Collect up to `max` matches on a line (used by the renderer for visible
+// rows only). Returns the number of spans written.
+size_t search_line_spans(const SearchState *s, const char *line,
+                         SearchSpan *spans, size_t max);
+
+// Find the next (forward = 1) or previous (forward = 0) match strictly
+// after/before (line, col), wrapping around the buffer once.
+// Returns 1 and fills out_line/out_col on a hit, 0 otherwise.
+int search_find(const SearchState *s, Buffer *buf,
+                size_t line, size_t col, int forward,
+                size_t *out_line, size_t *out_col);
+
+// Build a copy of `line` with matches replaced by `repl` ('&' inserts the
+// matched text, \& a literal '&'). Only the first match is replaced unless
+// `global` is set. Returns 1 with a malloc'd line in *result and the
+// number of replacements added to *nsubs, 0 if nothing matched, or -1 if
+// out of memory.
+int search_replace_line(const SearchState *s, const char *line,
+                        const char *repl, int global, char **result, size_t *nsubs);
+
+// Restart the background total-match count (call after any buffer edit)
+void search_invalidate_count(SearchState *s);
+
+// Advance the total-match count for at most budget_ms.
+// Returns 1 while counting is still pending, 0 once done or idle.
+int search_count_step(SearchState *s, Buffer *buf, long long budget_ms);
+
+// Count every match in the buffer in one go (used by benchmarks)
+size_t search_count_all(const SearchState *s, Buffer *buf);
+
+#endif
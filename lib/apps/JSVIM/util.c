@@ -2,6 +2,9 @@
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
 
 char *dupstr(const char *s) {
@@ -15,3 +18,15 @@ int file_exists(const char *fname) {
     struct stat st;
     return stat(fname, &st) == 0;
 }
+
+int mkdir_parents(const char *file) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", file);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return 0;
+}
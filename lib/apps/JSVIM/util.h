@@ -21,4 +21,7 @@ char *dupstr(const char *s);
 // Check if a file exists
 int file_exists(const char *fname);
 
+// Create every missing directory above `file` (mode 0755)
+int mkdir_parents(const char *file);
+
 #endif
@@ -0,0 +1,108 @@
+// watch.c - inotify watch on the open file, for reloading external changes
+#include "watch.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static long long watch_now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void watch_init(FileWatch *w) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->wd = -1;
+}
+
+int watch_start(FileWatch *w, const char *path) {
+    watch_stop(w);
+    snprintf(w->path, sizeof(w->path), "%s", path);
+
+    char dir[sizeof(w->path)];
+    const char *slash = strrchr(path, '/');
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+        snprintf(w->name, sizeof(w->name), "%s", slash + 1);
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+        snprintf(w->name, sizeof(w->name), "%s", path);
+    }
+
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) return -1;
+    w->wd = inotify_add_watch(w->fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO |
+                                          IN_CREATE | IN_DELETE);
+    if (w->wd < 0) {
+        watch_stop(w);
+        return -1;
+    }
+    watch_sync(w);
+    return 0;
+}
+
+void watch_stop(FileWatch *w) {
+    if (w->fd >= 0) close(w->fd);
+    w->fd = -1;
+    w->wd = -1;
+    w->pending = w->settled = 0;
+}
+
+void watch_sync(FileWatch *w) {
+    struct stat st;
+    if (w->fd < 0) return;
+    if (stat(w->path, &st) == 0) {
+        w->dev = st.st_dev;
+        w->ino = st.st_ino;
+        w->size = st.st_size;
+        w->mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    } else {
+        w->ino = 0;
+        w->size = -1;
+    }
+    w->pending = w->settled = 0;
+}
+
+int watch_poll(FileWatch *w) {
+    if (w->fd < 0) return 0;
+
+    char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(w->fd, evbuf, sizeof(evbuf));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        for (char *p = evbuf; p < evbuf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Lost events: compare the file itself
+                w->pending = w->settled = 1;
+            } else if (ev->len > 0 && strcmp(ev->name, w->name) == 0) {
+                w->pending = 1;
+                if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)) w->settled = 1;
+            } else {
+                continue;
+            }
+            w->last_event_ms = watch_now_ms();
+        }
+    }
+
+    if (!w->pending) return 0;
+    if (!w->settled && watch_now_ms() - w->last_event_ms < WATCH_SETTLE_MS) return 0;
+    w->pending = w->settled = 0;
+
+    // A deleted file leaves the buffer alone; it is reloaded if the file
+    // comes back
+    struct stat st;
+    if (stat(w->path, &st) != 0) return 0;
+    long long mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return st.st_dev != w->dev || st.st_ino != w->ino || st.st_size != w->size ||
+           mtime_ns != w->mtime_ns;
+}
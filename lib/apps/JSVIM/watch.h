@@ -0,0 +1,42 @@
+// watch.h - inotify watch on the open file, for reloading external changes
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <sys/types.h>
+
+// A change seen only as IN_MODIFY (a process still writing) is acted on
+// once no event has arrived for this long; a close or rename acts at once
+#define WATCH_SETTLE_MS 100
+
+typedef struct {
+    int fd;                      // inotify fd, -1 when not watching
+    int wd;
+    char name[256];              // basename matched against events
+    char path[1024];
+    // What the file looked like when the buffer last matched it (load,
+    // save or reload); events that leave it like this are our own writes
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    long long mtime_ns;
+    int pending;                 // event seen, not yet acted on
+    int settled;                 // ... and the writer has finished
+    long long last_event_ms;
+} FileWatch;
+
+void watch_init(FileWatch *w);
+
+// Watch `path` through its directory, so a file replaced by rename
+// (git checkout, most formatters) or recreated (log rotation) is still
+// seen. Also records the current state, as watch_sync does.
+int watch_start(FileWatch *w, const char *path);
+void watch_stop(FileWatch *w);
+
+// Record the file's current state as the one the buffer matches
+void watch_sync(FileWatch *w);
+
+// Drain events. Returns 1 once the file differs from the recorded state
+// and the writer has settled; the caller reloads and calls watch_sync.
+int watch_poll(FileWatch *w);
+
+#endif
@@ -0,0 +1,280 @@
+// words.c - Index of the buffer's words for Ctrl-N completion
+#include "words.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static long long words_now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// Anything past ASCII counts, so UTF-8 names index whole
+int words_is_word_char(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+void words_init(WordIndex *ix) {
+    memset(ix, 0, sizeof(*ix));
+}
+
+void words_free(WordIndex *ix) {
+    for (size_t i = 0; i < ix->count; i++) free(ix->lines[i].ids);
+    free(ix->lines);
+    free(ix->nodes);
+    words_init(ix);
+}
+
+void words_reset(WordIndex *ix) {
+    words_free(ix);
+}
+
+// Add d to the live count of node id and everything above it
+static void add_live(WordIndex *ix, uint32_t id, int d) {
+    for (;;) {
+        ix->nodes[id].live += (uint32_t)d;
+        if (id == 0) break;
+        id = ix->nodes[id].parent;
+    }
+}
+
+static void word_ref(WordIndex *ix, uint32_t id) {
+    if (ix->nodes[id].count++ == 0) add_live(ix, id, 1);
+}
+
+static void word_unref(WordIndex *ix, uint32_t id) {
+    if (--ix->nodes[id].count == 0) add_live(ix, id, -1);
+}
+
+static void line_unref(WordIndex *ix, WordLine *l) {
+    for (uint32_t i = 0; i < l->count; i++) word_unref(ix, l->ids[i]);
+    free(l->ids);
+    l->ids = NULL;
+    l->count = 0;
+    l->scanned = 0;
+}
+
+// Child of `parent` for c, created in sorted position if missing.
+// Returns 0 when out of memory.
+static uint32_t child_for(WordIndex *ix, uint32_t parent, char c) {
+    uint32_t prev = 0, cur = ix->nodes[parent].child;
+    while (cur && (unsigned char)ix->nodes[cur].ch < (unsigned char)c) {
+        prev = cur;
+        cur = ix->nodes[cur].next;
+    }
+    if (cur && ix->nodes[cur].ch == c) return cur;
+
+    if (ix->node_count == ix->node_cap) {
+        size_t cap = ix->node_cap * 2;
+        WordNode *tmp = realloc(ix->nodes, cap * sizeof(WordNode));
+        if (!tmp) return 0;
+        ix->nodes = tmp;
+        ix->node_cap = cap;
+    }
+    uint32_t id = (uint32_t)ix->node_count++;
+    WordNode *n = &ix->nodes[id];
+    memset(n, 0, sizeof(*n));
+    n->ch = c;
+    n->parent = parent;
+    n->next = cur;
+    if (prev)
+        ix->nodes[prev].next = id;
+    else
+        ix->nodes[parent].child = id;
+    return id;
+}
+
+// Trie node for a word, created if missing; 0 when out of memory
+static uint32_t word_node(WordIndex *ix, const char *w, size_t len) {
+    uint32_t id = 0;
+    for (size_t i = 0; i < len; i++)
+        if ((id = child_for(ix, id, w[i])) == 0) return 0;
+    return id;
+}
+
+static void scan_line(WordIndex *ix, Buffer *buf, size_t line) {
+    WordLine *l = &ix->lines[line];
+    const unsigned char *s = (const unsigned char *)buf->lines[line];
+    uint32_t *ids = NULL;
+    size_t n = 0, cap = 0;
+
+    for (const unsigned char *p = s; *p; ) {
+        if (!words_is_word_char(*p)) {
+            p++;
+            continue;
+        }
+        const unsigned char *w = p;
+        while (words_is_word_char(*p)) p++;
+        size_t len = (size_t)(p - w);
+        // Numbers are not words worth completing
+        if (len < WORDS_MIN_LEN || len > WORDS_MAX_LEN || (*w >= '0' && *w <= '9'))
+            continue;
+        uint32_t id = word_node(ix, (const char *)w, len);
+        if (!id) break;
+        if (n == cap) {
+            size_t ncap = cap ? cap * 2 : 8;
+            uint32_t *tmp = realloc(ids, ncap * sizeof(uint32_t));
+            if (!tmp) break;
+            ids = tmp;
+            cap = ncap;
+        }
+        ids[n++] = id;
+        word_ref(ix, id);
+    }
+    l->ids = ids;
+    l->count = (uint32_t)n;
+    l->scanned = 1;
+}
+
+// Size the index for buf: every line waits for the first pass
+static int words_begin(WordIndex *ix, Buffer *buf) {
+    ix->node_cap = 1024;
+    ix->nodes = calloc(ix->node_cap, sizeof(WordNode));
+    ix->cap = buf->count ? buf->count : 1;
+    ix->lines = calloc(ix->cap, sizeof(WordLine));
+    if (!ix->nodes || !ix->lines) {
+        words_free(ix);
+        return -1;
+    }
+    ix->node_count = 1;
+    ix->count = buf->count;
+    ix->scan_pos = 0;
+    ix->dirty_lo = ix->dirty_hi = 0;
+    ix->valid = 1;
+    return 0;
+}
+
+void words_edit(WordIndex *ix, size_t first, size_t old_count, size_t new_count) {
+    if (!ix->valid) return;
+    if (first + old_count > ix->count) {
+        // Out of step with the buffer: start over
+        words_reset(ix);
+        return;
+    }
+
+    for (size_t i = first; i < first + old_count; i++) line_unref(ix, &ix->lines[i]);
+    if (new_count != old_count) {
+        size_t count = ix->count - old_count + new_count;
+        if (count > ix->cap) {
+            size_t cap = ix->cap * 2 > count ? ix->cap * 2 : count;
+            WordLine *tmp = realloc(ix->lines, cap * sizeof(WordLine));
+            if (!tmp) {
+                words_reset(ix);
+                return;
+            }
+            ix->lines = tmp;
+            ix->cap = cap;
+        }
+        memmove(ix->lines + first + new_count, ix->lines + first + old_count,
+                (ix->count - first - old_count) * sizeof(WordLine));
+        memset(ix->lines + first, 0, new_count * sizeof(WordLine));
+        ix->count = count;
+    }
+
+    // Positions past the edit move with it
+    long delta = (long)new_count - (long)old_count;
+    size_t end = first + old_count;
+    if (ix->scan_pos >= end)
+        ix->scan_pos += (size_t)delta;
+    else if (ix->scan_pos > first)
+        ix->scan_pos = first + new_count;
+
+    if (new_count == 0) {
+        if (ix->dirty_lo >= end) ix->dirty_lo += (size_t)delta;
+        else if (ix->dirty_lo > first) ix->dirty_lo = first;
+        if (ix->dirty_hi >= end) ix->dirty_hi += (size_t)delta;
+        else if (ix->dirty_hi > first) ix->dirty_hi = first;
+        return;
+    }
+    if (ix->dirty_lo == ix->dirty_hi) {
+        ix->dirty_lo = first;
+        ix->dirty_hi = first + new_count;
+        return;
+    }
+    size_t lo = ix->dirty_lo >= end ? ix->dirty_lo + (size_t)delta : ix->dirty_lo;
+    size_t hi = ix->dirty_hi >= end ? ix->dirty_hi + (size_t)delta : ix->dirty_hi;
+    ix->dirty_lo = lo < first ? lo : first;
+    ix->dirty_hi = hi > first + new_count ? hi : first + new_count;
+}
+
+int words_step(WordIndex *ix, Buffer *buf, long long budget_ms) {
+    if (!ix->valid) {
+        if (buf->count == 0 || words_begin(ix, buf) != 0) return 0;
+    } else if (ix->count != buf->count) {
+        words_reset(ix);
+        if (buf->count == 0 || words_begin(ix, buf) != 0) return 0;
+    }
+
+    long long deadline = budget_ms < 0 ? 0 : words_now_ms() + budget_ms;
+    size_t done = 0;
+
+    // Edited lines first: they are few, and the ones a completion is
+    // most likely to want
+    if (ix->dirty_hi > ix->count) ix->dirty_hi = ix->count;
+    while (ix->dirty_lo < ix->dirty_hi) {
+        size_t i = ix->dirty_lo++;
+        if (!ix->lines[i].scanned) scan_line(ix, buf, i);
+        // Checking the clock per line would cost more than the scan itself
+        if (budget_ms >= 0 && (++done & 1023) == 0 && words_now_ms() >= deadline)
+            return 1;
+    }
+    ix->dirty_lo = ix->dirty_hi = 0;
+
+    while (ix->scan_pos < ix->count) {
+        size_t i = ix->scan_pos++;
+        if (!ix->lines[i].scanned) scan_line(ix, buf, i);
+        if (budget_ms >= 0 && (++done & 1023) == 0 && words_now_ms() >= deadline)
+            return ix->scan_pos < ix->count;
+    }
+    return 0;
+}
+
+size_t words_complete(WordIndex *ix, Buffer *buf, const char *prefix,
+                      char out[][WORDS_MAX_LEN + 1], size_t max) {
+    words_step(ix, buf, -1);
+    if (!ix->valid || max == 0) return 0;
+
+    size_t plen = strlen(prefix);
+    if (plen > WORDS_MAX_LEN) return 0;
+    uint32_t top = 0;
+    for (size_t i = 0; i < plen; i++) {
+        uint32_t c = ix->nodes[top].child;
+        while (c && ix->nodes[c].ch != prefix[i]) c = ix->nodes[c].next;
+        if (!c) return 0;
+        top = c;
+    }
+
+    // Pre-order walk below the prefix node, which yields sorted words;
+    // subtrees with no live word are skipped whole
+    char word[WORDS_MAX_LEN + 1];
+    memcpy(word, prefix, plen);
+    size_t depth = plen, n = 0;
+    uint32_t cur = ix->nodes[top].child;
+    while (cur && n < max) {
+        WordNode *nd = &ix->nodes[cur];
+        if (nd->live) {
+            word[depth++] = nd->ch;
+            if (nd->count) {
+                memcpy(out[n], word, depth);
+                out[n][depth] = '\0';
+                n++;
+            }
+            if (nd->child) {
+                cur = nd->child;
+                continue;
+            }
+            depth--;
+        }
+        // Next sibling, or the next sibling of the nearest ancestor that
+        // has one, without climbing past the prefix
+        while (!ix->nodes[cur].next) {
+            cur = ix->nodes[cur].parent;
+            if (cur == top) return n;
+            depth--;
+        }
+        cur = ix->nodes[cur].next;
+    }
+    return n;
+}
@@ -0,0 +1,79 @@
+// words.h - Index of the buffer's words for Ctrl-N completion
+#ifndef WORDS_H
+#define WORDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+
+#define WORDS_MIN_LEN 2
+#define WORDS_MAX_LEN 64          // longer runs are not indexed
+#define WORDS_MAX_SUGGEST 32
+
+// Spend at most this long per main-loop tick building the index
+#define WORDS_SLICE_MS 10
+
+// One node of the prefix trie: a character, and the word ending there
+typedef struct {
+    uint32_t child;              // first child (children sorted by ch), 0 = none
+    uint32_t next;               // next sibling
+    uint32_t parent;
+    uint32_t count;              // occurrences in the buffer of the word ending here
+    uint32_t live;               // words below (and at) this node with count > 0
+    char ch;
+} WordNode;
+
+typedef struct {
+    uint32_t *ids;               // trie node of each word on the line
+    uint32_t count;
+    int scanned;
+} WordLine;
+
+// Every identifier in the buffer, counted, in a prefix trie. Lines keep
+// the words they added, so an edit takes out only its own lines' words
+// (words_edit) and the replaced lines are rescanned later; nothing
+// rescans the whole buffer after the first pass. Words whose count drops
+// to zero stay in the trie but `live` lets lookups skip them.
+typedef struct {
+    WordNode *nodes;             // nodes[0] is the root
+    size_t node_count, node_cap;
+    WordLine *lines;
+    size_t count, cap;
+    size_t scan_pos;             // first pass: lines below this are done
+    size_t dirty_lo, dirty_hi;   // edited lines to rescan: [dirty_lo, dirty_hi)
+    int valid;                   // sized for the current buffer
+} WordIndex;
+
+// A Ctrl-N / Ctrl-P cycle in progress
+typedef struct {
+    int active;
+    size_t line, col;            // where the word being completed starts
+    size_t len;                  // length of the text there now
+    char prefix[WORDS_MAX_LEN + 1];
+    char items[WORDS_MAX_SUGGEST][WORDS_MAX_LEN + 1];
+    size_t count;
+    long sel;                    // -1 = the typed prefix itself
+} WordCompletion;
+
+// Bytes that make up a word (identifier characters, and any non-ASCII)
+int words_is_word_char(int c);
+
+void words_init(WordIndex *ix);
+void words_free(WordIndex *ix);
+
+// Drop everything; the buffer is indexed again from scratch
+void words_reset(WordIndex *ix);
+
+// Lines [first, first + old_count) were replaced by new_count lines
+void words_edit(WordIndex *ix, size_t first, size_t old_count, size_t new_count);
+
+// Index edited and not yet seen lines for up to budget_ms (< 0: all of
+// them). Returns 1 while work is left.
+int words_step(WordIndex *ix, Buffer *buf, long long budget_ms);
+
+// Words starting with `prefix` (and longer than it), in sorted order.
+// Brings the index up to date first. Returns how many were written.
+size_t words_complete(WordIndex *ix, Buffer *buf, const char *prefix,
+                      char out[][WORDS_MAX_LEN + 1], size_t max);
+
+#endif
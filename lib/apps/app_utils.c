@@ -6,8 +6,7 @@
 #include <termios.h>
 #include <sys/wait.h>
 #include "quickjs.h"
-
-#define JSSH_SUPPRESS "\x1B[JSSH_SUPPRESS"
+#include "../../src/utils.h"
 
 JSValue jsvim(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
     char **exec_argv = calloc(argc + 2, sizeof(char *));
@@ -93,5 +92,5 @@ JSValue jsvim(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *arg
     }
     free(exec_argv);
 
-    return JS_NewString(ctx, JSSH_SUPPRESS);
+    return JS_NewString(ctx, JS_SUPPRESS);
 }
\ No newline at end of file
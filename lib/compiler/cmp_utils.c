@@ -7,8 +7,17 @@
 #include <string.h>
 #include <unistd.h>
 #include <quickjs.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include "sys/select.h"
+#include "../../src/startup.h"
+#include "../../src/utils.h"
+
+extern char **environ;
 
 #define JS_SUPPRESS "\x1B[JSSH_SUPPRESS"
 
@@ -54,39 +63,233 @@ CompilerInfo detected[20];
 int detected_count = 0;
 static volatile pid_t current_child_pid = 0;
 
-// Compiler version detector
-static char *get_version_output(const char *cmd) {
-    char command[256];
-    snprintf(command, sizeof(command), "%s --version 2>&1", cmd);
-    FILE *fp = popen(command, "r");
-    if (!fp) return NULL;
+#define PROBE_TIMEOUT_MS 3000
+#define COMPILER_CACHE_MAGIC "jssh-compilers 1\n"
 
-    char buf[512];
-    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
-    pclose(fp);
-    if (n == 0) return NULL;
-    buf[n] = '\0';
+// One compiler being detected
+typedef struct {
+    char path[PATH_MAX];   // resolved binary, "" if not on PATH
+    long long mtime_ns;
+    char *version;         // first line of `--version`, NULL if none
+    pid_t pid;             // probe running, or 0
+    int fd;
+    char out[512];
+    size_t out_len;
+    int timed_out;         // not cached, so it is probed again next time
+} CompilerProbe;
 
-    char *newline = strchr(buf, '\n');
-    if (newline) *newline = '\0';
+// Find a command on PATH the way execvp does, and resolve symlinks so
+// e.g. python3 -> python3.12 is keyed by the real binary
+static int resolve_on_path(const char *cmd, char *out) {
+    const char *path = getenv("PATH");
+    if (!path) path = "/usr/bin:/bin";
+    for (;;) {
+        const char *sep = strchr(path, ':');
+        size_t len = sep ? (size_t)(sep - path) : strlen(path);
+        char cand[PATH_MAX];
+        snprintf(cand, sizeof(cand), "%.*s/%s", len ? (int)len : 1, len ? path : ".", cmd);
+        if (access(cand, X_OK) == 0 && realpath(cand, out)) return 0;
+        if (!sep) return -1;
+        path = sep + 1;
+    }
+}
 
-    if (strncmp(buf, "sh:", 3) == 0 || strstr(buf, "not found") || strstr(buf, "command not found"))
+// Cached version for a binary, "-" if it printed none. NULL on a miss.
+static char *cache_lookup(const char *cache, const char *name, const CompilerProbe *p) {
+    if (!cache) return NULL;
+    size_t nlen = strlen(name), plen = strlen(p->path);
+    for (const char *line = cache; *line; ) {
+        const char *eol = strchr(line, '\n');
+        if (!eol) break;
+        char *end;
+        if ((size_t)(eol - line) > nlen + plen + 2 &&
+            memcmp(line, name, nlen) == 0 && line[nlen] == '\t' &&
+            memcmp(line + nlen + 1, p->path, plen) == 0 && line[nlen + 1 + plen] == '\t' &&
+            strtoll(line + nlen + plen + 2, &end, 10) == p->mtime_ns && *end == '\t')
+            return strndup(end + 1, eol - (end + 1));
+        line = eol + 1;
+    }
+    return NULL;
+}
+
+static char *read_cache(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&buf, &len);
+    char chunk[4096];
+    size_t n;
+    while (mem && (n = fread(chunk, 1, sizeof(chunk), f)) > 0) fwrite(chunk, 1, n, mem);
+    fclose(f);
+    if (!mem) return NULL;
+    fclose(mem);
+    if (strncmp(buf, COMPILER_CACHE_MAGIC, strlen(COMPILER_CACHE_MAGIC)) != 0) {
+        free(buf);
         return NULL;
+    }
+    return buf;
+}
 
-    return strdup(buf);
+// Start `<path> --version` with stdout and stderr on a pipe
+static int start_probe(const char *name, CompilerProbe *p) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDERR_FILENO);
+    char *const argv[] = { (char *)name, "--version", NULL };
+    int rc = posix_spawn(&p->pid, p->path, &fa, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    if (rc != 0) {
+        close(fds[0]);
+        p->pid = 0;
+        return -1;
+    }
+    p->fd = fds[0];
+    p->out_len = 0;
+    return 0;
 }
 
+// Read every running probe until all have closed their output or the
+// timeout passes, then reap them
+static void finish_probes(CompilerProbe *probes, int count) {
+    struct pollfd pfds[20];
+    int idx[20];
+    long long deadline = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    deadline = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + PROBE_TIMEOUT_MS;
+
+    for (;;) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (probes[i].pid == 0 || probes[i].fd < 0) continue;
+            pfds[n].fd = probes[i].fd;
+            pfds[n].events = POLLIN;
+            idx[n++] = i;
+        }
+        if (n == 0) break;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        long long left = deadline - (ts.tv_sec * 1000LL + ts.tv_nsec / 1000000);
+        if (left <= 0) break;
+        if (poll(pfds, n, (int)left) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int k = 0; k < n; k++) {
+            if (!pfds[k].revents) continue;
+            CompilerProbe *p = &probes[idx[k]];
+            char buf[512];
+            ssize_t r = read(p->fd, buf, sizeof(buf));
+            if (r > 0) {
+                size_t room = sizeof(p->out) - 1 - p->out_len;
+                size_t take = (size_t)r < room ? (size_t)r : room;
+                memcpy(p->out + p->out_len, buf, take);
+                p->out_len += take;
+            } else if (r == 0 || errno != EINTR) {
+                close(p->fd);
+                p->fd = -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        CompilerProbe *p = &probes[i];
+        if (p->pid == 0) continue;
+        int status = 0;
+        if (p->fd >= 0) {
+            // Hung probe: give up on it
+            kill(p->pid, SIGKILL);
+            close(p->fd);
+            p->fd = -1;
+            p->out_len = 0;
+            p->timed_out = 1;
+        }
+        waitpid(p->pid, &status, 0);
+        p->pid = 0;
+        p->out[p->out_len] = '\0';
+
+        char *newline = strchr(p->out, '\n');
+        if (newline) *newline = '\0';
+        for (char *c = p->out; *c; c++)
+            if (*c == '\t' || *c == '\r') *c = ' ';
+        if (p->out[0] && !strstr(p->out, "not found"))
+            p->version = strdup(p->out);
+    }
+}
+
+// Detect the known compilers. Versions are cached in the jssh cache dir
+// by resolved binary path and mtime; only new or changed binaries are
+// probed, all at once.
 void detect_compilers(void) {
+    CompilerProbe probes[20];
+    int count = 0, misses = 0;
     detected_count = 0;
+    // Runs on first use of cmp; shows up in the startup profile when a
+    // startup script touches it. The probes run in parallel, so each one
+    // is timed for its spawn and the wait is timed once for all of them.
+    startup_begin("detect_compilers");
 
-    for (int i = 0; compilers[i]; i++) {
-        char *out = get_version_output(compilers[i]);
-        if (out) {
-            detected[detected_count].name = compilers[i];
-            detected[detected_count].version = out;
-            detected_count++;
+    char cache_path[PATH_MAX];
+    int have_cache = jssh_cache_file("compilers", cache_path, sizeof(cache_path)) == 0;
+    char *cache = have_cache ? read_cache(cache_path) : NULL;
+
+    for (int i = 0; compilers[i] && count < 20; i++, count++) {
+        CompilerProbe *p = &probes[i];
+        memset(p, 0, sizeof(*p));
+        p->fd = -1;
+        struct stat st;
+        if (resolve_on_path(compilers[i], p->path) != 0 || stat(p->path, &st) != 0) {
+            p->path[0] = '\0';
+            continue;
+        }
+        p->mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+        char *hit = cache_lookup(cache, compilers[i], p);
+        if (hit) {
+            if (strcmp(hit, "-") == 0) free(hit);
+            else p->version = hit;
+            continue;
+        }
+        startup_begin("spawn %s --version", compilers[i]);
+        if (start_probe(compilers[i], p) == 0) misses++;
+        startup_end();
+    }
+    if (misses) {
+        startup_begin("wait for %d compiler probes", misses);
+        finish_probes(probes, count);
+        startup_end();
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!probes[i].version) continue;
+        detected[detected_count].name = compilers[i];
+        detected[detected_count].version = probes[i].version;
+        detected_count++;
+    }
+
+    // Rewrite the cache with what is on PATH now
+    if (misses && have_cache && jssh_cache_mkdirs(cache_path) == 0) {
+        char tmp[PATH_MAX + 16];
+        snprintf(tmp, sizeof(tmp), "%s.%d", cache_path, (int)getpid());
+        FILE *f = fopen(tmp, "w");
+        if (f) {
+            fputs(COMPILER_CACHE_MAGIC, f);
+            for (int i = 0; i < count; i++) {
+                if (!probes[i].path[0] || probes[i].timed_out) continue;
+                fprintf(f, "%s\t%s\t%lld\t%s\n", compilers[i], probes[i].path,
+                        probes[i].mtime_ns, probes[i].version ? probes[i].version : "-");
+            }
+            if (fclose(f) != 0 || rename(tmp, cache_path) != 0)
+                unlink(tmp);
         }
     }
+    free(cache);
+    startup_end();
 }
 
 static void sigint_handler(int sig) {
@@ -2,7 +2,9 @@
 #include "quickjs.h"
 #include "cmp_utils.h"
 
-void js_init_compiler(JSContext *ctx) {
+// Build the cmp object: detection runs here, on first use of cmp,
+// rather than at every startup
+static JSValue js_cmp_get(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
   JSValue global_obj = JS_GetGlobalObject(ctx);
   JSValue cmp = JS_NewObject(ctx);
   if (detected_count == 0)
@@ -12,10 +14,23 @@ void js_init_compiler(JSContext *ctx) {
   JS_SetPropertyStr(ctx, cmp, "list", JS_NewCFunction(ctx, js_compiler_list, "list", 0));
   for (int i = 0; i < detected_count; i++) {
     const char *name = detected[i].name;
-    JS_SetPropertyStr(ctx, cmp, name, JS_NewCFunctionData(ctx, js_run_compiler, 1, 0, 1, (JSValueConst[]){JS_NewString(ctx, name)}));
+    JSValue name_val = JS_NewString(ctx, name);
+    JS_SetPropertyStr(ctx, cmp, name, JS_NewCFunctionData(ctx, js_run_compiler, 1, 0, 1, &name_val));
+    JS_FreeValue(ctx, name_val);
   }
 
-  JS_SetPropertyStr(ctx, global_obj, "cmp", cmp);
+  // Replace the getter with the object itself
+  JS_DefinePropertyValueStr(ctx, global_obj, "cmp", JS_DupValue(ctx, cmp), JS_PROP_C_W_E);
+  JS_FreeValue(ctx, global_obj);
+  return cmp;
+}
 
+void js_init_compiler(JSContext *ctx) {
+  JSValue global_obj = JS_GetGlobalObject(ctx);
+  JSAtom atom = JS_NewAtom(ctx, "cmp");
+  JS_DefinePropertyGetSet(ctx, global_obj, atom,
+                          JS_NewCFunction(ctx, js_cmp_get, "cmp", 0), JS_UNDEFINED,
+                          JS_PROP_CONFIGURABLE | JS_PROP_ENUMERABLE);
+  JS_FreeAtom(ctx, atom);
   JS_FreeValue(ctx, global_obj);
-}
\ No newline at end of file
+}
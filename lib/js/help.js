@@ -12,11 +12,12 @@ const helpdb = {
   Clears the terminal screen.
 `,
         "cat": `
-{green}cat(path){reset}
-  Prints the contents of a file to stdout.
+{green}cat(path, ...){reset}
+  Prints the contents of one or more files to stdout, one after another.
 
   Example:
     cat("file.txt")
+    cat("app.log.1", "app.log")
 `,
         "tac": `
 {green}tac(path){reset}
@@ -40,6 +41,15 @@ const helpdb = {
 
   Example:
     ls("/etc", "l")
+`,
+        "pipe": `
+{green}pipe(source, filter, ...){reset}
+  Streams cat, tac, echo or ls output through filters.
+  Filters: grep(pattern, "ivE"), head(n), tail(n), wc("lwc"),
+  sort("rnu"), uniq("cd"). .text() returns the output as a string.
+
+  Example:
+    pipe(cat("app.log"), grep("ERROR"), tail(20))
 `,
         "cd": `
 {green}cd(path){reset}
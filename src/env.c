@@ -37,6 +37,7 @@ static const char *default_env[] = {
     "color_chr={red}",
     "color_blk={red}",
     "color_reg={white}",
+    "history_size=100000",
     "jssh_loc={}",
     NULL
 };
@@ -5,44 +5,155 @@
 #include <errno.h>
 #include <dirent.h>
 #include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include "quickjs.h"
 #include "quickjs-libc.h"
+#include "stream.h"
 #include "utils.h"
 
-
-// return this in a JS_String to suppress the undefined after functions which print directly to console
-#define JS_SUPPRESS "\x1B[JSSH_SUPPRESS" 
-
 // cat
 JSValue js_cat(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-
-    const char *path;
     if (argc < 1)
-        path = "./";
+        return JS_ThrowTypeError(ctx, "cat(path, ...)");
 
-    path = JS_ToCString(ctx, argv[0]);
-    if (!path)
-        return JS_EXCEPTION;
+    int *fds = malloc(argc * sizeof(*fds));
+    if (!fds)
+        return JS_ThrowOutOfMemory(ctx);
 
-    FILE *f = fopen(path, "rb");
-    JS_FreeCString(ctx, path);
-    if (!f)
-        return JS_ThrowTypeError(ctx, "fopen failed: %s", strerror(errno));
+    // All opened now, so a missing file throws here and not when printed
+    for (int i = 0; i < argc; i++) {
+        const char *path = JS_ToCString(ctx, argv[i]);
+        if (!path) {
+            while (i > 0) close(fds[--i]);
+            free(fds);
+            return JS_EXCEPTION;
+        }
+        fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        if (fds[i] < 0) {
+            JSValue err = JS_ThrowTypeError(ctx, "open failed: %s: %s", path, strerror(errno));
+            JS_FreeCString(ctx, path);
+            while (i > 0) close(fds[--i]);
+            free(fds);
+            return err;
+        }
+        JS_FreeCString(ctx, path);
+    }
 
-    char buf[4096];
-    size_t n;
-    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
-        fwrite(buf, 1, n, stdout);
+    PipeStage *s = pipe_file_source(fds, argc);
+    free(fds);
+    return js_new_stream(ctx, s);
+}
+
+// tac: the file is read backward a chunk at a time. A line that starts
+// before the chunk stays in buf and the previous chunk is read in front
+// of it, so each line is found with one memrchr and copied once. Reads
+// go through pread rather than mmap, so a log truncated under us is a
+// read error and not a SIGBUS.
+//
+// Readahead only works forward, so the chunks are large and the one
+// before is requested with fadvise while this one is being scanned.
+#define TAC_CHUNK (4 << 20)
+
+typedef struct {
+    PipeStage base;
+    int fd;
+    off_t off;              // file offset of buf[0]
+    char *buf;
+    size_t pos, cap;        // lines before buf[pos] are still to come
+    const char *line;       // line being handed out, then its '\n'
+    size_t line_len;
+    int need_nl;
+    int started, done;
+} TacSource;
+
+// Read the chunk before buf[0]. Returns 0, or -1 with errno set.
+static int tac_read_back(TacSource *t) {
+    size_t chunk = t->off < TAC_CHUNK ? (size_t)t->off : TAC_CHUNK;
+    if (t->pos + chunk > t->cap) {
+        // Sized to what is read, so a small file gets a small buffer
+        size_t cap = t->cap ? t->cap : t->pos + chunk;
+        while (cap < t->pos + chunk) cap *= 2;
+        char *buf = realloc(t->buf, cap);
+        if (!buf) return -1;
+        t->buf = buf;
+        t->cap = cap;
+    }
+    memmove(t->buf + chunk, t->buf, t->pos);
+    for (size_t got = 0; got < chunk; ) {
+        ssize_t n = pread(t->fd, t->buf + got, chunk - got, t->off - chunk + got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;  // file shrank under us
+            return -1;
+        }
+        got += n;
+    }
+    t->off -= chunk;
+    t->pos += chunk;
+    if (t->off > 0) {
+        off_t ahead = t->off < TAC_CHUNK ? t->off : TAC_CHUNK;
+        posix_fadvise(t->fd, t->off - ahead, ahead, POSIX_FADV_WILLNEED);
+    }
+    return 0;
+}
+
+static ssize_t tac_pull(PipeStage *s, char *out, size_t cap) {
+    TacSource *t = (TacSource *)s;
+    size_t n = 0;
+    if (!t->started) {
+        t->started = 1;
+        if (t->off == 0) t->done = 1;
+        else if (tac_read_back(t) < 0) return -1;
+        // A final '\n' ends the last line, it does not start an empty one
+        else if (t->buf[t->pos - 1] == '\n') t->pos--;
+    }
+    for (;;) {
+        size_t k = t->line_len < cap - n ? t->line_len : cap - n;
+        if (k) {
+            memcpy(out + n, t->line, k);
+            t->line += k;
+            t->line_len -= k;
+            n += k;
+        }
+        if (t->line_len == 0 && t->need_nl && n < cap) {
+            out[n++] = '\n';
+            t->need_nl = 0;
+        }
+        if (t->line_len || t->need_nl || t->done) return n;
+
+        char *nl = t->pos ? memrchr(t->buf, '\n', t->pos) : NULL;
+        if (!nl && t->off > 0) {
+            if (tac_read_back(t) < 0) return n ? (ssize_t)n : -1;
+            continue;
+        }
+        size_t start = nl ? (size_t)(nl - t->buf) + 1 : 0;
+        size_t len = t->pos - start;
+        if (nl) t->pos = nl - t->buf;
+        else t->done = 1;
+        if (len < cap - n) {
+            // The usual case: the line and its '\n' fit, copy them now
+            memcpy(out + n, t->buf + start, len);
+            out[n + len] = '\n';
+            n += len + 1;
+        } else {
+            t->line = t->buf + start;
+            t->line_len = len;
+            t->need_nl = 1;
+        }
     }
-    fclose(f);
-    fputc('\n', stdout);
-    return JS_NewString(ctx, JS_SUPPRESS);
 }
 
-// tac
+static void tac_free(PipeStage *s) {
+    TacSource *t = (TacSource *)s;
+    close(t->fd);
+    free(t->buf);
+    free(t);
+}
+
 JSValue js_tac(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
     if (argc < 1)
         return JS_ThrowTypeError(ctx, "tac(path)");
@@ -51,87 +162,28 @@ JSValue js_tac(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *ar
     if (!path)
         return JS_EXCEPTION;
 
-    FILE *f = fopen(path, "rb");
-    if (!f) {
-        JS_FreeCString(ctx, path);
-        return JS_ThrowTypeError(ctx, "fopen failed: %s", strerror(errno));
-    }
-
-    if (fseek(f, 0, SEEK_END) != 0) {
-        fclose(f);
-        JS_FreeCString(ctx, path);
-        return JS_ThrowInternalError(ctx, "fseek failed: %s", strerror(errno));
-    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    JS_FreeCString(ctx, path);
+    if (fd < 0)
+        return JS_ThrowTypeError(ctx, "open failed: %s", strerror(errno));
 
-    long pos = ftell(f);
-    if (pos < 0) {
-        fclose(f);
-        JS_FreeCString(ctx, path);
-        return JS_ThrowInternalError(ctx, "ftell failed: %s", strerror(errno));
-    }
-
-    const size_t bufsize = 4096;
-    char buf[bufsize];
-    long offset = pos;
-    long line_end = pos;
-
-    while (offset > 0) {
-        size_t chunk = (offset >= bufsize) ? bufsize : offset;
-        offset -= chunk;
-        if (fseek(f, offset, SEEK_SET) != 0)
-            break;
-
-        size_t n = fread(buf, 1, chunk, f);
-        if (n == 0) break; // EOF or error
-
-        for (long i = n - 1; i >= 0; i--) {
-            if (buf[i] == '\n') {
-                long line_start = offset + i + 1;
-                long line_len = line_end - line_start;
-                if (line_len > 0) {
-                    char *line = malloc(line_len + 1);
-                    if (!line) {
-                        fclose(f);
-                        JS_FreeCString(ctx, path);
-                        return JS_ThrowInternalError(ctx, "tac: out of memory");
-                    }
-                    if (fseek(f, line_start, SEEK_SET) == 0) {
-                        size_t got = fread(line, 1, line_len, f);
-                        if (got == (size_t)line_len) {
-                            line[line_len] = '\0';
-                            fwrite(line, 1, line_len, stdout);
-                            fputc('\n', stdout);
-                        }
-                    }
-                    free(line);
-                }
-                line_end = offset + i;
-            }
-        }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        return JS_ThrowInternalError(ctx, "fstat failed: %s", strerror(err));
     }
 
-    // First line (if not newline terminated)
-    if (line_end > 0) {
-        char *line = malloc(line_end + 1);
-        if (!line) {
-            fclose(f);
-            JS_FreeCString(ctx, path);
-            return JS_ThrowInternalError(ctx, "tac: out of memory");
-        }
-        if (fseek(f, 0, SEEK_SET) == 0) {
-            size_t got = fread(line, 1, line_end, f);
-            if (got == (size_t)line_end) {
-                line[line_end] = '\0';
-                fwrite(line, 1, line_end, stdout);
-                fputc('\n', stdout);
-            }
-        }
-        free(line);
+    TacSource *t = calloc(1, sizeof(*t));
+    if (!t) {
+        close(fd);
+        return JS_ThrowOutOfMemory(ctx);
     }
-
-    fclose(f);
-    JS_FreeCString(ctx, path);
-    return JS_NewString(ctx, JS_SUPPRESS);
+    t->base.pull = tac_pull;
+    t->base.free = tac_free;
+    t->fd = fd;
+    t->off = st.st_size;
+    return js_new_stream(ctx, &t->base);
 }
 
 // echo
@@ -141,25 +193,36 @@ JSValue js_echo(JSContext *ctx, JSValueConst this_val,
         return JS_ThrowTypeError(ctx, "echo(\"<string>\") expected");
     }
 
+    char *data = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&data, &len);
+    if (!out)
+        return JS_ThrowOutOfMemory(ctx);
+
     for (int i = 0; i < argc; i++) {
-        const char *arg = JS_ToCString(ctx, argv[i]);
-        if (!arg)
+        size_t n;
+        const char *arg = JS_ToCStringLen(ctx, &n, argv[i]);
+        if (!arg) {
+            fclose(out);
+            free(data);
             return JS_EXCEPTION;
+        }
 
         if (i > 0)
-            fputc(' ', stdout);
+            fputc(' ', out);
 
-        fputs(arg, stdout);
+        fwrite(arg, 1, n, out);
         JS_FreeCString(ctx, arg);
     }
 
-    fputc('\n', stdout);
-    
-    return JS_NewString(ctx, JS_SUPPRESS);
+    fputc('\n', out);
+    fclose(out);
+
+    return js_new_stream(ctx, pipe_buffer_source(data, len));
 }
 
 // ls command
-static void print_perms(mode_t mode) {
+static void print_perms(FILE *out, mode_t mode) {
     char buf[11];
     buf[0] = S_ISDIR(mode) ? 'd' : '-';
     buf[1] = (mode & S_IRUSR) ? 'r' : '-';
@@ -172,7 +235,72 @@ static void print_perms(mode_t mode) {
     buf[8] = (mode & S_IWOTH) ? 'w' : '-';
     buf[9] = (mode & S_IXOTH) ? 'x' : '-';
     buf[10] = '\0';
-    printf("%s ", buf);
+    fprintf(out, "%s ", buf);
+}
+
+typedef struct {
+    char *name;
+    struct stat st;
+} LsEntry;
+
+// The directory is read when ls() is called; the listing is rendered on
+// the first pull, once it is known whether it goes to the terminal (in
+// color) or into another stage (plain, one name per line).
+typedef struct {
+    PipeStage base;
+    LsEntry *entries;
+    size_t count;
+    int long_fmt;
+    char *data;
+    size_t len, pos;
+    int rendered;
+} LsSource;
+
+static int ls_render(LsSource *l) {
+    FILE *out = open_memstream(&l->data, &l->len);
+    if (!out) return -1;
+    int color = !l->base.piped;
+    for (size_t i = 0; i < l->count; i++) {
+        const LsEntry *e = &l->entries[i];
+        if (l->long_fmt) {
+            print_perms(out, e->st.st_mode);
+            fprintf(out, "%5ld ", (long)e->st.st_size);
+
+            char timebuf[64];
+            strftime(timebuf, sizeof(timebuf), "%b %d %H:%M",
+                     localtime(&e->st.st_mtime));
+            fprintf(out, "%s ", timebuf);
+        }
+        if (color)
+            fprint_name(out, e->name, e->st.st_mode);  // colored name
+        else
+            fputs(e->name, out);
+        fputs(l->long_fmt || !color ? "\n" : "  ", out);
+    }
+    if (!l->long_fmt && color)
+        fputc('\n', out);
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+static ssize_t ls_pull(PipeStage *s, char *buf, size_t cap) {
+    LsSource *l = (LsSource *)s;
+    if (!l->rendered) {
+        l->rendered = 1;
+        if (ls_render(l) < 0) return -1;
+    }
+    size_t n = l->len - l->pos < cap ? l->len - l->pos : cap;
+    memcpy(buf, l->data + l->pos, n);
+    l->pos += n;
+    return n;
+}
+
+static void ls_free(PipeStage *s) {
+    LsSource *l = (LsSource *)s;
+    for (size_t i = 0; i < l->count; i++)
+        free(l->entries[i].name);
+    free(l->entries);
+    free(l->data);
+    free(l);
 }
 
 JSValue js_ls(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
@@ -195,13 +323,19 @@ JSValue js_ls(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *arg
         }
     }
 
-    DIR *dir = opendir(path);
+    LsSource *l = calloc(1, sizeof(*l));
+    DIR *dir = l ? opendir(path) : NULL;
     if (!dir) {
+        free(l);
         if (argc > 0) JS_FreeCString(ctx, path);
         if (argc > 1) JS_FreeCString(ctx, flag);
         return JS_ThrowTypeError(ctx, "cannot open directory");
     }
+    l->base.pull = ls_pull;
+    l->base.free = ls_free;
+    l->long_fmt = flag && strcmp(flag, "l") == 0;
 
+    size_t cap = 0;
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
         if (entry->d_name[0] == '.') continue;
@@ -213,33 +347,25 @@ JSValue js_ls(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *arg
         if (stat(fullpath, &st) != 0)
             continue;
 
-        if (flag && strcmp(flag, "l") == 0) {
-            print_perms(st.st_mode);
-            printf("%5ld ", (long)st.st_size);
-
-            char timebuf[64];
-            strftime(timebuf, sizeof(timebuf), "%b %d %H:%M",
-                     localtime(&st.st_mtime));
-            printf("%s ", timebuf);
-
-            // colored name
-            print_name(entry->d_name, st.st_mode);
-            printf("\n");
-        } else {
-            // colored name
-            print_name(entry->d_name, st.st_mode);
-            printf("  ");
+        if (l->count == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            LsEntry *e = realloc(l->entries, ncap * sizeof(*e));
+            if (!e) break;
+            l->entries = e;
+            cap = ncap;
         }
+        char *name = strdup(entry->d_name);
+        if (!name) break;
+        l->entries[l->count].name = name;
+        l->entries[l->count].st = st;
+        l->count++;
     }
 
-    if (!(flag && strcmp(flag, "l") == 0))
-        printf("\n");
-
     closedir(dir);
     if (argc > 0) JS_FreeCString(ctx, path);
     if (argc > 1) JS_FreeCString(ctx, flag);
 
-    return JS_NewString(ctx, JS_SUPPRESS);
+    return js_new_stream(ctx, &l->base);
 }
 
 // cd
@@ -0,0 +1,383 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <readline/history.h>
+#include <readline/readline.h>
+#include "env.h"
+#include "hist.h"
+
+#define HISTORY_SIZE_DEFAULT 100000
+
+// How long to wait after ESC for the rest of a key's escape sequence
+#define ESC_SEQ_WAIT_MS 50
+
+// Every entry, oldest first, NUL terminated in one arena
+static char *arena;
+static size_t arena_len, arena_cap;
+static size_t *entry_off;
+static uint32_t entry_count, entry_cap;
+
+// Trigram -> ascending ids of the entries containing it. Open addressing;
+// a trigram never contains NUL, so key 0 marks an empty slot.
+typedef struct {
+    uint32_t key;
+    uint32_t count, cap;
+    uint32_t *ids;
+} TrigramList;
+
+static TrigramList *tri_table;
+static size_t tri_cap, tri_used;
+
+// Lines in the file as far as this process knows, to decide when to trim
+static long file_lines;
+static int trimming;
+static long trim_keep;  // history_size, read on the main thread
+
+static uint32_t tri_key(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16) |
+           ((uint32_t)(unsigned char)s[1] << 8) | (unsigned char)s[2];
+}
+
+static size_t tri_slot(const TrigramList *table, size_t cap, uint32_t key) {
+    size_t i = (key * 2654435761u) & (cap - 1);
+    while (table[i].key && table[i].key != key) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static TrigramList *tri_find(uint32_t key) {
+    if (!tri_cap) return NULL;
+    TrigramList *t = &tri_table[tri_slot(tri_table, tri_cap, key)];
+    return t->key ? t : NULL;
+}
+
+static TrigramList *tri_get(uint32_t key) {
+    if ((tri_used + 1) * 10 > tri_cap * 7) {
+        size_t cap = tri_cap ? tri_cap * 2 : 4096;
+        TrigramList *table = calloc(cap, sizeof(*table));
+        if (!table) return NULL;
+        for (size_t i = 0; i < tri_cap; i++)
+            if (tri_table[i].key)
+                table[tri_slot(table, cap, tri_table[i].key)] = tri_table[i];
+        free(tri_table);
+        tri_table = table;
+        tri_cap = cap;
+    }
+    TrigramList *t = &tri_table[tri_slot(tri_table, tri_cap, key)];
+    if (!t->key) {
+        t->key = key;
+        tri_used++;
+    }
+    return t;
+}
+
+static void index_entry(const char *line) {
+    size_t len = strlen(line);
+    if (entry_count == entry_cap) {
+        uint32_t cap = entry_cap ? entry_cap * 2 : 1024;
+        size_t *off = realloc(entry_off, cap * sizeof(*off));
+        if (!off) return;
+        entry_off = off;
+        entry_cap = cap;
+    }
+    if (arena_len + len + 1 > arena_cap) {
+        size_t cap = arena_cap ? arena_cap * 2 : 65536;
+        while (cap < arena_len + len + 1) cap *= 2;
+        char *a = realloc(arena, cap);
+        if (!a) return;
+        arena = a;
+        arena_cap = cap;
+    }
+    uint32_t id = entry_count++;
+    entry_off[id] = arena_len;
+    memcpy(arena + arena_len, line, len + 1);
+    arena_len += len + 1;
+
+    for (size_t i = 0; i + 3 <= len; i++) {
+        TrigramList *t = tri_get(tri_key(line + i));
+        if (!t || (t->count && t->ids[t->count - 1] == id)) continue;
+        if (t->count == t->cap) {
+            uint32_t cap = t->cap ? t->cap * 2 : 4;
+            uint32_t *ids = realloc(t->ids, cap * sizeof(*ids));
+            if (!ids) continue;
+            t->ids = ids;
+            t->cap = cap;
+        }
+        t->ids[t->count++] = id;
+    }
+}
+
+static const char *entry_text(uint32_t id) {
+    return arena + entry_off[id];
+}
+
+// Newest entry below `before` that contains query, or -1. Short queries
+// scan back from `before`; longer ones walk the rarest of the query's
+// trigrams and only check the entries on it.
+static long history_find(const char *query, long before) {
+    size_t qlen = strlen(query);
+    if (before > (long)entry_count) before = entry_count;
+    if (qlen < 3) {
+        for (long id = before - 1; id >= 0; id--)
+            if (strstr(entry_text(id), query)) return id;
+        return -1;
+    }
+
+    const TrigramList *best = NULL;
+    for (size_t i = 0; i + 3 <= qlen; i++) {
+        const TrigramList *t = tri_find(tri_key(query + i));
+        if (!t) return -1;
+        if (!best || t->count < best->count) best = t;
+    }
+    // Last position on the list below `before`
+    uint32_t lo = 0, hi = best->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((long)best->ids[mid] < before) lo = mid + 1;
+        else hi = mid;
+    }
+    for (long k = (long)lo - 1; k >= 0; k--)
+        if (strstr(entry_text(best->ids[k]), query)) return best->ids[k];
+    return -1;
+}
+
+static long history_limit(void) {
+    const char *v = env_get("history_size", NULL);
+    long n = v ? strtol(v, NULL, 10) : 0;
+    return n > 0 ? n : HISTORY_SIZE_DEFAULT;
+}
+
+// Open the history file for appending with an exclusive lock. A trim
+// renames a new file into place, so the lock is only good if it is on
+// the file that is still at `path`.
+static int open_locked(const char *path, int flags) {
+    for (int tries = 0; tries < 5; tries++) {
+        int fd = open(path, flags | O_CLOEXEC, 0600);
+        if (fd < 0) return -1;
+        struct stat a, b;
+        if (flock(fd, LOCK_EX) == 0 && fstat(fd, &a) == 0 &&
+            stat(path, &b) == 0 && a.st_ino == b.st_ino && a.st_dev == b.st_dev)
+            return fd;
+        close(fd);
+    }
+    return -1;
+}
+
+static void *trim_thread(void *arg) {
+    char *path = arg;
+    long keep = trim_keep;
+    int fd = open_locked(path, O_RDONLY);
+    if (fd < 0) goto out;
+
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fd, &st) != 0 || !(buf = malloc(st.st_size + 1))) goto unlock;
+    ssize_t n = read(fd, buf, st.st_size);
+    if (n != st.st_size) goto unlock;
+
+    // Start of the last `keep` lines
+    long lines = 0;
+    size_t start = 0;
+    for (ssize_t i = n - 1; i >= 0; i--) {
+        if (buf[i] == '\n' && i != n - 1 && ++lines == keep) {
+            start = i + 1;
+            break;
+        }
+    }
+    if (start == 0) goto unlock;
+
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out >= 0) {
+        int ok = write(out, buf + start, n - start) == (ssize_t)(n - start);
+        if (close(out) != 0 || !ok || rename(tmp, path) != 0)
+            unlink(tmp);
+    }
+unlock:
+    free(buf);
+    close(fd);
+out:
+    free(path);
+    __atomic_store_n(&trimming, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Trim once the file is a quarter over the limit, so it is not rewritten
+// on every command
+static void maybe_trim(const char *path) {
+    long limit = history_limit();
+    if (file_lines <= limit + limit / 4 || __atomic_load_n(&trimming, __ATOMIC_ACQUIRE))
+        return;
+    char *copy = strdup(path);
+    if (!copy) return;
+    pthread_t th;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    trimming = 1;
+    trim_keep = limit;
+    if (pthread_create(&th, &attr, trim_thread, copy) == 0) {
+        file_lines = limit;
+    } else {
+        trimming = 0;
+        free(copy);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void history_load(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fd, &st) == 0 && (buf = malloc(st.st_size + 1)) != NULL) {
+        ssize_t n = read(fd, buf, st.st_size);
+        if (n < 0) n = 0;
+        buf[n] = '\0';
+        for (char *line = buf; *line; ) {
+            char *eol = strchr(line, '\n');
+            if (eol) *eol = '\0';
+            if (*line) {
+                add_history(line);
+                index_entry(line);
+                file_lines++;
+            }
+            if (!eol) break;
+            line = eol + 1;
+        }
+    }
+    free(buf);
+    close(fd);
+    maybe_trim(path);
+}
+
+void history_append(const char *path, const char *line) {
+    add_history(line);
+    index_entry(line);
+
+    int fd = open_locked(path, O_WRONLY | O_APPEND | O_CREAT);
+    if (fd < 0) return;
+    // One write, so a line is never interleaved with another window's
+    size_t len = strlen(line);
+    char *rec = malloc(len + 1);
+    if (rec) {
+        memcpy(rec, line, len);
+        rec[len] = '\n';
+        if (write(fd, rec, len + 1) == (ssize_t)(len + 1))
+            file_lines++;
+        free(rec);
+    }
+    close(fd);
+    maybe_trim(path);
+}
+
+// Whether another byte of input arrives within ms
+static int key_pending(int ms) {
+    struct pollfd p = { fileno(rl_instream ? rl_instream : stdin), POLLIN, 0 };
+    return poll(&p, 1, ms) > 0;
+}
+
+// ESC has been read and more input follows: read the rest of the key
+// (a CSI or SS3 sequence, or the one key of a Meta combination) and push
+// all of it back, so readline runs the key once the search ends
+static void pass_escape_sequence(void) {
+    int seq[16], n = 0;
+    seq[n++] = 27;
+    int c = rl_read_key();
+    if (c >= 0) {
+        seq[n++] = c;
+        if (c == '[') {
+            // Parameter and intermediate bytes, then one final byte
+            while (n < 16 && (c = rl_read_key()) >= 0) {
+                seq[n++] = c;
+                if (c < 0x20 || c >= 0x40) break;
+            }
+        } else if (c == 'O' && (c = rl_read_key()) >= 0) {
+            seq[n++] = c;
+        }
+    }
+    for (int i = 0; i < n; i++) rl_stuff_char(seq[i]);
+}
+
+int jssh_history_search(int count, int key) {
+    (void)count; (void)key;
+    static char last_query[256];
+    char query[256] = "";
+    size_t qlen = 0;
+    char *saved = strdup(rl_line_buffer);
+    int saved_point = rl_point;
+    long match = -1;
+    int failed = 0;
+
+    for (;;) {
+        rl_message("(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+        if (match >= 0) {
+            const char *text = entry_text(match);
+            rl_replace_line(text, 0);
+            rl_point = (int)(strstr(text, query) - text);
+        }
+        rl_redisplay();
+
+        int c = rl_read_key();
+        if (c == 18) {                                  // Ctrl-R: older
+            if (qlen == 0 && last_query[0]) {
+                snprintf(query, sizeof(query), "%s", last_query);
+                qlen = strlen(query);
+                match = history_find(query, entry_count);
+            } else if (match >= 0) {
+                // Skip repeats of the entry already shown
+                long next = match;
+                do next = history_find(query, next);
+                while (next >= 0 && strcmp(entry_text(next), entry_text(match)) == 0);
+                if (next >= 0) match = next;
+                failed = next < 0;
+                continue;
+            }
+        } else if (c == 7 || c < 0) {                   // Ctrl-G: cancel
+            rl_replace_line(saved ? saved : "", 0);
+            rl_point = saved_point;
+            break;
+        } else if (c == 127 || c == 8) {
+            if (qlen > 0) query[--qlen] = '\0';
+            match = -1;
+            if (qlen == 0) {
+                failed = 0;
+                continue;
+            }
+            match = history_find(query, entry_count);
+        } else if (c == '\r' || c == '\n') {
+            rl_done = 1;
+            break;
+        } else if (c == 27) {
+            // ESC alone ends the search. Arrows and other keys send ESC
+            // and more: end the search and let readline handle the key.
+            if (key_pending(ESC_SEQ_WAIT_MS)) pass_escape_sequence();
+            break;
+        } else if (c >= 32 && qlen + 1 < sizeof(query)) {
+            query[qlen++] = (char)c;
+            query[qlen] = '\0';
+            // A longer query still matches at or before the current entry
+            match = history_find(query, match >= 0 ? match + 1 : (long)entry_count);
+        } else {
+            // Any other key ends the search and then does its usual job
+            rl_execute_next(c);
+            break;
+        }
+        failed = qlen > 0 && match < 0;
+        if (failed) match = -1;
+    }
+
+    if (qlen) snprintf(last_query, sizeof(last_query), "%s", query);
+    rl_clear_message();
+    free(saved);
+    return 0;
+}
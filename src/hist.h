@@ -0,0 +1,14 @@
+#ifndef HIST_H
+#define HIST_H
+
+// ~/.jssh_history. Loaded once at startup, then each command is appended
+// on its own under an flock, so several jssh windows can share the file.
+// It is trimmed to history_size lines on a background thread.
+void history_load(const char *path);
+void history_append(const char *path, const char *line);
+
+// Ctrl-R: incremental reverse search, backed by a trigram index of every
+// entry so it stays instant on very large histories
+int jssh_history_search(int count, int key);
+
+#endif
@@ -11,7 +11,10 @@
 #include "env.h"
 #include "sys.h"
 #include "func.h"
+#include "hist.h"
 #include "utils.h"
+#include "startup.h"
+#include "stream.h"
 #include "quickjs.h"
 #include "quickjs-libc.h"
 
@@ -62,10 +65,25 @@ static void handle_exit_signal(int sig) {
 }
 
 int main(int argc, char **argv) {
+    // --profile-startup[=trace.json]: time startup, report and exit
+    const char *trace_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--profile-startup") == 0)
+            trace_path = "jssh-startup.json";
+        else if (strncmp(argv[i], "--profile-startup=", 18) == 0)
+            trace_path = argv[i] + 18;
+    }
+    if (trace_path) startup_profile_enable();
+
+    startup_begin("JS_NewRuntime");
     JSRuntime *rt = JS_NewRuntime();
+    startup_end();
+    startup_begin("JS_NewContext");
     JSContext *ctx = JS_NewContext(rt);
     js_std_add_helpers(ctx, argc, argv);
+    startup_end();
 
+    startup_begin("builtins");
     JSValue global_obj = JS_GetGlobalObject(ctx);
 
     // Init all os primitives in JS
@@ -86,29 +104,52 @@ int main(int argc, char **argv) {
     JS_SetPropertyStr(ctx, global_obj, "clear", JS_NewCFunction(ctx, js_clear, "clear", 0));
     JS_SetPropertyStr(ctx, global_obj, "version", JS_NewCFunction(ctx, js_version, "version", 0));
     JS_SetPropertyStr(ctx, global_obj, "update", JS_NewCFunction(ctx, js_update, "update", 0));
+    startup_end();
 
+    // Streams, pipe() and the text filters
+    startup_begin("js_init_stream");
+    js_init_stream(ctx);
+    startup_end();
 
     // Init syscalls for pure JS commands
+    startup_begin("js_init_sys");
     js_init_sys(ctx);
+    startup_end();
 
     JS_FreeValue(ctx, global_obj);
 
     // Load the pure JS commands
+    startup_begin("load_js_libs");
     load_js_libs(ctx, "./lib/js");
+    startup_end();
 
     // Get color mode of terminal
+    startup_begin("detect_color_mode");
     detect_color_mode();
+    startup_end();
 
     // Module library conditional imports
+    startup_begin("js_init_network");
     js_init_network(ctx);
+    startup_end();
+    startup_begin("js_init_compiler");
     js_init_compiler(ctx);
+    startup_end();
+    startup_begin("js_init_fs");
     js_init_fs(ctx);
+    startup_end();
+    startup_begin("js_init_git");
     js_init_git(ctx);
+    startup_end();
+    startup_begin("js_init_app");
     js_init_app(ctx);
+    startup_end();
 
 
     // Init keybindings for autocomplete
+    startup_begin("init_qol_bindings");
     init_qol_bindings();
+    startup_end();
 
     // Init highlighting
     rl_redisplay_function = jssh_redisplay;
@@ -124,16 +165,28 @@ int main(int argc, char **argv) {
     }
     const char *username = pw ? pw->pw_name : "unknown";
 
-    init_history_file(); // sets history path to ~/.jssh_history
-    read_history(history_file);  // loads ~/.jssh_history if exists
-
     signal(SIGTERM, handle_exit_signal);
     signal(SIGHUP,  handle_exit_signal);
 
     // Load env file for settings
     char envpath[512];
     snprintf(envpath, sizeof(envpath), "%s/.jssh_env", home);
+    startup_begin("env_load");
     env_load(envpath);
+    startup_end();
+
+    // After the env file, which may set history_size
+    startup_begin("history_load");
+    init_history_file(); // sets history path to ~/.jssh_history
+    history_load(history_file);  // loads ~/.jssh_history if exists
+    startup_end();
+
+    if (trace_path) {
+        startup_report(trace_path);
+        JS_FreeContext(ctx);
+        JS_FreeRuntime(rt);
+        return 0;
+    }
 
     char host[256];
     if (gethostname(host, sizeof(host)) != 0)
@@ -169,10 +222,8 @@ int main(int argc, char **argv) {
         }
         printf("\n");
 
-        if (*line){
-            add_history(line);
-            write_history(history_file);
-        }
+        if (*line)
+            history_append(history_file, line);
 
         if (strcmp(line, ":quit") == 0) {
             free(line);
@@ -186,7 +237,7 @@ int main(int argc, char **argv) {
             const char *str = JS_ToCString(ctx, val);
             if (str) {
                 if (strcmp(str, "undefined") != 0 &&
-                    strcmp(str, "\x1B[JSSH_SUPPRESS") != 0) { 
+                    strcmp(str, JS_SUPPRESS) != 0) { 
                     // Remove the undefined after certain functions
                     printf("%s\n", str);
                 }
@@ -0,0 +1,1199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "pipe.h"
+
+// Largest single kernel copy, and the buffer for copying by hand
+#define COPY_MAX (1 << 30)
+#define COPY_BUF (1 << 20)
+
+void pipe_free(PipeStage *s) {
+    while (s) {
+        PipeStage *up = s->up;
+        s->free(s);
+        s = up;
+    }
+}
+
+ssize_t pipe_fill(PipeStage *up, LineIn *in) {
+    if (in->eof || !up) {
+        in->eof = 1;
+        return 0;
+    }
+    // Keep the unread part and read more behind it
+    if (in->pos > 0) {
+        memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+    if (in->cap - in->len < PIPE_CHUNK / 2) {
+        size_t cap = in->cap ? in->cap * 2 : PIPE_CHUNK;
+        char *buf = realloc(in->buf, cap);
+        if (!buf) return -1;
+        in->buf = buf;
+        in->cap = cap;
+    }
+    // One byte stays spare, for grep_match
+    ssize_t n = up->pull(up, in->buf + in->len, in->cap - in->len - 1);
+    if (n < 0) return -1;
+    if (n == 0) in->eof = 1;
+    in->len += n;
+    return n;
+}
+
+int pipe_line(PipeStage *up, LineIn *in, const char **line, size_t *len, int *nl) {
+    for (;;) {
+        char *eol = in->pos < in->len ? memchr(in->buf + in->pos, '\n', in->len - in->pos) : NULL;
+        if (eol || (in->eof && in->pos < in->len)) {
+            *line = in->buf + in->pos;
+            *len = (eol ? (size_t)(eol - in->buf) : in->len) - in->pos;
+            *nl = eol != NULL;
+            in->pos += *len + *nl;
+            return 1;
+        }
+        if (in->eof) return 0;
+        if (pipe_fill(up, in) < 0) return -1;
+    }
+}
+
+void pipe_line_free(LineIn *in) {
+    free(in->buf);
+    memset(in, 0, sizeof(*in));
+}
+
+// Output a filter has decided on but not yet handed downstream
+typedef struct {
+    const char *p;
+    size_t n;
+} Pending;
+
+static size_t pending_take(Pending *pd, char *out, size_t cap) {
+    size_t n = pd->n < cap ? pd->n : cap;
+    if (n == 0) return 0;
+    memcpy(out, pd->p, n);
+    pd->p += n;
+    pd->n -= n;
+    return n;
+}
+
+// Read exactly len bytes at off. Returns 0, or -1 with errno set.
+static int pread_full(int fd, char *buf, size_t len, off_t off) {
+    for (size_t got = 0; got < len; ) {
+        ssize_t n = pread(fd, buf + got, len - got, off + got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;  // file shrank under us
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+// Buffer source (echo, ls)
+typedef struct {
+    PipeStage base;
+    char *data;
+    size_t len, pos;
+} BufferSource;
+
+static ssize_t buffer_pull(PipeStage *s, char *buf, size_t cap) {
+    BufferSource *b = (BufferSource *)s;
+    size_t n = b->len - b->pos < cap ? b->len - b->pos : cap;
+    memcpy(buf, b->data + b->pos, n);
+    b->pos += n;
+    return n;
+}
+
+static void buffer_free(PipeStage *s) {
+    free(((BufferSource *)s)->data);
+    free(s);
+}
+
+PipeStage *pipe_buffer_source(char *data, size_t len) {
+    BufferSource *b = calloc(1, sizeof(*b));
+    if (!b) {
+        free(data);
+        return NULL;
+    }
+    b->base.pull = buffer_pull;
+    b->base.free = buffer_free;
+    b->data = data;
+    b->len = len;
+    return &b->base;
+}
+
+// File source (cat): read straight into the pipeline chunk by chunk, one
+// file after another
+typedef struct {
+    PipeStage base;
+    int *fds;
+    int nfds, cur;
+    int started;        // something was pulled from fds[cur]
+} FileSource;
+
+static ssize_t file_pull(PipeStage *s, char *buf, size_t cap) {
+    FileSource *f = (FileSource *)s;
+    while (f->cur < f->nfds) {
+        ssize_t n;
+        f->started = 1;
+        do n = read(f->fds[f->cur], buf, cap);
+        while (n < 0 && errno == EINTR);
+        if (n != 0) return n;
+        f->cur++;
+        f->started = 0;
+    }
+    return 0;
+}
+
+static int file_fd(PipeStage *s) {
+    FileSource *f = (FileSource *)s;
+    return f->nfds - f->cur == 1 && !f->started ? f->fds[f->cur] : -1;
+}
+
+static void file_free(PipeStage *s) {
+    FileSource *f = (FileSource *)s;
+    for (int i = 0; i < f->nfds; i++) close(f->fds[i]);
+    free(f->fds);
+    free(f);
+}
+
+PipeStage *pipe_file_source(const int *fds, int nfds) {
+    FileSource *f = calloc(1, sizeof(*f));
+    int *copy = malloc(nfds * sizeof(*copy));
+    if (!f || !copy) {
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        free(f);
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy, fds, nfds * sizeof(*copy));
+    f->base.pull = file_pull;
+    f->base.free = file_free;
+    f->base.file = file_fd;
+    f->fds = copy;
+    f->nfds = nfds;
+    return &f->base;
+}
+
+// The next whole regular file of a file source, handed to a consumer
+// that reads it to the end itself. -1 when s is anything else.
+static int file_next(PipeStage *s) {
+    if (s->pull != file_pull) return -1;
+    FileSource *f = (FileSource *)s;
+    struct stat st;
+    if (f->cur >= f->nfds || f->started ||
+        fstat(f->fds[f->cur], &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+    return f->fds[f->cur++];
+}
+
+static int write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// Plain copy for a terminal, or when the kernel can't copy for us. Big
+// reads, so a large file still takes few syscalls.
+static int copy_rw(int in, int out) {
+    char *buf = malloc(COPY_BUF);
+    if (!buf) return -1;
+    ssize_t n;
+    int rc = 0;
+    while ((n = read(in, buf, COPY_BUF)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            rc = -1;
+            break;
+        }
+        if ((rc = write_full(out, buf, n)) != 0) break;
+    }
+    free(buf);
+    return rc;
+}
+
+// The kernel will not do this copy, but read/write can
+static int copy_refused(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP ||
+           err == EBADF || err == EPERM || err == ETXTBSY;
+}
+
+// Copy the rest of in to out inside the kernel where it can: between
+// files with copy_file_range, into a pipe with splice, and with sendfile
+// otherwise. All of them move the file offset of in, so when one gives
+// up partway the next picks up from there.
+static int copy_fd(int in, int out) {
+    struct stat st;
+    ssize_t n;
+    if (fstat(out, &st) != 0) return -1;
+    // copy_file_range and sendfile refuse a file opened for append (>>)
+    int flags = fcntl(out, F_GETFL);
+    if (flags >= 0 && (flags & O_APPEND)) return copy_rw(in, out);
+    if (S_ISREG(st.st_mode)) {
+        while ((n = copy_file_range(in, NULL, out, NULL, COPY_MAX, 0)) > 0 ||
+               (n < 0 && errno == EINTR))
+            ;
+        if (n == 0) return 0;
+        if (!copy_refused(errno)) return -1;
+    } else if (S_ISFIFO(st.st_mode)) {
+        while ((n = splice(in, NULL, out, NULL, COPY_MAX, SPLICE_F_MORE)) > 0 ||
+               (n < 0 && errno == EINTR))
+            ;
+        if (n == 0) return 0;
+        if (!copy_refused(errno)) return -1;
+    }
+    if (!isatty(out)) {
+        while ((n = sendfile(out, in, NULL, COPY_MAX)) > 0 || (n < 0 && errno == EINTR))
+            ;
+        if (n == 0) return 0;
+        if (!copy_refused(errno)) return -1;
+    }
+    return copy_rw(in, out);
+}
+
+int pipe_drain(PipeStage *s, int fd, int *ends_nl) {
+    int in;
+    while ((in = file_next(s)) >= 0) {
+        // The copy never reaches user space, so look at the last byte here
+        struct stat st;
+        char c;
+        if (fstat(in, &st) == 0 && st.st_size > 0 && pread(in, &c, 1, st.st_size - 1) == 1)
+            *ends_nl = c == '\n';
+        if (copy_fd(in, fd) != 0) return -1;
+    }
+
+    char *buf = malloc(PIPE_CHUNK);
+    if (!buf) return -1;
+    ssize_t n;
+    int rc = 0;
+    while ((n = s->pull(s, buf, PIPE_CHUNK)) > 0) {
+        *ends_nl = buf[n - 1] == '\n';
+        if ((rc = write_full(fd, buf, n)) != 0) break;
+    }
+    if (n < 0) rc = -1;
+    free(buf);
+    return rc;
+}
+
+// grep(pattern, flags)
+typedef struct {
+    PipeStage base;
+    LineIn in;
+    Pending pend;
+    char *pattern;      // lowercased when fold is set
+    size_t plen;
+    int invert, use_re, fold;
+    regex_t re;
+    int add_nl;         // the pending line is the last one and has no '\n'
+    char *scratch;      // fold: lowercased text, at the same offsets
+    size_t scratch_cap;
+    size_t fold_from, fold_to;  // scan: the part of in.buf in scratch
+    int done;
+} GrepStage;
+
+// The text to search for "i": p[0..n) lowercased into scratch at `at`,
+// so a case-insensitive literal still runs on memmem
+static const char *grep_fold(GrepStage *g, const char *p, size_t n, size_t at) {
+    if (at + n > g->scratch_cap) {
+        size_t cap = g->scratch_cap ? g->scratch_cap : PIPE_CHUNK;
+        while (cap < at + n) cap *= 2;
+        char *s = realloc(g->scratch, cap);
+        if (!s) return NULL;
+        g->scratch = s;
+        g->scratch_cap = cap;
+    }
+    char *q = g->scratch + at;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        q[i] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+    }
+    return q;
+}
+
+static int grep_match(GrepStage *g, char *line, size_t len) {
+    int hit = 0;
+    if (g->use_re) {
+        // NUL terminate the line in place: over its '\n', or the spare
+        // byte pipe_fill leaves after the buffer
+        char saved = line[len];
+        line[len] = '\0';
+        hit = regexec(&g->re, line, 0, NULL, 0) == 0;
+        line[len] = saved;
+    } else {
+        const char *hay = g->fold ? grep_fold(g, line, len, 0) : line;
+        hit = hay && memmem(hay, len, g->pattern, g->plen) != NULL;
+    }
+    return hit != g->invert;
+}
+
+// First match in the complete lines base[0..end), at in.buf offset off,
+// or NULL. A regex runs on the whole block with REG_NEWLINE, so ^, $ and
+// . still stop at line ends.
+static char *grep_find(GrepStage *g, char *base, size_t end, size_t off, int *err) {
+    if (g->use_re) {
+        // NUL terminate in place: over a '\n' or the spare byte
+        char saved = base[end];
+        base[end] = '\0';
+        regmatch_t m;
+        int rc = regexec(&g->re, base, 1, &m, 0);
+        base[end] = saved;
+        if (rc != 0) return NULL;
+        // An empty match past the last '\n' is not on any line
+        if ((size_t)m.rm_so == end && base[end - 1] == '\n') return NULL;
+        return base + m.rm_so;
+    }
+    const char *hay = base;
+    if (g->fold) {
+        // Fold each byte once, not again after every hit
+        if (off < g->fold_from || off + end > g->fold_to) {
+            if (!grep_fold(g, base, end, off)) {
+                *err = 1;
+                return NULL;
+            }
+            g->fold_from = off;
+            g->fold_to = off + end;
+        }
+        hay = g->scratch + off;
+    }
+    const char *found = memmem(hay, end, g->pattern, g->plen);
+    return found ? base + (found - hay) : NULL;
+}
+
+// Search all the complete lines in the buffer at once (memmem is
+// Two-Way, with a fast first-byte scan) and only find the line around a
+// hit, instead of splitting every line first
+static int grep_scan(GrepStage *g) {
+    LineIn *in = &g->in;
+    for (;;) {
+        char *base = in->buf + in->pos;
+        size_t avail = in->len - in->pos;
+        char *last = avail ? memrchr(base, '\n', avail) : NULL;
+        size_t end = last ? (size_t)(last - base) + 1 : (in->eof ? avail : 0);
+        if (end == 0) {
+            if (in->eof) return 0;
+            if (pipe_fill(g->base.up, in) < 0) return -1;
+            g->fold_to = 0;     // the buffer moved
+            continue;
+        }
+        int err = 0;
+        char *hit = grep_find(g, base, end, in->pos, &err);
+        if (err) return -1;
+        if (!hit) {
+            in->pos += end;
+            continue;
+        }
+        char *ls = hit > base ? memrchr(base, '\n', hit - base) : NULL;
+        ls = ls ? ls + 1 : base;
+        char *le = memchr(hit, '\n', base + end - hit);
+        size_t n = le ? (size_t)(le - ls) + 1 : (size_t)(base + end - ls);
+        in->pos = (ls - in->buf) + n;
+        // REG_NEWLINE keeps . and [^...] on one line, but [[:space:]] or
+        // [\n] can still match across one: keep the line only if it
+        // matches on its own
+        if (g->use_re && !grep_match(g, ls, le ? (size_t)(le - ls) : n))
+            continue;
+        g->pend.p = ls;
+        g->pend.n = n;
+        g->add_nl = !le;
+        return 1;
+    }
+}
+
+static ssize_t grep_pull(PipeStage *s, char *out, size_t cap) {
+    GrepStage *g = (GrepStage *)s;
+    int fast = !g->invert && (g->use_re || !memchr(g->pattern, '\n', g->plen));
+    size_t n = 0;
+    for (;;) {
+        n += pending_take(&g->pend, out + n, cap - n);
+        if (g->pend.n == 0 && g->add_nl && n < cap) {
+            out[n++] = '\n';
+            g->add_nl = 0;
+        }
+        if (n == cap || g->done) return n;
+
+        int r;
+        if (fast) {
+            r = grep_scan(g);
+        } else {
+            const char *line;
+            size_t len;
+            int nl;
+            r = pipe_line(s->up, &g->in, &line, &len, &nl);
+            if (r > 0 && grep_match(g, (char *)line, len)) {
+                g->pend.p = line;
+                g->pend.n = len + nl;
+                g->add_nl = !nl;
+            }
+        }
+        if (r < 0) return n ? (ssize_t)n : -1;
+        if (r == 0) g->done = 1;
+    }
+}
+
+static void grep_free(PipeStage *s) {
+    GrepStage *g = (GrepStage *)s;
+    pipe_line_free(&g->in);
+    if (g->use_re) regfree(&g->re);
+    free(g->scratch);
+    free(g->pattern);
+    free(g);
+}
+
+PipeStage *pipe_grep(const char *pattern, size_t plen, const char *flags, char *err, size_t errsz) {
+    int icase = 0, invert = 0, ere = 0;
+    for (const char *f = flags ? flags : ""; *f; f++) {
+        if (*f == 'i') icase = 1;
+        else if (*f == 'v') invert = 1;
+        else if (*f == 'E') ere = 1;
+        else {
+            snprintf(err, errsz, "unknown flag '%c'", *f);
+            return NULL;
+        }
+    }
+
+    GrepStage *g = calloc(1, sizeof(*g));
+    if (g) g->pattern = malloc(plen + 1);
+    if (!g || !g->pattern) {
+        free(g);
+        return NULL;
+    }
+    memcpy(g->pattern, pattern, plen);
+    g->pattern[plen] = '\0';
+    g->plen = plen;
+    g->invert = invert;
+
+    if (icase && !ere) {
+        g->fold = 1;
+        for (size_t i = 0; i < plen; i++)
+            if (g->pattern[i] >= 'A' && g->pattern[i] <= 'Z') g->pattern[i] += 32;
+    } else if (ere) {
+        int rc = regcomp(&g->re, g->pattern, REG_EXTENDED | REG_NEWLINE | (icase ? REG_ICASE : 0));
+        if (rc != 0) {
+            regerror(rc, &g->re, err, errsz);
+            free(g->pattern);
+            free(g);
+            return NULL;
+        }
+        g->use_re = 1;
+    }
+    g->base.pull = grep_pull;
+    g->base.free = grep_free;
+    g->base.filter = 1;
+    return &g->base;
+}
+
+// head(n): the first n lines. Frees everything upstream once it has
+// them, so a long source stops being read.
+typedef struct {
+    PipeStage base;
+    LineIn in;
+    Pending pend;
+    long left;
+} HeadStage;
+
+static ssize_t head_pull(PipeStage *s, char *out, size_t cap) {
+    HeadStage *h = (HeadStage *)s;
+    size_t n = 0;
+    for (;;) {
+        n += pending_take(&h->pend, out + n, cap - n);
+        if (n == cap) return n;
+        if (h->left <= 0) {
+            if (s->up) {
+                pipe_free(s->up);
+                s->up = NULL;
+            }
+            if (h->pend.n == 0) pipe_line_free(&h->in);
+            return n;
+        }
+
+        const char *line;
+        size_t len;
+        int nl;
+        int r = pipe_line(s->up, &h->in, &line, &len, &nl);
+        if (r < 0) return n ? (ssize_t)n : -1;
+        if (r == 0) {
+            h->left = 0;
+            continue;
+        }
+        h->pend.p = line;
+        h->pend.n = len + nl;
+        h->left--;
+    }
+}
+
+static void head_free(PipeStage *s) {
+    pipe_line_free(&((HeadStage *)s)->in);
+    free(s);
+}
+
+PipeStage *pipe_head(long n) {
+    HeadStage *h = calloc(1, sizeof(*h));
+    if (!h) return NULL;
+    h->base.pull = head_pull;
+    h->base.free = head_free;
+    h->base.filter = 1;
+    h->left = n;
+    return &h->base;
+}
+
+// tail(n): the last n lines. Straight after a file source it seeks: the
+// file is scanned backward from the end for n newlines and only the tail
+// is read. Otherwise the input streams through a buffer that is cut back
+// to the last n lines as it grows.
+typedef struct {
+    PipeStage base;
+    LineIn in;
+    long n;
+    int fd;             // file mode: serve [off, end) of fd with pread
+    off_t off, end;
+    size_t keep;        // stream mode: bytes held after the last cut
+    int ready;
+} TailStage;
+
+// Offset in buf of the last n lines. A final '\n' ends the last line.
+static size_t tail_start(const char *buf, size_t len, long n) {
+    if (n <= 0) return len;
+    size_t end = len && buf[len - 1] == '\n' ? len - 1 : len;
+    for (long i = 0; i < n; i++) {
+        char *nl = end ? memrchr(buf, '\n', end) : NULL;
+        if (!nl) return 0;
+        end = nl - buf;
+    }
+    return end + 1;
+}
+
+// The same for a file, reading backward a chunk at a time
+static off_t tail_file_start(int fd, off_t size, long n) {
+    if (n <= 0) return size;
+    char *buf = malloc(PIPE_CHUNK);
+    if (!buf) return -1;
+    off_t pos = size, start = 0;
+    long found = 0;
+    while (pos > 0) {
+        size_t chunk = pos < PIPE_CHUNK ? (size_t)pos : PIPE_CHUNK;
+        if (pread_full(fd, buf, chunk, pos - chunk) < 0) {
+            start = -1;
+            break;
+        }
+        size_t end = chunk;
+        if (pos == size && buf[end - 1] == '\n') end--;
+        char *nl;
+        while (end > 0 && (nl = memrchr(buf, '\n', end))) {
+            if (++found == n) {
+                start = pos - chunk + (nl - buf) + 1;
+                goto out;
+            }
+            end = nl - buf;
+        }
+        pos -= chunk;
+    }
+out:
+    free(buf);
+    return start;
+}
+
+static int tail_prepare(TailStage *t) {
+    PipeStage *up = t->base.up;
+    int fd = up && up->file ? up->file(up) : -1;
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t start = tail_file_start(fd, st.st_size, t->n);
+        if (start < 0) return -1;
+        t->fd = fd;
+        t->off = start;
+        t->end = st.st_size;
+        return 0;
+    }
+
+    LineIn *in = &t->in;
+    for (;;) {
+        ssize_t r = pipe_fill(up, in);
+        if (r < 0) return -1;
+        size_t held = in->len - in->pos;
+        if (r == 0 || held > 2 * t->keep + PIPE_CHUNK) {
+            in->pos += tail_start(in->buf + in->pos, held, t->n);
+            t->keep = in->len - in->pos;
+        }
+        if (r == 0) return 0;
+    }
+}
+
+static ssize_t tail_pull(PipeStage *s, char *out, size_t cap) {
+    TailStage *t = (TailStage *)s;
+    if (!t->ready) {
+        if (tail_prepare(t) < 0) return -1;
+        t->ready = 1;
+    }
+    if (t->fd >= 0) {
+        size_t n = t->end - t->off < (off_t)cap ? (size_t)(t->end - t->off) : cap;
+        ssize_t r;
+        do r = pread(t->fd, out, n, t->off);
+        while (r < 0 && errno == EINTR);
+        if (r > 0) t->off += r;
+        return r;
+    }
+    Pending pd = { t->in.buf + t->in.pos, t->in.len - t->in.pos };
+    size_t n = pending_take(&pd, out, cap);
+    t->in.pos += n;
+    return n;
+}
+
+static void tail_free(PipeStage *s) {
+    pipe_line_free(&((TailStage *)s)->in);
+    free(s);
+}
+
+PipeStage *pipe_tail(long n) {
+    TailStage *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->base.pull = tail_pull;
+    t->base.free = tail_free;
+    t->base.filter = 1;
+    t->n = n;
+    t->fd = -1;
+    return &t->base;
+}
+
+// wc(flags)
+typedef struct {
+    PipeStage base;
+    int lines, words, bytes;
+    char out[96];
+    Pending pend;
+    int done;
+} WcStage;
+
+// Newlines in p[0..n), eight bytes at a time: a byte is '\n' when it is
+// zero after XOR with '\n' in every lane. The per-lane counts are summed
+// every 255 words, before any lane can overflow.
+static size_t count_newlines(const char *p, size_t n) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t low7 = ones * 0x7f, nl = ones * '\n';
+    size_t count = 0, i = 0;
+    while (i + 8 <= n) {
+        uint64_t acc = 0;
+        for (int k = 0; k < 255 && i + 8 <= n; k++, i += 8) {
+            uint64_t x;
+            memcpy(&x, p + i, 8);
+            x ^= nl;
+            // High bit of each lane set when that byte is nonzero
+            uint64_t t = ((x & low7) + low7) | x;
+            acc += (~t >> 7) & ones;
+        }
+        acc = (acc & 0x00ff00ff00ff00ffULL) + ((acc >> 8) & 0x00ff00ff00ff00ffULL);
+        count += (acc * 0x0001000100010001ULL) >> 48;
+    }
+    for (; i < n; i++) count += p[i] == '\n';
+    return count;
+}
+
+static int wc_count(WcStage *w, size_t *lines, size_t *words, size_t *bytes) {
+    PipeStage *up = w->base.up;
+    // A filter that was never given input counts nothing
+    if (!up) return 0;
+    int fd = up->file ? up->file(up) : -1;
+    struct stat st;
+    // Bytes alone need no reading for a regular file
+    if (!w->lines && !w->words && fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        *bytes = st.st_size;
+        return 0;
+    }
+
+    char *buf = malloc(PIPE_CHUNK);
+    if (!buf) return -1;
+    int in_word = 0;
+    ssize_t n;
+    while ((n = up->pull(up, buf, PIPE_CHUNK)) > 0) {
+        *bytes += n;
+        if (w->lines) *lines += count_newlines(buf, n);
+        if (w->words) {
+            for (ssize_t i = 0; i < n; i++) {
+                unsigned char c = buf[i];
+                int space = c == ' ' || (c >= '\t' && c <= '\r');
+                *words += !space && !in_word;
+                in_word = !space;
+            }
+        }
+    }
+    free(buf);
+    return n < 0 ? -1 : 0;
+}
+
+static ssize_t wc_pull(PipeStage *s, char *out, size_t cap) {
+    WcStage *w = (WcStage *)s;
+    if (!w->done) {
+        size_t lines = 0, words = 0, bytes = 0;
+        if (wc_count(w, &lines, &words, &bytes) < 0) return -1;
+        w->done = 1;
+        int len = 0;
+        if (w->lines) len += snprintf(w->out + len, sizeof(w->out) - len, "%zu ", lines);
+        if (w->words) len += snprintf(w->out + len, sizeof(w->out) - len, "%zu ", words);
+        if (w->bytes) len += snprintf(w->out + len, sizeof(w->out) - len, "%zu ", bytes);
+        w->out[len - 1] = '\n';
+        w->pend.p = w->out;
+        w->pend.n = len;
+    }
+    return pending_take(&w->pend, out, cap);
+}
+
+static void wc_free(PipeStage *s) {
+    free(s);
+}
+
+PipeStage *pipe_wc(const char *flags, char *err, size_t errsz) {
+    int lines = 0, words = 0, bytes = 0;
+    for (const char *f = flags ? flags : ""; *f; f++) {
+        if (*f == 'l') lines = 1;
+        else if (*f == 'w') words = 1;
+        else if (*f == 'c') bytes = 1;
+        else {
+            snprintf(err, errsz, "unknown flag '%c'", *f);
+            return NULL;
+        }
+    }
+    WcStage *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    if (!lines && !words && !bytes) lines = words = bytes = 1;
+    w->base.pull = wc_pull;
+    w->base.free = wc_free;
+    w->base.filter = 1;
+    w->lines = lines;
+    w->words = words;
+    w->bytes = bytes;
+    return &w->base;
+}
+
+// sort(flags): lines are copied into an arena and sorted there. When the
+// arena reaches run_bytes it is sorted and written to an unlinked temp
+// file as a run; at the end the runs are merged through a heap, so input
+// larger than memory only costs disk.
+typedef struct {
+    size_t off, len;    // in the arena, without the '\n' that follows
+} SortLine;
+
+typedef struct {
+    FILE *f;
+    char *line;         // current line, with its '\n'
+    size_t cap;
+    ssize_t len;
+} SortRun;
+
+typedef struct {
+    PipeStage base;
+    LineIn in;
+    int reverse, numeric, unique;
+    size_t run_bytes;
+    char *arena;
+    size_t arena_len, arena_cap;
+    SortLine *lines;
+    size_t count, lines_cap;
+    SortRun *runs;
+    size_t nruns;
+    int *heap;          // runs by their current line
+    size_t heap_len;
+    int state;          // 0 reading, 1 serving the arena, 2 merging, 3 done
+    size_t next;        // arena: next line to hand out
+    int cur;            // merge: run whose line is pending, or -1
+    char *last;         // merge with "u": the line handed out last
+    size_t last_len, last_cap;
+    int have_last;
+    Pending pend;
+} SortStage;
+
+// A number as sort -n reads it: blanks, then [-]digits[.digits]. Hex,
+// exponents, inf and nan are not numbers here; no number is 0.
+typedef struct {
+    int neg;
+    const char *ip, *fp;    // integer digits without leading zeros, and
+    size_t ilen, flen;      // fraction digits without trailing zeros
+} SortNum;
+
+static void sort_num(const char *p, size_t len, SortNum *n) {
+    size_t i = 0;
+    while (i < len && (p[i] == ' ' || p[i] == '\t')) i++;
+    n->neg = i < len && p[i] == '-';
+    if (n->neg) i++;
+    while (i < len && p[i] == '0') i++;
+    n->ip = p + i;
+    for (n->ilen = 0; i < len && p[i] >= '0' && p[i] <= '9'; i++) n->ilen++;
+    n->fp = p + i + 1;
+    n->flen = 0;
+    if (i < len && p[i] == '.')
+        for (i++; i < len && p[i] >= '0' && p[i] <= '9'; i++) n->flen++;
+    while (n->flen && n->fp[n->flen - 1] == '0') n->flen--;
+    if (!n->ilen && !n->flen) n->neg = 0;      // -0 is 0
+}
+
+// Digit by digit, so numbers of any length compare exactly
+static int num_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    SortNum x, y;
+    sort_num(a, alen, &x);
+    sort_num(b, blen, &y);
+    if (x.neg != y.neg) return x.neg ? -1 : 1;
+    int c = (x.ilen > y.ilen) - (x.ilen < y.ilen);
+    if (!c) c = memcmp(x.ip, y.ip, x.ilen);
+    if (!c) {
+        size_t k = x.flen < y.flen ? x.flen : y.flen;
+        c = memcmp(x.fp, y.fp, k);
+        // Trailing zeros are gone, so more digits is more
+        if (!c) c = (x.flen > y.flen) - (x.flen < y.flen);
+    }
+    c = c > 0 ? 1 : c < 0 ? -1 : 0;
+    return x.neg ? -c : c;
+}
+
+// With "n" lines compare by number, and equal numbers by their bytes
+// unless "u" is set: sort -nu keeps one line per number
+static int sort_cmp(const SortStage *st, const char *a, size_t alen,
+                    const char *b, size_t blen) {
+    int c = 0;
+    if (st->numeric) c = num_cmp(a, alen, b, blen);
+    if (!c && !(st->numeric && st->unique)) {
+        c = memcmp(a, b, alen < blen ? alen : blen);
+        if (!c) c = (alen > blen) - (alen < blen);
+    }
+    return st->reverse ? -c : c;
+}
+
+// Equal lines stay in input order, so "u" keeps the first one
+static int sort_line_cmp(const void *pa, const void *pb, void *arg) {
+    const SortStage *st = arg;
+    const SortLine *a = pa, *b = pb;
+    int c = sort_cmp(st, st->arena + a->off, a->len, st->arena + b->off, b->len);
+    return c ? c : (a->off > b->off) - (a->off < b->off);
+}
+
+// Whether arena line i repeats line i - 1
+static int sort_repeat(const SortStage *st, size_t i) {
+    if (i == 0) return 0;
+    const SortLine *a = &st->lines[i - 1], *b = &st->lines[i];
+    return sort_cmp(st, st->arena + a->off, a->len, st->arena + b->off, b->len) == 0;
+}
+
+static int sort_add(SortStage *st, const char *line, size_t len) {
+    if (st->arena_len + len + 1 > st->arena_cap) {
+        size_t cap = st->arena_cap ? st->arena_cap * 2 : PIPE_CHUNK * 16;
+        while (cap < st->arena_len + len + 1) cap *= 2;
+        char *a = realloc(st->arena, cap);
+        if (!a) return -1;
+        st->arena = a;
+        st->arena_cap = cap;
+    }
+    if (st->count == st->lines_cap) {
+        size_t cap = st->lines_cap ? st->lines_cap * 2 : 4096;
+        SortLine *l = realloc(st->lines, cap * sizeof(*l));
+        if (!l) return -1;
+        st->lines = l;
+        st->lines_cap = cap;
+    }
+    char *p = st->arena + st->arena_len;
+    memcpy(p, line, len);
+    p[len] = '\n';
+    SortLine *l = &st->lines[st->count++];
+    l->off = st->arena_len;
+    l->len = len;
+    st->arena_len += len + 1;
+    return 0;
+}
+
+static FILE *sort_tmpfile(void) {
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/jssh-sort-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) return NULL;
+    unlink(path);
+    FILE *f = fdopen(fd, "w+");
+    if (!f) close(fd);
+    return f;
+}
+
+// Sort the arena and write it out as a run
+static int sort_spill(SortStage *st) {
+    SortRun *runs = realloc(st->runs, (st->nruns + 1) * sizeof(*runs));
+    if (!runs) return -1;
+    st->runs = runs;
+    SortRun *r = &runs[st->nruns];
+    memset(r, 0, sizeof(*r));
+    if (!(r->f = sort_tmpfile())) return -1;
+    st->nruns++;
+
+    qsort_r(st->lines, st->count, sizeof(*st->lines), sort_line_cmp, st);
+    for (size_t i = 0; i < st->count; i++) {
+        const SortLine *l = &st->lines[i];
+        if (st->unique && sort_repeat(st, i)) continue;
+        if (fwrite(st->arena + l->off, 1, l->len + 1, r->f) != l->len + 1) return -1;
+    }
+    if (fflush(r->f) != 0) return -1;
+    st->arena_len = 0;
+    st->count = 0;
+    return 0;
+}
+
+// Runs were written in input order, so ties go to the earlier run
+static int run_cmp(const SortStage *st, int a, int b) {
+    const SortRun *ra = &st->runs[a], *rb = &st->runs[b];
+    int c = sort_cmp(st, ra->line, ra->len - 1, rb->line, rb->len - 1);
+    return c ? c : (a > b) - (a < b);
+}
+
+static void heap_down(SortStage *st, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, m = i;
+        if (l < st->heap_len && run_cmp(st, st->heap[l], st->heap[m]) < 0) m = l;
+        if (l + 1 < st->heap_len && run_cmp(st, st->heap[l + 1], st->heap[m]) < 0) m = l + 1;
+        if (m == i) return;
+        int t = st->heap[i];
+        st->heap[i] = st->heap[m];
+        st->heap[m] = t;
+        i = m;
+    }
+}
+
+// Next line of a run. Returns 1, 0 at its end, -1 on error.
+static int run_next(SortRun *r) {
+    errno = 0;
+    r->len = getline(&r->line, &r->cap, r->f);
+    if (r->len < 0) return errno ? -1 : 0;
+    return 1;
+}
+
+static int sort_finish_input(SortStage *st) {
+    pipe_line_free(&st->in);
+    if (st->nruns == 0) {
+        if (st->count)
+            qsort_r(st->lines, st->count, sizeof(*st->lines), sort_line_cmp, st);
+        st->state = 1;
+        return 0;
+    }
+    if (st->count && sort_spill(st) < 0) return -1;
+    free(st->arena);
+    free(st->lines);
+    st->arena = NULL;
+    st->lines = NULL;
+
+    if (!(st->heap = malloc(st->nruns * sizeof(*st->heap)))) return -1;
+    for (size_t i = 0; i < st->nruns; i++) {
+        SortRun *r = &st->runs[i];
+        rewind(r->f);
+        int rc = run_next(r);
+        if (rc < 0) return -1;
+        if (rc > 0) st->heap[st->heap_len++] = i;
+    }
+    for (size_t i = st->heap_len; i-- > 0; )
+        heap_down(st, i);
+    st->state = 2;
+    return 0;
+}
+
+static ssize_t sort_pull(PipeStage *s, char *out, size_t cap) {
+    SortStage *st = (SortStage *)s;
+    size_t n = 0;
+    if (st->state == 0) {
+        const char *line;
+        size_t len;
+        int nl, r;
+        while ((r = pipe_line(s->up, &st->in, &line, &len, &nl)) > 0) {
+            if (sort_add(st, line, len) < 0) return -1;
+            if (st->arena_len >= st->run_bytes && sort_spill(st) < 0) return -1;
+        }
+        if (r < 0 || sort_finish_input(st) < 0) return -1;
+    }
+    for (;;) {
+        n += pending_take(&st->pend, out + n, cap - n);
+        if (n == cap) return n;
+
+        if (st->state == 1) {
+            if (st->next == st->count) {
+                st->state = 3;
+                continue;
+            }
+            size_t i = st->next++;
+            if (st->unique && sort_repeat(st, i)) continue;
+            st->pend.p = st->arena + st->lines[i].off;
+            st->pend.n = st->lines[i].len + 1;
+        } else if (st->state == 2) {
+            if (st->cur >= 0) {
+                // The pending line is out: move its run on
+                int rc = run_next(&st->runs[st->cur]);
+                if (rc < 0) return n ? (ssize_t)n : -1;
+                if (rc == 0) st->heap[0] = st->heap[--st->heap_len];
+                heap_down(st, 0);
+                st->cur = -1;
+            }
+            if (st->heap_len == 0) {
+                st->state = 3;
+                continue;
+            }
+            SortRun *r = &st->runs[st->heap[0]];
+            st->cur = st->heap[0];
+            if (st->unique) {
+                if (st->have_last &&
+                    sort_cmp(st, st->last, st->last_len - 1, r->line, r->len - 1) == 0)
+                    continue;
+                if ((size_t)r->len > st->last_cap) {
+                    char *p = realloc(st->last, r->len);
+                    if (!p) return n ? (ssize_t)n : -1;
+                    st->last = p;
+                    st->last_cap = r->len;
+                }
+                memcpy(st->last, r->line, r->len);
+                st->last_len = r->len;
+                st->have_last = 1;
+            }
+            st->pend.p = r->line;
+            st->pend.n = r->len;
+        } else {
+            return n;
+        }
+    }
+}
+
+static void sort_free(PipeStage *s) {
+    SortStage *st = (SortStage *)s;
+    pipe_line_free(&st->in);
+    for (size_t i = 0; i < st->nruns; i++) {
+        fclose(st->runs[i].f);
+        free(st->runs[i].line);
+    }
+    free(st->runs);
+    free(st->heap);
+    free(st->arena);
+    free(st->lines);
+    free(st->last);
+    free(st);
+}
+
+PipeStage *pipe_sort(const char *flags, size_t run_bytes, char *err, size_t errsz) {
+    int reverse = 0, numeric = 0, unique = 0;
+    for (const char *f = flags ? flags : ""; *f; f++) {
+        if (*f == 'r') reverse = 1;
+        else if (*f == 'n') numeric = 1;
+        else if (*f == 'u') unique = 1;
+        else {
+            snprintf(err, errsz, "unknown flag '%c'", *f);
+            return NULL;
+        }
+    }
+    SortStage *st = calloc(1, sizeof(*st));
+    if (!st) return NULL;
+    st->base.pull = sort_pull;
+    st->base.free = sort_free;
+    st->base.filter = 1;
+    st->reverse = reverse;
+    st->numeric = numeric;
+    st->unique = unique;
+    st->run_bytes = run_bytes ? run_bytes : PIPE_CHUNK;
+    st->cur = -1;
+    return &st->base;
+}
+
+// uniq(flags)
+typedef struct {
+    PipeStage base;
+    LineIn in;
+    int counts, dups_only;
+    char *prev;         // the line being repeated
+    size_t prev_len, prev_cap;
+    long seen;          // times in a row prev was seen, 0 before any line
+    char *obuf;
+    size_t obuf_cap;
+    Pending pend;
+    int done;
+} UniqStage;
+
+// Queue prev for output. Returns 0, or -1 when out of memory.
+static int uniq_emit(UniqStage *u) {
+    if (u->seen == 0 || (u->dups_only && u->seen < 2)) return 0;
+    if (u->prev_len + 32 > u->obuf_cap) {
+        size_t cap = u->prev_len + 32;
+        char *p = realloc(u->obuf, cap);
+        if (!p) return -1;
+        u->obuf = p;
+        u->obuf_cap = cap;
+    }
+    int k = u->counts ? snprintf(u->obuf, 32, "%7ld ", u->seen) : 0;
+    if (u->prev_len) memcpy(u->obuf + k, u->prev, u->prev_len);
+    u->obuf[k + u->prev_len] = '\n';
+    u->pend.p = u->obuf;
+    u->pend.n = k + u->prev_len + 1;
+    return 0;
+}
+
+static ssize_t uniq_pull(PipeStage *s, char *out, size_t cap) {
+    UniqStage *u = (UniqStage *)s;
+    size_t n = 0;
+    for (;;) {
+        n += pending_take(&u->pend, out + n, cap - n);
+        if (n == cap || u->done) return n;
+
+        const char *line;
+        size_t len;
+        int nl;
+        int r = pipe_line(s->up, &u->in, &line, &len, &nl);
+        if (r < 0) return n ? (ssize_t)n : -1;
+        if (r == 0) {
+            u->done = 1;
+            if (uniq_emit(u) < 0) return n ? (ssize_t)n : -1;
+            continue;
+        }
+        if (u->seen && len == u->prev_len && (len == 0 || memcmp(line, u->prev, len) == 0)) {
+            u->seen++;
+            continue;
+        }
+        if (uniq_emit(u) < 0) return n ? (ssize_t)n : -1;
+        if (len > u->prev_cap) {
+            char *p = realloc(u->prev, len);
+            if (!p) return n ? (ssize_t)n : -1;
+            u->prev = p;
+            u->prev_cap = len;
+        }
+        if (len) memcpy(u->prev, line, len);
+        u->prev_len = len;
+        u->seen = 1;
+    }
+}
+
+static void uniq_free(PipeStage *s) {
+    UniqStage *u = (UniqStage *)s;
+    pipe_line_free(&u->in);
+    free(u->prev);
+    free(u->obuf);
+    free(u);
+}
+
+PipeStage *pipe_uniq(const char *flags, char *err, size_t errsz) {
+    int counts = 0, dups_only = 0;
+    for (const char *f = flags ? flags : ""; *f; f++) {
+        if (*f == 'c') counts = 1;
+        else if (*f == 'd') dups_only = 1;
+        else {
+            snprintf(err, errsz, "unknown flag '%c'", *f);
+            return NULL;
+        }
+    }
+    UniqStage *u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->base.pull = uniq_pull;
+    u->base.free = uniq_free;
+    u->base.filter = 1;
+    u->counts = counts;
+    u->dups_only = dups_only;
+    return &u->base;
+}
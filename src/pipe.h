@@ -0,0 +1,77 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Bytes moved between stages per pull
+#define PIPE_CHUNK (64 * 1024)
+
+// A pipeline stage. The consumer pulls chunks from the last stage, and
+// each stage pulls from its upstream only when it needs more input, so
+// at most one chunk per stage is in flight and a stage that is done
+// (head) ends the reads above it.
+typedef struct PipeStage PipeStage;
+struct PipeStage {
+    // Fill up to `cap` bytes of buf. Returns the count, 0 at the end of
+    // the stream, or -1 with errno set.
+    ssize_t (*pull)(PipeStage *s, char *buf, size_t cap);
+    void (*free)(PipeStage *s);
+    // A file source with one file left that nothing has been pulled from
+    // yet: its fd, which the consumer may read directly (tail seeks from
+    // the end). Else -1.
+    int (*file)(PipeStage *s);
+    PipeStage *up;      // NULL for a source
+    int filter;         // takes input: only valid after a source in pipe()
+    int piped;          // feeds another stage, so no terminal colors
+};
+
+// Free a stage and everything upstream of it
+void pipe_free(PipeStage *s);
+
+// Buffered input from an upstream stage, for filters. One byte after
+// buf[len] is always spare, so the last line can be NUL terminated.
+typedef struct {
+    char *buf;
+    size_t len, pos, cap;
+    int eof;
+} LineIn;
+
+// Read more of up behind the unread part of in. Returns the bytes added,
+// 0 at the end (in->eof is set), or -1.
+ssize_t pipe_fill(PipeStage *up, LineIn *in);
+
+// Next line without its '\n' (line[len] is the '\n' when *nl is set).
+// Valid until the next call. Returns 1, 0 at the end, -1 on error.
+int pipe_line(PipeStage *up, LineIn *in, const char **line, size_t *len, int *nl);
+void pipe_line_free(LineIn *in);
+
+// Sources. Both take ownership of the data / fds; the fds of a file
+// source are read one after another.
+PipeStage *pipe_buffer_source(char *data, size_t len);
+PipeStage *pipe_file_source(const int *fds, int nfds);
+
+// Write everything s produces to fd. Whole regular files at the front of
+// a file source are copied by the kernel without passing through the
+// pipeline. *ends_nl is cleared when the output ends without a '\n'.
+// Returns 0, or -1 with errno set.
+int pipe_drain(PipeStage *s, int fd, int *ends_nl);
+
+// Filters. Constructors that take flags return NULL with a message in
+// err for bad ones.
+
+// Lines containing pattern. flags: "i" ignore case, "v" invert,
+// "E" pattern is a POSIX extended regex.
+PipeStage *pipe_grep(const char *pattern, size_t plen, const char *flags, char *err, size_t errsz);
+// The first / last n lines
+PipeStage *pipe_head(long n);
+PipeStage *pipe_tail(long n);
+// Counts: "l" lines, "w" words, "c" bytes; all three by default
+PipeStage *pipe_wc(const char *flags, char *err, size_t errsz);
+// Sorted lines, byte order. flags: "r" reverse, "n" numeric, "u" drop
+// repeats. Input past run_bytes is sorted in runs on disk and merged.
+PipeStage *pipe_sort(const char *flags, size_t run_bytes, char *err, size_t errsz);
+// Adjacent repeats dropped. flags: "c" prefix counts, "d" only repeated
+PipeStage *pipe_uniq(const char *flags, char *err, size_t errsz);
+
+#endif
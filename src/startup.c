@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils.h"
+#include "startup.h"
+
+#define STARTUP_PHASES 512
+#define STARTUP_DEPTH  16
+
+typedef struct {
+    char name[128];
+    long long start_ns;
+    long long total_ns;
+    long long child_ns;  // time of the phases nested directly inside
+    int depth;
+} StartupPhase;
+
+int startup_profiling = 0;
+
+static StartupPhase phases[STARTUP_PHASES];
+static int phase_count;
+static int open_stack[STARTUP_DEPTH];
+static int open_depth;
+static long long t_origin;
+
+static long long clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void startup_profile_enable(void) {
+    startup_profiling = 1;
+    phase_count = open_depth = 0;
+    t_origin = clock_ns();
+}
+
+void startup_begin(const char *fmt, ...) {
+    if (!startup_profiling) return;
+    // Past the limits the phase is skipped; startup_end must still pair up
+    if (open_depth == STARTUP_DEPTH || phase_count == STARTUP_PHASES) {
+        if (open_depth < STARTUP_DEPTH) open_stack[open_depth] = -1;
+        open_depth++;
+        return;
+    }
+    StartupPhase *p = &phases[phase_count];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(p->name, sizeof(p->name), fmt, ap);
+    va_end(ap);
+    p->depth = open_depth;
+    p->total_ns = p->child_ns = 0;
+    open_stack[open_depth++] = phase_count++;
+    p->start_ns = clock_ns();
+}
+
+void startup_end(void) {
+    if (!startup_profiling || open_depth == 0) return;
+    long long now = clock_ns();
+    int depth = --open_depth;
+    int idx = depth < STARTUP_DEPTH ? open_stack[depth] : -1;
+    if (idx < 0) return;
+    phases[idx].total_ns = now - phases[idx].start_ns;
+    for (int d = depth - 1; d >= 0; d--) {
+        if (d < STARTUP_DEPTH && open_stack[d] >= 0) {
+            phases[open_stack[d]].child_ns += phases[idx].total_ns;
+            break;
+        }
+    }
+}
+
+static int cmp_self_desc(const void *a, const void *b) {
+    const StartupPhase *pa = *(const StartupPhase *const *)a;
+    const StartupPhase *pb = *(const StartupPhase *const *)b;
+    long long sa = pa->total_ns - pa->child_ns, sb = pb->total_ns - pb->child_ns;
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+void startup_report(const char *trace_path) {
+    if (!startup_profiling) return;
+    long long total = clock_ns() - t_origin;
+    startup_profiling = 0;
+
+    StartupPhase *sorted[STARTUP_PHASES];
+    for (int i = 0; i < phase_count; i++) sorted[i] = &phases[i];
+    qsort(sorted, phase_count, sizeof(sorted[0]), cmp_self_desc);
+
+    printR("{cyan}Startup: %.3f ms{reset}\n", total / 1e6);
+    printf("%10s %10s %6s  %s\n", "self ms", "total ms", "self%", "phase");
+    for (int i = 0; i < phase_count; i++) {
+        const StartupPhase *p = sorted[i];
+        long long self = p->total_ns - p->child_ns;
+        printf("%10.3f %10.3f %5.1f%%  %s\n", self / 1e6, p->total_ns / 1e6,
+               total > 0 ? 100.0 * self / total : 0.0, p->name);
+    }
+
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+        printR("{red}Cannot write %s{reset}\n", trace_path);
+        return;
+    }
+    // Complete ("X") events in microseconds, in start order
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (int i = 0; i < phase_count; i++) {
+        const StartupPhase *p = &phases[i];
+        fprintf(f, "  {\"name\":");
+        json_string(f, p->name);
+        fprintf(f, ",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":%d,\"tid\":1}%s\n",
+                (p->start_ns - t_origin) / 1e3, p->total_ns / 1e3, (int)getpid(),
+                i + 1 < phase_count ? "," : "");
+    }
+    fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+    if (fclose(f) == 0)
+        printR("{green}Trace written to %s{reset}\n", trace_path);
+}
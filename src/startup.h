@@ -0,0 +1,17 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+// Startup profiler behind `jssh --profile-startup`. Phases nest: a
+// startup_begin inside another phase is charged to it as well, and the
+// table shows both total and self time.
+extern int startup_profiling;
+
+void startup_profile_enable(void);
+void startup_begin(const char *fmt, ...);
+void startup_end(void);
+
+// Print the phases sorted by self time and write them to `trace_path`
+// as Chrome trace JSON (chrome://tracing, Perfetto). Stops profiling.
+void startup_report(const char *trace_path);
+
+#endif
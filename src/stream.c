@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "env.h"
+#include "stream.h"
+#include "utils.h"
+
+// Default sort() run size in MB, before it spills to disk (env sort_mem)
+#define SORT_MEM_DEFAULT 256
+
+static JSClassID js_stream_class_id;
+
+static PipeStage *stream_take(JSContext *ctx, JSValueConst obj) {
+    PipeStage *s = JS_GetOpaque(obj, js_stream_class_id);
+    if (s) JS_SetOpaque(obj, NULL);
+    return s;
+}
+
+// Write to the terminal, ending on a newline so the prompt starts clean
+static int stream_print(PipeStage *s) {
+    int ends_nl = 1;
+    fflush(stdout);
+    int rc = pipe_drain(s, STDOUT_FILENO, &ends_nl);
+    int saved = errno;
+    if (!ends_nl) {
+        ssize_t w = write(STDOUT_FILENO, "\n", 1);
+        (void)w;
+    }
+    errno = saved;
+    return rc;
+}
+
+static void js_stream_finalizer(JSRuntime *rt, JSValue val) {
+    // Never piped or printed: write it out, as the builtin used to. A
+    // filter that was never given input has nothing to print.
+    PipeStage *s = JS_GetOpaque(val, js_stream_class_id);
+    if (!s) return;
+    if (!(s->filter && !s->up)) stream_print(s);
+    pipe_free(s);
+}
+
+static JSClassDef js_stream_class = {
+    .class_name = "Stream",
+    .finalizer = js_stream_finalizer,
+};
+
+JSValue js_new_stream(JSContext *ctx, PipeStage *s) {
+    if (!s) return JS_ThrowOutOfMemory(ctx);
+    JSValue obj = JS_NewObjectClass(ctx, js_stream_class_id);
+    if (JS_IsException(obj)) {
+        pipe_free(s);
+        return obj;
+    }
+    JS_SetOpaque(obj, s);
+    return obj;
+}
+
+// stream.toString(): print it (this is what the REPL calls)
+static JSValue js_stream_to_string(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    PipeStage *s = stream_take(ctx, this_val);
+    if (!s) return JS_NewString(ctx, JS_SUPPRESS);
+    if (s->filter && !s->up) {
+        pipe_free(s);
+        return JS_ThrowTypeError(ctx, "filter has no input: use pipe(source, filter)");
+    }
+    int rc = stream_print(s);
+    int err = errno;
+    pipe_free(s);
+    if (rc != 0 && err != EPIPE)
+        return JS_ThrowInternalError(ctx, "stream: %s", strerror(err));
+    return JS_NewString(ctx, JS_SUPPRESS);
+}
+
+// stream.text(): the whole output as a string
+static JSValue js_stream_text(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    PipeStage *s = stream_take(ctx, this_val);
+    if (!s) return JS_ThrowTypeError(ctx, "stream already consumed");
+    if (s->filter && !s->up) {
+        pipe_free(s);
+        return JS_ThrowTypeError(ctx, "filter has no input: use pipe(source, filter)");
+    }
+    char *data = NULL;
+    size_t len = 0, cap = 0;
+    ssize_t n = 0;
+    for (;;) {
+        if (cap - len < PIPE_CHUNK) {
+            cap = cap ? cap * 2 : PIPE_CHUNK;
+            char *d = realloc(data, cap);
+            if (!d) break;
+            data = d;
+        }
+        n = s->pull(s, data + len, cap - len);
+        if (n <= 0) break;
+        len += n;
+    }
+    int err = errno;
+    pipe_free(s);
+    if (n < 0 || !data) {
+        free(data);
+        return JS_ThrowInternalError(ctx, "stream: %s", strerror(n < 0 ? err : ENOMEM));
+    }
+    JSValue str = JS_NewStringLen(ctx, data, len);
+    free(data);
+    return str;
+}
+
+// pipe(source, filter, ...)
+static JSValue js_pipe(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    if (argc < 1)
+        return JS_ThrowTypeError(ctx, "pipe(source, filter, ...)");
+    for (int i = 0; i < argc; i++) {
+        PipeStage *s = JS_GetOpaque(argv[i], js_stream_class_id);
+        if (!s)
+            return JS_ThrowTypeError(ctx, "pipe: argument %d is not a stream", i + 1);
+        if (i == 0 && s->filter && !s->up)
+            return JS_ThrowTypeError(ctx, "pipe: the first stage must be a source like cat()");
+        if (i > 0 && !(s->filter && !s->up))
+            return JS_ThrowTypeError(ctx, "pipe: argument %d is not a filter like grep()", i + 1);
+        // Each stage can only be taken once
+        for (int j = 0; j < i; j++)
+            if (JS_GetOpaque(argv[j], js_stream_class_id) == s)
+                return JS_ThrowTypeError(ctx, "pipe: argument %d is used twice", i + 1);
+    }
+
+    PipeStage *tail = stream_take(ctx, argv[0]);
+    for (int i = 1; i < argc; i++) {
+        PipeStage *s = stream_take(ctx, argv[i]);
+        tail->piped = 1;
+        s->up = tail;
+        tail = s;
+    }
+    return js_new_stream(ctx, tail);
+}
+
+// Optional flags argument, NULL when it is not given. Returns -1 with an
+// exception pending if it cannot be read.
+static int flags_arg(JSContext *ctx, int argc, JSValueConst *argv, int i, const char **flags) {
+    *flags = NULL;
+    if (i >= argc || JS_IsUndefined(argv[i])) return 0;
+    *flags = JS_ToCString(ctx, argv[i]);
+    return *flags ? 0 : -1;
+}
+
+static JSValue filter_result(JSContext *ctx, PipeStage *s, const char *name, const char *err) {
+    if (!s)
+        return err[0] ? JS_ThrowTypeError(ctx, "%s: %s", name, err) : JS_ThrowOutOfMemory(ctx);
+    return js_new_stream(ctx, s);
+}
+
+// grep(pattern, flags)
+static JSValue js_grep(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
+    if (argc < 1)
+        return JS_ThrowTypeError(ctx, "grep(pattern, flags)");
+    size_t plen;
+    const char *pattern = JS_ToCStringLen(ctx, &plen, argv[0]);
+    if (!pattern) return JS_EXCEPTION;
+    const char *flags;
+    if (flags_arg(ctx, argc, argv, 1, &flags) < 0) {
+        JS_FreeCString(ctx, pattern);
+        return JS_EXCEPTION;
+    }
+    char err[128] = "";
+    PipeStage *s = pipe_grep(pattern, plen, flags, err, sizeof(err));
+    JS_FreeCString(ctx, pattern);
+    if (flags) JS_FreeCString(ctx, flags);
+    return filter_result(ctx, s, "grep", err);
+}
+
+// head(n), tail(n)
+static JSValue js_head_tail(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic) {
+    int64_t n = 10;
+    if (argc > 0 && JS_ToInt64(ctx, &n, argv[0]) != 0) return JS_EXCEPTION;
+    PipeStage *s = magic ? pipe_tail(n) : pipe_head(n);
+    return filter_result(ctx, s, magic ? "tail" : "head", "");
+}
+
+// wc(flags), sort(flags), uniq(flags)
+static JSValue js_flag_filter(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic) {
+    const char *flags;
+    if (flags_arg(ctx, argc, argv, 0, &flags) < 0) return JS_EXCEPTION;
+    char err[128] = "";
+    PipeStage *s;
+    const char *name;
+    if (magic == 0) {
+        name = "wc";
+        s = pipe_wc(flags, err, sizeof(err));
+    } else if (magic == 1) {
+        name = "sort";
+        const char *v = env_get("sort_mem", NULL);
+        long mb = v ? strtol(v, NULL, 10) : 0;
+        if (mb <= 0) mb = SORT_MEM_DEFAULT;
+        s = pipe_sort(flags, (size_t)mb << 20, err, sizeof(err));
+    } else {
+        name = "uniq";
+        s = pipe_uniq(flags, err, sizeof(err));
+    }
+    if (flags) JS_FreeCString(ctx, flags);
+    return filter_result(ctx, s, name, err);
+}
+
+void js_init_stream(JSContext *ctx) {
+    JS_NewClassID(&js_stream_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_stream_class_id, &js_stream_class);
+
+    JSValue proto = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, proto, "toString", JS_NewCFunction(ctx, js_stream_to_string, "toString", 0));
+    JS_SetPropertyStr(ctx, proto, "text", JS_NewCFunction(ctx, js_stream_text, "text", 0));
+    JS_SetClassProto(ctx, js_stream_class_id, proto);
+
+    JSValue global_obj = JS_GetGlobalObject(ctx);
+    JS_SetPropertyStr(ctx, global_obj, "pipe", JS_NewCFunction(ctx, js_pipe, "pipe", 1));
+    JS_SetPropertyStr(ctx, global_obj, "grep", JS_NewCFunction(ctx, js_grep, "grep", 2));
+    JS_SetPropertyStr(ctx, global_obj, "head", JS_NewCFunctionMagic(ctx, js_head_tail, "head", 1, JS_CFUNC_generic_magic, 0));
+    JS_SetPropertyStr(ctx, global_obj, "tail", JS_NewCFunctionMagic(ctx, js_head_tail, "tail", 1, JS_CFUNC_generic_magic, 1));
+    JS_SetPropertyStr(ctx, global_obj, "wc", JS_NewCFunctionMagic(ctx, js_flag_filter, "wc", 1, JS_CFUNC_generic_magic, 0));
+    JS_SetPropertyStr(ctx, global_obj, "sort", JS_NewCFunctionMagic(ctx, js_flag_filter, "sort", 1, JS_CFUNC_generic_magic, 1));
+    JS_SetPropertyStr(ctx, global_obj, "uniq", JS_NewCFunctionMagic(ctx, js_flag_filter, "uniq", 1, JS_CFUNC_generic_magic, 2));
+    JS_FreeValue(ctx, global_obj);
+}
@@ -0,0 +1,13 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "pipe.h"
+#include "quickjs.h"
+
+// Wrap a stage in a JS Stream object, which owns it from then on
+JSValue js_new_stream(JSContext *ctx, PipeStage *s);
+
+// Register Stream, pipe() and the filter builtins
+void js_init_stream(JSContext *ctx);
+
+#endif
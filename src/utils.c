@@ -16,7 +16,9 @@
 #include <readline/readline.h>
 #include "sys.h"
 #include "env.h"
+#include "hist.h"
 #include "utils.h"
+#include "startup.h"
 
 static int g_color_mode = 8; // 8, 256, or 16777216 (truecolor)
 int js_lib_count = 0; // Pure JS libs counter
@@ -64,7 +66,7 @@ static const char *ansi8(const char *name) {
 }
 
 // Render either named colors or {rgb:r,g,b}
-static void render_colors(const char *input) {
+static void render_colors(FILE *out, const char *input) {
     const char *p = input;
     while (*p) {
         if (*p == '{') {
@@ -81,15 +83,15 @@ static void render_colors(const char *input) {
                         int r, g, b;
                         if (sscanf(tag + 4, "%d,%d,%d", &r, &g, &b) == 3) {
                             if (g_color_mode == 16777216) {
-                                printf("\033[38;2;%d;%d;%dm", r, g, b);
+                                fprintf(out, "\033[38;2;%d;%d;%dm", r, g, b);
                             } else if (g_color_mode == 256) {
                                 // Approximate 256-color cube
                                 int R = r / 51, G = g / 51, B = b / 51;
                                 int idx = 16 + 36 * R + 6 * G + B;
-                                printf("\033[38;5;%dm", idx);
+                                fprintf(out, "\033[38;5;%dm", idx);
                             } else {
                                 // crude 8-color fallback
-                                fputs("\033[37m", stdout); // white
+                                fputs("\033[37m", out); // white
                             }
                             p = end + 1;
                             continue;
@@ -98,7 +100,7 @@ static void render_colors(const char *input) {
                         // Named colors
                         const char *code = ansi8(tag);
                         if (code) {
-                            fputs(code, stdout);
+                            fputs(code, out);
                             p = end + 1;
                             continue;
                         }
@@ -106,10 +108,10 @@ static void render_colors(const char *input) {
                 }
             }
         }
-        fputc(*p, stdout);
+        fputc(*p, out);
         p++;
     }
-    fputs("\033[0m", stdout); // reset at the end
+    fputs("\033[0m", out); // reset at the end
 }
 
 void printR(const char *fmt, ...) {
@@ -119,10 +121,24 @@ void printR(const char *fmt, ...) {
     vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
 
-    render_colors(buf);
+    render_colors(stdout, buf);
+}
+
+void fprintR(FILE *out, const char *fmt, ...) {
+    char buf[4096];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    render_colors(out, buf);
 }
 
 void print_name(const char *name, mode_t mode) {
+    fprint_name(stdout, name, mode);
+}
+
+void fprint_name(FILE *out, const char *name, mode_t mode) {
     const char *color = NULL;
 
     if (S_ISDIR(mode))       color = env_get("color_dir", "{blue}");
@@ -134,7 +150,7 @@ void print_name(const char *name, mode_t mode) {
     else if (mode & S_IXUSR) color = env_get("color_exe", "{green}");
     else                     color = env_get("color_reg", "{white}");
 
-    printR("%s%s{reset}", color, name);
+    fprintR(out, "%s%s{reset}", color, name);
 }
 
 int get_terminal_dimensions(int *width, int *height) {
@@ -162,24 +178,15 @@ int visual_width(const char *str) {
                 if (*str) str++;
             }
         } else {
-            width++;
+            // \001 \002 bracket invisible prompt text for readline
+            if (*str != '\001' && *str != '\002' && ((unsigned char)*str & 0xC0) != 0x80)
+                width++;
             str++;
         }
     }
     return width;
 }
 
-char* rl_line_buffer_slice(int start, int end) {
-    int len = end - start;
-    if (len < 0) len = 0;
-    char *slice = malloc(len + 1);
-    if (slice) {
-        strncpy(slice, rl_line_buffer + start, len);
-        slice[len] = '\0';
-    }
-    return slice;
-}
-
 // Run make via fork+execvp; returns 0 on success, -1 on failure.
 static int run_make(char **make_argv) {
     pid_t pid = fork();
@@ -202,8 +209,6 @@ static int run_make(char **make_argv) {
 
 // update
 JSValue js_update(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-    write_history(history_file);
-
     if (argc == 0) {
         // No user input — safe literal command
         char *clean_argv[] = { "make", "clean", NULL };
@@ -285,6 +290,165 @@ JSValue js_show_env(JSContext *ctx, JSValueConst this_val, int argc, JSValueCons
 }
 
 // import JS command files
+
+// Compiled lib/js scripts are cached as QuickJS bytecode under
+// ~/.cache/jssh (or $XDG_CACHE_HOME/jssh), one file per script. A cache
+// file is used only if the script's path, mtime and size and the jssh
+// build all match what it was written for; anything else recompiles it.
+// Set JSSH_NO_JS_CACHE=1 to always compile from source.
+#define JS_CACHE_MAGIC "JSSHBC1"
+#ifndef CONFIG_VERSION
+#define CONFIG_VERSION "unknown"
+#endif
+#ifndef JSSH_VERSION
+#define JSSH_VERSION "unknown"
+#endif
+// CONFIG_VERSION is fixed in the Makefile, so the build time tells apart
+// binaries whose QuickJS bytecode format may differ
+#define JS_CACHE_BUILD JSSH_VERSION " " CONFIG_VERSION " " __DATE__ " " __TIME__
+
+typedef struct {
+    char magic[8];
+    long long mtime_ns;
+    long long size;
+    unsigned int path_len;       // followed by the path,
+    unsigned int build_len;      // JS_CACHE_BUILD
+    unsigned long long bc_len;   // and the bytecode
+} JsCacheHeader;
+
+static unsigned long long fnv1a(const char *s) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int jssh_cache_file(const char *name, char *out, size_t outsz) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int n;
+    if (xdg && *xdg) n = snprintf(out, outsz, "%s/jssh/%s", xdg, name);
+    else if (home) n = snprintf(out, outsz, "%s/.cache/jssh/%s", home, name);
+    else return -1;
+    return n < (int)outsz ? 0 : -1;
+}
+
+// <cache dir>/<FNV-1a of abs><ext>
+static int js_cache_path(const char *abs, const char *ext, char *out, size_t outsz) {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx%s", fnv1a(abs), ext);
+    return jssh_cache_file(name, out, outsz);
+}
+
+int jssh_cache_mkdirs(const char *file) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", file);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return 0;
+}
+
+// JSSH_NO_JS_CACHE set to anything but 0
+static int js_cache_disabled(void) {
+    const char *v = getenv("JSSH_NO_JS_CACHE");
+    return v && *v && strcmp(v, "0") != 0;
+}
+
+static void js_report_error(JSContext *ctx, const char *path) {
+    printR("{red}JS error in %s{reset}\n", path);
+    JSValue exc = JS_GetException(ctx);
+    const char *msg = JS_ToCString(ctx, exc);
+    if (msg) {
+        printR("{yellow}%s{reset}\n", msg);
+        JS_FreeCString(ctx, msg);
+    }
+    JS_FreeValue(ctx, exc);
+}
+
+// Read the cached bytecode for a script, or JS_UNDEFINED if there is no
+// valid cache entry
+static JSValue js_cache_load(JSContext *ctx, const char *cache, const char *abs,
+                             const struct stat *st) {
+    FILE *f = fopen(cache, "rb");
+    if (!f) return JS_UNDEFINED;
+
+    JsCacheHeader hdr;
+    size_t path_len = strlen(abs), build_len = strlen(JS_CACHE_BUILD);
+    char key[PATH_MAX + 64];
+    JSValue obj = JS_UNDEFINED;
+    uint8_t *bc = NULL;
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, JS_CACHE_MAGIC, sizeof(JS_CACHE_MAGIC)) != 0 ||
+        hdr.mtime_ns != (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec ||
+        hdr.size != (long long)st->st_size ||
+        hdr.path_len != path_len || hdr.build_len != build_len ||
+        path_len + build_len > sizeof(key) ||
+        fread(key, 1, path_len + build_len, f) != path_len + build_len ||
+        memcmp(key, abs, path_len) != 0 ||
+        memcmp(key + path_len, JS_CACHE_BUILD, build_len) != 0)
+        goto done;
+
+    bc = malloc(hdr.bc_len ? hdr.bc_len : 1);
+    if (!bc || fread(bc, 1, hdr.bc_len, f) != hdr.bc_len) goto done;
+
+    obj = JS_ReadObject(ctx, bc, hdr.bc_len, JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(obj)) {
+        // Written by an incompatible build: drop it and recompile
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        obj = JS_UNDEFINED;
+    }
+done:
+    free(bc);
+    fclose(f);
+    return obj;
+}
+
+// Save a compiled script. Written to a temp file and renamed, so a crash
+// or a second jssh never leaves half an entry behind.
+static void js_cache_store(JSContext *ctx, const char *cache, const char *abs,
+                           const struct stat *st, JSValueConst obj) {
+    size_t bc_len;
+    uint8_t *bc = JS_WriteObject(ctx, &bc_len, obj, JS_WRITE_OBJ_BYTECODE);
+    if (!bc) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return;
+    }
+
+    if (jssh_cache_mkdirs(cache) != 0) {
+        js_free(ctx, bc);
+        return;
+    }
+
+    JsCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, JS_CACHE_MAGIC, sizeof(JS_CACHE_MAGIC));
+    hdr.mtime_ns = (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    hdr.size = (long long)st->st_size;
+    hdr.path_len = (unsigned int)strlen(abs);
+    hdr.build_len = (unsigned int)strlen(JS_CACHE_BUILD);
+    hdr.bc_len = bc_len;
+
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid());
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+                 fwrite(abs, 1, hdr.path_len, f) == hdr.path_len &&
+                 fwrite(JS_CACHE_BUILD, 1, hdr.build_len, f) == hdr.build_len &&
+                 fwrite(bc, 1, bc_len, f) == bc_len;
+        if (fclose(f) != 0 || !ok || rename(tmp, cache) != 0)
+            unlink(tmp);
+    }
+    js_free(ctx, bc);
+}
+
 void load_js_file(JSContext *ctx, const char *path) {
     FILE *f = fopen(path, "rb");
     if (!f) {
@@ -299,39 +463,334 @@ void load_js_file(JSContext *ctx, const char *path) {
         return;
     }
 
-    char *buf = malloc(st.st_size + 1);
-    if (!buf) {
-        printR("{red}Out of memory while loading %s{reset}\n", path);
-        fclose(f);
+    // Cached bytecode skips reading and parsing the source
+    char abs[PATH_MAX], cache[PATH_MAX];
+    int use_cache = !js_cache_disabled() && realpath(path, abs) && js_cache_path(abs, ".jsbc", cache, sizeof(cache)) == 0;
+    JSValue obj = use_cache ? js_cache_load(ctx, cache, abs, &st) : JS_UNDEFINED;
+
+    if (JS_IsUndefined(obj)) {
+        char *buf = malloc(st.st_size + 1);
+        if (!buf) {
+            printR("{red}Out of memory while loading %s{reset}\n", path);
+            fclose(f);
+            return;
+        }
+
+        size_t nread = fread(buf, 1, st.st_size, f);
+        if (nread != (size_t)st.st_size) {
+            printR("{red}Short read while loading %s{reset}\n", path);
+            free(buf);
+            fclose(f);
+            return;
+        }
+        buf[st.st_size] = '\0';
+
+        obj = JS_Eval(ctx, buf, st.st_size, path,
+                      JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+        free(buf);
+        if (JS_IsException(obj)) {
+            js_report_error(ctx, path);
+            fclose(f);
+            return;
+        }
+        if (use_cache)
+            js_cache_store(ctx, cache, abs, &st, obj);
+    }
+    fclose(f);
+
+    JSValue val = JS_EvalFunction(ctx, obj);
+    if (JS_IsException(val)) {
+        js_report_error(ctx, path);
         return;
     }
 
-    size_t nread = fread(buf, 1, st.st_size, f);
+    JS_FreeValue(ctx, val);
+}
+
+// Lazy lib/js loading. A script whose top level is only declarations gets
+// a stub per global it declares at startup; the first access to any of them
+// runs the whole script. Any other script runs at startup. The names are
+// found by scanning the source, and kept in a manifest in the cache dir so
+// unchanged scripts are not read again.
+
+#define JS_LIBS_MAGIC "jssh-libs 2\n"
+
+static int js_ident_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$';
+}
+
+static size_t js_ident_len(const char *s, size_t n) {
+    size_t i = 0;
+    if (n == 0 || !js_ident_start(s[0])) return 0;
+    while (i < n && (js_ident_start(s[i]) || (s[i] >= '0' && s[i] <= '9'))) i++;
+    return i;
+}
+
+// Append `len` bytes of a name to the space separated list in out
+static int js_add_name(char *out, size_t outsz, size_t *used, const char *name, size_t len) {
+    if (*used + len + 2 > outsz) return -1;
+    if (*used) out[(*used)++] = ' ';
+    memcpy(out + *used, name, len);
+    *used += len;
+    out[*used] = '\0';
+    return 0;
+}
+
+// Words after which a '/' starts a regex literal rather than dividing
+static int js_regex_keyword(const char *w, size_t n) {
+    static const char *const kw[] = { "return", "typeof", "instanceof", "in", "of", "new",
+                                      "delete", "void", "throw", "case", "do", "else",
+                                      "yield", "await" };
+    for (size_t k = 0; k < sizeof(kw) / sizeof(kw[0]); k++)
+        if (strlen(kw[k]) == n && memcmp(kw[k], w, n) == 0) return 1;
+    return 0;
+}
+
+// Collect the globals a script declares with function, async function,
+// class, const, let and var at the top level. Strings, template literals,
+// regex literals and comments are skipped so their contents never match.
+// Returns the number of names, or -1 if the top level holds anything but
+// such declarations, the source cannot be followed, or the names do not
+// fit in out: the script then has to run at startup.
+static int js_scan_globals(const char *src, size_t len, char *out, size_t outsz) {
+    char stack[64];              // open brackets; '`' for a template literal
+    int sp = 0, count = 0;
+    int decl = 0;                // top-level statement: 1 const/let/var, 2 function/class
+    int want_name = 0;           // a ',' in a const/let/var: a name follows
+    int cont = 0;                // the last top-level token continues the statement
+    int expr_end = 0;            // the last token ends an operand, so '/' divides
+    size_t used = 0, i = 0;
+    out[0] = '\0';
+
+    while (i < len) {
+        char c = src[i];
+        if (sp > 0 && stack[sp - 1] == '`') {
+            if (c == '\\') i += 2;
+            else if (c == '`') {
+                if (--sp == 0) cont = 0;
+                i++;
+                expr_end = 1;
+            } else if (c == '$' && i + 1 < len && src[i + 1] == '{') {
+                if (sp == (int)sizeof(stack)) return -1;
+                stack[sp++] = '{';
+                i += 2;
+                expr_end = 0;
+            } else i++;
+            continue;
+        }
+        if (c == '\n') {
+            // Without an operator at the end of the line, a const/let/var ends here
+            if (sp == 0 && decl == 1 && !cont) decl = 0;
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r') { i++; continue; }
+        if (c == '/' && i + 1 < len && src[i + 1] == '/') {
+            while (i < len && src[i] != '\n') i++;
+            continue;
+        }
+        if (c == '/' && i + 1 < len && src[i + 1] == '*') {
+            for (i += 2; i + 1 < len && !(src[i] == '*' && src[i + 1] == '/'); i++) ;
+            if (i + 1 >= len) return -1;
+            i += 2;
+            continue;
+        }
+        size_t n = js_ident_len(src + i, len - i);
+        // Only a declaration may start a top-level statement
+        if (n == 0 && sp == 0 && !decl && c != ';') return -1;
+        if (c == '\'' || c == '"') {
+            for (i++; i < len && src[i] != c && src[i] != '\n'; i++)
+                if (src[i] == '\\') i++;
+            if (i >= len || src[i] != c) return -1;
+            i++;
+            cont = 0;
+            expr_end = 1;
+            continue;
+        }
+        if (c == '/' && !expr_end) {
+            int in_class = 0;
+            for (i++; i < len && src[i] != '\n' && (in_class || src[i] != '/'); i++) {
+                if (src[i] == '\\') i++;
+                else if (src[i] == '[') in_class = 1;
+                else if (src[i] == ']') in_class = 0;
+            }
+            if (i >= len || src[i] != '/') return -1;
+            i++;
+            i += js_ident_len(src + i, len - i);    // flags
+            cont = 0;
+            expr_end = 1;
+            continue;
+        }
+
+        if (n == 0) {
+            if (c == '{' || c == '(' || c == '[' || c == '`') {
+                if (sp == (int)sizeof(stack)) return -1;
+                stack[sp++] = c;
+            } else if (c == '}' || c == ')' || c == ']') {
+                if (sp == 0) return -1;
+                // A function or class declaration ends with its body
+                if (--sp == 0 && c == '}' && decl == 2) decl = 0;
+            } else if (sp == 0 && c == ',') {
+                want_name = decl == 1;
+            } else if (sp == 0 && c == ';') {
+                decl = 0;
+            }
+            if (sp == 0) cont = strchr("=,+-*/%&|^!~?:<>.", c) != NULL;
+            expr_end = c == ')' || c == ']' || (c >= '0' && c <= '9');
+            i++;
+            continue;
+        }
+
+        const char *word = src + i;
+        i += n;
+        expr_end = !js_regex_keyword(word, n);
+        if (sp != 0) continue;
+        cont = 0;
+        if (want_name) {
+            if (js_add_name(out, outsz, &used, word, n) != 0) return -1;
+            count++;
+            want_name = 0;
+            continue;
+        }
+        if (decl) continue;
+
+        int is_var = (n == 5 && memcmp(word, "const", 5) == 0) ||
+                     (n == 3 && (memcmp(word, "let", 3) == 0 || memcmp(word, "var", 3) == 0));
+        int is_decl = is_var || (n == 5 && memcmp(word, "class", 5) == 0) ||
+                      (n == 8 && memcmp(word, "function", 8) == 0);
+        if (n == 5 && memcmp(word, "async", 5) == 0) {
+            while (i < len && (src[i] == ' ' || src[i] == '\t')) i++;
+            if (len - i >= 8 && memcmp(src + i, "function", 8) == 0 &&
+                js_ident_len(src + i, len - i) == 8) {
+                i += 8;
+                is_decl = 1;
+            }
+        }
+        if (!is_decl) return -1;
+
+        while (i < len && (src[i] == ' ' || src[i] == '\t' || src[i] == '*')) i++;
+        n = js_ident_len(src + i, len - i);
+        if (n == 0) return -1;    // destructuring declares names we do not follow
+        if (js_add_name(out, outsz, &used, src + i, n) != 0) return -1;
+        count++;
+        i += n;
+        decl = is_var ? 1 : 2;
+        expr_end = 1;
+    }
+    return sp == 0 && !want_name ? count : -1;
+}
+
+// Whole file, NUL terminated, or NULL
+static char *js_read_all(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fileno(f), &st) == 0 && (buf = malloc(st.st_size + 1)) != NULL) {
+        *len = fread(buf, 1, st.st_size, f);
+        buf[*len] = '\0';
+    }
     fclose(f);
-    if (nread != (size_t)st.st_size) {
-        printR("{red}Short read while loading %s{reset}\n", path);
-        free(buf);
-        return;
+    return buf;
+}
+
+// The names the manifest lists for a script, if its mtime and size still
+// match. Sets *names_len; the names run to the end of the line.
+static const char *js_manifest_find(const char *manifest, const char *file,
+                                    long long mtime_ns, long long size,
+                                    size_t *names_len) {
+    if (!manifest) return NULL;
+    size_t flen = strlen(file);
+    for (const char *p = manifest; *p; ) {
+        const char *eol = strchr(p, '\n');
+        if (!eol) break;
+        char *end;
+        if ((size_t)(eol - p) > flen && memcmp(p, file, flen) == 0 && p[flen] == '\t' &&
+            strtoll(p + flen + 1, &end, 10) == mtime_ns && *end == '\t' &&
+            strtoll(end + 1, &end, 10) == size && *end == '\t') {
+            *names_len = eol - (end + 1);
+            return end + 1;
+        }
+        p = eol + 1;
     }
-    buf[st.st_size] = '\0';
+    return NULL;
+}
 
-    JSValue val = JS_Eval(ctx, buf, st.st_size, path, JS_EVAL_TYPE_GLOBAL);
-    free(buf);
+// Getter (magic 0) and setter (magic 1) of a stub. data: the script's path,
+// the array of all its names, and the name this stub stands for.
+static JSValue js_lazy_access(JSContext *ctx, JSValueConst this_val, int argc,
+                              JSValueConst *argv, int magic, JSValue *data) {
+    JSValue global = JS_GetGlobalObject(ctx);
+
+    // Drop every stub of the script, so its declarations can take their place
+    JSValue len_val = JS_GetPropertyStr(ctx, data[1], "length");
+    uint32_t count = 0;
+    JS_ToUint32(ctx, &count, len_val);
+    JS_FreeValue(ctx, len_val);
+    for (uint32_t k = 0; k < count; k++) {
+        JSValue v = JS_GetPropertyUint32(ctx, data[1], k);
+        JSAtom atom = JS_ValueToAtom(ctx, v);
+        JS_DeleteProperty(ctx, global, atom, 0);
+        JS_FreeAtom(ctx, atom);
+        JS_FreeValue(ctx, v);
+    }
+    JS_FreeValue(ctx, global);
 
-    if (JS_IsException(val)) {
-        printR("{red}JS error in %s{reset}\n", path);
-        JSValue exc = JS_GetException(ctx);
-        const char *msg = JS_ToCString(ctx, exc);
-        if (msg) {
-            printR("{yellow}%s{reset}\n", msg);
-            JS_FreeCString(ctx, msg);
+    const char *path = JS_ToCString(ctx, data[0]);
+    const char *name = JS_ToCString(ctx, data[2]);
+    if (!path || !name) {
+        JS_FreeCString(ctx, path);
+        JS_FreeCString(ctx, name);
+        return JS_EXCEPTION;
+    }
+    load_js_file(ctx, path);
+
+    // Evaluated rather than read off the global object, since const, let
+    // and class declarations are not its properties
+    char code[300];
+    JSValue ret;
+    if (magic == 0) {
+        ret = JS_Eval(ctx, name, strlen(name), "<lazy>", JS_EVAL_TYPE_GLOBAL);
+    } else {
+        snprintf(code, sizeof(code), "(function (v) { %s = v; })", name);
+        JSValue fn = JS_Eval(ctx, code, strlen(code), "<lazy>", JS_EVAL_TYPE_GLOBAL);
+        ret = JS_IsException(fn) ? fn : JS_Call(ctx, fn, JS_UNDEFINED, argc > 0 ? 1 : 0, argv);
+        if (!JS_IsException(fn)) JS_FreeValue(ctx, fn);
+    }
+    JS_FreeCString(ctx, path);
+    JS_FreeCString(ctx, name);
+    return ret;
+}
+
+// Put a stub on the global object for each of a script's names
+static void js_lazy_define(JSContext *ctx, const char *path, const char *names, size_t len) {
+    JSValue global = JS_GetGlobalObject(ctx);
+    JSValue list = JS_NewArray(ctx);
+    JSValue path_val = JS_NewString(ctx, path);
+    uint32_t count = 0;
+
+    for (size_t i = 0; i < len; ) {
+        size_t n = 0;
+        while (i + n < len && names[i + n] != ' ') n++;
+        if (n > 0 && n < 256) {
+            JSValue name = JS_NewStringLen(ctx, names + i, n);
+            JSAtom atom = JS_NewAtomLen(ctx, names + i, n);
+            JS_SetPropertyUint32(ctx, list, count++, JS_DupValue(ctx, name));
+
+            JSValue data[3] = { path_val, list, name };
+            JSValue get = JS_NewCFunctionData(ctx, js_lazy_access, 0, 0, 3, data);
+            JSValue set = JS_NewCFunctionData(ctx, js_lazy_access, 1, 1, 3, data);
+            JS_DefinePropertyGetSet(ctx, global, atom, get, set,
+                                    JS_PROP_CONFIGURABLE | JS_PROP_ENUMERABLE);
+            JS_FreeAtom(ctx, atom);
+            JS_FreeValue(ctx, name);
         }
-        JS_FreeValue(ctx, exc);
-        JS_FreeValue(ctx, val);
-        return;
+        i += n + 1;
     }
 
-    JS_FreeValue(ctx, val);
+    JS_FreeValue(ctx, path_val);
+    JS_FreeValue(ctx, list);
+    JS_FreeValue(ctx, global);
 }
 
 void load_js_libs(JSContext *ctx, const char *dirpath) {
@@ -341,21 +800,86 @@ void load_js_libs(JSContext *ctx, const char *dirpath) {
         return;
     }
 
+    char abs[PATH_MAX], manifest_path[PATH_MAX];
+    int use_manifest = !js_cache_disabled() && realpath(dirpath, abs) &&
+                       js_cache_path(abs, ".libs", manifest_path, sizeof(manifest_path)) == 0;
+    size_t old_len = 0;
+    char *old = use_manifest ? js_read_all(manifest_path, &old_len) : NULL;
+    if (old && strncmp(old, JS_LIBS_MAGIC, strlen(JS_LIBS_MAGIC)) != 0) {
+        free(old);
+        old = NULL;
+    }
+
+    char *manifest = NULL;
+    size_t manifest_len = 0;
+    FILE *mf = use_manifest ? open_memstream(&manifest, &manifest_len) : NULL;
+    if (mf) fputs(JS_LIBS_MAGIC, mf);
+    int changed = !old;
+    size_t old_entries = 0, entries = 0;
+    for (const char *p = old; p && (p = strchr(p, '\n')) != NULL; p++) old_entries++;
+    if (old_entries) old_entries--;  // the magic line
+
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_REG) {
-            const char *name = entry->d_name;
-            size_t len = strlen(name);
-            if (len > 3 && strcmp(name + len - 3, ".js") == 0) {
-                char path[PATH_MAX];
-                snprintf(path, sizeof(path), "%s/%s", dirpath, name);
-                printf("[JSsh] Loading %s\n", path);
-                load_js_file(ctx, path);
-                js_lib_count++;
-            }
+        if (entry->d_type != DT_REG) continue;
+        const char *file = entry->d_name;
+        size_t len = strlen(file);
+        if (len <= 3 || strcmp(file + len - 3, ".js") != 0) continue;
+
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dirpath, file);
+        if (stat(path, &st) != 0) continue;
+        js_lib_count++;
+
+        long long mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        size_t names_len = 0;
+        const char *names = strpbrk(file, "\t\n") ? NULL :
+                            js_manifest_find(old, file, mtime_ns, st.st_size, &names_len);
+        char scanned[4096];
+        if (!names) {
+            startup_begin("scan %s", path);
+            size_t src_len;
+            char *src = js_read_all(path, &src_len);
+            if (!src || js_scan_globals(src, src_len, scanned, sizeof(scanned)) < 0)
+                scanned[0] = '\0';
+            free(src);
+            names = scanned;
+            names_len = strlen(scanned);
+            changed = 1;
+            startup_end();
+        }
+        if (mf && !strpbrk(file, "\t\n")) {
+            fprintf(mf, "%s\t%lld\t%lld\t%.*s\n", file, mtime_ns,
+                    (long long)st.st_size, (int)names_len, names);
+            entries++;
+        }
+
+        // A script with other top-level statements is run for their effects
+        if (names_len == 0) {
+            startup_begin("load_js_file %s", path);
+            load_js_file(ctx, path);
+            startup_end();
+        } else {
+            js_lazy_define(ctx, path, names, names_len);
         }
     }
     closedir(dir);
+
+    if (mf && fclose(mf) == 0) {
+        if ((changed || entries != old_entries) && jssh_cache_mkdirs(manifest_path) == 0) {
+            char tmp[PATH_MAX + 16];
+            snprintf(tmp, sizeof(tmp), "%s.%d", manifest_path, (int)getpid());
+            FILE *f = fopen(tmp, "wb");
+            if (f) {
+                int ok = fwrite(manifest, 1, manifest_len, f) == manifest_len;
+                if (fclose(f) != 0 || !ok || rename(tmp, manifest_path) != 0)
+                    unlink(tmp);
+            }
+        }
+        free(manifest);
+    }
+    free(old);
 }
 
 // env_get
@@ -454,6 +978,7 @@ static int jssh_tab_handler(int count, int key) {
 
 void init_qol_bindings(void) {
     rl_bind_key('\t', jssh_tab_handler);
+    rl_bind_key(18, jssh_history_search);  // Ctrl-R
 }
 
 // Syntax Highlighting
@@ -467,13 +992,14 @@ void init_qol_bindings(void) {
 
 // Lengths precomputed via sizeof to avoid strlen() in the hot loop
 #define KW(s) { s, (int)(sizeof(s)-1) }
-static const struct { const char *word; int len; } js_keywords[] = {
+typedef struct { const char *word; int len; } hl_word_t;
+static const hl_word_t js_keywords[] = {
     KW("function"), KW("return"), KW("if"),    KW("else"),   KW("while"),
     KW("for"),      KW("var"),    KW("let"),   KW("const"),  KW("true"),
     KW("false"),    KW("null"),   KW("undefined"), KW("new"), KW("class"),
     KW("import"),   KW("export"), { NULL, 0 }
 };
-static const struct { const char *word; int len; } js_objects[] = {
+static const hl_word_t js_objects[] = {
     KW("fs"), KW("cmp"), KW("net"), KW("crypt"), KW("sys"), KW("git"),
     { NULL, 0 }
 };
@@ -484,145 +1010,166 @@ static const struct { const char *word; int len; } js_objects[] = {
     memcpy((dst), (clr), sizeof(clr)-1); (dst) += sizeof(clr)-1; \
 } while (0)
 
-static char *highlight_line(const char *line) {
-    size_t in_len = strlen(line);
-    // 26 bytes per input char covers worst case: single char token wrapped in
-    // longest color code (20 bytes) + reset (4 bytes) = 25 bytes overhead.
-    char *out = malloc(in_len * 26 + 64);
-    if (!out) return NULL;
+// Token classes, indexing hl_colors; HL_PLAIN is copied uncolored
+enum { HL_PLAIN, HL_KEYWORD, HL_OBJECT, HL_STRING, HL_NUMBER, HL_FUNCTION, HL_COMMENT };
 
-    char *dst = out;
-    const char *p = line;
+#define CLR(s) { s, sizeof(s) - 1 }
+static const struct { const char *code; size_t len; } hl_colors[] = {
+    CLR(""), CLR(CLR_KEYWORD), CLR(CLR_OBJECT), CLR(CLR_STRING),
+    CLR(CLR_NUMBER), CLR(CLR_FUNCTION), CLR(CLR_COMMENT),
+};
+#undef CLR
 
-    while (*p) {
-        // Single-line comment: rest of line gets comment color
-        if (p[0] == '/' && p[1] == '/') {
-            size_t rest = strlen(p);
-            APPEND_CLR(dst, CLR_COMMENT);
-            memcpy(dst, p, rest); dst += rest;
-            APPEND_CLR(dst, CLR_RESET);
-            p += rest;
-            continue;
-        }
+static int word_in(const char *w, int len, const hl_word_t *list) {
+    for (int i = 0; list[i].word; i++)
+        if (len == list[i].len && memcmp(w, list[i].word, len) == 0) return 1;
+    return 0;
+}
 
-        // Block comment
-        if (p[0] == '/' && p[1] == '*') {
-            const char *end = strstr(p + 2, "*/");
-            size_t len = end ? (size_t)(end - p + 2) : strlen(p);
-            APPEND_CLR(dst, CLR_COMMENT);
-            memcpy(dst, p, len); dst += len;
-            APPEND_CLR(dst, CLR_RESET);
-            p += len;
-            continue;
-        }
+// Lex the token at line[pos]: sets *end and returns its HL_* class.
+// Only identifiers look past their own end (over spaces, for '.' or '(').
+static int hl_lex(const char *line, size_t pos, size_t *end) {
+    const char *p = line + pos;
 
-        // Strings: " ' ` with escape sequence handling
-        if (*p == '"' || *p == '\'' || *p == '`') {
-            char quote = *p;
-            const char *start = p++;
-            while (*p && *p != quote) {
-                if (*p == '\\' && p[1]) p++; // skip escaped char
+    // Single-line comment: rest of line
+    if (p[0] == '/' && p[1] == '/') {
+        *end = pos + strlen(p);
+        return HL_COMMENT;
+    }
+    // Block comment
+    if (p[0] == '/' && p[1] == '*') {
+        const char *close = strstr(p + 2, "*/");
+        *end = close ? (size_t)(close + 2 - line) : pos + strlen(p);
+        return HL_COMMENT;
+    }
+    // Strings: " ' ` with escape sequence handling
+    if (*p == '"' || *p == '\'' || *p == '`') {
+        char quote = *p++;
+        while (*p && *p != quote) {
+            if (*p == '\\' && p[1]) p++; // skip escaped char
+            p++;
+        }
+        if (*p == quote) p++;
+        *end = p - line;
+        return HL_STRING;
+    }
+    // Keywords and identifiers (both start with alpha or _)
+    if (isalpha((unsigned char)*p) || *p == '_') {
+        const char *start = p;
+        while (isalnum((unsigned char)*p) || *p == '_') p++;
+        int len = (int)(p - start);
+        *end = p - line;
+
+        // Keyword: a whole word, not a property (foo.bar)
+        char prev = pos > 0 ? start[-1] : '\0';
+        if (prev != '.' && !isalnum((unsigned char)prev) && prev != '_' &&
+            word_in(start, len, js_keywords))
+            return HL_KEYWORD;
+
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '.' && word_in(start, len, js_objects)) return HL_OBJECT;
+        if (*p == '(') return HL_FUNCTION;
+        return HL_PLAIN;
+    }
+    // Numbers: integer, float (3.14), hex (0xFF), scientific (1e10)
+    if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            p += 2;
+            while (isxdigit((unsigned char)*p)) p++;
+        } else {
+            while (isdigit((unsigned char)*p)) p++;
+            if (*p == '.') { p++; while (isdigit((unsigned char)*p)) p++; }
+            if (*p == 'e' || *p == 'E') {
                 p++;
+                if (*p == '+' || *p == '-') p++;
+                while (isdigit((unsigned char)*p)) p++;
             }
-            if (*p == quote) p++;
-            size_t len = (size_t)(p - start);
-            APPEND_CLR(dst, CLR_STRING);
-            memcpy(dst, start, len); dst += len;
-            APPEND_CLR(dst, CLR_RESET);
-            continue;
         }
+        *end = p - line;
+        return HL_NUMBER;
+    }
+    // Default: one character through unchanged
+    *end = pos + 1;
+    return HL_PLAIN;
+}
 
-        // Keywords and identifiers (both start with alpha or _)
-        if (isalpha((unsigned char)*p) || *p == '_') {
-            const char *start = p;
-            while (isalnum((unsigned char)*p) || *p == '_') p++;
-            int len = (int)(p - start);
-
-            char prev = (start > line) ? start[-1] : '\0';
-            char next = *p;
-
-            // Property access (foo.bar): the identifier after '.' is never a keyword
-            int is_prop = (prev == '.');
-            int word_start = !is_prop &&
-                (prev == '\0' || (!isalnum((unsigned char)prev) && prev != '_'));
-            int word_end = (next == '\0' || (!isalnum((unsigned char)next) && next != '_'));
-
-            int colored = 0;
-
-            // Keyword: must be a full word and not after '.'
-            if (word_start && word_end) {
-                for (int i = 0; js_keywords[i].word; i++) {
-                    if (len == js_keywords[i].len &&
-                        memcmp(start, js_keywords[i].word, len) == 0) {
-                        APPEND_CLR(dst, CLR_KEYWORD);
-                        memcpy(dst, start, len); dst += len;
-                        APPEND_CLR(dst, CLR_RESET);
-                        colored = 1;
-                        break;
-                    }
-                }
-            }
-
-            if (!colored) {
-                const char *look = p;
-                while (isspace((unsigned char)*look)) look++;
-
-                if (*look == '.') {
-                    // Known object?
-                    for (int i = 0; js_objects[i].word; i++) {
-                        if (len == js_objects[i].len &&
-                            memcmp(start, js_objects[i].word, len) == 0) {
-                            APPEND_CLR(dst, CLR_OBJECT);
-                            memcpy(dst, start, len); dst += len;
-                            APPEND_CLR(dst, CLR_RESET);
-                            colored = 1;
-                            break;
-                        }
-                    }
-                } else if (*look == '(') {
-                    // Function call
-                    APPEND_CLR(dst, CLR_FUNCTION);
-                    memcpy(dst, start, len); dst += len;
-                    APPEND_CLR(dst, CLR_RESET);
-                    colored = 1;
-                }
-            }
-
-            if (!colored) {
-                memcpy(dst, start, len); dst += len;
-            }
-            continue;
-        }
+// The last highlighted line, its tokens and its colored output. Each
+// redisplay keeps the tokens before the first changed byte and re-lexes
+// only from there, appending to the output kept for them.
+typedef struct {
+    size_t start, end;
+    size_t out;        // offset of the token's output in hl_out
+    int cls;
+} HlToken;
+
+static char *hl_text, *hl_out;
+static size_t hl_len, hl_text_cap, hl_out_len, hl_out_cap;
+static HlToken *hl_toks;
+static size_t hl_ntoks, hl_toks_cap;
+
+static int hl_reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t n = *cap ? *cap : 256;
+    while (n < need) n *= 2;
+    char *b = realloc(*buf, n);
+    if (!b) return -1;
+    *buf = b;
+    *cap = n;
+    return 0;
+}
 
-        // Numbers: integer, float (3.14), hex (0xFF), scientific (1e10)
-        if (isdigit((unsigned char)*p) ||
-            (*p == '.' && isdigit((unsigned char)p[1]))) {
-            const char *start = p;
-            if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
-                p += 2;
-                while (isxdigit((unsigned char)*p)) p++;
-            } else {
-                while (isdigit((unsigned char)*p)) p++;
-                if (*p == '.') { p++; while (isdigit((unsigned char)*p)) p++; }
-                if (*p == 'e' || *p == 'E') {
-                    p++;
-                    if (*p == '+' || *p == '-') p++;
-                    while (isdigit((unsigned char)*p)) p++;
-                }
-            }
-            size_t len = (size_t)(p - start);
-            APPEND_CLR(dst, CLR_NUMBER);
-            memcpy(dst, start, len); dst += len;
-            APPEND_CLR(dst, CLR_RESET);
-            continue;
+// Colored copy of `line`, valid until the next call, or NULL on OOM
+static const char *highlight_line(const char *line, size_t len) {
+    size_t same = 0;
+    size_t cmp = len < hl_len ? len : hl_len;
+    while (same < cmp && line[same] == hl_text[same]) same++;
+    if (same == len && len == hl_len && hl_out) return hl_out;
+
+    // Keep the tokens that end before the change. The one ending at it
+    // may grow (a number, "/" turning into "//"), and an identifier
+    // followed only by spaces up to it may change color.
+    size_t keep = hl_ntoks;
+    while (keep > 0 && hl_toks[keep - 1].end >= same) keep--;
+    while (keep > 0 && hl_toks[keep - 1].cls == HL_PLAIN &&
+           hl_toks[keep - 1].end - hl_toks[keep - 1].start == 1 &&
+           isspace((unsigned char)line[hl_toks[keep - 1].start]))
+        keep--;
+    if (keep > 0 && (isalpha((unsigned char)line[hl_toks[keep - 1].start]) ||
+                     line[hl_toks[keep - 1].start] == '_'))
+        keep--;
+
+    if (hl_reserve(&hl_text, &hl_text_cap, len + 1) != 0) return NULL;
+    memcpy(hl_text + same, line + same, len - same);
+    hl_text[len] = '\0';
+    hl_len = len;
+
+    size_t pos = keep ? hl_toks[keep - 1].end : 0;
+    hl_out_len = keep ? hl_toks[keep].out : 0;
+    hl_ntoks = keep;
+    while (pos < len) {
+        size_t end;
+        int cls = hl_lex(hl_text, pos, &end);
+        if (hl_ntoks == hl_toks_cap) {
+            size_t cap = hl_toks_cap ? hl_toks_cap * 2 : 64;
+            HlToken *t = realloc(hl_toks, cap * sizeof(*t));
+            if (!t) { hl_len = hl_ntoks = 0; return NULL; }
+            hl_toks = t;
+            hl_toks_cap = cap;
         }
-
-        // Default: pass character through unchanged
-        *dst++ = *p++;
+        size_t need = hl_out_len + (end - pos) + hl_colors[cls].len + sizeof(CLR_RESET) + 1;
+        if (hl_reserve(&hl_out, &hl_out_cap, need) != 0) { hl_len = hl_ntoks = 0; return NULL; }
+
+        hl_toks[hl_ntoks++] = (HlToken){ pos, end, hl_out_len, cls };
+        char *dst = hl_out + hl_out_len;
+        if (cls != HL_PLAIN) { memcpy(dst, hl_colors[cls].code, hl_colors[cls].len); dst += hl_colors[cls].len; }
+        memcpy(dst, hl_text + pos, end - pos); dst += end - pos;
+        if (cls != HL_PLAIN) { memcpy(dst, CLR_RESET, sizeof(CLR_RESET) - 1); dst += sizeof(CLR_RESET) - 1; }
+        hl_out_len = dst - hl_out;
+        pos = end;
     }
-
-    *dst = '\0';
-    return out;
+    if (hl_reserve(&hl_out, &hl_out_cap, hl_out_len + 1) != 0) return NULL;
+    hl_out[hl_out_len] = '\0';
+    return hl_out;
 }
 
 typedef struct {
@@ -660,57 +1207,80 @@ static prediction_t jssh_predict(const char *buf, int point) {
     return out;
 }
 
-void jssh_redisplay(void) {
-    fputs("\r", stdout);
-
-    if(g_previous_lines > 1) {
-        fprintf(stdout, "\033[%dA", g_previous_lines - 1);
+// Screen width of the line and of its first `point` bytes, in one pass.
+// Escape sequences take no columns, nor do UTF-8 continuation bytes.
+static void line_widths(const char *s, int len, int point, int *total, int *cursor) {
+    int w = 0, i = 0;
+    *cursor = -1;
+    while (i < len) {
+        if (i >= point && *cursor < 0) *cursor = w;
+        if (s[i] == '\033') {
+            i++;
+            if (i < len && s[i] == '[') {
+                i++;
+                while (i < len && ((s[i] >= '0' && s[i] <= '9') || s[i] == ';')) i++;
+                if (i < len) i++;
+            }
+        } else {
+            if (((unsigned char)s[i] & 0xC0) != 0x80) w++;
+            i++;
+        }
     }
-    fputs("\033[J", stdout);
+    if (*cursor < 0) *cursor = w;
+    *total = w;
+}
+
+static char *frame;
+static size_t frame_cap;
 
+// Build the whole redraw in one reused buffer and write it at once
+void jssh_redisplay(void) {
     int w, h;
     if (get_terminal_dimensions(&w, &h) == -1) {
         w = 80;
     }
 
-    char *hl = highlight_line(rl_line_buffer);
+    const char *hl = highlight_line(rl_line_buffer, rl_end);
     const char *line = hl ? hl : rl_line_buffer;
     prediction_t pred = jssh_predict(rl_line_buffer, rl_point);
+    const char *prompt = rl_display_prompt ? rl_display_prompt : "";
 
-    fputs(rl_display_prompt, stdout);
-    fputs(line, stdout);
+    int prompt_len = visual_width(prompt);
+    int line_len, cur_visual_pos;
+    line_widths(rl_line_buffer, rl_end, rl_point, &line_len, &cur_visual_pos);
+    int pred_len = pred.active && pred.text ? (int)strlen(pred.text) : 0;
 
-    if (pred.active && pred.text) {
-        fputs("\033[90m", stdout);
-        fputs(pred.text, stdout);
-        fputs("\033[0m", stdout);
-    }
+    size_t prompt_bytes = strlen(prompt);
+    size_t line_bytes = hl ? hl_out_len : (size_t)rl_end;
+    if (hl_reserve(&frame, &frame_cap, prompt_bytes + line_bytes + pred_len + 64) != 0)
+        return;
 
-    int prompt_len = visual_width(rl_display_prompt);
-    int line_len = visual_width(line); // same as visual_width(rl_line_buffer) — ANSI codes ignored
-    int pred_len = pred.active && pred.text ? (int)strlen(pred.text) : 0;
+    char *dst = frame;
+    *dst++ = '\r';
+    if (g_previous_lines > 1)
+        dst += sprintf(dst, "\033[%dA", g_previous_lines - 1);
+    APPEND_CLR(dst, "\033[J");
+    memcpy(dst, prompt, prompt_bytes); dst += prompt_bytes;
+    memcpy(dst, line, line_bytes); dst += line_bytes;
+    if (pred_len) {
+        APPEND_CLR(dst, "\033[90m");
+        memcpy(dst, pred.text, pred_len); dst += pred_len;
+        APPEND_CLR(dst, CLR_RESET);
+    }
 
     int total_visual_len = prompt_len + line_len + pred_len;
-
     if (total_visual_len == 0) {
         g_previous_lines = 1;
     } else {
         g_previous_lines = (total_visual_len - 1) / w + 1;
     }
-    char *buffer_slice = rl_line_buffer_slice(0, rl_point);
-    int cur_visual_pos = visual_width(buffer_slice);
-    if (buffer_slice) free(buffer_slice);
-    int line_visual_len = line_len; // reuse already-computed value
 
-    if (rl_point < rl_end || (pred.active && pred.text)) {
-        int cols_to_end_of_line = line_visual_len - cur_visual_pos;
-        int back = cols_to_end_of_line + pred_len;
-
-        if (back > 0) {
-            fprintf(stdout, "\033[%dD", back);
-        }
+    if (rl_point < rl_end || pred_len) {
+        int back = line_len - cur_visual_pos + pred_len;
+        if (back > 0)
+            dst += sprintf(dst, "\033[%dD", back);
     }
 
+    fwrite(frame, 1, dst - frame, stdout);
     fflush(stdout);
-    if (hl) free(hl);
 }
\ No newline at end of file
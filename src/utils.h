@@ -1,8 +1,13 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
+#include <sys/types.h>
 #include "quickjs.h"
 
+// return this in a JS_String to suppress the undefined after functions which print directly to console
+#define JS_SUPPRESS "\x1B[JSSH_SUPPRESS"
+
 extern int js_lib_count;
 
 void resetColor(void);
@@ -11,10 +16,16 @@ void jssh_redisplay(void);
 void detect_color_mode(void);
 void init_qol_bindings(void);
 void printR(const char *fmt, ...);
+void fprintR(FILE *out, const char *fmt, ...);
 void setColor(int r, int g, int b);
 void print_name(const char *name, mode_t mode);
+void fprint_name(FILE *out, const char *name, mode_t mode);
 const char *env_get(const char *key, const char *def);
 void load_js_libs(JSContext *ctx, const char *dirpath);
+// <cache dir>/name: $XDG_CACHE_HOME/jssh or ~/.cache/jssh
+int jssh_cache_file(const char *name, char *out, size_t outsz);
+// Create every missing directory above a cache file
+int jssh_cache_mkdirs(const char *file);
 JSValue js_cat(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 JSValue js_printR(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 JSValue js_update(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);